@@ -5,13 +5,38 @@
 #include "exceptions.h"
 
 #include <cstdint>
+#include <vector>
+
+#if defined _MSC_VER && (defined _M_X64 || defined _M_ARM64)
+#	include <intrin.h>
+#endif
 
 namespace _3fd
 {
 	namespace utils
 	{
+		// Gets the position of the least significant activated bit in a word, which cannot be zero
+		inline unsigned int _count_trailing_zeros64(uint64_t word) NOEXCEPT
+		{
+			_ASSERTE(word != 0); // the result is undefined for zero
+#	if defined __GNUG__
+			return __builtin_ctzll(word);
+#	elif defined _MSC_VER && (defined _M_X64 || defined _M_ARM64)
+			unsigned long pos;
+			_BitScanForward64(&pos, word);
+			return pos;
+#	else
+			unsigned int pos(0);
+			for (; (word & 1) == 0; word >>= 1)
+				++pos;
+			return pos;
+#	endif
+		}
+
 		/// <summary>
 		/// A fixed size array of booleans stored as a single bit.
+		/// The bits are kept in 64 bits words, with the lowest index in the least significant bit,
+		/// so searches and bulk operations work on whole words (and on 256 bits chunks with AVX2).
 		/// </summary>
 		class ArrayOfBits : notcopiable
 		{
@@ -19,10 +44,23 @@ namespace _3fd
 
 			const size_t m_nBits;
 
-			uintptr_t *m_data;
+			uint64_t *m_data;
 			size_t m_activatedBitsCount;
 
-			uintptr_t *GetWord(size_t bitIdx, uint32_t &bitInPos) const;
+			/// <summary>
+			/// Gets how many words the array takes.
+			/// </summary>
+			size_t GetNumWords() const { return (m_nBits + 63) / 64; }
+
+			uint64_t *GetWord(size_t bitIdx, uint64_t &mask) const;
+
+			size_t FindNext(size_t bitIdx, uint64_t flip) const;
+
+			size_t FindPrevious(size_t bitIdx, uint64_t flip) const;
+
+			void SetRange(size_t beginIdx, size_t endIdx, bool val);
+
+			void CheckSameSize(const ArrayOfBits &other) const;
 
 		public:
 
@@ -62,9 +100,133 @@ namespace _3fd
 
 			size_t FindLastDeactivated() const;
 
+			size_t FindNextActivated(size_t bitIdx) const;
+
+			size_t FindNextDeactivated(size_t bitIdx) const;
+
 			void Activate(size_t bitIdx);
 
 			void Deactivate(size_t bitIdx);
+
+			/// <summary>
+			/// Activates all bits in a given range.
+			/// </summary>
+			/// <param name="beginIdx">The index of the first bit in the range.</param>
+			/// <param name="endIdx">The index one past the last bit in the range.</param>
+			void ActivateRange(size_t beginIdx, size_t endIdx) { SetRange(beginIdx, endIdx, true); }
+
+			/// <summary>
+			/// Deactivates all bits in a given range.
+			/// </summary>
+			/// <param name="beginIdx">The index of the first bit in the range.</param>
+			/// <param name="endIdx">The index one past the last bit in the range.</param>
+			void DeactivateRange(size_t beginIdx, size_t endIdx) { SetRange(beginIdx, endIdx, false); }
+
+			size_t CountActivated(size_t beginIdx, size_t endIdx) const;
+
+			ArrayOfBits &operator&=(const ArrayOfBits &other);
+
+			ArrayOfBits &operator|=(const ArrayOfBits &other);
+
+			ArrayOfBits &operator^=(const ArrayOfBits &other);
+
+			/// <summary>
+			/// Invokes a callback for each activated bit, in increasing order of index.
+			/// The array cannot be modified by the callback.
+			/// </summary>
+			/// <param name="callback">The callback, which receives the index of the activated bit.</param>
+			template <typename CallbackType>
+			void ForEachActivated(CallbackType callback) const
+			{
+				const auto numWords = GetNumWords();
+
+				for (size_t wordIdx = 0; wordIdx < numWords; ++wordIdx)
+				{
+					// visit the bits from the least significant one, clearing each after visited:
+					for (auto word = m_data[wordIdx]; word != 0; word &= word - 1)
+						callback(wordIdx * 64 + _count_trailing_zeros64(word));
+				}
+			}
+		};
+
+		/// <summary>
+		/// A fixed size array of bits with summary levels on top of it, in which each word
+		/// summarizes 64 words of the level below. Searching for the first or last activated
+		/// (or deactivated) bit descends the levels, which takes O(log64 n) regardless of how
+		/// sparse or dense the array is, so it serves as a slot allocator for large pools.
+		/// </summary>
+		class HierarchicalArrayOfBits : notcopiable
+		{
+		private:
+
+			/// <summary>
+			/// A summary level, in which the bit i tells something about the word i in the level below.
+			/// </summary>
+			struct Level
+			{
+				uint64_t *nonEmpty; // the word has some activated bit
+				uint64_t *nonFull; // the word has some deactivated bit
+			};
+
+			const size_t m_nBits;
+
+			uint64_t *m_data; // the bits, followed by the summary levels
+			std::vector<Level> m_levels; // from the bottom to the top (a single word)
+			size_t m_activatedBitsCount;
+
+			uint64_t GetUsedMask(size_t wordIdx) const;
+
+			void Propagate(uint64_t *Level::*summary, size_t wordIdx, bool val);
+
+			void UpdateSummaries(size_t wordIdx, uint64_t before, uint64_t after);
+
+			size_t FindFirst(uint64_t *Level::*summary, uint64_t flip) const;
+
+			size_t FindLast(uint64_t *Level::*summary, uint64_t flip) const;
+
+		public:
+
+			HierarchicalArrayOfBits(size_t nBits, bool val);
+
+			HierarchicalArrayOfBits(HierarchicalArrayOfBits &&ob);
+
+			~HierarchicalArrayOfBits();
+
+			/// <summary>
+			/// Gets the amount of bits the array was set to store.
+			/// </summary>
+			/// <returns>How many bits the array was set to store upon construction.</returns>
+			size_t Size() const { return m_nBits; }
+
+			/// <summary>
+			/// Gets how many bits in the array are currently activated.
+			/// </summary>
+			/// <returns>The amount of activated bits in the array.</returns>
+			size_t GetActivatedCount() const { return m_activatedBitsCount; }
+
+			/// <summary>
+			/// Determines whether there is any activated bit in the array.
+			/// </summary>
+			/// <returns>
+			/// <c>true</c> if there is at least one activated bit in the array, otherwise, <c>false</c>.
+			/// </returns>
+			bool IsAnyActivated() const { return m_activatedBitsCount > 0; }
+
+			bool operator[](size_t bitIdx) const;
+
+			size_t FindFirstActivated() const;
+
+			size_t FindFirstDeactivated() const;
+
+			size_t FindLastActivated() const;
+
+			size_t FindLastDeactivated() const;
+
+			void Activate(size_t bitIdx);
+
+			void Deactivate(size_t bitIdx);
+
+			size_t ActivateFirstDeactivated();
 		};
 
 	}// end of namespace utils
@@ -3,8 +3,15 @@
 #include "configuration.h"
 #include "exceptions.h"
 #include "logger.h"
+#include <algorithm>
+#include <mutex>
 #include <sstream>
 
+#ifndef _WIN32
+#   include <pthread.h>
+#   include <time.h>
+#endif
+
 namespace _3fd
 {
 namespace core
@@ -13,17 +20,83 @@ namespace core
     //  CallStack Class
     ///////////////////////////////////////
 
+    // Rounds a capacity up to a power of 2, with at least 8 frames
+    static uint32_t RoundUpPow2(uint32_t value)
+    {
+        uint32_t result(8);
+        while (result < value && result < (1U << 31))
+            result <<= 1;
+
+        return result;
+    }
+
     /// <summary>
     /// Initializes a new instance of the <see cref="CallStack" /> class.
     /// </summary>
-    /// <param name="logInitialCap">The log initial capacity.</param>
-    CallStack::CallStack(size_t logInitialCap)
+    /// <param name="capacity">How many frames the ring keeps, which is rounded up to a power of 2.</param>
+    CallStack::CallStack(uint32_t capacity)
+        : m_mask(RoundUpPow2(capacity) - 1)
+        , m_depth(0)
+        , m_lostDepth(0)
+        , m_sequence(0)
+    {
+        m_stackFrames.reset(new Entry[m_mask + 1]);
+    }
+
+    /// <summary>
+    /// Marks the beginning of a change, which makes the sequence number odd.
+    /// </summary>
+    void CallStack::BeginChange() NOEXCEPT
     {
-        m_stackFrames.reserve(logInitialCap);
+        m_sequence.store(m_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    /// <summary>
+    /// Marks the end of a change, which makes the sequence number even again.
+    /// </summary>
+    void CallStack::EndChange() NOEXCEPT
+    {
+        m_sequence.store(m_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+#   ifdef ENABLE_3FD_CST_COMPACT
+
+    /// <summary>
+    /// Registers the frame. If the ring is full, the outermost frame is overwritten.
+    /// </summary>
+    /// <param name="siteId">The id of the call site, as registered in the call stack tracer.</param>
+    void CallStack::RegisterFrame(uint32_t siteId) NOEXCEPT
+    {
+        BeginChange();
+        auto depth = m_depth.load(std::memory_order_relaxed);
+        m_stackFrames[depth & m_mask].store(siteId, std::memory_order_relaxed);
+
+        if (++depth > m_mask + 1 && depth - (m_mask + 1) > m_lostDepth.load(std::memory_order_relaxed))
+            m_lostDepth.store(depth - (m_mask + 1), std::memory_order_relaxed);
+
+        m_depth.store(depth, std::memory_order_relaxed);
+        EndChange();
     }
 
     /// <summary>
-    /// Registers the frame.
+    /// Gets a frame in the stack.
+    /// </summary>
+    /// <param name="depth">The depth of the frame.</param>
+    /// <param name="frame">Receives the frame.</param>
+    /// <returns><c>true</c> if the call site of the frame could be resolved, otherwise, <c>false</c>.</returns>
+    bool CallStack::GetFrame(uint32_t depth, Frame &frame) const NOEXCEPT
+    {
+        return CallStackTracer::ResolveCallSite(
+            m_stackFrames[depth & m_mask].load(std::memory_order_relaxed),
+            frame
+        );
+    }
+
+#   else
+
+    /// <summary>
+    /// Registers the frame. If the ring is full, the outermost frame is overwritten.
     /// </summary>
     /// <param name="file">The file name.</param>
     /// <param name="line">The line number.</param>
@@ -32,19 +105,52 @@ namespace core
                                     unsigned long line, 
                                     const char *function) NOEXCEPT
     {
-        m_stackFrames.push_back(
-            Frame(file, function, line)
-        );
+        BeginChange();
+        auto depth = m_depth.load(std::memory_order_relaxed);
+        auto &entry = m_stackFrames[depth & m_mask];
+        entry.file.store(file, std::memory_order_relaxed);
+        entry.function.store(function, std::memory_order_relaxed);
+        entry.line.store(line, std::memory_order_relaxed);
+
+        if (++depth > m_mask + 1 && depth - (m_mask + 1) > m_lostDepth.load(std::memory_order_relaxed))
+            m_lostDepth.store(depth - (m_mask + 1), std::memory_order_relaxed);
+
+        m_depth.store(depth, std::memory_order_relaxed);
+        EndChange();
+    }
+
+    /// <summary>
+    /// Gets a frame in the stack.
+    /// </summary>
+    /// <param name="depth">The depth of the frame.</param>
+    /// <param name="frame">Receives the frame.</param>
+    /// <returns>Always <c>true</c>.</returns>
+    bool CallStack::GetFrame(uint32_t depth, Frame &frame) const NOEXCEPT
+    {
+        auto &entry = m_stackFrames[depth & m_mask];
+        frame.file = entry.file.load(std::memory_order_relaxed);
+        frame.function = entry.function.load(std::memory_order_relaxed);
+        frame.line = entry.line.load(std::memory_order_relaxed);
+        return true;
     }
 
+#   endif
+
     /// <summary>
     /// Pops the last added stack frame.
     /// </summary>
-    /// <returns>Whether the stack log is empty after popping an entry from it.</returns>
-    bool CallStack::PopStackFrameEntry() NOEXCEPT
+    void CallStack::PopStackFrameEntry() NOEXCEPT
     {
-        m_stackFrames.pop_back();
-        return m_stackFrames.empty();
+        BeginChange();
+        auto depth = m_depth.load(std::memory_order_relaxed);
+        _ASSERTE(depth > 0); // there must be a frame to pop
+
+        // frames pushed from now on will take the place of the lost ones:
+        if (--depth < m_lostDepth.load(std::memory_order_relaxed))
+            m_lostDepth.store(depth, std::memory_order_relaxed);
+
+        m_depth.store(depth, std::memory_order_relaxed);
+        EndChange();
     }
 
     // From path+fileName, gets only the file name
@@ -66,10 +172,33 @@ namespace core
     }
 
     /// <summary>
-    /// Gets the call stack trace report.
+    /// Captures the raw frames of the stack, which is much cheaper than generating a report.
+    /// Only the owner thread can call this.
     /// </summary>
-    /// <returns>A string which shows the current stack trace.</returns>
-    string CallStack::GetReport()
+    /// <param name="trace">Receives the trace.</param>
+    void CallStack::CaptureTrace(Trace &trace) const
+    {
+        auto depth = m_depth.load(std::memory_order_relaxed);
+        auto lostDepth = m_lostDepth.load(std::memory_order_relaxed);
+
+        trace.lostFrames = lostDepth;
+        trace.capacity = m_mask + 1;
+        trace.frames.resize(depth - lostDepth);
+
+        for (auto idx = lostDepth; idx < depth; ++idx)
+        {
+            auto &frame = trace.frames[idx - lostDepth];
+            if (!GetFrame(idx, frame))
+                frame.file = nullptr;
+        }
+    }
+
+    /// <summary>
+    /// Formats a stack trace as a report.
+    /// </summary>
+    /// <param name="trace">The trace.</param>
+    /// <returns>A string which shows the stack trace, one frame per line.</returns>
+    string CallStack::FormatTrace(const Trace &trace)
     {
 #       ifdef _3FD_PLATFORM_WINRT
         const char *newLine = "\n";
@@ -78,9 +207,19 @@ namespace core
 #       endif
         std::ostringstream oss;
 
-        for(int index = 0 ; index < m_stackFrames.size() ; ++index)
+        if (trace.lostFrames > 0)
+        {
+            oss << "$ (" << trace.lostFrames << " outer frames lost, because the stack went deeper than "
+                << trace.capacity << " frames)" << newLine;
+        }
+
+        for (auto &frame : trace.frames)
         {
-            auto &frame = m_stackFrames[index];
+            if (frame.file == nullptr)
+            {
+                oss << "$ (unknown call site)" << newLine;
+                continue;
+            }
 
             oss << "$ " << GetFileName(frame.file)
                 << " (" << frame.line << ") @ " << frame.function
@@ -90,6 +229,50 @@ namespace core
         return oss.str();
     }
 
+    /// <summary>
+    /// Gets the call stack trace report. Only the owner thread can call this.
+    /// </summary>
+    /// <returns>A string which shows the current stack trace.</returns>
+    string CallStack::GetReport()
+    {
+        Trace trace;
+        CaptureTrace(trace);
+        return FormatTrace(trace);
+    }
+
+    /// <summary>
+    /// Takes a snapshot of the stack, which can be done from any thread.
+    /// </summary>
+    /// <param name="frames">Receives the frames, from the outermost to the innermost.</param>
+    /// <returns>
+    /// <c>true</c> if the snapshot is consistent, otherwise (when the owner thread changed
+    /// the stack in the meantime), <c>false</c>.
+    /// </returns>
+    bool CallStack::TakeSnapshot(std::vector<Frame> &frames) const
+    {
+        frames.clear();
+
+        auto sequence = m_sequence.load(std::memory_order_acquire);
+        if (sequence % 2 != 0)
+            return false;
+
+        auto depth = m_depth.load(std::memory_order_relaxed);
+        auto lostDepth = m_lostDepth.load(std::memory_order_relaxed);
+
+        // values read amid changes might not make sense:
+        if (depth > lostDepth + m_mask + 1)
+            return false;
+
+        for (auto idx = lostDepth; idx < depth; ++idx)
+        {
+            Frame frame;
+            if (GetFrame(idx, frame))
+                frames.push_back(frame);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return m_sequence.load(std::memory_order_relaxed) == sequence;
+    }
 
     //////////////////////////////////
     //  CallStackTracer Class
@@ -97,8 +280,185 @@ namespace core
 
     thread_local CallStack * CallStackTracer::callStack(nullptr);
 
+    /* The call stacks of all threads are registered, so samplers can go through them.
+    These are function-local statics because threads might trace calls during static
+    initialization: */
+
+    static std::mutex &GetRegistryMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    /// <summary>
+    /// A registered thread: its call stack and the clock of the CPU time it consumes, which
+    /// lets samplers tell the threads running from those waiting on locks, I/O and the like.
+    /// </summary>
+    struct RegisteredThread
+    {
+        CallStack *callStack;
+#   ifdef _3FD_PLATFORM_WINRT
+        // the CPU time of a thread is not available to Store apps
+#   elif defined _WIN32
+        HANDLE cpuClock;
+#   else
+        clockid_t cpuClock;
+        bool hasCpuClock;
+#   endif
+        uint64_t sampledCpuTime; // nanoseconds, as of the last sample
+
+        RegisteredThread(CallStack *p_callStack);
+
+        bool GetCpuTime(uint64_t &nanosecs) const NOEXCEPT;
+
+        void Release() NOEXCEPT;
+    };
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="RegisteredThread"/> struct.
+    /// Must be called by the thread being registered.
+    /// </summary>
+    RegisteredThread::RegisteredThread(CallStack *p_callStack)
+        : callStack(p_callStack)
+        , sampledCpuTime(0)
+    {
+#   ifdef _3FD_PLATFORM_WINRT
+#   elif defined _WIN32
+        cpuClock = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, GetCurrentThreadId());
+#   else
+        hasCpuClock = (pthread_getcpuclockid(pthread_self(), &cpuClock) == 0);
+#   endif
+        GetCpuTime(sampledCpuTime);
+    }
+
+    /// <summary>
+    /// Gets how much CPU time the thread has consumed.
+    /// </summary>
+    /// <param name="nanosecs">Receives the CPU time, in nanoseconds.</param>
+    /// <returns>Whether the CPU time is available.</returns>
+    bool RegisteredThread::GetCpuTime(uint64_t &nanosecs) const NOEXCEPT
+    {
+#   ifdef _3FD_PLATFORM_WINRT
+        return false;
+#   elif defined _WIN32
+        FILETIME creationTime, exitTime, kernelTime, userTime;
+        if (cpuClock == NULL || GetThreadTimes(cpuClock, &creationTime, &exitTime, &kernelTime, &userTime) == FALSE)
+            return false;
+
+        ULARGE_INTEGER kernel, user;
+        kernel.LowPart = kernelTime.dwLowDateTime;
+        kernel.HighPart = kernelTime.dwHighDateTime;
+        user.LowPart = userTime.dwLowDateTime;
+        user.HighPart = userTime.dwHighDateTime;
+        nanosecs = (kernel.QuadPart + user.QuadPart) * 100;
+        return true;
+#   else
+        timespec time;
+        if (!hasCpuClock || clock_gettime(cpuClock, &time) != 0)
+            return false;
+
+        nanosecs = static_cast<uint64_t> (time.tv_sec) * 1000000000ULL + time.tv_nsec;
+        return true;
+#   endif
+    }
+
+    /// <summary>
+    /// Releases the resources held for the thread, except for its call stack.
+    /// </summary>
+    void RegisteredThread::Release() NOEXCEPT
+    {
+#   if defined _WIN32 && !defined _3FD_PLATFORM_WINRT
+        if (cpuClock != NULL)
+            CloseHandle(cpuClock);
+#   endif
+    }
+
+    static std::vector<RegisteredThread> &GetRegisteredThreads()
+    {
+        static std::vector<RegisteredThread> threads;
+        return threads;
+    }
+
+#   ifdef ENABLE_3FD_CST_COMPACT
+
+    /* The call sites are stored in chunks that never move, so they can be
+    read without locking, whereas registration is serialized by a mutex: */
+    static const uint32_t callSitesPerChunk(1024);
+    static const uint32_t maxCallSiteChunks(4096);
+    static const uint32_t invalidCallSiteId(~static_cast<uint32_t> (0));
+
+    static std::atomic<CallStack::Frame *> callSiteChunks[maxCallSiteChunks];
+    static std::atomic<uint32_t> numCallSites(0);
+
+    // Call sites might be registered during static initialization, hence the function-local static
+    static std::mutex &GetCallSitesMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    /// <summary>
+    /// Registers a call site. This is invoked only once per site, by the macro CALL_STACK_TRACE.
+    /// </summary>
+    /// <param name="file">The file name.</param>
+    /// <param name="line">The line number.</param>
+    /// <param name="function">The function name.</param>
+    /// <returns>The id of the call site, to be used when tracking calls.</returns>
+    uint32_t CallStackTracer::RegisterCallSite(const char *file,
+                                               unsigned long line,
+                                               const char *function) NOEXCEPT
+    {
+        try
+        {
+            std::lock_guard<std::mutex> lock(GetCallSitesMutex());
+
+            auto siteId = numCallSites.load(std::memory_order_relaxed);
+            auto chunkIdx = siteId / callSitesPerChunk;
+
+            if (chunkIdx >= maxCallSiteChunks)
+                return invalidCallSiteId;
+
+            auto chunk = callSiteChunks[chunkIdx].load(std::memory_order_relaxed);
+            if (chunk == nullptr)
+            {
+                chunk = new CallStack::Frame[callSitesPerChunk];
+                callSiteChunks[chunkIdx].store(chunk, std::memory_order_relaxed);
+            }
+
+            auto &site = chunk[siteId % callSitesPerChunk];
+            site.file = file;
+            site.function = function;
+            site.line = line;
+
+            numCallSites.store(siteId + 1, std::memory_order_release);
+            return siteId;
+        }
+        catch (std::exception &)
+        {
+            return invalidCallSiteId;
+        }
+    }
+
+    /// <summary>
+    /// Resolves the id of a call site to its location in the source code.
+    /// </summary>
+    /// <param name="siteId">The id of the call site.</param>
+    /// <param name="frame">Receives the location of the call site.</param>
+    /// <returns><c>true</c> if the call site was found, otherwise, <c>false</c>.</returns>
+    bool CallStackTracer::ResolveCallSite(uint32_t siteId, CallStack::Frame &frame) NOEXCEPT
+    {
+        if (siteId >= numCallSites.load(std::memory_order_acquire))
+            return false;
+
+        frame = callSiteChunks[siteId / callSitesPerChunk].load(std::memory_order_relaxed)[siteId % callSitesPerChunk];
+        return true;
+    }
+
+#   endif
+
     /// <summary>
     /// Registers the current thread to have its stack traced.
+    /// The call stack is allocated only once, and lives until the thread exits.
     /// </summary>
     /// <returns>
     /// <see cref="STATUS_OKAY"/> whenever successful, otherwise, <see cref="STATUS_FAIL"/>
@@ -109,9 +469,20 @@ namespace core
         {
             try
             {
-                callStack = new CallStack (
+                std::unique_ptr<CallStack> newCallStack(new CallStack (
                     AppConfig::GetSettings().framework.stackTracing.stackLogInitialCap
-                );
+                ));
+
+                {
+                    std::lock_guard<std::mutex> lock(GetRegistryMutex());
+                    GetRegisteredThreads().push_back(RegisteredThread(newCallStack.get()));
+                }
+
+                callStack = newCallStack.release();
+
+                // releases the call stack when the thread exits:
+                thread_local static ThreadExitTrigger exitTrigger;
+                (void)exitTrigger;
 
                 return STATUS_OKAY;
             }
@@ -143,11 +514,41 @@ namespace core
     {
         if(callStack != nullptr)
         {
+            {
+                std::lock_guard<std::mutex> lock(GetRegistryMutex());
+                auto &threads = GetRegisteredThreads();
+
+                auto iter = std::find_if(threads.begin(), threads.end(),
+                    [](const RegisteredThread &thread) { return thread.callStack == callStack; });
+
+                if (iter != threads.end())
+                {
+                    iter->Release();
+                    threads.erase(iter);
+                }
+            }
+
             delete callStack;
             callStack = nullptr;
         }
     }
 
+#   ifdef ENABLE_3FD_CST_COMPACT
+
+    /// <summary>
+    /// Tracks the call.
+    /// </summary>
+    /// <param name="siteId">The id of the call site.</param>
+    void CallStackTracer::TrackCall(uint32_t siteId)
+    {
+        if (callStack != nullptr)
+            callStack->RegisterFrame(siteId);
+        else if (RegisterThread() == STATUS_OKAY)
+            callStack->RegisterFrame(siteId);
+    }
+
+#   else
+
     /// <summary>
     /// Tracks the call.
     /// </summary>
@@ -164,19 +565,16 @@ namespace core
             callStack->RegisterFrame(file, line, function);
     }
 
+#   endif
+
     /// <summary>
     /// Pops the last added stack frame.
-    /// If the stack become empty, this object will be destroyed.
+    /// The call stack is kept even when it becomes empty, so the next call does not allocate it again.
     /// </summary>
     void CallStackTracer::PopStackFrameEntry() NOEXCEPT
     {
         if (callStack != nullptr)
-        {
-            if (callStack->PopStackFrameEntry() == false)
-                return;
-            else
-                UnregisterThread();
-        }
+            callStack->PopStackFrameEntry();
     }
 
     /// <summary>
@@ -188,5 +586,59 @@ namespace core
         return callStack->GetReport();
     }
 
+    /// <summary>
+    /// Captures the raw frames of the call stack, to be formatted later by <see cref="CallStack::FormatTrace"/>.
+    /// </summary>
+    /// <param name="trace">Receives the trace.</param>
+    void CallStackTracer::CaptureStackTrace(CallStack::Trace &trace)
+    {
+        callStack->CaptureTrace(trace);
+    }
+
+    /// <summary>
+    /// Takes a snapshot of the call stack of every thread being traced.
+    /// </summary>
+    /// <param name="callback">The callback to receive the frames of each thread, from the
+    /// outermost to the innermost, along with the CPU time (in nanoseconds) the thread has
+    /// consumed since the previous sample, or <c>UINT64_MAX</c> when the platform cannot tell.
+    /// Threads with no frames are skipped.</param>
+    void CallStackTracer::SampleAllThreads(const std::function<void (const std::vector<CallStack::Frame> &, uint64_t)> &callback)
+    {
+        std::vector<std::pair<std::vector<CallStack::Frame>, uint64_t>> snapshots;
+
+        {
+            std::lock_guard<std::mutex> lock(GetRegistryMutex());
+            auto &threads = GetRegisteredThreads();
+            snapshots.reserve(threads.size());
+
+            for (auto &thread : threads)
+            {
+                uint64_t cpuTime(UINT64_MAX), now;
+                if (thread.GetCpuTime(now))
+                {
+                    cpuTime = now - thread.sampledCpuTime;
+                    thread.sampledCpuTime = now;
+                }
+
+                // retry a few times, in case the owner thread is changing its stack:
+                std::vector<CallStack::Frame> frames;
+                for (int attempt = 0; attempt < 3; ++attempt)
+                {
+                    if (thread.callStack->TakeSnapshot(frames))
+                    {
+                        if (!frames.empty())
+                            snapshots.push_back(std::make_pair(std::move(frames), cpuTime));
+
+                        break;
+                    }
+                }
+            }
+        }
+
+        // the callbacks run without holding the lock, so they can trace calls too:
+        for (auto &snapshot : snapshots)
+            callback(snapshot.first, snapshot.second);
+    }
+
 }// end of namespace core
 }// end of namespace _3fd
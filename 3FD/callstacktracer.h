@@ -3,6 +3,10 @@
 
 #include "base.h"
 #include "preprocessing.h"
+#include <atomic>
+#include <cinttypes>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -21,11 +25,15 @@ namespace core
 
 
     /// <summary>
-    /// Stores an history of procedure call events
+    /// Stores an history of procedure call events in a ring of fixed capacity, which is
+    /// allocated once per thread. When the stack grows deeper than the capacity, the newest
+    /// frames overwrite the outermost ones, which are then reported as lost. Only the owner
+    /// thread changes the stack, but any thread can take snapshots of it, guarded by a
+    /// sequence number (seqlock), which is odd while a change is in progress.
     /// </summary>
     class CallStack : notcopiable
     {
-    private:
+    public:
 
         /// <summary>
         /// Represents a stack frame traced event
@@ -35,27 +43,70 @@ namespace core
             const char *file;
             const char *function;
             unsigned long line;
+        };
+
+        /// <summary>
+        /// The raw frames of a stack trace, which are only formatted when a report is needed.
+        /// </summary>
+        struct Trace
+        {
+            std::vector<Frame> frames; // from the outermost to the innermost (unknown call sites have no file)
+            uint32_t lostFrames; // how many outer frames have been overwritten
+            uint32_t capacity; // the capacity of the ring the trace came from
 
-            Frame(const char *p_file, 
-                    const char *p_function, 
-                    unsigned long p_line)
-                : file(p_file), function(p_function), line(p_line) 
-            {}
+            Trace() : lostFrames(0), capacity(0) {}
+
+            /// <summary>
+            /// Determines whether the trace is empty.
+            /// </summary>
+            bool IsEmpty() const { return frames.empty() && lostFrames == 0; }
         };
 
-        std::vector<Frame> m_stackFrames;
+    private:
+
+#   ifdef ENABLE_3FD_CST_COMPACT
+        typedef std::atomic<uint32_t> Entry; // the id of the call site, resolved to a frame only for reports
+#   else
+        struct Entry
+        {
+            std::atomic<const char *> file;
+            std::atomic<const char *> function;
+            std::atomic<unsigned long> line;
+        };
+#   endif
+        std::unique_ptr<Entry[]> m_stackFrames;
+        const uint32_t m_mask; // the capacity minus 1
+        std::atomic<uint32_t> m_depth; // might be greater than the capacity
+        std::atomic<uint32_t> m_lostDepth; // frames below this depth have been overwritten
+        std::atomic<uint32_t> m_sequence;
+
+        void BeginChange() NOEXCEPT;
+
+        void EndChange() NOEXCEPT;
+
+        bool GetFrame(uint32_t depth, Frame &frame) const NOEXCEPT;
 
     public:
 
-        CallStack(size_t logInitialCap);
+        CallStack(uint32_t capacity);
 
+#   ifdef ENABLE_3FD_CST_COMPACT
+        void RegisterFrame(uint32_t siteId) NOEXCEPT;
+#   else
         void RegisterFrame(const char *file, 
                             unsigned long line, 
                             const char *function) NOEXCEPT;
+#   endif
 
-        bool PopStackFrameEntry() NOEXCEPT;
+        void PopStackFrameEntry() NOEXCEPT;
 
         string GetReport();
+
+        void CaptureTrace(Trace &trace) const;
+
+        static string FormatTrace(const Trace &trace);
+
+        bool TakeSnapshot(std::vector<Frame> &frames) const;
     };
 
         
@@ -68,6 +119,14 @@ namespace core
 
         thread_local static CallStack *callStack;
 
+        /// <summary>
+        /// Releases the call stack of a thread when it exits.
+        /// </summary>
+        struct ThreadExitTrigger
+        {
+            ~ThreadExitTrigger() { UnregisterThread(); }
+        };
+
         /// <summary>
         /// Prevents a default instance of the <see cref="CallStackTracer"/> class from being created.
         /// </summary>
@@ -95,13 +154,27 @@ namespace core
             return callStack != nullptr;
         }
 
+#   ifdef ENABLE_3FD_CST_COMPACT
+        static uint32_t RegisterCallSite(const char *file,
+                                         unsigned long line,
+                                         const char *function) NOEXCEPT;
+
+        static bool ResolveCallSite(uint32_t siteId, CallStack::Frame &frame) NOEXCEPT;
+
+        static void TrackCall(uint32_t siteId);
+#   else
         static void TrackCall(const char *file, 
                                 unsigned long line, 
                                 const char *function);
+#   endif
 
         static void PopStackFrameEntry() NOEXCEPT;
 
         static string GetStackReport();
+
+        static void CaptureStackTrace(CallStack::Trace &trace);
+
+        static void SampleAllThreads(const std::function<void (const std::vector<CallStack::Frame> &, uint64_t)> &callback);
     };
 
     /// <summary>
@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "configuration.h"
 #include "exceptions.h"
+#include "logger.h"
 #include "utils_io.h"
 #include <rapidxml.hpp>
 
@@ -397,6 +398,41 @@ namespace core
             to = defaultVal;
     }
 
+    /// <summary>
+    /// Parses a log level with a given key from dictionary data loaded from XML.
+    /// The level is either the name of a priority (such as "debug") or its numeric value.
+    /// </summary>
+    /// <param name="kvPairs">The dictionary whose data was loaded from XML.</param>
+    /// <param name="key">The key of the value to parse.</param>
+    /// <param name="to">Reference to receive the parsed value.</param>
+    /// <param name="defaultVal">The default value to set in case the key is not found in the dictionary or cannot be parsed.</param>
+    static void ParseLogLevel(const XmlDictionary &kvPairs, const char *key, uint32_t &to, uint32_t defaultVal)
+    {
+        static const char *names[] =
+        {
+            "fatal", "critical", "error", "warning", "notice", "information", "debug", "trace"
+        };
+
+        to = defaultVal;
+        auto iter = kvPairs.find(key);
+
+        if (iter == kvPairs.end())
+            return;
+
+        for (uint32_t idx = 0; idx < sizeof names / sizeof names[0]; ++idx)
+        {
+            if (strcasecmp(iter->second, names[idx]) == 0)
+            {
+                to = Logger::PRIO_FATAL + idx;
+                return;
+            }
+        }
+
+        auto value = strtoul(iter->second, nullptr, 10);
+        if (value >= Logger::PRIO_FATAL && value <= Logger::PRIO_TRACE)
+            to = static_cast<uint32_t> (value);
+    }
+
 
     /// <summary>
     /// Initializes this instance with data from the XML configuration file.
@@ -449,6 +485,14 @@ namespace core
             {
                 LoadEntriesIntoDictionary(node, dictionary);
                 ParseValue(dictionary, "sizeLimit",      settings.common.log.sizeLimit, 1024);
+#   ifdef NDEBUG
+                ParseLogLevel(dictionary, "level",       settings.common.log.level, Logger::PRIO_INFORMATION);
+#   else
+                ParseLogLevel(dictionary, "level",       settings.common.log.level, Logger::PRIO_DEBUG);
+#   endif
+                ParseValue(dictionary, "rateLimit",      settings.common.log.rateLimit, 0);
+                ParseValue(dictionary, "rateBurst",      settings.common.log.rateBurst, 20);
+                ParseValue(dictionary, "collapseRepeated", settings.common.log.collapseRepeated, false);
 #   ifndef _3FD_PLATFORM_WINRT
                 ParseValue(dictionary, "purgeAge",       settings.common.log.purgeAge, 30);
                 ParseValue(dictionary, "purgeCount",     settings.common.log.purgeCount, 16);
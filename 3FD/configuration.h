@@ -62,6 +62,10 @@ namespace core
                     bool     writeToConsole;
 #endif
                     uint32_t sizeLimit;
+                    uint32_t level; // the lowest priority (see core::Logger::Priority) still written
+                    uint32_t rateLimit; // messages per second from the same source, or zero for no limit
+                    uint32_t rateBurst;
+                    bool     collapseRepeated;
                 } log;
             } common;
 
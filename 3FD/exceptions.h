@@ -88,7 +88,7 @@ namespace core
     private:
 
         string m_details;
-        string m_cst;
+        CallStack::Trace m_cst; // formatted only when needed, because exceptions might be thrown in busy paths
         std::shared_ptr<IAppException> m_innerEx;
 
         /// <summary>
@@ -113,7 +113,7 @@ namespace core
         {
 #        ifdef ENABLE_3FD_CST
             if (CallStackTracer::IsReady())
-                m_cst = CallStackTracer::GetStackReport();
+                CallStackTracer::CaptureStackTrace(m_cst);
 #        endif    
         }
 
@@ -124,7 +124,7 @@ namespace core
         {
 #        ifdef ENABLE_3FD_CST
             if (CallStackTracer::IsReady())
-                m_cst = CallStackTracer::GetStackReport();
+                CallStackTracer::CaptureStackTrace(m_cst);
 #        endif
         }
 
@@ -135,7 +135,7 @@ namespace core
         {
 #        ifdef ENABLE_3FD_CST
             if (CallStackTracer::IsReady())
-                m_cst = CallStackTracer::GetStackReport();
+                CallStackTracer::CaptureStackTrace(m_cst);
 #        endif
         }
 
@@ -147,7 +147,7 @@ namespace core
         {
 #        ifdef ENABLE_3FD_CST
             if (CallStackTracer::IsReady())
-                m_cst = CallStackTracer::GetStackReport();
+                CallStackTracer::CaptureStackTrace(m_cst);
 #        endif
         }
 
@@ -219,8 +219,8 @@ namespace core
                 oss << " - " << m_details;
 
 #            ifdef ENABLE_3FD_CST
-            if (m_cst.empty() == false)
-                oss << newLine << newLine << "### CALL STACK TRACE ###" << newLine << m_cst;
+            if (m_cst.IsEmpty() == false)
+                oss << newLine << newLine << "### CALL STACK TRACE ###" << newLine << CallStack::FormatTrace(m_cst);
 #            endif    
 #        endif
             return oss.str();
@@ -8,6 +8,7 @@
 #include "exceptions.h"
 #include "callstacktracer.h"
 #include "configuration.h"
+#include "timing.h"
 
 #include <array>
 #include <sstream>
@@ -221,7 +222,11 @@ namespace _3fd
                     IMessage *message = m_messagesQueue.Remove();
                     while(message != nullptr)
                     {
-                        message->Execute(m_memoryDigraph);
+                        {
+                            SCOPED_TIMER("memory::GarbageCollector::ExecuteMessage");
+                            message->Execute(m_memoryDigraph);
+                        }
+
                         delete message;
                         message = m_messagesQueue.Remove();
                     }
@@ -12,6 +12,7 @@
 #include <iostream>
 #include <codecvt>
 #include <stack>
+#include <algorithm>
 #include <array>
 #include <chrono>
 #include <ctime>
@@ -41,6 +42,286 @@ namespace core
 #endif
     }
 
+    //////////////////////////////
+    // LogThrottle Class
+    //////////////////////////////
+
+    const size_t LogThrottle::maxSources;
+    const size_t LogThrottle::maxSampleLength;
+    const uint32_t LogThrottle::repeatIntervalSecs;
+    const uint32_t LogThrottle::quietIntervalSecs;
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="LogThrottle"/> class,
+    /// with the settings in the configuration file.
+    /// </summary>
+    LogThrottle::LogThrottle()
+        : m_rateLimit(AppConfig::GetSettings().common.log.rateLimit)
+        , m_rateBurst(std::max(AppConfig::GetSettings().common.log.rateBurst, 1U))
+        , m_collapseRepeated(AppConfig::GetSettings().common.log.collapseRepeated)
+        , m_hasEvicted(false)
+        , m_hasHeldBack(false)
+        , m_nextQuietCheck(0)
+    {}
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="LogThrottle"/> class.
+    /// </summary>
+    /// <param name="rateLimit">How many messages per second a source can write, or zero for no limit.</param>
+    /// <param name="rateBurst">How many messages a source can write at once, before the rate limit applies.</param>
+    /// <param name="collapseRepeated">Whether repetitions of a message are collapsed.</param>
+    LogThrottle::LogThrottle(uint32_t rateLimit, uint32_t rateBurst, bool collapseRepeated)
+        : m_rateLimit(rateLimit)
+        , m_rateBurst(std::max(rateBurst, 1U))
+        , m_collapseRepeated(collapseRepeated)
+        , m_hasEvicted(false)
+        , m_hasHeldBack(false)
+        , m_nextQuietCheck(0)
+    {}
+
+    /// <summary>
+    /// Gets the key of the source of a message, which is a hash of
+    /// its priority and its text, ignoring decimal digits.
+    /// </summary>
+    size_t LogThrottle::GetSourceKey(uint32_t prio, const string &what) NOEXCEPT
+    {
+        uint64_t hash = 14695981039346656037ULL ^ prio; // FNV-1a
+
+        for (auto ch : what)
+        {
+            if (ch < '0' || ch > '9')
+                hash = (hash ^ static_cast<uint8_t> (ch)) * 1099511628211ULL;
+        }
+
+        return static_cast<size_t> (hash);
+    }
+
+    /// <summary>
+    /// Gets the key of a message, which is a hash of all its text.
+    /// </summary>
+    size_t LogThrottle::GetMessageKey(const string &what, const string &details) NOEXCEPT
+    {
+        std::hash<string> hashFunc;
+        return hashFunc(what) * 31 + hashFunc(details);
+    }
+
+    /// <summary>
+    /// Forgets the sources with nothing held back and quiet for longer than the repeat interval.
+    /// If that is not enough to make room, all sources are forgotten, but what they held back
+    /// is kept to be reported by <see cref="LogThrottle::TakeEvicted"/>.
+    /// </summary>
+    void LogThrottle::EvictIdleSources(std::chrono::steady_clock::time_point now)
+    {
+        auto iter = m_sources.begin();
+        while (iter != m_sources.end())
+        {
+            auto &source = iter->second;
+
+            if (source.heldBack.numRepeated == 0
+                && source.heldBack.numDropped == 0
+                && now - source.lastRefillTime > std::chrono::seconds(repeatIntervalSecs))
+            {
+                iter = m_sources.erase(iter);
+            }
+            else
+                ++iter;
+        }
+
+        if (m_sources.size() >= maxSources)
+        {
+            for (auto &entry : m_sources)
+            {
+                auto &heldBack = entry.second.heldBack;
+
+                if (heldBack.numRepeated > 0 || heldBack.numDropped > 0)
+                    m_evicted.push_back(std::move(heldBack));
+            }
+
+            m_sources.clear();
+            m_hasEvicted.store(!m_evicted.empty(), std::memory_order_relaxed);
+        }
+    }
+
+    /// <summary>
+    /// Decides whether to write a message to the log.
+    /// </summary>
+    /// <param name="prio">The priority of the message.</param>
+    /// <param name="what">The reason for the message.</param>
+    /// <param name="details">The message details.</param>
+    /// <param name="now">The current time.</param>
+    /// <param name="heldBack">When the message is to be written, receives what was held back
+    /// from the same source since the last message written, which should be reported first.</param>
+    /// <returns><c>true</c> if the message is to be written, otherwise, <c>false</c>.</returns>
+    bool LogThrottle::Admit(uint32_t prio,
+                            const string &what,
+                            const string &details,
+                            std::chrono::steady_clock::time_point now,
+                            HeldBack &heldBack)
+    {
+        auto sourceKey = GetSourceKey(prio, what);
+        auto messageKey = m_collapseRepeated ? GetMessageKey(what, details) : 0;
+
+        std::lock_guard<std::mutex> lock(m_sourcesMutex);
+
+        auto iter = m_sources.find(sourceKey);
+        if (iter == m_sources.end())
+        {
+            if (m_sources.size() >= maxSources)
+                EvictIdleSources(now);
+
+            Source source;
+            source.tokens = m_rateBurst;
+            source.lastRefillTime = now;
+            source.lastHeldBackTime = now;
+            source.lastMessageKey = 0;
+            source.written = false;
+            source.heldBack.prio = prio;
+            source.heldBack.numRepeated = 0;
+            source.heldBack.numDropped = 0;
+            iter = m_sources.emplace(sourceKey, std::move(source)).first;
+        }
+
+        auto &source = iter->second;
+
+        if (m_collapseRepeated
+            && source.written
+            && source.lastMessageKey == messageKey
+            && now - source.lastWriteTime < std::chrono::seconds(repeatIntervalSecs))
+        {
+            ++source.heldBack.numRepeated;
+            source.lastHeldBackTime = now;
+            m_hasHeldBack.store(true, std::memory_order_relaxed);
+            return false;
+        }
+
+        if (m_rateLimit > 0)
+        {
+            std::chrono::duration<double> elapsed = now - source.lastRefillTime;
+            source.tokens = std::min(m_rateBurst, source.tokens + elapsed.count() * m_rateLimit);
+            source.lastRefillTime = now;
+
+            if (source.tokens < 1.0)
+            {
+                ++source.heldBack.numDropped;
+                source.lastHeldBackTime = now;
+                m_hasHeldBack.store(true, std::memory_order_relaxed);
+                return false;
+            }
+
+            source.tokens -= 1.0;
+        }
+        else
+            source.lastRefillTime = now;
+
+        heldBack.prio = prio;
+        heldBack.numRepeated = source.heldBack.numRepeated;
+        heldBack.numDropped = source.heldBack.numDropped;
+
+        if (heldBack.numRepeated > 0 || heldBack.numDropped > 0)
+            heldBack.message = source.heldBack.message;
+
+        source.heldBack.numRepeated = 0;
+        source.heldBack.numDropped = 0;
+        source.heldBack.message.assign(what, 0, maxSampleLength);
+        source.lastMessageKey = messageKey;
+        source.lastWriteTime = now;
+        source.written = true;
+        return true;
+    }
+
+    /// <summary>
+    /// Takes what was held back from the sources forgotten to make room, and not reported yet.
+    /// </summary>
+    /// <returns>What was held back, for each source forgotten.</returns>
+    std::vector<LogThrottle::HeldBack> LogThrottle::TakeEvicted()
+    {
+        std::vector<HeldBack> result;
+
+        std::lock_guard<std::mutex> lock(m_sourcesMutex);
+        result.swap(m_evicted);
+        m_hasEvicted.store(false, std::memory_order_relaxed);
+        return result;
+    }
+
+    /// <summary>
+    /// Takes what was held back from the sources that have gone quiet for the quiet interval, so a flood
+    /// that stopped gets reported without waiting for another message from the same source. This is
+    /// cheap when nothing is held back, and looks through the sources at most once a second.
+    /// </summary>
+    /// <param name="now">The current time.</param>
+    /// <returns>What was held back, for each quiet source (and each source forgotten).</returns>
+    std::vector<LogThrottle::HeldBack> LogThrottle::TakeQuiet(std::chrono::steady_clock::time_point now)
+    {
+        using namespace std::chrono;
+
+        std::vector<HeldBack> result;
+
+        auto nowTicks = static_cast<int64_t> (duration_cast<milliseconds>(now.time_since_epoch()).count());
+
+        if (!m_hasHeldBack.load(std::memory_order_relaxed)
+            || nowTicks < m_nextQuietCheck.load(std::memory_order_relaxed))
+        {
+            return result;
+        }
+
+        std::lock_guard<std::mutex> lock(m_sourcesMutex);
+        m_nextQuietCheck.store(nowTicks + 1000, std::memory_order_relaxed);
+
+        result.swap(m_evicted);
+        m_hasEvicted.store(false, std::memory_order_relaxed);
+
+        bool stillHeldBack(false);
+
+        for (auto &entry : m_sources)
+        {
+            auto &source = entry.second;
+            auto &heldBack = source.heldBack;
+
+            if (heldBack.numRepeated == 0 && heldBack.numDropped == 0)
+                continue;
+
+            if (now - source.lastHeldBackTime < seconds(quietIntervalSecs))
+            {
+                stillHeldBack = true;
+                continue;
+            }
+
+            result.push_back(heldBack);
+            heldBack.numRepeated = 0;
+            heldBack.numDropped = 0;
+        }
+
+        m_hasHeldBack.store(stillHeldBack, std::memory_order_relaxed);
+        return result;
+    }
+
+    /// <summary>
+    /// Takes what has been held back from all sources (including those forgotten) and not reported yet.
+    /// </summary>
+    /// <returns>What was held back, for each source.</returns>
+    std::vector<LogThrottle::HeldBack> LogThrottle::TakeHeldBack()
+    {
+        std::vector<HeldBack> result;
+
+        std::lock_guard<std::mutex> lock(m_sourcesMutex);
+        result.swap(m_evicted);
+        m_hasEvicted.store(false, std::memory_order_relaxed);
+
+        for (auto &entry : m_sources)
+        {
+            auto &heldBack = entry.second.heldBack;
+
+            if (heldBack.numRepeated > 0 || heldBack.numDropped > 0)
+            {
+                result.push_back(heldBack);
+                heldBack.numRepeated = 0;
+                heldBack.numDropped = 0;
+            }
+        }
+
+        return result;
+    }
+
     //////////////////////////////
     // Logger Class
     //////////////////////////////
@@ -49,6 +330,10 @@ namespace core
 
     std::mutex Logger::singleInstanceCreationMutex;
 
+    /* Until the logger is created, nothing is filtered out, so the first
+    message to write can create it. After that, the configured level applies: */
+    std::atomic<uint32_t> Logger::currentLevel(Logger::PRIO_TRACE);
+
     /// <summary>
     /// Creates the unique instance of the <see cref="Logger" /> class.
     /// </summary>
@@ -62,7 +347,13 @@ namespace core
             std::lock_guard<std::mutex> lock(singleInstanceCreationMutex);
 
             if(uniqueObjectPtr == nullptr)
+            {
                 uniqueObjectPtr = new Logger (id, logToConsole);
+
+                auto level = AppConfig::GetSettings().common.log.level;
+                if (level >= PRIO_FATAL && level <= PRIO_TRACE)
+                    SetLevel(static_cast<Priority> (level));
+            }
         }
         catch(std::system_error &ex)
         {
@@ -85,6 +376,10 @@ namespace core
 
             if (uniqueObjectPtr != nullptr)
             {
+                // report what the throttle has held back and not reported yet:
+                for (auto &heldBack : uniqueObjectPtr->m_throttle.TakeHeldBack())
+                    uniqueObjectPtr->WriteHeldBack(heldBack);
+
                 delete uniqueObjectPtr;
                 uniqueObjectPtr = nullptr;
             }
@@ -147,7 +442,7 @@ namespace core
 #   endif
         std::ostringstream oss;
         oss << "API call " << function << " returned: " << transcoder.to_bytes(comErrObj.ErrorMessage());
-        WriteImpl(std::move(message), oss.str(), prio, true);
+        WriteThrottled(std::move(message), oss.str(), prio, true);
     }
 #endif
 
@@ -159,7 +454,99 @@ namespace core
     /// <param name="cst">When set to <c>true</c>, append the call stack trace.</param>
     void Logger::WriteImpl(string &&message, Priority prio, bool cst) NOEXCEPT
     {
-        WriteImpl(std::move(message), string(""), prio, cst);
+        WriteThrottled(std::move(message), string(""), prio, cst);
+    }
+
+    /// <summary>
+    /// Writes a message and its details to the log output, unless the
+    /// throttle holds it back, in which case that is reported later.
+    /// </summary>
+    /// <param name="what">The reason for the message.</param>
+    /// <param name="details">The message details.</param>
+    /// <param name="prio">The priority for the message.</param>
+    /// <param name="cst">When set to <c>true</c>, append the call stack trace.</param>
+    void Logger::WriteThrottled(string &&what, string &&details, Priority prio, bool cst) NOEXCEPT
+    {
+        if (m_throttle.IsActive())
+        {
+            try
+            {
+                LogThrottle::HeldBack heldBack;
+                bool admitted = m_throttle.Admit(prio, what, details, std::chrono::steady_clock::now(), heldBack);
+
+                // sources forgotten to make room must report what they held back:
+                if (m_throttle.HasEvicted())
+                {
+                    for (auto &evicted : m_throttle.TakeEvicted())
+                        WriteHeldBack(evicted);
+                }
+
+                if (!admitted)
+                    return;
+
+                WriteHeldBack(heldBack);
+                WriteQuietHeldBack();
+            }
+            catch (std::exception &)
+            {
+                // DO NOTHING: when the throttle fails, just write the message
+            }
+        }
+
+        WriteImpl(std::move(what), std::move(details), prio, cst);
+    }
+
+    /// <summary>
+    /// Reports in the log output the messages that the throttle has held back from a source.
+    /// </summary>
+    /// <param name="heldBack">What was held back.</param>
+    void Logger::WriteHeldBack(const LogThrottle::HeldBack &heldBack) NOEXCEPT
+    {
+        try
+        {
+            if (heldBack.numRepeated > 0)
+            {
+                std::ostringstream oss;
+                oss << "Last message repeated " << heldBack.numRepeated
+                    << " more time(s): " << heldBack.message;
+
+                WriteImpl(oss.str(), string(""), static_cast<Priority> (heldBack.prio), false);
+            }
+
+            if (heldBack.numDropped > 0)
+            {
+                std::ostringstream oss;
+                oss << "Rate limit dropped " << heldBack.numDropped
+                    << " message(s) like: " << heldBack.message;
+
+                WriteImpl(oss.str(), string(""), static_cast<Priority> (heldBack.prio), false);
+            }
+        }
+        catch (std::exception &)
+        {
+            // DO NOTHING: this is just a report, which can be lost
+        }
+    }
+
+    /// <summary>
+    /// Reports in the log output what the throttle has held back from sources gone quiet.
+    /// Besides every message written, this is invoked periodically by the log writer thread
+    /// (where the backend has one), so it is not postponed when all sources go quiet.
+    /// </summary>
+    void Logger::WriteQuietHeldBack() NOEXCEPT
+    {
+        if (!m_throttle.IsActive())
+            return;
+
+        try
+        {
+            for (auto &heldBack : m_throttle.TakeQuiet(std::chrono::steady_clock::now()))
+                WriteHeldBack(heldBack);
+        }
+        catch (std::exception &)
+        {
+            // DO NOTHING: this is just a report, which can be lost
+        }
     }
 
 }// end of namespace core
@@ -3,10 +3,26 @@
 
 #include "base.h"
 #include "exceptions.h"
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <sstream>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 
-#ifdef _3FD_POCO_SUPPORT
+#ifdef ENABLE_3FD_MMAP_LOGGER
+#    include <condition_variable>
+#    include <deque>
+#    include <memory>
+#    include <thread>
+#    include <vector>
+#elif defined ENABLE_3FD_NATIVE_LOGGER
+#    include <condition_variable>
+#    include <memory>
+#    include <thread>
+#    include <vector>
+#elif defined _3FD_POCO_SUPPORT
 #    include <Poco/Logger.h>
 #    include <Poco/Message.h>
 #elif defined _3FD_PLATFORM_WINRT
@@ -22,6 +38,101 @@ namespace core
 
     void AttemptConsoleOutput(const string &message);
 
+    /// <summary>
+    /// Limits how many messages from the same source are written to the log per second (with
+    /// a token bucket), and collapses repetitions of a message. The source of a message is told
+    /// by its priority and its text, ignoring decimal digits, so a call site writing the same
+    /// message with varying numbers in it counts as a single source.
+    /// </summary>
+    class LogThrottle : notcopiable
+    {
+    public:
+
+        /// <summary>
+        /// What was held back from a source since the last message written from it.
+        /// </summary>
+        struct HeldBack
+        {
+            uint32_t prio;
+            uint32_t numRepeated; // repetitions of the last message written, not written again
+            uint32_t numDropped; // messages dropped by rate limiting
+            string message; // beginning of the last message written
+        };
+
+        static const size_t maxSources = 4096;
+        static const size_t maxSampleLength = 80;
+
+        // A message repeated for longer than this is written again:
+        static const uint32_t repeatIntervalSecs = 30;
+
+        // A source quiet for this long reports what it held back, without waiting for its next message:
+        static const uint32_t quietIntervalSecs = 5;
+
+    private:
+
+        struct Source
+        {
+            double tokens;
+            std::chrono::steady_clock::time_point lastRefillTime;
+            std::chrono::steady_clock::time_point lastWriteTime;
+            std::chrono::steady_clock::time_point lastHeldBackTime;
+            size_t lastMessageKey;
+            bool written;
+            HeldBack heldBack;
+        };
+
+        const double m_rateLimit;
+        const double m_rateBurst;
+        const bool m_collapseRepeated;
+
+        std::mutex m_sourcesMutex;
+        std::unordered_map<size_t, Source> m_sources;
+
+        // what was held back from sources forgotten to make room, not reported yet:
+        std::vector<HeldBack> m_evicted;
+        std::atomic<bool> m_hasEvicted;
+
+        // whether any source holds something back, and when to look for quiet ones again:
+        std::atomic<bool> m_hasHeldBack;
+        std::atomic<int64_t> m_nextQuietCheck;
+
+        void EvictIdleSources(std::chrono::steady_clock::time_point now);
+
+    public:
+
+        LogThrottle();
+
+        LogThrottle(uint32_t rateLimit, uint32_t rateBurst, bool collapseRepeated);
+
+        /// <summary>
+        /// Determines whether the throttle holds back anything at all, otherwise
+        /// it does not need to be consulted.
+        /// </summary>
+        bool IsActive() const { return m_rateLimit > 0 || m_collapseRepeated; }
+
+        static size_t GetSourceKey(uint32_t prio, const string &what) NOEXCEPT;
+
+        static size_t GetMessageKey(const string &what, const string &details) NOEXCEPT;
+
+        bool Admit(uint32_t prio,
+                   const string &what,
+                   const string &details,
+                   std::chrono::steady_clock::time_point now,
+                   HeldBack &heldBack);
+
+        /// <summary>
+        /// Determines whether sources with something held back have been forgotten to make room,
+        /// in which case <see cref="LogThrottle::TakeEvicted"/> should be invoked to report that.
+        /// </summary>
+        bool HasEvicted() const { return m_hasEvicted.load(std::memory_order_relaxed); }
+
+        std::vector<HeldBack> TakeEvicted();
+
+        std::vector<HeldBack> TakeQuiet(std::chrono::steady_clock::time_point now);
+
+        std::vector<HeldBack> TakeHeldBack();
+    };
+
     /// <summary>
     /// Implements a logging facility.
     /// </summary>
@@ -46,7 +157,75 @@ namespace core
 
     private:
 
-#ifdef _3FD_POCO_SUPPORT
+        LogThrottle m_throttle;
+
+#ifdef ENABLE_3FD_MMAP_LOGGER
+
+        class LogSegment;
+
+        const string m_id;
+        const uint64_t m_segmentSize;
+        uint64_t m_nextSequence;
+        bool m_logToConsole;
+
+        std::atomic<LogSegment *> m_currentSegment;
+        std::atomic<LogSegment *> m_spareSegment;
+
+        /* Owns every segment object, so one is never released while a thread might still look at it.
+        Archived segments are reused instead, hence this does not grow past the segments in flight. */
+        std::vector<std::unique_ptr<LogSegment>> m_segments;
+        std::vector<LogSegment *> m_freeSegments;
+        std::mutex m_segmentsMutex;
+
+        std::thread m_archiverThread;
+        std::mutex m_archiverMutex;
+        std::condition_variable m_archiverCondition;
+        std::deque<LogSegment *> m_segmentsToArchive;
+        std::deque<string> m_leftoverFiles;
+        bool m_terminate;
+
+        LogSegment *CreateSegment();
+
+        void RecycleSegment(LogSegment *segment) NOEXCEPT;
+
+        LogSegment *RotateSegment(LogSegment *fullSegment, uint64_t usedLength) NOEXCEPT;
+
+        void ArchiveSegmentFile(const string &filePath);
+
+        void PurgeArchives();
+
+        void ArchiverThreadProc();
+
+#elif defined ENABLE_3FD_NATIVE_LOGGER
+
+        class LogRing;
+
+        struct ThreadRing;
+
+        const uint32_t m_instanceId;
+
+        std::vector<std::shared_ptr<LogRing>> m_rings;
+        std::mutex m_ringsMutex;
+
+        std::thread m_logWriterThread;
+        std::mutex m_writerMutex;
+        std::condition_variable m_writerCondition;
+        std::atomic<bool> m_writerAlive;
+        bool m_terminate;
+
+        const string m_filePath;
+        int m_fileDescriptor;
+        uint64_t m_fileSize;
+
+        LogRing &GetThreadRing();
+
+        bool FlushRings();
+
+        void ShiftLogFile();
+
+        void LogWriterThreadProc();
+
+#elif defined _3FD_POCO_SUPPORT
         Poco::Logger *m_logger;
 
 #elif defined _3FD_PLATFORM_WINRT
@@ -105,6 +284,10 @@ namespace core
 
         static Logger *GetInstance() NOEXCEPT;
 
+        // Lowest priority currently written:
+
+        static std::atomic<uint32_t> currentLevel;
+
         // Private implementations:
 
         void WriteImpl(IAppException &ex, Priority prio);
@@ -116,12 +299,47 @@ namespace core
 
         void WriteImpl(string &&what, string &&details, Priority prio, bool cst) NOEXCEPT;
 
+        void WriteThrottled(string &&what, string &&details, Priority prio, bool cst) NOEXCEPT;
+
+        void WriteHeldBack(const LogThrottle::HeldBack &heldBack) NOEXCEPT;
+
+        void WriteQuietHeldBack() NOEXCEPT;
+
     public:
 
         static void Shutdown();
 
         ~Logger();
 
+        /// <summary>
+        /// Determines whether messages with a given priority are currently written to the log.
+        /// This is cheap enough to be checked before even composing a message.
+        /// </summary>
+        /// <param name="prio">The priority to check.</param>
+        /// <returns><c>true</c> if such messages are written, otherwise, <c>false</c>.</returns>
+        static bool IsEnabled(Priority prio) NOEXCEPT
+        {
+            return static_cast<uint32_t> (prio) <= currentLevel.load(std::memory_order_relaxed);
+        }
+
+        /// <summary>
+        /// Gets the lowest priority currently written to the log.
+        /// </summary>
+        static Priority GetLevel() NOEXCEPT
+        {
+            return static_cast<Priority> (currentLevel.load(std::memory_order_relaxed));
+        }
+
+        /// <summary>
+        /// Sets the lowest priority to write to the log, which takes effect immediately in all threads.
+        /// The logger starts with the level set in the configuration file, when it is created.
+        /// </summary>
+        /// <param name="level">The new level.</param>
+        static void SetLevel(Priority level) NOEXCEPT
+        {
+            currentLevel.store(static_cast<uint32_t> (level), std::memory_order_relaxed);
+        }
+
         /// <summary>
         /// Writes an exception to the log output.
         /// </summary>
@@ -129,8 +347,11 @@ namespace core
         /// <param name="prio">The priority of the error.</param>
         static void Write(IAppException &ex, Priority prio)
         {
+            if (!IsEnabled(prio))
+                return;
+
             Logger * const singleton = GetInstance();
-            if (singleton != nullptr)
+            if (singleton != nullptr && IsEnabled(prio))
                 singleton->WriteImpl(ex, prio);
         }
 
@@ -144,8 +365,11 @@ namespace core
         /// <param name="prio">The priority of the message.</param>
         static void Write(HRESULT hr, const char *message, const char *function, Priority prio)
         {
+            if (!IsEnabled(prio))
+                return;
+
             Logger * const singleton = GetInstance();
-            if (singleton != nullptr)
+            if (singleton != nullptr && IsEnabled(prio))
                 singleton->WriteImpl(hr, message, function, prio);
         }
 #endif
@@ -157,7 +381,8 @@ namespace core
         /// <param name="cst">When set to <c>true</c>, append the call stack trace.</param>
         static void Write(const string &message, Priority prio, bool cst = false)
         {
-            Write(string(message), prio, cst);
+            if (IsEnabled(prio))
+                Write(string(message), prio, cst);
         }
 
         /// <summary>
@@ -168,8 +393,11 @@ namespace core
         /// <param name="cst">When set to <c>true</c>, append the call stack trace.</param>
         static void Write(string &&message, Priority prio, bool cst = false) NOEXCEPT
         {
+            if (!IsEnabled(prio))
+                return;
+
             Logger * const singleton = GetInstance();
-            if (singleton != nullptr)
+            if (singleton != nullptr && IsEnabled(prio))
                 singleton->WriteImpl(std::move(message), prio, cst);
         }
 
@@ -182,7 +410,8 @@ namespace core
         /// <param name="cst">When set to <c>true</c>, append the call stack trace.</param>
         static void Write(const string &what, const string &details, Priority prio, bool cst = false)
         {
-            Write(string(what), string(details), prio, cst);
+            if (IsEnabled(prio))
+                Write(string(what), string(details), prio, cst);
         }
 
         /// <summary>
@@ -194,9 +423,12 @@ namespace core
         /// <param name="cst">When set to <c>true</c>, append the call stack trace.</param>
         static void Write(string &&what, string &&details, Priority prio, bool cst = false)
         {
+            if (!IsEnabled(prio))
+                return;
+
             Logger * const singleton = GetInstance();
-            if (singleton != nullptr)
-                singleton->WriteImpl(std::move(what), std::move(details), prio, cst);
+            if (singleton != nullptr && IsEnabled(prio))
+                singleton->WriteThrottled(std::move(what), std::move(details), prio, cst);
         }
     };
         
@@ -246,7 +478,7 @@ namespace core
         /// </summary>
         ~ScopedLogWrite()
         {
-            if (m_wasFailure)
+            if (m_wasFailure && Logger::IsEnabled(m_prioWhenFailure))
                 Logger::Write(m_message.append(m_suffixWhenFailure), m_prioWhenFailure);
         }
 
@@ -255,7 +487,9 @@ namespace core
         /// </summary>
         void LogSuccess()
         {
-            Logger::Write(m_message.append(m_suffixWhenSuccess), m_prioWhenSuccess);
+            if (Logger::IsEnabled(m_prioWhenSuccess))
+                Logger::Write(m_message.append(m_suffixWhenSuccess), m_prioWhenSuccess);
+
             m_wasFailure = false;
         }
     };
@@ -263,4 +497,18 @@ namespace core
 }// end of namespace core
 }// end of namespace _3fd
 
+/* Write a message to the log only when its priority is enabled, otherwise the
+   expression composing the message is not even evaluated, so nothing is allocated: */
+
+#define LOG_WRITE(PRIO, MESSAGE) \
+    do { if (_3fd::core::Logger::IsEnabled(PRIO)) _3fd::core::Logger::Write((MESSAGE), (PRIO)); } while (false)
+
+// Same as LOG_WRITE, but composes the message from stream insertions, as in LOG_WRITE_FORMATTED(PRIO, "value is " << value)
+#define LOG_WRITE_FORMATTED(PRIO, INSERTIONS) \
+    do { if (_3fd::core::Logger::IsEnabled(PRIO)) { \
+        std::ostringstream _3fdLogStream; \
+        _3fdLogStream << INSERTIONS; \
+        _3fd::core::Logger::Write(_3fdLogStream.str(), (PRIO)); \
+    }} while (false)
+
 #endif // end of header guard
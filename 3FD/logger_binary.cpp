@@ -0,0 +1,606 @@
+#include "stdafx.h"
+#include "logger_binary.h"
+#include "configuration.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <istream>
+#include <iterator>
+#include <map>
+#include <ostream>
+#include <sstream>
+
+namespace _3fd
+{
+namespace core
+{
+    /* Layout of the binary log:
+
+    The file starts with a header, and another one is written whenever the file
+    is reopened, because format ids are only valid within a session. Then follow
+    records of 2 kinds, both starting with a byte for their kind:
+
+        format definition: 'F', zero, uint16 text length, uint32 format id, text
+        event: 'E', uint8 priority, uint16 arguments length, uint32 format id,
+               uint32 thread id, int64 time (nanoseconds since epoch), arguments
+
+    The arguments are encoded by BinaryLogArgEncoder, and all the integers are
+    in the byte order of the machine, which is checked by the decoder. */
+
+    static const char sessionMagic[] = "3FDBLOG"; // 7 chars + version
+    static const uint8_t formatVersion = 1;
+    static const uint32_t byteOrderMark = 0x01020304;
+
+    static const size_t sessionHeaderLength = 16;
+    static const size_t definitionHeaderLength = 8;
+    static const size_t eventHeaderLength = 20;
+
+    static const char definitionKind = 'F';
+    static const char eventKind = 'E';
+
+    /// <summary>
+    /// Appends to a buffer the raw bytes of a value.
+    /// </summary>
+    template <typename ValType>
+    static void AppendRaw(std::vector<char> &buffer, ValType value)
+    {
+        auto bytes = reinterpret_cast<const char *> (&value);
+        buffer.insert(buffer.end(), bytes, bytes + sizeof value);
+    }
+
+    //////////////////////////////////
+    // Registry of format strings
+    //////////////////////////////////
+
+    /// <summary>
+    /// Keeps the format strings, indexed by id minus 1.
+    /// </summary>
+    struct FormatRegistry
+    {
+        std::mutex mutex;
+        std::vector<string> formats;
+        std::map<string, uint32_t> idsByFormat;
+    };
+
+    static FormatRegistry &GetFormatRegistry()
+    {
+        static FormatRegistry registry;
+        return registry;
+    }
+
+    /// <summary>
+    /// Registers a format string, unless already registered.
+    /// </summary>
+    /// <param name="format">The format string.</param>
+    /// <returns>The id of the format string, or zero in case of failure.</returns>
+    uint32_t BinaryLog::RegisterFormat(const char *format) NOEXCEPT
+    {
+        try
+        {
+            auto &registry = GetFormatRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+
+            auto iter = registry.idsByFormat.find(format);
+            if (iter != registry.idsByFormat.end())
+                return iter->second;
+
+            registry.formats.push_back(format);
+            auto id = static_cast<uint32_t> (registry.formats.size());
+            registry.idsByFormat[format] = id;
+            return id;
+        }
+        catch (std::exception &ex)
+        {
+            std::ostringstream oss;
+            oss << "Failed to register format string for binary log: " << ex.what();
+            AttemptConsoleOutput(oss.str());
+            return 0;
+        }
+    }
+
+    /// <summary>
+    /// Gets a small id for the calling thread, which is cheaper to write than the one from the system.
+    /// </summary>
+    uint32_t BinaryLog::GetThreadId() NOEXCEPT
+    {
+        static std::atomic<uint32_t> numThreads(0);
+        thread_local static uint32_t threadId(0);
+
+        if (threadId == 0)
+            threadId = ++numThreads;
+
+        return threadId;
+    }
+
+    //////////////////////////////
+    // BinaryLog Class
+    //////////////////////////////
+
+    BinaryLog * BinaryLog::uniqueObjectPtr(nullptr);
+
+    std::mutex BinaryLog::singleInstanceCreationMutex;
+
+    /// <summary>
+    /// Gets the path of the binary log file, which is named after the application.
+    /// </summary>
+    string BinaryLog::GetFilePath()
+    {
+        return AppConfig::GetApplicationId() + ".binlog";
+    }
+
+    /// <summary>
+    /// Gets the unique instance of the singleton <see cref="BinaryLog" /> class.
+    /// </summary>
+    /// <returns>A pointer to the singleton, or a null pointer if the creation failed.</returns>
+    BinaryLog * BinaryLog::GetInstance() NOEXCEPT
+    {
+        if (uniqueObjectPtr != nullptr)
+            return uniqueObjectPtr;
+
+        try
+        {
+            std::lock_guard<std::mutex> lock(singleInstanceCreationMutex);
+
+            if (uniqueObjectPtr == nullptr)
+                uniqueObjectPtr = new BinaryLog(GetFilePath());
+        }
+        catch (IAppException &appEx)
+        {
+            std::ostringstream oss;
+            oss << "The binary log creation failed with an exception - " << appEx.ToString();
+            AttemptConsoleOutput(oss.str());
+        }
+        catch (std::exception &ex)
+        {
+            std::ostringstream oss;
+            oss << "The binary log creation failed with an exception - " << ex.what();
+            AttemptConsoleOutput(oss.str());
+        }
+
+        return uniqueObjectPtr;
+    }
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="BinaryLog"/> class.
+    /// </summary>
+    /// <param name="filePath">The path of the file to append the records to.</param>
+    BinaryLog::BinaryLog(const string &filePath)
+        : m_file(filePath, std::ios::binary | std::ios::app)
+    {
+        if (!m_file.is_open())
+            throw AppException<std::runtime_error>("Failed to open binary log file", filePath);
+
+        m_buffer.reserve(flushThreshold + maxArgsLength + eventHeaderLength);
+
+        // start a new session:
+        m_buffer.insert(m_buffer.end(), sessionMagic, sessionMagic + sizeof sessionMagic - 1);
+        AppendRaw(m_buffer, formatVersion);
+        AppendRaw(m_buffer, byteOrderMark);
+        AppendRaw(m_buffer, static_cast<uint32_t> (0)); // reserved
+    }
+
+    /// <summary>
+    /// Finalizes an instance of the <see cref="BinaryLog"/> class.
+    /// </summary>
+    BinaryLog::~BinaryLog()
+    {
+        try
+        {
+            FlushBuffer();
+        }
+        catch (IAppException &appEx)
+        {
+            AttemptConsoleOutput(appEx.ToString());
+        }
+    }
+
+    /// <summary>
+    /// Writes the buffered records to the file. The caller must hold the lock.
+    /// </summary>
+    void BinaryLog::FlushBuffer()
+    {
+        if (m_buffer.empty())
+            return;
+
+        m_file.write(m_buffer.data(), m_buffer.size());
+        m_file.flush();
+        m_buffer.clear();
+
+        if (m_file.bad())
+            throw AppException<std::runtime_error>("Failed to write binary log file");
+    }
+
+    /// <summary>
+    /// Appends a record to the buffer, and writes the buffer to the file if
+    /// it got large or when the priority is that of an error.
+    /// </summary>
+    /// <param name="prio">The priority of the message.</param>
+    /// <param name="formatId">The id of the format string.</param>
+    /// <param name="args">The encoded arguments.</param>
+    /// <param name="argsLength">The length of the encoded arguments.</param>
+    void BinaryLog::Append(Logger::Priority prio, uint32_t formatId, const char *args, size_t argsLength) NOEXCEPT
+    {
+        using namespace std::chrono;
+        auto time = static_cast<int64_t> (duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count());
+        auto threadId = GetThreadId();
+
+        try
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            // first time this format is used in this session?
+            if (formatId >= m_definedFormats.size() || !m_definedFormats[formatId])
+            {
+                string format;
+                {
+                    auto &registry = GetFormatRegistry();
+                    std::lock_guard<std::mutex> lock(registry.mutex);
+                    format = registry.formats[formatId - 1];
+                }
+
+                auto length = static_cast<uint16_t> (std::min(format.length(), static_cast<size_t> (UINT16_MAX)));
+                m_buffer.push_back(definitionKind);
+                m_buffer.push_back(0);
+                AppendRaw(m_buffer, length);
+                AppendRaw(m_buffer, formatId);
+                m_buffer.insert(m_buffer.end(), format.data(), format.data() + length);
+
+                if (formatId >= m_definedFormats.size())
+                    m_definedFormats.resize(formatId + 1, false);
+
+                m_definedFormats[formatId] = true;
+            }
+
+            m_buffer.push_back(eventKind);
+            m_buffer.push_back(static_cast<char> (prio));
+            AppendRaw(m_buffer, static_cast<uint16_t> (argsLength));
+            AppendRaw(m_buffer, formatId);
+            AppendRaw(m_buffer, threadId);
+            AppendRaw(m_buffer, time);
+            m_buffer.insert(m_buffer.end(), args, args + argsLength);
+
+            if (prio <= Logger::PRIO_ERROR || m_buffer.size() >= flushThreshold)
+                FlushBuffer();
+        }
+        catch (IAppException &appEx)
+        {
+            AttemptConsoleOutput(appEx.ToString());
+        }
+        catch (std::exception &ex)
+        {
+            std::ostringstream oss;
+            oss << "Failed to write in binary log. An exception had to be swallowed: " << ex.what();
+            AttemptConsoleOutput(oss.str());
+        }
+    }
+
+    /// <summary>
+    /// Writes to the file all the records buffered so far.
+    /// </summary>
+    void BinaryLog::Flush()
+    {
+        if (uniqueObjectPtr == nullptr)
+            return;
+
+        std::lock_guard<std::mutex> lock(uniqueObjectPtr->m_mutex);
+        uniqueObjectPtr->FlushBuffer();
+    }
+
+    /// <summary>
+    /// Shuts down the binary log, writing the buffered records to the file.
+    /// </summary>
+    void BinaryLog::Shutdown()
+    {
+        try
+        {
+            std::lock_guard<std::mutex> lock(singleInstanceCreationMutex);
+
+            if (uniqueObjectPtr != nullptr)
+            {
+                delete uniqueObjectPtr;
+                uniqueObjectPtr = nullptr;
+            }
+        }
+        catch (std::system_error &)
+        {/* DO NOTHING: SWALLOW EXCEPTION
+            This method cannot throw an exception because it could have been originally
+            invoked by a destructor. */
+        }
+    }
+
+    ////////////////////////
+    // Decoding
+    ////////////////////////
+
+    /// <summary>
+    /// Reads a value with raw bytes from a record.
+    /// </summary>
+    template <typename ValType>
+    static ValType ReadRaw(const char *&iter, const char *end)
+    {
+        ValType value;
+
+        if (static_cast<size_t> (end - iter) < sizeof value)
+            throw AppException<std::runtime_error>("Failed to decode binary log: record is truncated");
+
+        memcpy(&value, iter, sizeof value);
+        iter += sizeof value;
+        return value;
+    }
+
+    /// <summary>
+    /// Reads a value with raw bytes from encoded arguments.
+    /// </summary>
+    template <typename ValType>
+    static ValType ReadArg(const char *&iter, const char *end)
+    {
+        ValType value;
+
+        if (static_cast<size_t> (end - iter) < sizeof value)
+            throw AppException<std::runtime_error>("Failed to decode binary log: argument is truncated");
+
+        memcpy(&value, iter, sizeof value);
+        iter += sizeof value;
+        return value;
+    }
+
+    /// <summary>
+    /// Renders an argument as text, in the same way <see cref="utils::SerializeTo"/> does.
+    /// </summary>
+    template <typename ValType>
+    static string RenderArg(ValType value, int32_t width, int32_t precision)
+    {
+        auto arg = utils::FormatArg(value);
+
+        if (width >= 0)
+            arg.width(width);
+
+        if (precision >= 0)
+            arg.precision(precision);
+
+        string text;
+        utils::SerializeTo(text, arg);
+        return text;
+    }
+
+    /// <summary>
+    /// Decodes the next argument and renders it as text.
+    /// </summary>
+    static string DecodeArg(const char *&iter, const char *end)
+    {
+        auto flags = ReadArg<uint8_t>(iter, end);
+        int32_t width = (flags & BinaryLogArgEncoder::widthFlag) != 0 ? ReadArg<int32_t>(iter, end) : -1;
+        int32_t precision = (flags & BinaryLogArgEncoder::precisionFlag) != 0 ? ReadArg<int32_t>(iter, end) : -1;
+
+        switch (static_cast<BinaryLogArgType> (flags & BinaryLogArgEncoder::typeMask))
+        {
+        case BinaryLogArgType::Char:
+            return RenderArg(ReadArg<char>(iter, end), width, precision);
+
+        case BinaryLogArgType::WideChar:
+            return RenderArg(static_cast<wchar_t> (ReadArg<uint32_t>(iter, end)), width, precision);
+
+        case BinaryLogArgType::Int16:
+            return RenderArg(static_cast<signed short> (ReadArg<int16_t>(iter, end)), width, precision);
+
+        case BinaryLogArgType::UInt16:
+            return RenderArg(static_cast<unsigned short> (ReadArg<uint16_t>(iter, end)), width, precision);
+
+        case BinaryLogArgType::Int32:
+            return RenderArg(static_cast<signed int> (ReadArg<int32_t>(iter, end)), width, precision);
+
+        case BinaryLogArgType::UInt32:
+            return RenderArg(static_cast<unsigned int> (ReadArg<uint32_t>(iter, end)), width, precision);
+
+        case BinaryLogArgType::Int64:
+            return RenderArg(static_cast<signed long long> (ReadArg<int64_t>(iter, end)), width, precision);
+
+        case BinaryLogArgType::UInt64:
+            return RenderArg(static_cast<unsigned long long> (ReadArg<uint64_t>(iter, end)), width, precision);
+
+        case BinaryLogArgType::Double:
+            return RenderArg(ReadArg<double>(iter, end), width, precision);
+
+        case BinaryLogArgType::Pointer:
+            return RenderArg(reinterpret_cast<void *> (static_cast<uintptr_t> (ReadArg<uint64_t>(iter, end))), width, precision);
+
+        case BinaryLogArgType::String:
+        {
+            auto length = ReadArg<uint16_t>(iter, end);
+            if (static_cast<size_t> (end - iter) < length)
+                throw AppException<std::runtime_error>("Failed to decode binary log: argument is truncated");
+
+            string value(iter, length);
+            iter += length;
+            return RenderArg(value.c_str(), width, precision);
+        }
+
+        case BinaryLogArgType::WideString:
+        {
+            auto length = ReadArg<uint16_t>(iter, end);
+            std::wstring value;
+            value.reserve(length);
+
+            for (uint16_t idx = 0; idx < length; ++idx)
+                value.push_back(static_cast<wchar_t> (ReadArg<uint32_t>(iter, end)));
+
+            return RenderArg(value.c_str(), width, precision);
+        }
+
+        default:
+            throw AppException<std::runtime_error>("Failed to decode binary log: unknown argument type");
+        }
+    }
+
+    /// <summary>
+    /// Gets the label of a priority, as written in the text log.
+    /// </summary>
+    static const char *GetPriorityLabel(uint8_t prio)
+    {
+        static const char *labels[] =
+        {
+            "UNKNOWN", "FATAL", "CRITICAL", "ERROR", "WARNING", "NOTICE", "INFORMATION", "DEBUG", "TRACE"
+        };
+
+        return prio < sizeof labels / sizeof labels[0] ? labels[prio] : labels[0];
+    }
+
+    /// <summary>
+    /// Finds where the next session starts, by its header.
+    /// </summary>
+    /// <returns>The start of the next session, or the end of the input if there is none.</returns>
+    static const char *FindSession(const char *begin, const char *end)
+    {
+        // magic, version and byte order mark, so the chance of matching some argument is negligible:
+        std::array<char, sizeof sessionMagic - 1 + sizeof formatVersion + sizeof byteOrderMark> header;
+        memcpy(header.data(), sessionMagic, sizeof sessionMagic - 1);
+        header[sizeof sessionMagic - 1] = static_cast<char> (formatVersion);
+        memcpy(header.data() + sizeof sessionMagic, &byteOrderMark, sizeof byteOrderMark);
+
+        return std::search(begin, end, header.begin(), header.end());
+    }
+
+    /// <summary>
+    /// Decodes the records of a session, rendering them to text, one per line.
+    /// </summary>
+    /// <param name="iter">Where the records of the session start.</param>
+    /// <param name="end">Where the session ends.</param>
+    /// <param name="output">The output stream to receive the text.</param>
+    /// <param name="numRecords">Incremented for each record decoded.</param>
+    static void DecodeSession(const char *iter, const char *end, std::ostream &output, size_t &numRecords)
+    {
+        std::map<uint32_t, string> formats; // ids are valid within a session only
+
+        while (iter != end)
+        {
+            char kind = ReadRaw<char>(iter, end);
+
+            if (kind == definitionKind)
+            {
+                ReadRaw<uint8_t>(iter, end);
+                auto length = ReadRaw<uint16_t>(iter, end);
+                auto formatId = ReadRaw<uint32_t>(iter, end);
+
+                if (static_cast<size_t> (end - iter) < length)
+                    throw AppException<std::runtime_error>("Failed to decode binary log: record is truncated");
+
+                formats[formatId] = string(iter, length);
+                iter += length;
+            }
+            else if (kind == eventKind)
+            {
+                auto prio = ReadRaw<uint8_t>(iter, end);
+                auto argsLength = ReadRaw<uint16_t>(iter, end);
+                auto formatId = ReadRaw<uint32_t>(iter, end);
+                auto threadId = ReadRaw<uint32_t>(iter, end);
+                auto time = ReadRaw<int64_t>(iter, end);
+
+                if (static_cast<size_t> (end - iter) < argsLength)
+                    throw AppException<std::runtime_error>("Failed to decode binary log: record is truncated");
+
+                const char *iterArgs = iter;
+                const char *endArgs = iter + argsLength;
+                iter = endArgs;
+
+                auto iterFormat = formats.find(formatId);
+                if (iterFormat == formats.end())
+                    throw AppException<std::runtime_error>("Failed to decode binary log: format string not defined", std::to_string(formatId));
+
+                // replace each "{}" by the next argument, then append the left over ones:
+                string text;
+                const string &format = iterFormat->second;
+                size_t pos(0);
+
+                while (pos < format.length())
+                {
+                    auto next = format.find("{}", pos);
+                    if (next == string::npos || iterArgs == endArgs)
+                        break;
+
+                    text.append(format, pos, next - pos);
+                    text.append(DecodeArg(iterArgs, endArgs));
+                    pos = next + 2;
+                }
+
+                if (pos < format.length())
+                    text.append(format, pos, string::npos);
+
+                while (iterArgs != endArgs)
+                    text.append(DecodeArg(iterArgs, endArgs));
+
+                // same time format as the text log, but with fractions of second:
+                std::array<char, 21> timeBuffer;
+                auto seconds = static_cast<time_t> (time / 1000000000);
+                strftime(timeBuffer.data(), timeBuffer.size(), "%Y-%b-%d %H:%M:%S", localtime(&seconds));
+
+                std::array<char, 8> fraction;
+                snprintf(fraction.data(), fraction.size(), ".%06u", static_cast<unsigned int> (time % 1000000000 / 1000));
+
+                output << timeBuffer.data() << fraction.data()
+                       << " [thread " << threadId << "] - "
+                       << GetPriorityLabel(prio) << " - "
+                       << text << '\n';
+
+                ++numRecords;
+            }
+            else
+                throw AppException<std::runtime_error>("Failed to decode binary log: unknown record kind");
+        }
+    }
+
+    /// <summary>
+    /// Decodes a binary log, rendering its records to text, one per line.
+    /// </summary>
+    /// <param name="input">The input stream, opened in binary mode.</param>
+    /// <param name="output">The output stream to receive the text.</param>
+    /// <returns>How many records were decoded.</returns>
+    /// <remarks>A session is appended to the file whenever it is reopened, so when the process
+    /// crashes in the middle of a write, the partial record is followed by the next session. The
+    /// records of a session are bounded by the header of the next one, and from a malformed record
+    /// up to that point everything is skipped, hence the later sessions are not lost.</remarks>
+    size_t BinaryLog::Decode(std::istream &input, std::ostream &output)
+    {
+        CALL_STACK_TRACE;
+
+        std::vector<char> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        const char *iter = data.data();
+        const char *end = data.data() + data.size();
+        size_t numRecords(0);
+
+        if (static_cast<size_t> (end - iter) < sessionHeaderLength)
+            return 0;
+
+        if (memcmp(iter, sessionMagic, sizeof sessionMagic - 1) != 0
+            || static_cast<uint8_t> (iter[sizeof sessionMagic - 1]) != formatVersion)
+        {
+            throw AppException<std::runtime_error>("Failed to decode binary log: header not recognized");
+        }
+
+        uint32_t mark;
+        memcpy(&mark, iter + sizeof sessionMagic, sizeof mark);
+
+        if (mark != byteOrderMark)
+            throw AppException<std::runtime_error>("Failed to decode binary log: written in another byte order");
+
+        while (static_cast<size_t> (end - iter) >= sessionHeaderLength)
+        {
+            auto next = FindSession(iter + sessionHeaderLength, end);
+
+            try
+            {
+                DecodeSession(iter + sessionHeaderLength, next, output, numRecords);
+            }
+            catch (IAppException &)
+            {/* DO NOTHING: the remaining of the session is a partial record
+                left behind by a crash, so resume from the next session */
+            }
+
+            iter = next;
+        }
+
+        return numRecords;
+    }
+
+}// end of namespace core
+}// end of namespace _3fd
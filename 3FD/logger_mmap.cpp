@@ -0,0 +1,880 @@
+#include "stdafx.h"
+#include "logger.h"
+#include "configuration.h"
+#include "callstacktracer.h"
+#include "timing.h"
+
+#include <Poco/DeflatingStream.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace _3fd
+{
+namespace core
+{
+    /* Every segment file starts with a header line of fixed length, which is rewritten
+    when the segment is sealed, followed by the text of the log records:
+
+        #3FD-LOG seq=000000000001 used=00000000000000000000 state=open
+
+    While a segment is open, the file is pre-sized, hence filled with zeros past the last
+    record, and the text might have holes of zeros where a thread was still copying a record
+    when the process crashed. A segment found open when the logger starts has been left by a
+    crash, so zeros are removed from its text before archiving it. */
+
+    static const size_t segmentHeaderLength = 64;
+
+    static const char *segmentHeaderFormat = "#3FD-LOG seq=%012llu used=%020llu state=%s";
+
+    /// <summary>
+    /// Formats the header of a segment file.
+    /// </summary>
+    /// <param name="sequence">The sequence number of the segment.</param>
+    /// <param name="usedLength">The length of the text in the segment, known once sealed.</param>
+    /// <param name="sealed">Whether the segment is sealed.</param>
+    /// <returns>The header, always with the same length.</returns>
+    static string FormatSegmentHeader(uint64_t sequence, uint64_t usedLength, bool sealed)
+    {
+        std::array<char, segmentHeaderLength> buffer;
+        auto length = snprintf(buffer.data(), buffer.size(), segmentHeaderFormat,
+            static_cast<unsigned long long> (sequence),
+            static_cast<unsigned long long> (usedLength),
+            sealed ? "done" : "open");
+
+        string header(buffer.data(), std::min(static_cast<size_t> (length), buffer.size() - 1));
+        header.resize(segmentHeaderLength - 1, ' ');
+        header.push_back('\n');
+        return header;
+    }
+
+    /// <summary>
+    /// Gets the label of a priority, as written in the log output.
+    /// </summary>
+    static const char *GetPriorityLabel(uint32_t prio)
+    {
+        static const char *labels[] =
+        {
+            "", "FATAL - ", "CRITICAL - ", "ERROR - ", "WARNING - ",
+            "NOTICE - ", "INFORMATION - ", "DEBUG - ", "TRACE - "
+        };
+
+        return prio < sizeof labels / sizeof labels[0] ? labels[prio] : "";
+    }
+
+    /// <summary>
+    /// Makes a message with the error of the last failed system call.
+    /// </summary>
+    static string GetSystemErrorDetails(const char *call, const string &filePath)
+    {
+        std::ostringstream oss;
+        oss << "POSIX API: " << call << " for \'" << filePath << "\' - " << strerror(errno);
+        return oss.str();
+    }
+
+    ////////////////////////////////
+    // LogSegment Class
+    ////////////////////////////////
+
+    /// <summary>
+    /// A segment of the log, which is a pre-sized file mapped into memory. Threads reserve
+    /// room for their records by atomically moving the cursor forward, then copy the text
+    /// straight into the mapping, so they never take a lock.
+    /// </summary>
+    class Logger::LogSegment : notcopiable
+    {
+    private:
+
+        string m_filePath;
+        uint64_t m_sequence;
+        const uint64_t m_capacity;
+        int m_fileDescriptor;
+        char *m_mapping;
+
+        void Unmap()
+        {
+            if (m_mapping != nullptr)
+            {
+                munmap(m_mapping, segmentHeaderLength + m_capacity);
+                m_mapping = nullptr;
+            }
+
+            if (m_fileDescriptor >= 0)
+            {
+                close(m_fileDescriptor);
+                m_fileDescriptor = -1;
+            }
+        }
+
+    public:
+
+        std::atomic<uint64_t> cursor; // where the next record is reserved
+        std::atomic<uint32_t> numWriters; // how many threads might be copying into the segment
+        uint64_t usedLength; // length of the text, known when the segment is rotated
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="LogSegment"/> class,
+        /// creating the segment file.
+        /// </summary>
+        /// <param name="filePath">The path of the segment file.</param>
+        /// <param name="sequence">The sequence number of the segment.</param>
+        /// <param name="capacity">How much text the segment can take.</param>
+        LogSegment(const string &filePath, uint64_t sequence, uint64_t capacity)
+            : m_sequence(0)
+            , m_capacity(capacity)
+            , m_fileDescriptor(-1)
+            , m_mapping(nullptr)
+            , cursor(0)
+            , numWriters(0)
+            , usedLength(0)
+        {
+            Open(filePath, sequence);
+        }
+
+        /// <summary>
+        /// Finalizes an instance of the <see cref="LogSegment"/> class.
+        /// </summary>
+        ~LogSegment()
+        {
+            Unmap();
+        }
+
+        /// <summary>
+        /// Creates the segment file and maps it into memory. This is also how a segment
+        /// already archived gets reused, so the counter of writers is left untouched.
+        /// </summary>
+        /// <param name="filePath">The path of the segment file.</param>
+        /// <param name="sequence">The sequence number of the segment.</param>
+        void Open(const string &filePath, uint64_t sequence)
+        {
+            _ASSERTE(m_mapping == nullptr && m_fileDescriptor < 0);
+
+            m_filePath = filePath;
+            m_sequence = sequence;
+            cursor.store(0);
+            usedLength = 0;
+
+            m_fileDescriptor = open(filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+            if (m_fileDescriptor < 0)
+                throw AppException<std::runtime_error>("Failed to create log segment", GetSystemErrorDetails("open", filePath));
+
+            const auto fileSize = static_cast<off_t> (segmentHeaderLength + m_capacity);
+
+            /* Allocate the blocks up front, otherwise a full disk would kill the process with SIGBUS
+            when writing into the mapping. When the file system does not support it, fall back to a
+            sparse file: */
+            if (posix_fallocate(m_fileDescriptor, 0, fileSize) != 0 && ftruncate(m_fileDescriptor, fileSize) != 0)
+            {
+                auto details = GetSystemErrorDetails("ftruncate", filePath);
+                Unmap();
+                unlink(filePath.c_str());
+                throw AppException<std::runtime_error>("Failed to pre-size log segment", details);
+            }
+
+            void *mapping = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fileDescriptor, 0);
+
+            if (mapping == MAP_FAILED)
+            {
+                auto details = GetSystemErrorDetails("mmap", filePath);
+                Unmap();
+                unlink(filePath.c_str());
+                throw AppException<std::runtime_error>("Failed to map log segment into memory", details);
+            }
+
+            m_mapping = static_cast<char *> (mapping);
+
+            auto header = FormatSegmentHeader(sequence, 0, false);
+            memcpy(m_mapping, header.data(), header.length());
+        }
+
+        const string &GetFilePath() const { return m_filePath; }
+
+        uint64_t GetCapacity() const { return m_capacity; }
+
+        /// <summary>
+        /// Gets where the text of the segment starts in the mapping.
+        /// </summary>
+        char *GetText() const { return m_mapping + segmentHeaderLength; }
+
+        /// <summary>
+        /// Seals the segment, which no thread can be writing into anymore: the header is
+        /// rewritten with the length of the text, which the file is truncated to.
+        /// </summary>
+        /// <param name="textLength">The length of the text written.</param>
+        void Seal(uint64_t textLength)
+        {
+            if (m_mapping == nullptr)
+                return;
+
+            auto header = FormatSegmentHeader(m_sequence, textLength, true);
+            memcpy(m_mapping, header.data(), header.length());
+            munmap(m_mapping, segmentHeaderLength + m_capacity);
+            m_mapping = nullptr;
+
+            if (ftruncate(m_fileDescriptor, static_cast<off_t> (segmentHeaderLength + textLength)) != 0)
+            {
+                auto details = GetSystemErrorDetails("ftruncate", m_filePath);
+                Unmap();
+                throw AppException<std::runtime_error>("Failed to truncate sealed log segment", details);
+            }
+
+            Unmap();
+        }
+
+        /// <summary>
+        /// Discards a segment never written, removing its file.
+        /// </summary>
+        void Discard()
+        {
+            Unmap();
+            unlink(m_filePath.c_str());
+        }
+    };
+
+    ////////////////////////////////
+    // Logger Class
+    ////////////////////////////////
+
+    /// <summary>
+    /// Gets the unique instance of the singleton <see cref="Logger" /> class.
+    /// </summary>
+    /// <returns>A pointer to the singleton.</returns>
+    Logger * Logger::GetInstance() NOEXCEPT
+    {
+        if (uniqueObjectPtr != nullptr)
+            return uniqueObjectPtr;
+        else
+        {
+            try
+            {
+                CreateInstance(AppConfig::GetApplicationId(),
+                    AppConfig::GetSettings().common.log.writeToConsole);
+            }
+            catch (IAppException &appEx)
+            {
+                std::ostringstream oss;
+                oss << "The logging facility creation failed with an exception - " << appEx.ToString();
+                AttemptConsoleOutput(oss.str());
+            }
+
+            return uniqueObjectPtr;
+        }
+    }
+
+    /// <summary>
+    /// Splits the path of the log into directory and prefix of the names of the segment files.
+    /// </summary>
+    static void SplitLogPath(const string &id, string &directory, string &prefix)
+    {
+        auto pos = id.rfind('/');
+
+        if (pos == string::npos)
+        {
+            directory = ".";
+            prefix = id + '.';
+        }
+        else
+        {
+            directory = id.substr(0, pos + 1);
+            prefix = id.substr(pos + 1) + '.';
+        }
+    }
+
+    /// <summary>
+    /// Parses the sequence number in the name of a segment file, or an archive of one.
+    /// </summary>
+    /// <param name="fileName">The name of the file.</param>
+    /// <param name="prefix">The prefix of the names of segment files.</param>
+    /// <param name="suffix">The expected suffix, which tells whether this is an archive.</param>
+    /// <param name="sequence">Receives the sequence number.</param>
+    /// <returns>Whether the file name matched.</returns>
+    static bool ParseSegmentFileName(const string &fileName, const string &prefix, const char *suffix, uint64_t &sequence)
+    {
+        auto suffixLength = strlen(suffix);
+
+        if (fileName.length() <= prefix.length() + suffixLength
+            || fileName.compare(0, prefix.length(), prefix) != 0
+            || fileName.compare(fileName.length() - suffixLength, suffixLength, suffix) != 0)
+        {
+            return false;
+        }
+
+        auto digits = fileName.substr(prefix.length(), fileName.length() - prefix.length() - suffixLength);
+
+        if (digits.find_first_not_of("0123456789") != string::npos)
+            return false;
+
+        sequence = strtoull(digits.c_str(), nullptr, 10);
+        return true;
+    }
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="Logger"/> class.
+    /// </summary>
+    /// <param name="id">The id of the server, which also names the segment files.</param>
+    /// <param name="logToConsole">Whether the console or the segment files are to receive the log output.</param>
+    Logger::Logger(const string &id, bool logToConsole)
+        : m_id(id)
+        , m_segmentSize(std::max(static_cast<uint64_t> (AppConfig::GetSettings().common.log.sizeLimit) * 1024, static_cast<uint64_t> (64 * 1024)))
+        , m_nextSequence(1)
+        , m_logToConsole(logToConsole)
+        , m_currentSegment(nullptr)
+        , m_spareSegment(nullptr)
+        , m_terminate(false)
+    {
+        if (logToConsole)
+            return;
+
+        try
+        {
+            /* Segments left by a previous execution are archived by the background thread,
+            and the sequence of segments continues from where it stopped: */
+            string directory, prefix;
+            SplitLogPath(m_id, directory, prefix);
+
+            DIR *dir = opendir(directory.c_str());
+            if (dir != nullptr)
+            {
+                struct dirent *entry;
+                while ((entry = readdir(dir)) != nullptr)
+                {
+                    uint64_t sequence;
+                    if (ParseSegmentFileName(entry->d_name, prefix, ".log", sequence))
+                        m_leftoverFiles.push_back(directory + '/' + entry->d_name);
+                    else if (!ParseSegmentFileName(entry->d_name, prefix, ".log.gz", sequence))
+                        continue;
+
+                    m_nextSequence = std::max(m_nextSequence, sequence + 1);
+                }
+
+                closedir(dir);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_segmentsMutex);
+                m_currentSegment.store(CreateSegment());
+            }
+
+            m_archiverThread = std::thread(&Logger::ArchiverThreadProc, this);
+        }
+        catch (IAppException &ex)
+        {
+            std::ostringstream oss;
+            oss << "There was a failure when trying to set up the logger - " << ex.ToString();
+            AttemptConsoleOutput(oss.str());
+        }
+        catch (std::system_error &ex)
+        {
+            std::ostringstream oss;
+            oss << "There was a failure when trying to set up the logger. System error: "
+                << StdLibExt::GetDetailsFromSystemError(ex);
+            AttemptConsoleOutput(oss.str());
+        }
+        /* Even when the set-up of the logger fails, the application must continue to execute,
+        because the logger is merely an auxiliary service. */
+    }
+
+    /// <summary>
+    /// Finalizes an instance of the <see cref="Logger"/> class. The current segment is sealed,
+    /// but left uncompressed, so the latest records are readable, until the next execution.
+    /// </summary>
+    Logger::~Logger()
+    {
+        if (m_archiverThread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_archiverMutex);
+                m_terminate = true;
+            }
+
+            m_archiverCondition.notify_one();
+            m_archiverThread.join();
+        }
+
+        try
+        {
+            auto segment = m_currentSegment.exchange(nullptr);
+            if (segment != nullptr)
+            {
+                while (segment->numWriters.load() > 0)
+                    std::this_thread::yield();
+
+                segment->Seal(std::min(segment->cursor.load(), segment->GetCapacity()));
+            }
+
+            segment = m_spareSegment.exchange(nullptr);
+            if (segment != nullptr)
+                segment->Discard();
+        }
+        catch (IAppException &ex)
+        {
+            AttemptConsoleOutput(ex.ToString());
+        }
+    }
+
+    /// <summary>
+    /// Creates a new segment, reusing one already archived when available.
+    /// The caller must hold the lock of the segments.
+    /// </summary>
+    /// <returns>The new segment.</returns>
+    Logger::LogSegment * Logger::CreateSegment()
+    {
+        std::array<char, 32> sequence;
+        snprintf(sequence.data(), sequence.size(), "%06llu", static_cast<unsigned long long> (m_nextSequence));
+        string filePath = m_id + '.' + sequence.data() + ".log";
+
+        LogSegment *segment;
+
+        if (!m_freeSegments.empty())
+        {
+            segment = m_freeSegments.back();
+            segment->Open(filePath, m_nextSequence);
+            m_freeSegments.pop_back();
+        }
+        else
+        {
+            m_segments.reserve(m_segments.size() + 1);
+            m_freeSegments.reserve(m_segments.size() + 1);
+            m_segments.emplace_back(new LogSegment(filePath, m_nextSequence, m_segmentSize));
+            segment = m_segments.back().get();
+        }
+
+        ++m_nextSequence;
+        return segment;
+    }
+
+    /// <summary>
+    /// Makes an archived segment available for reuse.
+    /// </summary>
+    /// <param name="segment">The segment, already sealed or discarded.</param>
+    void Logger::RecycleSegment(LogSegment *segment) NOEXCEPT
+    {
+        std::lock_guard<std::mutex> lock(m_segmentsMutex);
+        m_freeSegments.push_back(segment); // capacity reserved upon creation, so it does not throw
+    }
+
+    /// <summary>
+    /// Replaces the current segment once it is full, and queues it for archiving.
+    /// Only the thread whose reservation crossed the end of the segment does this.
+    /// </summary>
+    /// <param name="fullSegment">The segment that got full.</param>
+    /// <param name="usedLength">The length of the text in the full segment.</param>
+    /// <returns>The new current segment, or a null pointer if it could not be created.</returns>
+    Logger::LogSegment * Logger::RotateSegment(LogSegment *fullSegment, uint64_t usedLength) NOEXCEPT
+    {
+        fullSegment->usedLength = usedLength;
+        LogSegment *nextSegment(nullptr);
+
+        try
+        {
+            std::lock_guard<std::mutex> lock(m_segmentsMutex);
+
+            // normally the archiver has already prepared the next one:
+            nextSegment = m_spareSegment.exchange(nullptr);
+
+            if (nextSegment == nullptr)
+                nextSegment = CreateSegment();
+        }
+        catch (IAppException &ex)
+        {
+            AttemptConsoleOutput(ex.ToString());
+        }
+        catch (std::exception &ex)
+        {
+            std::ostringstream oss;
+            oss << "Failed to rotate log segment: " << ex.what();
+            AttemptConsoleOutput(oss.str());
+        }
+
+        // threads waiting for the rotation are released here (even without a new segment):
+        m_currentSegment.store(nextSegment);
+
+        try
+        {
+            std::lock_guard<std::mutex> lock(m_archiverMutex);
+            m_segmentsToArchive.push_back(fullSegment);
+        }
+        catch (std::exception &)
+        {
+            // DO NOTHING: the segment will be archived in the next execution
+        }
+
+        m_archiverCondition.notify_one();
+        return nextSegment;
+    }
+
+    /// <summary>
+    /// Writes a message and its details to the log output. Room for the record is reserved
+    /// by atomically moving the cursor of the current segment, then the text is copied into
+    /// the mapping of the segment, without taking locks.
+    /// </summary>
+    /// <param name="what">The reason for the message.</param>
+    /// <param name="details">The message details.</param>
+    /// <param name="prio">The priority for the message.</param>
+    /// <param name="cst">When set to <c>true</c>, append the call stack trace.</param>
+    void Logger::WriteImpl(string &&what, string &&details, Priority prio, bool cst) NOEXCEPT
+    {
+        try
+        {
+            SCOPED_TIMER("core::Logger::Write");
+
+            std::array<std::pair<const char *, size_t>, 3> pieces;
+            size_t numPieces(0);
+            size_t length(what.length());
+            pieces[numPieces++] = std::make_pair(what.data(), what.length());
+
+#    ifdef ENABLE_3FD_ERR_IMPL_DETAILS
+            if (details.empty() == false)
+            {
+                details.insert(0, " - ");
+                pieces[numPieces++] = std::make_pair(details.data(), details.length());
+                length += details.length();
+            }
+#    endif
+#    ifdef ENABLE_3FD_CST
+            string report;
+            if (cst && CallStackTracer::IsReady())
+            {
+                report = "\n\n### CALL STACK TRACE ###\n" + CallStackTracer::GetStackReport();
+                pieces[numPieces++] = std::make_pair(report.data(), report.length());
+                length += report.length();
+            }
+#    endif
+            /* The prefix with the time stamp is formatted by each
+            thread only once per second, then reused in that second: */
+            struct TimePrefix
+            {
+                time_t secs;
+                size_t length;
+                std::array<char, 64> text;
+            };
+
+            thread_local static TimePrefix timePrefix = { -1, 0, {} };
+
+            auto now = time(nullptr);
+            if (now != timePrefix.secs)
+            {
+                struct tm localTime;
+                localtime_r(&now, &localTime);
+
+                auto &text = timePrefix.text;
+                auto prefixLength = strftime(text.data(), text.size(), "%Y-%b-%d %H:%M:%S", &localTime);
+                prefixLength += snprintf(text.data() + prefixLength, text.size() - prefixLength, " [process %ld] - ", static_cast<long> (getpid()));
+
+                timePrefix.length = std::min(prefixLength, text.size() - 1);
+                timePrefix.secs = now;
+            }
+
+            auto prioLabel = GetPriorityLabel(prio);
+            auto prioLabelLength = strlen(prioLabel);
+            auto textLength = std::min(length, static_cast<size_t> (m_segmentSize / 4));
+            auto recordLength = timePrefix.length + prioLabelLength + textLength + 1;
+
+            if (m_logToConsole)
+            {
+                string line;
+                line.reserve(recordLength);
+                line.append(timePrefix.text.data(), timePrefix.length).append(prioLabel);
+
+                for (size_t idx = 0; idx < numPieces; ++idx)
+                    line.append(pieces[idx].first, pieces[idx].second);
+
+                line.push_back('\n');
+
+                if (write(STDERR_FILENO, line.data(), line.length()) < 0)
+                    AttemptConsoleOutput(line);
+
+                return;
+            }
+
+            while (true)
+            {
+                auto segment = m_currentSegment.load();
+
+                if (segment == nullptr)
+                    return; // no segment available, so the record is dropped
+
+                /* Announce the copy before checking the segment is still the current one,
+                so the archiver never seals a segment while this thread copies into it: */
+                segment->numWriters.fetch_add(1);
+
+                if (segment != m_currentSegment.load())
+                {
+                    segment->numWriters.fetch_sub(1, std::memory_order_release);
+                    continue;
+                }
+
+                auto offset = segment->cursor.fetch_add(recordLength, std::memory_order_relaxed);
+                auto capacity = segment->GetCapacity();
+
+                if (offset + recordLength <= capacity)
+                {
+                    auto dest = segment->GetText() + offset;
+                    memcpy(dest, timePrefix.text.data(), timePrefix.length);
+                    dest += timePrefix.length;
+                    memcpy(dest, prioLabel, prioLabelLength);
+                    dest += prioLabelLength;
+
+                    auto remaining = textLength;
+                    for (size_t idx = 0; idx < numPieces && remaining > 0; ++idx)
+                    {
+                        auto count = std::min(pieces[idx].second, remaining);
+                        memcpy(dest, pieces[idx].first, count);
+                        dest += count;
+                        remaining -= count;
+                    }
+
+                    *dest = '\n';
+                    segment->numWriters.fetch_sub(1, std::memory_order_release);
+                    return;
+                }
+
+                segment->numWriters.fetch_sub(1, std::memory_order_release);
+
+                // the reservation crossing the end of the segment is the one to rotate it:
+                if (offset <= capacity)
+                    RotateSegment(segment, offset);
+                else
+                {
+                    /* Wait for the rotation. The cursor is also checked, because the segment
+                    could have been archived and reused as the current one meanwhile: */
+                    while (m_currentSegment.load() == segment
+                           && segment->cursor.load(std::memory_order_relaxed) > capacity)
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+        }
+        catch (std::exception &ex)
+        {
+            std::ostringstream oss;
+            oss << "Failed to write in log output. An exception had to be swallowed: " << ex.what();
+            AttemptConsoleOutput(oss.str());
+        }
+    }
+
+    /// <summary>
+    /// Compresses the text of a sealed segment file (or one left open by a crash)
+    /// into a GZIP archive, then removes the segment file.
+    /// </summary>
+    /// <param name="filePath">The path of the segment file.</param>
+    void Logger::ArchiveSegmentFile(const string &filePath)
+    {
+        std::ifstream input(filePath, std::ios::binary);
+
+        if (!input.is_open())
+            throw AppException<std::runtime_error>("Failed to open log segment for archiving", filePath);
+
+        std::array<char, segmentHeaderLength + 1> header;
+        header[segmentHeaderLength] = 0;
+
+        unsigned long long sequence, usedLength;
+        std::array<char, 8> state;
+
+        if (!input.read(header.data(), segmentHeaderLength)
+            || sscanf(header.data(), "#3FD-LOG seq=%llu used=%llu state=%4s", &sequence, &usedLength, state.data()) != 3)
+        {
+            throw AppException<std::runtime_error>("Failed to archive log segment: header not recognized", filePath);
+        }
+
+        const bool sealed = (strcmp(state.data(), "done") == 0);
+        uint64_t remaining = sealed ? usedLength : UINT64_MAX;
+
+        string archivePath = filePath + ".gz";
+        std::ofstream output(archivePath, std::ios::binary | std::ios::trunc);
+
+        if (!output.is_open())
+            throw AppException<std::runtime_error>("Failed to create archive of log segment", archivePath);
+
+        Poco::DeflatingOutputStream deflater(output, Poco::DeflatingStreamBuf::STREAM_GZIP);
+
+        std::vector<char> buffer(64 * 1024);
+        while (remaining > 0)
+        {
+            input.read(buffer.data(), std::min(static_cast<uint64_t> (buffer.size()), remaining));
+
+            auto count = static_cast<size_t> (input.gcount());
+            if (count == 0)
+                break;
+
+            auto end = buffer.begin() + count;
+            remaining -= count;
+
+            // the text of a segment left open by a crash might have holes:
+            if (!sealed)
+                end = std::remove(buffer.begin(), end, '\0');
+
+            deflater.write(buffer.data(), end - buffer.begin());
+        }
+
+        deflater.close();
+        output.close();
+
+        if (output.fail())
+            throw AppException<std::runtime_error>("Failed to write archive of log segment", archivePath);
+
+        unlink(filePath.c_str());
+    }
+
+    /// <summary>
+    /// Removes the archives in excess of the purge count, or older than the purge age.
+    /// </summary>
+    void Logger::PurgeArchives()
+    {
+        auto &settings = AppConfig::GetSettings().common.log;
+
+        string directory, prefix;
+        SplitLogPath(m_id, directory, prefix);
+
+        std::vector<std::pair<uint64_t, string>> archives;
+
+        DIR *dir = opendir(directory.c_str());
+        if (dir == nullptr)
+            return;
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr)
+        {
+            uint64_t sequence;
+            if (ParseSegmentFileName(entry->d_name, prefix, ".log.gz", sequence))
+                archives.emplace_back(sequence, directory + '/' + entry->d_name);
+        }
+
+        closedir(dir);
+
+        // newest first:
+        std::sort(archives.begin(), archives.end(), std::greater<std::pair<uint64_t, string>>());
+
+        auto maxAge = static_cast<time_t> (settings.purgeAge) * 24 * 3600;
+        auto now = time(nullptr);
+
+        for (size_t idx = 0; idx < archives.size(); ++idx)
+        {
+            struct stat fileStatus;
+            if (idx >= settings.purgeCount
+                || (settings.purgeAge > 0 && stat(archives[idx].second.c_str(), &fileStatus) == 0 && now - fileStatus.st_mtime > maxAge))
+            {
+                unlink(archives[idx].second.c_str());
+            }
+        }
+    }
+
+    /// <summary>
+    /// The procedure executed by the archiver thread, which seals and compresses the full
+    /// segments, and keeps a spare segment ready for the next rotation.
+    /// </summary>
+    void Logger::ArchiverThreadProc()
+    {
+        bool terminate(false);
+
+        do
+        {
+            try
+            {
+                std::deque<LogSegment *> segments;
+                std::deque<string> leftovers;
+
+                {
+                    std::unique_lock<std::mutex> lock(m_archiverMutex);
+                    terminate = m_archiverCondition.wait_for(lock, std::chrono::seconds(1), [this]()
+                    {
+                        return m_terminate || !m_segmentsToArchive.empty() || !m_leftoverFiles.empty();
+                    });
+
+                    terminate = m_terminate;
+                    segments.swap(m_segmentsToArchive);
+                    leftovers.swap(m_leftoverFiles);
+                }
+
+                // a file failing does not keep the others in the batch from being archived:
+                for (auto &filePath : leftovers)
+                {
+                    try
+                    {
+                        ArchiveSegmentFile(filePath);
+                    }
+                    catch (IAppException &ex)
+                    {
+                        AttemptConsoleOutput("Failed to archive leftover log segment - " + ex.ToString());
+                    }
+                    catch (std::exception &ex)
+                    {
+                        AttemptConsoleOutput("Failed to archive leftover log segment " + filePath + ": " + ex.what());
+                    }
+                }
+
+                for (auto segment : segments)
+                {
+                    // wait for the threads still copying into the segment:
+                    while (segment->numWriters.load() > 0)
+                        std::this_thread::yield();
+
+                    try
+                    {
+                        segment->Seal(segment->usedLength);
+                        ArchiveSegmentFile(segment->GetFilePath());
+                    }
+                    catch (IAppException &ex)
+                    {
+                        AttemptConsoleOutput("Failed to archive log segment - " + ex.ToString());
+                    }
+                    catch (std::exception &ex)
+                    {
+                        AttemptConsoleOutput("Failed to archive log segment " + segment->GetFilePath() + ": " + ex.what());
+                    }
+
+                    /* A writer might still hold a pointer to the segment it loaded before the
+                    rotation, so the object is not released, but reused for a later segment: */
+                    RecycleSegment(segment);
+                }
+
+                if (!leftovers.empty() || !segments.empty())
+                    PurgeArchives();
+
+                // sources gone quiet report what the throttle held back from them:
+                WriteQuietHeldBack();
+
+                if (!terminate)
+                {
+                    std::lock_guard<std::mutex> lock(m_segmentsMutex);
+
+                    // the current segment is missing when its creation failed:
+                    if (m_currentSegment.load() == nullptr)
+                        m_currentSegment.store(CreateSegment());
+
+                    if (m_spareSegment.load() == nullptr)
+                        m_spareSegment.store(CreateSegment());
+                }
+            }
+            catch (IAppException &ex)
+            {
+                std::ostringstream oss;
+                oss << "Failure in log archiver thread - " << ex.ToString();
+                AttemptConsoleOutput(oss.str());
+            }
+            catch (std::exception &ex)
+            {
+                std::ostringstream oss;
+                oss << "Generic failure in log archiver thread: " << ex.what();
+                AttemptConsoleOutput(oss.str());
+            }
+        }
+        while (terminate == false);
+    }
+
+}// end of namespace core
+}// end of namespace _3fd
@@ -0,0 +1,670 @@
+#include "stdafx.h"
+#include "logger.h"
+#include "configuration.h"
+#include "callstacktracer.h"
+#include "timing.h"
+#include "utils_lockfreequeue.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace _3fd
+{
+namespace core
+{
+    ////////////////////////////////
+    // LogRing Class
+    ////////////////////////////////
+
+    /// <summary>
+    /// A ring of log records written by a single thread and read by the log writer thread.
+    /// Every record is contiguous in the ring (when one does not fit in the room left at the
+    /// end, a padding record takes that room), so the writer can output the text of the
+    /// records straight from the ring, without copying.
+    /// </summary>
+    class Logger::LogRing : notcopiable
+    {
+    public:
+
+        /// <summary>
+        /// Precedes the text of every record in the ring.
+        /// </summary>
+        struct RecordHeader
+        {
+            uint32_t length; // the length of the text
+            uint32_t prio; // zero for padding records
+            int64_t time; // nanoseconds since the epoch
+        };
+
+        /// <summary>
+        /// A piece of the text of a record.
+        /// </summary>
+        struct TextPiece
+        {
+            const char *data;
+            size_t length;
+        };
+
+        static const uint32_t capacity = 1 << 18;
+
+        static const uint32_t maxTextLength = capacity / 4;
+
+    private:
+
+        std::unique_ptr<char[]> m_buffer;
+        std::atomic<uint64_t> m_head; // only the owner thread changes it
+        char m_padding[utils::cacheLineSize - sizeof(std::atomic<uint64_t>)];
+        std::atomic<uint64_t> m_tail; // only the writer thread changes it
+
+        RecordHeader *GetHeaderAt(uint32_t offset) const
+        {
+            return reinterpret_cast<RecordHeader *> (m_buffer.get() + offset);
+        }
+
+    public:
+
+        std::atomic<bool> abandoned; // set when the owner thread exits
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="LogRing"/> class.
+        /// </summary>
+        LogRing()
+            : m_buffer(new char[capacity])
+            , m_head(0)
+            , m_tail(0)
+            , abandoned(false)
+        {}
+
+        /// <summary>
+        /// Gets the room taken in the ring by a record, which keeps the headers aligned.
+        /// </summary>
+        /// <param name="length">The length of the text in the record.</param>
+        /// <returns>The size of the record.</returns>
+        static uint32_t GetRecordSize(uint32_t length)
+        {
+            return (sizeof(RecordHeader) + length + 15) & ~15U;
+        }
+
+        /// <summary>
+        /// Attempts to add a record to the ring. Only the owner thread can call this.
+        /// </summary>
+        /// <param name="prio">The priority of the record.</param>
+        /// <param name="time">The time of the record (in nanoseconds since the epoch).</param>
+        /// <param name="pieces">The pieces to concatenate as the text of the record.</param>
+        /// <param name="numPieces">How many pieces there are.</param>
+        /// <param name="length">The length of the text, which truncates the pieces when shorter.</param>
+        /// <returns><c>true</c> if the record was added, or <c>false</c> if the ring is full.</returns>
+        bool TryPush(Priority prio, int64_t time, const TextPiece *pieces, size_t numPieces, uint32_t length)
+        {
+            _ASSERTE(length <= maxTextLength);
+
+            auto recordSize = GetRecordSize(length);
+            auto head = m_head.load(std::memory_order_relaxed);
+            auto offset = static_cast<uint32_t> (head % capacity);
+            auto paddingSize = (offset + recordSize > capacity) ? capacity - offset : 0;
+
+            if (head + paddingSize + recordSize - m_tail.load(std::memory_order_acquire) > capacity)
+                return false;
+
+            if (paddingSize > 0)
+            {
+                auto padding = GetHeaderAt(offset);
+                padding->length = paddingSize - sizeof(RecordHeader);
+                padding->prio = 0;
+                head += paddingSize;
+                offset = 0;
+            }
+
+            auto header = GetHeaderAt(offset);
+            header->length = length;
+            header->prio = static_cast<uint32_t> (prio);
+            header->time = time;
+
+            auto text = reinterpret_cast<char *> (header + 1);
+            for (size_t idx = 0; idx < numPieces && length > 0; ++idx)
+            {
+                auto pieceLength = std::min(pieces[idx].length, static_cast<size_t> (length));
+                memcpy(text, pieces[idx].data, pieceLength);
+                text += pieceLength;
+                length -= static_cast<uint32_t> (pieceLength);
+            }
+
+            m_head.store(head + recordSize, std::memory_order_release);
+            return true;
+        }
+
+        /// <summary>
+        /// Determines whether the ring is more than half full.
+        /// </summary>
+        bool IsHalfFull() const
+        {
+            return m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_relaxed) > capacity / 2;
+        }
+
+        /// <summary>
+        /// Gets the position right after the last record published by the owner thread.
+        /// </summary>
+        uint64_t GetHead() const { return m_head.load(std::memory_order_acquire); }
+
+        /// <summary>
+        /// Gets the position of the first record not yet released by the writer thread.
+        /// </summary>
+        uint64_t GetTail() const { return m_tail.load(std::memory_order_relaxed); }
+
+        /// <summary>
+        /// Gets the record in a position of the ring.
+        /// </summary>
+        const RecordHeader *GetRecord(uint64_t position) const
+        {
+            return GetHeaderAt(static_cast<uint32_t> (position % capacity));
+        }
+
+        /// <summary>
+        /// Gives the room of the records before a position back to the owner thread.
+        /// </summary>
+        void Release(uint64_t position) { m_tail.store(position, std::memory_order_release); }
+    };
+
+    /// <summary>
+    /// Keeps the ring of a thread for the logger instance which created it, and
+    /// marks the ring as abandoned when the thread exits, so the writer can drop it.
+    /// </summary>
+    struct Logger::ThreadRing
+    {
+        std::shared_ptr<LogRing> ring;
+        uint32_t loggerInstanceId;
+
+        ThreadRing() : loggerInstanceId(0) {}
+
+        ~ThreadRing()
+        {
+            if (ring)
+                ring->abandoned.store(true, std::memory_order_release);
+        }
+    };
+
+    ////////////////////////////////
+    // Logger Class
+    ////////////////////////////////
+
+    // Distinguishes the instances of the logger, because the singleton can be shut down and created again
+    static std::atomic<uint32_t> numLoggerInstances(0);
+
+    // Tells whether the calling thread is the log writer
+    thread_local static bool isLogWriterThread(false);
+
+    /// <summary>
+    /// Gets the unique instance of the singleton <see cref="Logger" /> class.
+    /// </summary>
+    /// <returns>A pointer to the singleton.</returns>
+    Logger * Logger::GetInstance() NOEXCEPT
+    {
+        if (uniqueObjectPtr != nullptr)
+            return uniqueObjectPtr;
+        else
+        {
+            try
+            {
+                CreateInstance(AppConfig::GetApplicationId(),
+                    AppConfig::GetSettings().common.log.writeToConsole);
+            }
+            catch (IAppException &appEx)
+            {
+                std::ostringstream oss;
+                oss << "The logging facility creation failed with an exception - " << appEx.ToString();
+                AttemptConsoleOutput(oss.str());
+            }
+
+            return uniqueObjectPtr;
+        }
+    }
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="Logger"/> class.
+    /// </summary>
+    /// <param name="id">The id of the server, which also names the log file.</param>
+    /// <param name="logToConsole">Whether the console or a text file is to receive the log output.</param>
+    Logger::Logger(const string &id, bool logToConsole)
+        : m_instanceId(++numLoggerInstances)
+        , m_writerAlive(false)
+        , m_terminate(false)
+        , m_filePath(id + ".log")
+        , m_fileDescriptor(-1)
+        , m_fileSize(0)
+    {
+        if (logToConsole)
+            m_fileDescriptor = STDERR_FILENO;
+        else
+        {
+            m_fileDescriptor = open(m_filePath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+            if (m_fileDescriptor < 0)
+            {
+                std::ostringstream oss;
+                oss << "There was a failure when trying to set up the logger. Could not open file \'"
+                    << m_filePath << "\': " << strerror(errno);
+                AttemptConsoleOutput(oss.str());
+                return;
+            }
+
+            struct stat fileStatus;
+            if (fstat(m_fileDescriptor, &fileStatus) == 0)
+                m_fileSize = fileStatus.st_size;
+        }
+
+        try
+        {
+            m_writerAlive.store(true, std::memory_order_release);
+            m_logWriterThread = std::thread(&Logger::LogWriterThreadProc, this);
+        }
+        catch (std::system_error &ex)
+        {
+            m_writerAlive.store(false, std::memory_order_release);
+
+            if (m_fileDescriptor != STDERR_FILENO)
+                close(m_fileDescriptor);
+
+            m_fileDescriptor = -1;
+
+            std::ostringstream oss;
+            oss << "There was a failure when trying to set up the logger. System error: "
+                << StdLibExt::GetDetailsFromSystemError(ex);
+            AttemptConsoleOutput(oss.str());
+        }
+        /* Even when the set-up of the logger fails, the application must continue to execute,
+        because the logger is merely an auxiliary service. */
+    }
+
+    /// <summary>
+    /// Finalizes an instance of the <see cref="Logger"/> class.
+    /// The events still queued are written before the writer thread terminates.
+    /// </summary>
+    Logger::~Logger()
+    {
+        if (m_logWriterThread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_writerMutex);
+                m_terminate = true;
+            }
+
+            m_writerCondition.notify_one();
+            m_logWriterThread.join();
+        }
+
+        if (m_fileDescriptor >= 0 && m_fileDescriptor != STDERR_FILENO)
+            close(m_fileDescriptor);
+    }
+
+    /// <summary>
+    /// Gets the ring of the calling thread, which is created on its first log write.
+    /// </summary>
+    /// <returns>The ring of the calling thread for this logger instance.</returns>
+    Logger::LogRing & Logger::GetThreadRing()
+    {
+        thread_local static ThreadRing threadRing;
+
+        if (threadRing.ring && threadRing.loggerInstanceId == m_instanceId)
+            return *threadRing.ring;
+
+        // a ring left from a previous instance of the logger is no longer drained:
+        if (threadRing.ring)
+            threadRing.ring->abandoned.store(true, std::memory_order_release);
+
+        auto ring = std::make_shared<LogRing>();
+
+        {
+            std::lock_guard<std::mutex> lock(m_ringsMutex);
+            m_rings.push_back(ring);
+        }
+
+        threadRing.ring = std::move(ring);
+        threadRing.loggerInstanceId = m_instanceId;
+        return *threadRing.ring;
+    }
+
+    /// <summary>
+    /// Writes a message and its details to the log output. The event is only queued in the ring of
+    /// the calling thread, whereas formatting and writing the output is left to the writer thread.
+    /// </summary>
+    /// <param name="what">The reason for the message.</param>
+    /// <param name="details">The message details.</param>
+    /// <param name="prio">The priority for the message.</param>
+    /// <param name="cst">When set to <c>true</c>, append the call stack trace.</param>
+    void Logger::WriteImpl(string &&what, string &&details, Priority prio, bool cst) NOEXCEPT
+    {
+        try
+        {
+            // the writer thread only runs when the set-up succeeded, and might have died since:
+            if (m_writerAlive.load(std::memory_order_acquire) == false)
+                return;
+
+            SCOPED_TIMER("core::Logger::Write");
+
+            std::array<LogRing::TextPiece, 4> pieces;
+            size_t numPieces(0);
+            size_t length(what.length());
+            pieces[numPieces++] = LogRing::TextPiece{ what.data(), what.length() };
+
+#    ifdef ENABLE_3FD_ERR_IMPL_DETAILS
+            if (details.empty() == false)
+            {
+                pieces[numPieces++] = LogRing::TextPiece{ " - ", 3 };
+                pieces[numPieces++] = LogRing::TextPiece{ details.data(), details.length() };
+                length += 3 + details.length();
+            }
+#    endif
+#    ifdef ENABLE_3FD_CST
+            string report;
+            if (cst && CallStackTracer::IsReady())
+            {
+                report = "\n\n### CALL STACK TRACE ###\n" + CallStackTracer::GetStackReport();
+                pieces[numPieces++] = LogRing::TextPiece{ report.data(), report.length() };
+                length += report.length();
+            }
+#    endif
+            using namespace std::chrono;
+            auto time = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+
+            auto textLength = static_cast<uint32_t> (std::min(length, static_cast<size_t> (LogRing::maxTextLength)));
+
+            auto &ring = GetThreadRing();
+
+            // when the ring is full, wait for the writer to make room:
+            while (!ring.TryPush(prio, time, pieces.data(), numPieces, textLength))
+            {
+                // but if the writer is gone, nothing will ever make room, so the record is dropped:
+                if (m_writerAlive.load(std::memory_order_acquire) == false)
+                    return;
+
+                // the writer itself (reporting what the throttle held back) makes room right away:
+                if (isLogWriterThread)
+                {
+                    FlushRings();
+                    continue;
+                }
+
+                m_writerCondition.notify_one();
+                std::this_thread::yield();
+            }
+
+            // errors are written right away, whereas the rest waits for the next batch:
+            if (prio <= PRIO_ERROR || ring.IsHalfFull())
+                m_writerCondition.notify_one();
+        }
+        catch (std::exception &ex)
+        {
+            std::ostringstream oss;
+            oss << "Failed to write in log output. An exception had to be swallowed: " << ex.what();
+            AttemptConsoleOutput(oss.str());
+        }
+    }
+
+    /// <summary>
+    /// Gets the label of a priority, as written in the log output.
+    /// </summary>
+    static const char *GetPriorityLabel(uint32_t prio)
+    {
+        static const char *labels[] =
+        {
+            "", "FATAL - ", "CRITICAL - ", "ERROR - ", "WARNING - ",
+            "NOTICE - ", "INFORMATION - ", "DEBUG - ", "TRACE - "
+        };
+
+        return prio < sizeof labels / sizeof labels[0] ? labels[prio] : "";
+    }
+
+    /// <summary>
+    /// Writes the whole content of a sequence of buffers to a file, retrying partial writes.
+    /// </summary>
+    /// <param name="fileDescriptor">The file descriptor.</param>
+    /// <param name="buffers">The buffers, which might be changed by partial writes.</param>
+    /// <param name="numBuffers">How many buffers there are.</param>
+    /// <returns>How many bytes were written, or -1 in case of error.</returns>
+    static ssize_t WriteAll(int fileDescriptor, struct iovec *buffers, int numBuffers)
+    {
+        ssize_t total(0);
+
+        while (numBuffers > 0)
+        {
+            auto count = writev(fileDescriptor, buffers, numBuffers);
+
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                return -1;
+            }
+
+            total += count;
+
+            // skip what was written:
+            while (numBuffers > 0 && static_cast<size_t> (count) >= buffers->iov_len)
+            {
+                count -= buffers->iov_len;
+                ++buffers;
+                --numBuffers;
+            }
+
+            if (numBuffers > 0)
+            {
+                buffers->iov_base = static_cast<char *> (buffers->iov_base) + count;
+                buffers->iov_len -= count;
+            }
+        }
+
+        return total;
+    }
+
+    /// <summary>
+    /// Writes the records queued in all rings, merged by their time, and gives their room back.
+    /// </summary>
+    /// <returns>Whether there was any record to write.</returns>
+    bool Logger::FlushRings()
+    {
+        std::vector<std::shared_ptr<LogRing>> rings;
+
+        {
+            std::lock_guard<std::mutex> lock(m_ringsMutex);
+
+            // drop the rings of threads that exited, once they are drained:
+            m_rings.erase(
+                std::remove_if(m_rings.begin(), m_rings.end(), [](const std::shared_ptr<LogRing> &ring)
+                {
+                    return ring->abandoned.load(std::memory_order_acquire) && ring->GetTail() == ring->GetHead();
+                }),
+                m_rings.end()
+            );
+
+            rings = m_rings;
+        }
+
+        std::vector<const LogRing::RecordHeader *> records;
+        std::vector<uint64_t> heads(rings.size());
+
+        for (size_t idx = 0; idx < rings.size(); ++idx)
+        {
+            auto &ring = *rings[idx];
+            heads[idx] = ring.GetHead();
+
+            for (auto position = ring.GetTail(); position < heads[idx];)
+            {
+                auto record = ring.GetRecord(position);
+                if (record->prio != 0)
+                    records.push_back(record);
+
+                position += LogRing::GetRecordSize(record->length);
+            }
+        }
+
+        if (records.empty())
+            return false;
+
+        // the rings of the threads are merged in chronological order:
+        std::stable_sort(records.begin(), records.end(),
+            [](const LogRing::RecordHeader *left, const LogRing::RecordHeader *right)
+            {
+                return left->time < right->time;
+            }
+        );
+
+        /* The prefix with the time stamp is formatted once per second and shared by all
+        records in that second, so the output is assembled without formatting or copying: */
+        std::deque<string> timePrefixes; // a deque never moves its elements
+        time_t timePrefixSecs(-1);
+        const char *newLine = "\n";
+
+        std::vector<struct iovec> buffers;
+        buffers.reserve(4 * records.size());
+
+        for (auto record : records)
+        {
+            auto secs = static_cast<time_t> (record->time / 1000000000LL);
+            if (secs != timePrefixSecs)
+            {
+                struct tm localTime;
+                localtime_r(&secs, &localTime);
+
+                std::array<char, 64> buffer;
+                auto length = strftime(buffer.data(), buffer.size(), "%Y-%b-%d %H:%M:%S", &localTime);
+                length += snprintf(buffer.data() + length, buffer.size() - length, " [process %ld] - ", static_cast<long> (getpid()));
+
+                timePrefixes.emplace_back(buffer.data(), std::min(length, buffer.size() - 1));
+                timePrefixSecs = secs;
+            }
+
+            auto prioLabel = GetPriorityLabel(record->prio);
+            auto &timePrefix = timePrefixes.back();
+            buffers.push_back(iovec{ const_cast<char *> (timePrefix.data()), timePrefix.length() });
+            buffers.push_back(iovec{ const_cast<char *> (prioLabel), strlen(prioLabel) });
+            buffers.push_back(iovec{ const_cast<LogRing::RecordHeader *> (record + 1), record->length });
+            buffers.push_back(iovec{ const_cast<char *> (newLine), 1 });
+        }
+
+        // write in batches of as many buffers as a single system call takes:
+        const int maxBuffersPerCall = 1024;
+
+        for (size_t offset = 0; m_fileDescriptor >= 0 && offset < buffers.size(); offset += maxBuffersPerCall)
+        {
+            auto count = static_cast<int> (std::min(buffers.size() - offset, static_cast<size_t> (maxBuffersPerCall)));
+            auto written = WriteAll(m_fileDescriptor, &buffers[offset], count);
+
+            if (written < 0)
+            {
+                std::ostringstream oss;
+                oss << "Failed to write in log output: " << strerror(errno);
+                AttemptConsoleOutput(oss.str());
+                break;
+            }
+
+            m_fileSize += written;
+        }
+
+        for (size_t idx = 0; idx < rings.size(); ++idx)
+            rings[idx]->Release(heads[idx]);
+
+        return true;
+    }
+
+    /// <summary>
+    /// Shifts the log file once it reaches the size limit: the current file becomes
+    /// the 1st backup, the 1st becomes the 2nd, and so on, up to the purge count.
+    /// </summary>
+    void Logger::ShiftLogFile()
+    {
+        auto &settings = AppConfig::GetSettings().common.log;
+
+        if (m_fileDescriptor < 0 || m_fileDescriptor == STDERR_FILENO || m_fileSize < static_cast<uint64_t> (settings.sizeLimit) * 1024)
+            return;
+
+        close(m_fileDescriptor);
+
+        std::ostringstream oss;
+        for (auto idx = settings.purgeCount; idx > 0; --idx)
+        {
+            oss.str("");
+            oss << m_filePath << '.' << idx;
+            auto target = oss.str();
+
+            if (idx == settings.purgeCount)
+                unlink(target.c_str());
+
+            oss.str("");
+            if (idx > 1)
+                oss << m_filePath << '.' << (idx - 1);
+            else
+                oss << m_filePath;
+
+            rename(oss.str().c_str(), target.c_str());
+        }
+
+        m_fileDescriptor = open(m_filePath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_TRUNC | O_CLOEXEC, 0644);
+        m_fileSize = 0;
+
+        if (m_fileDescriptor < 0)
+        {
+            oss.str("");
+            oss << "Failed to shift log file \'" << m_filePath << "\': " << strerror(errno);
+            AttemptConsoleOutput(oss.str());
+        }
+    }
+
+    /// <summary>
+    /// The procedure executed by the log writer thread, which wakes up
+    /// periodically (or when notified) to write the records queued.
+    /// </summary>
+    void Logger::LogWriterThreadProc()
+    {
+        isLogWriterThread = true;
+
+        try
+        {
+            bool terminate(false);
+
+            do
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_writerMutex);
+                    terminate = m_writerCondition.wait_for(lock, std::chrono::milliseconds(10), [this]() { return m_terminate; });
+                }
+
+                // sources gone quiet report what the throttle held back from them:
+                WriteQuietHeldBack();
+
+                // the records are released even if the output failed, so writing threads never get stuck:
+                while (FlushRings())
+                    ShiftLogFile();
+            }
+            while (terminate == false);
+        }
+        catch (IAppException &ex)
+        {
+            std::ostringstream oss;
+            oss << "Log writer thread terminated with an exception - " << ex.ToString();
+            AttemptConsoleOutput(oss.str());
+        }
+        catch (std::exception &ex)
+        {
+            std::ostringstream oss;
+            oss << "Generic failure in log writer thread: " << ex.what();
+            AttemptConsoleOutput(oss.str());
+        }
+
+        // from now on, the threads writing to the log do not wait for room in their rings:
+        m_writerAlive.store(false, std::memory_order_release);
+    }
+
+}// end of namespace core
+}// end of namespace _3fd
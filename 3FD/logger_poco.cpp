@@ -2,6 +2,7 @@
 #include "logger.h"
 #include "configuration.h"
 #include "callstacktracer.h"
+#include "timing.h"
 
 #include <Poco/AutoPtr.h>
 #include <Poco/Channel.h>
@@ -58,11 +59,9 @@ namespace core
         try
         {
             m_logger = &Poco::Logger::get(id);
-#    ifdef NDEBUG
-            m_logger->setLevel(Poco::Message::PRIO_INFORMATION);
-#    else
-            m_logger->setLevel(Poco::Message::PRIO_DEBUG);
-#    endif
+            // messages are filtered by priority before reaching POCO (see Logger::IsEnabled)
+            m_logger->setLevel(Poco::Message::PRIO_TRACE);
+
             // Record the log to a file channel. (The name of the file is the same of the server ID.)
             AutoPtr<Poco::Channel> channel;
 
@@ -180,6 +179,8 @@ namespace core
             if (m_logger == nullptr)
                 return;
 
+            SCOPED_TIMER("core::Logger::Write");
+
             std::ostringstream oss;
 
             switch (prio)
@@ -2,6 +2,7 @@
 #include "logger.h"
 #include "configuration.h"
 #include "callstacktracer.h"
+#include "timing.h"
 #include "utils_winrt.h"
 
 #include <array>
@@ -216,6 +217,9 @@ namespace _3fd
                     // Wait for queued messages:
                     terminate = m_terminationEvent.WaitFor(100);
 
+                    // Sources gone quiet report what the throttle held back from them:
+                    WriteQuietHeldBack();
+
                     // Write the queued messages in the text log file:
 
                     m_eventsQueue.ForEach([&estimateRoomForLogEvents, &ofs](const LogEvent &ev)
@@ -327,6 +331,8 @@ namespace _3fd
 
             try
             {
+                SCOPED_TIMER("core::Logger::Write");
+
                 using namespace std::chrono;
                 auto now = system_clock::to_time_t(system_clock::now());
 
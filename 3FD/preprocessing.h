@@ -88,15 +88,41 @@
 #   define ONDEBUG(CODE_LINE) CODE_LINE
 #endif
 
+// AVX2 code paths: when the build targets AVX2, they are always taken. Otherwise, with GCC or Clang on x86,
+// they are compiled apart for AVX2 and taken only when the CPU supports it, as checked at runtime:
+#if defined __AVX2__
+#   define _3FD_AVX2_CODE
+#   define _3FD_AVX2_TARGET
+#   define _3FD_CPU_HAS_AVX2() true
+#elif defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#   define _3FD_AVX2_CODE
+#   define _3FD_AVX2_TARGET __attribute__((target("avx2")))
+#   define _3FD_CPU_HAS_AVX2() (__builtin_cpu_supports("avx2") != 0)
+#endif
+
 // Some few useful "keywords":
 #define const_this const_cast<const decltype(*this) &> (*this)
 
 // These are the calls that should be used for handling errors: it uses the RuntimeManager class:
-#ifdef ENABLE_3FD_CST
+#if defined ENABLE_3FD_CST && defined ENABLE_3FD_CST_COMPACT
+#   // Obligatory use if you want call stack tracing feature. This is the compact mode, which only records the id of
+#   // the call site (registered once per site), and resolves it to file, line and function when a report is requested:
+#    define CALL_STACK_TRACE static const auto _callSiteId = _3fd::core::CallStackTracer::RegisterCallSite(__FILE__, __LINE__, __FUNCTION__); _3fd::core::CallStackTracer::TrackCall(_callSiteId); _3fd::core::StackDeactivationTrigger _stackDeactTrigObj;
+#elif defined ENABLE_3FD_CST
 #   // Obligatory use if you want call stack tracing feature:
 #    define CALL_STACK_TRACE _3fd::core::CallStackTracer::TrackCall(__FILE__, __LINE__, __FUNCTION__); _3fd::core::StackDeactivationTrigger _stackDeactTrigObj;
 #else
 #    define CALL_STACK_TRACE
 #endif
 
+#ifdef ENABLE_3FD_TIMING
+#   // Records how long the enclosing scope takes into the histogram of a named timer (see core::TimingRegistry):
+#    define SCOPED_TIMER(NAME) static const auto _timerId = _3fd::core::TimingRegistry::RegisterTimer(NAME); _3fd::core::ScopedTimer _scopedTimerObj(_timerId);
+#   // Same as CALL_STACK_TRACE, but also records how long the call takes into a timer named after the function:
+#    define CALL_STACK_TRACE_TIMED CALL_STACK_TRACE SCOPED_TIMER(__FUNCTION__)
+#else
+#    define SCOPED_TIMER(NAME)
+#    define CALL_STACK_TRACE_TIMED CALL_STACK_TRACE
+#endif
+
 #endif // header guard
@@ -0,0 +1,185 @@
+#include "stdafx.h"
+#include "profiler.h"
+#include "exceptions.h"
+#include "logger.h"
+#include <sstream>
+
+namespace _3fd
+{
+namespace core
+{
+    /// <summary>
+    /// Initializes a new instance of the <see cref="SamplingProfiler"/> class.
+    /// The sampling does not start until <see cref="SamplingProfiler::Start"/> is invoked.
+    /// </summary>
+    /// <param name="intervalMicrosecs">The interval (in microseconds) between samples.</param>
+    SamplingProfiler::SamplingProfiler(uint32_t intervalMicrosecs)
+        : m_interval(intervalMicrosecs)
+        , m_numSamples(0)
+        , m_running(false)
+    {
+        _ASSERTE(intervalMicrosecs > 0); // the sampler thread would never sleep
+    }
+
+    /// <summary>
+    /// Finalizes an instance of the <see cref="SamplingProfiler"/> class.
+    /// </summary>
+    SamplingProfiler::~SamplingProfiler()
+    {
+        Stop();
+    }
+
+    /// <summary>
+    /// Starts sampling, unless it is already running.
+    /// </summary>
+    void SamplingProfiler::Start()
+    {
+        std::lock_guard<std::mutex> controlLock(m_controlMutex);
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_running)
+            return;
+
+        try
+        {
+            m_running = true;
+            m_samplerThread = std::thread(&SamplingProfiler::RunSampler, this);
+        }
+        catch (std::system_error &ex)
+        {
+            m_running = false;
+            std::ostringstream oss;
+            oss << "System failure when launching sampler thread for profiler: " << StdLibExt::GetDetailsFromSystemError(ex);
+            throw AppException<std::runtime_error>(oss.str());
+        }
+    }
+
+    /// <summary>
+    /// Stops sampling. The samples taken so far are kept.
+    /// </summary>
+    void SamplingProfiler::Stop()
+    {
+        std::lock_guard<std::mutex> controlLock(m_controlMutex);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if (!m_running)
+                return;
+
+            m_running = false;
+        }
+
+        m_stopCondition.notify_all();
+        m_samplerThread.join();
+    }
+
+    /// <summary>
+    /// Discards the samples taken so far.
+    /// </summary>
+    void SamplingProfiler::Reset()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_foldedStacks.clear();
+        m_numSamples = 0;
+    }
+
+    /// <summary>
+    /// Gets how many samples have been taken, which is at most one per traced thread at each interval.
+    /// </summary>
+    /// <returns>The amount of samples.</returns>
+    uint64_t SamplingProfiler::GetNumSamples() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_numSamples;
+    }
+
+    /// <summary>
+    /// Gets the samples as folded stacks, one per line, with the frames separated by semicolons
+    /// (from the outermost to the innermost) followed by a space and the count of samples.
+    /// </summary>
+    /// <returns>The folded stacks, ready to be consumed by flame graph tools.</returns>
+    string SamplingProfiler::GetFoldedStacks() const
+    {
+        std::ostringstream oss;
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto &entry : m_foldedStacks)
+            oss << entry.first << ' ' << entry.second << '\n';
+
+        return oss.str();
+    }
+
+    /// <summary>
+    /// Takes a sample of every traced thread that has been running, and aggregates them.
+    /// </summary>
+    void SamplingProfiler::TakeSamples()
+    {
+        std::vector<string> samples;
+        const uint64_t minCpuTime = std::chrono::duration_cast<std::chrono::nanoseconds>(m_interval).count() / 2;
+
+        CallStackTracer::SampleAllThreads([&samples, minCpuTime](const std::vector<CallStack::Frame> &frames, uint64_t cpuTime)
+        {
+            // the thread has been mostly waiting since the last sample:
+            if (cpuTime < minCpuTime)
+                return;
+
+            string folded;
+            for (auto &frame : frames)
+            {
+                if (!folded.empty())
+                    folded.push_back(';');
+
+                // semicolons separate the frames, so they cannot show up in a name:
+                for (auto ptr = frame.function; *ptr != 0; ++ptr)
+                    folded.push_back(*ptr != ';' ? *ptr : ',');
+            }
+
+            samples.push_back(std::move(folded));
+        });
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto &folded : samples)
+            ++m_foldedStacks[folded];
+
+        m_numSamples += samples.size();
+    }
+
+    /// <summary>
+    /// The procedure executed by the sampler thread.
+    /// </summary>
+    void SamplingProfiler::RunSampler()
+    {
+        try
+        {
+            auto nextSampleTime = std::chrono::steady_clock::now() + m_interval;
+
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+
+                    if (m_stopCondition.wait_until(lock, nextSampleTime, [this]() { return !m_running; }))
+                        return;
+                }
+
+                TakeSamples();
+
+                // keep a steady rate, but do not try to catch up after falling behind:
+                nextSampleTime += m_interval;
+                auto now = std::chrono::steady_clock::now();
+                if (nextSampleTime < now)
+                    nextSampleTime = now + m_interval;
+            }
+        }
+        catch (std::exception &ex)
+        {
+            std::ostringstream oss;
+            oss << "Generic failure in sampler thread of profiler: " << ex.what();
+            Logger::Write(oss.str(), Logger::PRIO_ERROR);
+        }
+    }
+
+}// end of namespace core
+}// end of namespace _3fd
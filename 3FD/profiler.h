@@ -0,0 +1,68 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "base.h"
+#include "callstacktracer.h"
+#include <chrono>
+#include <condition_variable>
+#include <cinttypes>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace _3fd
+{
+namespace core
+{
+    using std::string;
+
+    /// <summary>
+    /// A sampling CPU profiler, whose thread periodically takes snapshots of the call stacks kept
+    /// by <see cref="CallStackTracer"/> for every traced thread. A snapshot only counts as a sample
+    /// when its thread spent at least half of the interval on a CPU, so threads blocked on locks,
+    /// I/O or condition variables do not show up as hot spots (where the platform cannot tell the
+    /// CPU time of a thread, as in Store apps, every snapshot counts and the profile is wall-clock).
+    /// The samples are aggregated as folded stacks, which is the input format of flame graph tools.
+    /// Only the frames of calls traced by the macro CALL_STACK_TRACE show up.
+    /// </summary>
+    class SamplingProfiler : notcopiable
+    {
+    private:
+
+        const std::chrono::microseconds m_interval;
+
+        std::map<string, uint64_t> m_foldedStacks;
+        uint64_t m_numSamples;
+        bool m_running;
+
+        std::thread m_samplerThread;
+        std::mutex m_controlMutex; // serializes starting and stopping, which touch the sampler thread
+        mutable std::mutex m_mutex;
+        std::condition_variable m_stopCondition;
+
+        void RunSampler();
+
+        void TakeSamples();
+
+    public:
+
+        SamplingProfiler(uint32_t intervalMicrosecs = 1000);
+
+        ~SamplingProfiler();
+
+        void Start();
+
+        void Stop();
+
+        void Reset();
+
+        uint64_t GetNumSamples() const;
+
+        string GetFoldedStacks() const;
+    };
+
+}// end of namespace core
+}// end of namespace _3fd
+
+#endif // header guard
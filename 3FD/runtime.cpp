@@ -3,6 +3,7 @@
 #include "exceptions.h"
 #include "callstacktracer.h"
 #include "logger.h"
+#include "logger_binary.h"
 #include "gc.h"
 
 #ifdef _WIN32
@@ -123,9 +124,7 @@ namespace core
 
             Logger::Write(oss.str(), Logger::PRIO_ERROR);
 
-            oss.str("");
-            oss << "3FD was shutdown in " << m_moduleName;
-            Logger::Write(oss.str(), core::Logger::PRIO_DEBUG);
+            LOG_WRITE_FORMATTED(Logger::PRIO_DEBUG, "3FD was shutdown in " << m_moduleName);
             Logger::Shutdown();
 
             exit(EXIT_FAILURE);
@@ -142,9 +141,7 @@ namespace core
         : m_moduleName(GetCurrentComponentName())
         , m_isComLibInitialized(false)
     {
-        std::ostringstream oss;
-        oss << "3FD has been initialized in " << m_moduleName;
-        Logger::Write(oss.str(), core::Logger::PRIO_DEBUG);
+        LOG_WRITE_FORMATTED(Logger::PRIO_DEBUG, "3FD has been initialized in " << m_moduleName);
     }
 
 #elif defined _3FD_PLATFORM_WINRT
@@ -172,9 +169,7 @@ namespace core
 
         strncpy(sqlite3_temp_directory, tempFolderPath.data(), tempDirStrSize);
 
-        std::ostringstream oss;
-        oss << "3FD has been initialized in " << m_moduleName;
-        Logger::Write(oss.str(), core::Logger::PRIO_DEBUG);
+        LOG_WRITE_FORMATTED(Logger::PRIO_DEBUG, "3FD has been initialized in " << m_moduleName);
     }
 
 #endif
@@ -187,11 +182,9 @@ namespace core
         memory::GarbageCollector::Shutdown();
 
 #ifdef _WIN32
-        std::ostringstream oss;
-        oss << "3FD was shutdown in " << m_moduleName;
-
-        Logger::Write(oss.str(), core::Logger::PRIO_DEBUG);
+        LOG_WRITE_FORMATTED(Logger::PRIO_DEBUG, "3FD was shutdown in " << m_moduleName);
 #endif
+        BinaryLog::Shutdown();
         Logger::Shutdown();
 
 #ifdef _3FD_PLATFORM_WINRT
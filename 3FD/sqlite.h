@@ -2,9 +2,16 @@
 #define SQLITE_H
 
 #include "base.h"
+#include "preprocessing.h"
 #include <string>
 #include <atomic>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <sqlite3.h>
 #include "utils_lockfreequeue.h"
 
@@ -13,6 +20,11 @@ namespace _3fd
 using std::string;
 using std::wstring;
 
+namespace utils
+{
+    class Arena; // forward class declaration
+}
+
 namespace sqlite
 {
     class PrepStatement; // forward class declaration
@@ -22,6 +34,10 @@ namespace sqlite
     /// </summary>
     class DatabaseConn : notcopiable
     {
+    public:
+
+        static const size_t defaultStmtCacheCapacity = 32;
+
     private:
 
         sqlite3    *m_dbHandle;
@@ -31,9 +47,55 @@ namespace sqlite
         /// </summary>
         std::map<int, PrepStatement> m_preparedStatements;
 
+        /// <summary>
+        /// A prepared statement no longer in use, kept for reuse.
+        /// </summary>
+        struct IdleStatement
+        {
+            uint64_t hash;
+            string query;
+            sqlite3_stmt *handle;
+            std::map<string, int> columnIndexes;
+        };
+
+        typedef std::list<IdleStatement> IdleStatementList;
+
+        /* Keeps in cache the statements no longer in use, so a statement created again for
+        the same query text is not prepared again. The most recently used come first, and the
+        least recently used are finalized when the capacity is exceeded. */
+        IdleStatementList m_idleStatements;
+        std::unordered_multimap<uint64_t, IdleStatementList::iterator> m_idleStatementsByHash;
+        size_t m_stmtCacheCapacity;
+        uint64_t m_stmtCacheHits;
+        uint64_t m_stmtCacheMisses;
+
+        /* With a full mutex, the connection can be shared by threads, and so can the statements
+        returned to the cache when released. Then the cache is guarded, otherwise this is null. */
+        std::unique_ptr<std::mutex> m_stmtCacheMutex;
+
+        std::unique_lock<std::mutex> LockStmtCache() const
+        {
+            return m_stmtCacheMutex ? std::unique_lock<std::mutex>(*m_stmtCacheMutex) : std::unique_lock<std::mutex>();
+        }
+
+        friend class PrepStatement;
+
+        sqlite3_stmt *TakeIdleStatement(const char *query,
+                                        size_t length,
+                                        string &queryText,
+                                        std::map<string, int> &columnIndexes);
+
+        void ReturnIdleStatement(sqlite3_stmt *stmtHandle,
+                                 string &&queryText,
+                                 std::map<string, int> &&columnIndexes) NOEXCEPT;
+
+        void ClearStatementCache() NOEXCEPT;
+
     public:
 
-        DatabaseConn(const string &dbFilePath, bool fullMutex = true);
+        DatabaseConn(const string &dbFilePath,
+                     bool fullMutex = true,
+                     size_t stmtCacheCapacity = defaultStmtCacheCapacity);
 
         DatabaseConn(DatabaseConn &&ob);
 
@@ -51,6 +113,33 @@ namespace sqlite
         PrepStatement &CachedStatement(int queryId, 
                                        const char *queryCode = nullptr, 
                                        size_t qlen = 0);
+
+        /// <summary>
+        /// Gets how many statements were created by reusing one from the cache.
+        /// </summary>
+        uint64_t GetStmtCacheHits() const
+        {
+            auto lock = LockStmtCache();
+            return m_stmtCacheHits;
+        }
+
+        /// <summary>
+        /// Gets how many statements had to be prepared because none was found in the cache.
+        /// </summary>
+        uint64_t GetStmtCacheMisses() const
+        {
+            auto lock = LockStmtCache();
+            return m_stmtCacheMisses;
+        }
+
+        /// <summary>
+        /// Gets how many statements are idle in the cache.
+        /// </summary>
+        size_t GetStmtCacheSize() const
+        {
+            auto lock = LockStmtCache();
+            return m_idleStatements.size();
+        }
     };
 
     /// <summary>
@@ -66,8 +155,14 @@ namespace sqlite
 
         std::map<string, int>    m_columnIndexes;
 
+        string                    m_queryText; // the text it was created from, which keys the cache of statements
+
         void CtorImpl(const char *query, size_t length);
 
+        void PrepareImpl(const char *query, size_t length);
+
+        int FindColumnIndex(const string &columnName, const char *errorMessage) const;
+
     public:
 
         PrepStatement(DatabaseConn &database, 
@@ -85,6 +180,26 @@ namespace sqlite
 
         string GetQuery() const;
 
+        int GetParamIndex(const string &paramName) const;
+
+        int GetParamCount() const;
+
+        int GetColumnIndex(const string &columnName) const;
+
+        int GetColumnCount() const;
+
+        void Bind(int paramIndex, int integer);
+
+        void Bind(int paramIndex, long long integer);
+
+        void Bind(int paramIndex, double real);
+
+        void Bind(int paramIndex, const string &text);
+
+        void Bind(int paramIndex, const wstring &text);
+
+        void Bind(int paramIndex, const void *blob, int nBytes);
+
         void Bind(const string &paramName, int integer);
 
         void Bind(const string &paramName, long long integer);
@@ -105,6 +220,20 @@ namespace sqlite
 
         void Reset();
 
+        int GetColumnValueInteger(int columnIndex);
+
+        long long GetColumnValueInteger64(int columnIndex);
+
+        double GetColumnValueFloat64(int columnIndex);
+
+        string GetColumnValueText(int columnIndex);
+
+        const char *GetColumnValueText(int columnIndex, utils::Arena &arena);
+
+        wstring GetColumnValueText16(int columnIndex);
+
+        const void *GetColumnValueBlob(int columnIndex, int &nBytes);
+
         int GetColumnValueInteger(const string &columnName);
 
         long long GetColumnValueInteger64(const string &columnName);
@@ -113,11 +242,156 @@ namespace sqlite
 
         string GetColumnValueText(const string &columnName);
 
+        const char *GetColumnValueText(const string &columnName, utils::Arena &arena);
+
         wstring GetColumnValueText16(const string &columnName);
 
         const void *GetColumnValueBlob(const string &columnName, int &nBytes);
     };
 
+    void CheckTypedStatementShape(const PrepStatement &statement, int numParams, int numColumns);
+
+    /// <summary>
+    /// Tells whether a type can be the type of a parameter in a <see cref="TypedStatement"/>.
+    /// </summary>
+    template <typename Type>
+    struct IsSQLiteParamType : std::integral_constant<bool,
+        std::is_same<Type, int>::value
+        || std::is_same<Type, long long>::value
+        || std::is_same<Type, double>::value
+        || std::is_same<Type, string>::value
+        || std::is_same<Type, wstring>::value> {};
+
+    /// <summary>
+    /// Tells whether a type can be the type of a column in a <see cref="TypedStatement"/>.
+    /// Wide text is retrieved as UTF-16, hence only where wchar_t holds UTF-16 code units.
+    /// </summary>
+    template <typename Type>
+    struct IsSQLiteColumnType : std::integral_constant<bool,
+        std::is_same<Type, int>::value
+        || std::is_same<Type, long long>::value
+        || std::is_same<Type, double>::value
+        || std::is_same<Type, string>::value
+        || (std::is_same<Type, wstring>::value && sizeof(wchar_t) == 2)> {};
+
+    template <template <typename> class Trait, typename ... Types>
+    struct _all_sqlite_types : std::true_type {};
+
+    template <template <typename> class Trait, typename FirstType, typename ... Types>
+    struct _all_sqlite_types<Trait, FirstType, Types ...> : std::integral_constant<bool,
+        Trait<FirstType>::value && _all_sqlite_types<Trait, Types ...>::value> {};
+
+    template <typename ParamsTuple, typename ColumnsTuple = std::tuple<>> class TypedStatement;
+
+    /// <summary>
+    /// A prepared statement whose parameters and result columns have their types fixed at compile time.
+    /// Parameters are bound by position and columns are read by position, straight into a tuple,
+    /// so executing it again and again takes no lookup of names. The shape of the query is checked
+    /// against the types only once, when the statement is created.
+    /// </summary>
+    /// <example>
+    /// TypedStatement&lt;std::tuple&lt;int&gt;, std::tuple&lt;string, double&gt;&gt;
+    ///     stmt(conn, "SELECT name, price FROM Products WHERE id = ?1;");
+    /// </example>
+    template <typename ... Params, typename ... Columns>
+    class TypedStatement<std::tuple<Params...>, std::tuple<Columns...>> : notcopiable
+    {
+        static_assert(_all_sqlite_types<IsSQLiteParamType, Params ...>::value,
+            "The types of the parameters must be int, long long, double, string or wstring");
+
+        static_assert(_all_sqlite_types<IsSQLiteColumnType, Columns ...>::value,
+            "The types of the columns must be int, long long, double, string, or wstring where wchar_t is 2 bytes long");
+
+    private:
+
+        PrepStatement m_statement;
+
+        void ReadColumn(int columnIndex, int &value) { value = m_statement.GetColumnValueInteger(columnIndex); }
+
+        void ReadColumn(int columnIndex, long long &value) { value = m_statement.GetColumnValueInteger64(columnIndex); }
+
+        void ReadColumn(int columnIndex, double &value) { value = m_statement.GetColumnValueFloat64(columnIndex); }
+
+        void ReadColumn(int columnIndex, string &value) { value = m_statement.GetColumnValueText(columnIndex); }
+
+        void ReadColumn(int columnIndex, wstring &value) { value = m_statement.GetColumnValueText16(columnIndex); }
+
+        template <size_t Index>
+        typename std::enable_if<(Index == sizeof...(Columns))>::type
+        ReadRow(std::tuple<Columns...> &) {}
+
+        template <size_t Index>
+        typename std::enable_if<(Index < sizeof...(Columns))>::type
+        ReadRow(std::tuple<Columns...> &row)
+        {
+            ReadColumn(static_cast<int> (Index), std::get<Index>(row));
+            ReadRow<Index + 1>(row);
+        }
+
+    public:
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="TypedStatement"/> class.
+        /// </summary>
+        /// <param name="database">The database connection.</param>
+        /// <param name="query">The query, whose parameters and result columns must match the types in number.</param>
+        TypedStatement(DatabaseConn &database, const string &query)
+            : m_statement(database, query)
+        {
+            CheckTypedStatementShape(m_statement, sizeof...(Params), sizeof...(Columns));
+        }
+
+        /// <summary>
+        /// Gets the underlying statement.
+        /// </summary>
+        PrepStatement &GetStatement() { return m_statement; }
+
+        /// <summary>
+        /// Binds all the parameters at once, in the order they are numbered in the query.
+        /// </summary>
+        /// <param name="...params">The parameter values.</param>
+        void Bind(const Params & ... params)
+        {
+            int paramIndex(0);
+            int expansion[] = { 0, (m_statement.Bind(++paramIndex, params), 0) ... };
+            (void)expansion;
+        }
+
+        /// <summary>
+        /// Evaluates the statement, as in <see cref="PrepStatement::Step"/>.
+        /// </summary>
+        int Step(bool throwEx = true) { return m_statement.Step(throwEx); }
+
+        /// <summary>
+        /// Steps into the next row of the result.
+        /// </summary>
+        /// <param name="row">Receives the values of the row, if any.</param>
+        /// <returns>Whether a row was retrieved. When <c>false</c>, the execution is finished.</returns>
+        bool Fetch(std::tuple<Columns...> &row)
+        {
+            if (m_statement.Step() != SQLITE_ROW)
+                return false;
+
+            ReadRow<0>(row);
+            return true;
+        }
+
+        /// <summary>
+        /// Gets the values of the current row of the result.
+        /// </summary>
+        std::tuple<Columns...> GetRow()
+        {
+            std::tuple<Columns...> row;
+            ReadRow<0>(row);
+            return row;
+        }
+
+        /// <summary>
+        /// Resets the execution, so the statement can be bound and evaluated again.
+        /// </summary>
+        void Reset() { m_statement.Reset(); }
+    };
+
     class DbConnWrapper; // forward class declaration
 
     /// <summary>
@@ -3,6 +3,7 @@
 #include "logger.h"
 #include "exceptions.h"
 #include <cassert>
+#include <cstring>
 #include <sstream>
 
 namespace _3fd
@@ -20,10 +21,15 @@ namespace _3fd
         /// </summary>
         /// <param name="dbFilePath">The database file path.</param>
         /// <param name="fullMutex">Whether a full mutex should be specified in the database connection creation.</param>
-        DatabaseConn::DatabaseConn(const string &dbFilePath, bool fullMutex)
+        /// <param name="stmtCacheCapacity">How many statements no longer in use are kept in cache for reuse (zero disables the cache).</param>
+        DatabaseConn::DatabaseConn(const string &dbFilePath, bool fullMutex, size_t stmtCacheCapacity)
         try : 
             m_dbHandle(nullptr), 
-            m_preparedStatements() 
+            m_preparedStatements(), 
+            m_stmtCacheCapacity(stmtCacheCapacity), 
+            m_stmtCacheHits(0), 
+            m_stmtCacheMisses(0), 
+            m_stmtCacheMutex(fullMutex ? new std::mutex() : nullptr) 
         {
             CALL_STACK_TRACE;
 
@@ -73,7 +79,13 @@ namespace _3fd
         /// <param name="ob">The object whose resources will be stolen.</param>
         DatabaseConn::DatabaseConn(DatabaseConn &&ob) : 
             m_dbHandle(ob.m_dbHandle), 
-            m_preparedStatements(std::move(ob.m_preparedStatements)) 
+            m_preparedStatements(std::move(ob.m_preparedStatements)), 
+            m_idleStatements(std::move(ob.m_idleStatements)), 
+            m_idleStatementsByHash(std::move(ob.m_idleStatementsByHash)), 
+            m_stmtCacheCapacity(ob.m_stmtCacheCapacity), 
+            m_stmtCacheHits(ob.m_stmtCacheHits), 
+            m_stmtCacheMisses(ob.m_stmtCacheMisses), 
+            m_stmtCacheMutex(std::move(ob.m_stmtCacheMutex)) 
         {
             ob.m_dbHandle = nullptr;
         }
@@ -86,13 +98,158 @@ namespace _3fd
             if(m_dbHandle != nullptr)
             {
                 m_preparedStatements.clear();
+                ClearStatementCache();
                 int status = sqlite3_close(m_dbHandle);
                 _ASSERTE(status == SQLITE_OK);
             }
         }
 
         /// <summary>
-        /// Creates a SQL statement for the current database.
+        /// Hashes the text of a query (FNV-1a).
+        /// </summary>
+        /// <param name="query">The query text.</param>
+        /// <param name="length">The query length.</param>
+        /// <returns>The hash of the text.</returns>
+        static uint64_t HashQuery(const char *query, size_t length)
+        {
+            uint64_t hash = 14695981039346656037ULL;
+
+            for (size_t idx = 0; idx < length; ++idx)
+            {
+                hash ^= static_cast<unsigned char> (query[idx]);
+                hash *= 1099511628211ULL;
+            }
+
+            return hash;
+        }
+
+        /// <summary>
+        /// Takes from the cache an idle statement prepared for the given query text.
+        /// </summary>
+        /// <param name="query">The query text.</param>
+        /// <param name="length">The query length.</param>
+        /// <param name="queryText">Receives the query text kept along with the statement.</param>
+        /// <param name="columnIndexes">Receives the indexes of the statement columns.</param>
+        /// <returns>The handle of the statement, or null when there is none in cache.</returns>
+        sqlite3_stmt *DatabaseConn::TakeIdleStatement(const char *query,
+                                                      size_t length,
+                                                      string &queryText,
+                                                      std::map<string, int> &columnIndexes)
+        {
+            if (m_stmtCacheCapacity == 0)
+                return nullptr;
+
+            auto hash = HashQuery(query, length);
+            auto lock = LockStmtCache();
+            auto range = m_idleStatementsByHash.equal_range(hash);
+
+            for (auto iter = range.first; iter != range.second; ++iter)
+            {
+                auto &entry = *iter->second;
+
+                if (entry.query.length() == length && memcmp(entry.query.data(), query, length) == 0)
+                {
+                    auto stmtHandle = entry.handle;
+                    queryText = std::move(entry.query);
+                    columnIndexes = std::move(entry.columnIndexes);
+
+                    m_idleStatements.erase(iter->second);
+                    m_idleStatementsByHash.erase(iter);
+                    ++m_stmtCacheHits;
+                    return stmtHandle;
+                }
+            }
+
+            queryText.assign(query, length);
+            ++m_stmtCacheMisses;
+            return nullptr;
+        }
+
+        /// <summary>
+        /// Returns to the cache a statement no longer in use, evicting
+        /// the least recently used when the capacity is exceeded.
+        /// </summary>
+        /// <param name="stmtHandle">The handle of the statement, which must have been reset.</param>
+        /// <param name="queryText">The query text the statement was created from.</param>
+        /// <param name="columnIndexes">The indexes of the statement columns.</param>
+        void DatabaseConn::ReturnIdleStatement(sqlite3_stmt *stmtHandle,
+                                               string &&queryText,
+                                               std::map<string, int> &&columnIndexes) NOEXCEPT
+        {
+            if (m_dbHandle == nullptr || m_stmtCacheCapacity == 0 || queryText.empty())
+            {
+                sqlite3_finalize(stmtHandle);
+                return;
+            }
+
+            std::unique_lock<std::mutex> lock;
+
+            try
+            {
+                auto hash = HashQuery(queryText.data(), queryText.length());
+                lock = LockStmtCache();
+
+                // another statement for the same query already in cache?
+                auto range = m_idleStatementsByHash.equal_range(hash);
+                for (auto iter = range.first; iter != range.second; ++iter)
+                {
+                    if (iter->second->query == queryText)
+                    {
+                        sqlite3_finalize(stmtHandle);
+                        return;
+                    }
+                }
+
+                // a statement taken from cache must look just like a new one:
+                sqlite3_clear_bindings(stmtHandle);
+
+                m_idleStatements.push_front(IdleStatement{ hash, std::move(queryText), stmtHandle, std::move(columnIndexes) });
+                m_idleStatementsByHash.emplace(hash, m_idleStatements.begin());
+            }
+            catch (std::exception &)
+            {
+                sqlite3_finalize(stmtHandle);
+                return;
+            }
+
+            // evict the least recently used:
+            while (m_idleStatements.size() > m_stmtCacheCapacity)
+            {
+                auto &oldest = m_idleStatements.back();
+                auto range = m_idleStatementsByHash.equal_range(oldest.hash);
+
+                for (auto iter = range.first; iter != range.second; ++iter)
+                {
+                    if (iter->second->handle == oldest.handle)
+                    {
+                        m_idleStatementsByHash.erase(iter);
+                        break;
+                    }
+                }
+
+                sqlite3_finalize(oldest.handle);
+                m_idleStatements.pop_back();
+            }
+        }
+
+        /// <summary>
+        /// Finalizes all the statements in cache.
+        /// </summary>
+        void DatabaseConn::ClearStatementCache() NOEXCEPT
+        {
+            auto lock = LockStmtCache();
+
+            for (auto &entry : m_idleStatements)
+                sqlite3_finalize(entry.handle);
+
+            m_idleStatementsByHash.clear();
+            m_idleStatements.clear();
+        }
+
+        /// <summary>
+        /// Creates a SQL statement for the current database. When a statement created
+        /// before for the same query text is no longer in use, it is reused rather than
+        /// prepared again.
         /// </summary>
         /// <param name="query">The query/statement.</param>
         /// <returns>A <see cref="PrepStatement"/> object for the created SQLite statement already prepared.</returns>
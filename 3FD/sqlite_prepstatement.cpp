@@ -2,9 +2,12 @@
 #include "sqlite.h"
 #include "exceptions.h"
 #include "logger.h"
+#include "timing.h"
+#include "utils.h"
 #include "utils_algorithms.h"
 #include <cassert>
 #include <codecvt>
+#include <cstring>
 #include <locale>
 #include <sstream>
 #include <algorithm>
@@ -27,6 +30,42 @@ namespace _3fd
         /// <param name="query">The query text.</param>
         /// <param name="length">The query length.</param>
         void PrepStatement::CtorImpl(const char *query, size_t length)
+        {
+            CALL_STACK_TRACE_TIMED;
+
+            // Reuse a statement created before for the same query, if idle in cache:
+            m_stmtHandle = m_database.TakeIdleStatement(query, length, m_queryText, m_columnIndexes);
+
+            if (m_stmtHandle != nullptr)
+            {
+                // Columns are looked up again only if a change in the schema has changed them:
+                if (static_cast<size_t> (sqlite3_column_count(m_stmtHandle)) == m_columnIndexes.size())
+                    return;
+
+                m_columnIndexes.clear();
+            }
+            else
+                PrepareImpl(query, length);
+
+            // Get the columns count in the result set of the prepared query
+            int numColumns = sqlite3_column_count(m_stmtHandle);
+
+            // Get the names of the columns:
+            for (int index = 0; index < numColumns; ++index)
+            {
+                m_columnIndexes.emplace(
+                    string(sqlite3_column_name(m_stmtHandle, index)),
+                    index
+                );
+            }
+        }
+
+        /// <summary>
+        /// Prepares the statement for a query.
+        /// </summary>
+        /// <param name="query">The query text.</param>
+        /// <param name="length">The query length.</param>
+        void PrepStatement::PrepareImpl(const char *query, size_t length)
         {
             CALL_STACK_TRACE;
 
@@ -71,18 +110,6 @@ namespace _3fd
                     throw core::AppException<std::runtime_error>("Failed to prepare SQLite statement", oss.str());
                 }
             }// loop: if lock failure, retry
-
-            // Get the columns count in the result set of the prepared query
-            int numColumns = sqlite3_column_count(m_stmtHandle);
-
-            // Get the names of the columns:
-            for (int index = 0; index < numColumns; ++index)
-            {
-                m_columnIndexes.emplace(
-                    string(sqlite3_column_name(m_stmtHandle, index)),
-                    index
-                );
-            }
         }
 
         /// <summary>
@@ -144,6 +171,7 @@ namespace _3fd
             m_stmtHandle(ob.m_stmtHandle), 
             m_database(ob.m_database), 
             m_columnIndexes(std::move(ob.m_columnIndexes)), 
+            m_queryText(std::move(ob.m_queryText)), 
             m_stepping(ob.m_stepping) 
         {
             ob.m_stmtHandle = nullptr;
@@ -151,6 +179,7 @@ namespace _3fd
 
         /// <summary>
         /// Finalizes an instance of the <see cref="PrepStatement"/> class.
+        /// The statement is given back to the database connection, for reuse.
         /// </summary>
         PrepStatement::~PrepStatement()
         {
@@ -158,7 +187,7 @@ namespace _3fd
             {
                 CALL_STACK_TRACE;
                 Reset(); // releases any lock in the database
-                sqlite3_finalize(m_stmtHandle);
+                m_database.ReturnIdleStatement(m_stmtHandle, std::move(m_queryText), std::move(m_columnIndexes));
             }
         }
 
@@ -172,48 +201,71 @@ namespace _3fd
         }
 
         /// <summary>
-        /// Gets the index of a parameter in a SQLite statement.
+        /// Gets the index of a parameter in the statement, so it can be bound without looking it up again.
         /// </summary>
-        /// <param name="stmtHandle">The statement handle.</param>
         /// <param name="paramName">Name of the parameter.</param>
-        /// <returns>The parameter index.</returns>
-        static int GetParamIndex(sqlite3_stmt *stmtHandle, const string &paramName)
+        /// <returns>The parameter index, which starts at 1.</returns>
+        int PrepStatement::GetParamIndex(const string &paramName) const
         {
-            int paramIndex = sqlite3_bind_parameter_index(stmtHandle, paramName.c_str());
-
-    #    ifndef NDEBUG
+            int paramIndex = sqlite3_bind_parameter_index(m_stmtHandle, paramName.c_str());
 
+            /* Checked in release builds too, otherwise binding by name would fail
+            for index 0 with an error that no longer tells the parameter name: */
             if(paramIndex == 0)
             {
                 CALL_STACK_TRACE;
                 ostringstream oss;
                 oss << "SQLite API: 'sqlite3_bind_parameter_index' - The parameter \'" << paramName 
-                    << "\' was not found int the query. Please check SQLite documentation. Query was {" << sqlite3_sql(stmtHandle) << '}';
+                    << "\' was not found int the query. Please check SQLite documentation. Query was {" << sqlite3_sql(m_stmtHandle) << '}';
 
                 throw core::AppException<std::runtime_error>("Could not find parameter in SQLite statement", oss.str());
             }
-    #    endif
 
             return paramIndex;
         }
 
+        /// <summary>
+        /// Gets how many parameters the statement has.
+        /// </summary>
+        int PrepStatement::GetParamCount() const
+        {
+            return sqlite3_bind_parameter_count(m_stmtHandle);
+        }
+
+        /// <summary>
+        /// Describes a parameter for the error messages, by its name, or by its index when it has no name.
+        /// </summary>
+        /// <param name="stmtHandle">The statement handle.</param>
+        /// <param name="paramIndex">The parameter index.</param>
+        /// <returns>The description of the parameter.</returns>
+        static string DescribeParam(sqlite3_stmt *stmtHandle, int paramIndex)
+        {
+            auto paramName = sqlite3_bind_parameter_name(stmtHandle, paramIndex);
+
+            if (paramName != nullptr)
+                return paramName;
+
+            ostringstream oss;
+            oss << '#' << paramIndex;
+            return oss.str();
+        }
+
         /// <summary>
         /// Binds the specified parameter to an integer value.
         /// </summary>
-        /// <param name="paramName">Name of the parameter.</param>
+        /// <param name="paramIndex">Index of the parameter, which starts at 1.</param>
         /// <param name="integer">The integer value.</param>
-        void PrepStatement::Bind(const string &paramName, int integer)
+        void PrepStatement::Bind(int paramIndex, int integer)
         {
-            int status = sqlite3_bind_int(m_stmtHandle, 
-                                          GetParamIndex(m_stmtHandle, paramName), 
-                                          integer);
+            int status = sqlite3_bind_int(m_stmtHandle, paramIndex, integer);
+
             if(status != SQLITE_OK)
             {
                 CALL_STACK_TRACE;
                 ostringstream oss;
                 oss << "SQLite API error code " << status
                     << " - 'sqlite3_bind_int' reported: " << sqlite3_errstr(status) 
-                    << ". Parameter was \'" << paramName 
+                    << ". Parameter was \'" << DescribeParam(m_stmtHandle, paramIndex) 
                     << "\' and the query was {" << sqlite3_sql(m_stmtHandle) << '}';
 
                 throw core::AppException<std::runtime_error>("Failed to bind integer value to the SQLite statement parameter", oss.str());
@@ -223,20 +275,19 @@ namespace _3fd
         /// <summary>
         /// Binds the specified parameter to an integer value.
         /// </summary>
-        /// <param name="paramName">Name of the parameter.</param>
+        /// <param name="paramIndex">Index of the parameter, which starts at 1.</param>
         /// <param name="integer">The integer value.</param>
-        void PrepStatement::Bind(const string &paramName, long long integer)
+        void PrepStatement::Bind(int paramIndex, long long integer)
         {
-            int status = sqlite3_bind_int64(m_stmtHandle, 
-                                            GetParamIndex(m_stmtHandle, paramName), 
-                                            integer);
+            int status = sqlite3_bind_int64(m_stmtHandle, paramIndex, integer);
+
             if(status != SQLITE_OK)
             {
                 CALL_STACK_TRACE;
                 ostringstream oss;
                 oss << "SQLite API error code " << status
                     << " - 'sqlite3_bind_int64' reported: " << sqlite3_errstr(status)
-                    << ". Parameter was \'" << paramName 
+                    << ". Parameter was \'" << DescribeParam(m_stmtHandle, paramIndex) 
                     << "\' and the query was {" << sqlite3_sql(m_stmtHandle) << '}';
 
                 throw core::AppException<std::runtime_error>("Failed to bind integer value to the SQLite statement parameter", oss.str());
@@ -246,20 +297,19 @@ namespace _3fd
         /// <summary>
         /// Binds the specified parameter to a real number.
         /// </summary>
-        /// <param name="paramName">Name of the parameter.</param>
+        /// <param name="paramIndex">Index of the parameter, which starts at 1.</param>
         /// <param name="real">The real number.</param>
-        void PrepStatement::Bind(const string &paramName, double real)
+        void PrepStatement::Bind(int paramIndex, double real)
         {
-            int status = sqlite3_bind_double(m_stmtHandle, 
-                                             GetParamIndex(m_stmtHandle, paramName), 
-                                             real);
+            int status = sqlite3_bind_double(m_stmtHandle, paramIndex, real);
+
             if(status != SQLITE_OK)
             {
                 CALL_STACK_TRACE;
                 ostringstream oss;
                 oss << "SQLite API error code " << status
                     << " - 'sqlite3_bind_double' reported: " << sqlite3_errstr(status)
-                    << ". Parameter was \'" << paramName 
+                    << ". Parameter was \'" << DescribeParam(m_stmtHandle, paramIndex) 
                     << "\' and the query was {" << sqlite3_sql(m_stmtHandle) << '}';
 
                 throw core::AppException<std::runtime_error>("Failed to bind floating point value to the SQLite statement parameter", oss.str());
@@ -269,12 +319,12 @@ namespace _3fd
         /// <summary>
         /// Binds the specified parameter to text content.
         /// </summary>
-        /// <param name="paramName">Name of the parameter.</param>
+        /// <param name="paramIndex">Index of the parameter, which starts at 1.</param>
         /// <param name="text">The text content.</param>
-        void PrepStatement::Bind(const string &paramName, const string &text)
+        void PrepStatement::Bind(int paramIndex, const string &text)
         {
             int status = sqlite3_bind_text(m_stmtHandle,
-                                           GetParamIndex(m_stmtHandle, paramName), 
+                                           paramIndex, 
                                            text.data(), 
                                            text.size(), 
                                            SQLITE_TRANSIENT);
@@ -284,7 +334,7 @@ namespace _3fd
                 ostringstream oss;
                 oss << "SQLite API error code " << status
                     << " - 'sqlite3_bind_text' reported: " << sqlite3_errstr(status)
-                    << ". Parameter was \'" << paramName 
+                    << ". Parameter was \'" << DescribeParam(m_stmtHandle, paramIndex) 
                     << "\' and the query was {" << sqlite3_sql(m_stmtHandle) << '}';
 
                 throw core::AppException<std::runtime_error>("Failed to bind text content to the SQLite statement parameter", oss.str());
@@ -294,9 +344,9 @@ namespace _3fd
         /// <summary>
         /// Binds the specified parameter to a text value (UCS-2 encoded).
         /// </summary>
-        /// <param name="paramName">Name of the parameter.</param>
+        /// <param name="paramIndex">Index of the parameter, which starts at 1.</param>
         /// <param name="text">The text value (UCS-2 encoded).</param>
-        void PrepStatement::Bind(const string &paramName, const wstring &text)
+        void PrepStatement::Bind(int paramIndex, const wstring &text)
         {
             CALL_STACK_TRACE;
 
@@ -307,7 +357,7 @@ namespace _3fd
                 auto textAsUTF8 = transcoder.to_bytes(text);
 
                 // Always store text as UTF-8:
-                Bind(paramName, textAsUTF8);
+                Bind(paramIndex, textAsUTF8);
             }
             catch(core::IAppException &)
             {
@@ -324,12 +374,12 @@ namespace _3fd
         /// <summary>
         /// Binds the specified parameter to a blob value.
         /// </summary>
-        /// <param name="paramName">Name of the parameter.</param>
+        /// <param name="paramIndex">Index of the parameter, which starts at 1.</param>
         /// <param name="blob">The blob value.</param>
-        void PrepStatement::Bind(const string &paramName, const void *blob, int nBytes)
+        void PrepStatement::Bind(int paramIndex, const void *blob, int nBytes)
         {
             int status = sqlite3_bind_blob(m_stmtHandle, 
-                                           GetParamIndex(m_stmtHandle, paramName), 
+                                           paramIndex, 
                                            blob, 
                                            nBytes, 
                                            SQLITE_TRANSIENT);
@@ -339,13 +389,73 @@ namespace _3fd
                 ostringstream oss;
                 oss << "SQLite API error code " << status
                     << " - 'sqlite3_bind_blob' reported: " << sqlite3_errstr(status)
-                    << ". Parameter was \'" << paramName 
+                    << ". Parameter was \'" << DescribeParam(m_stmtHandle, paramIndex) 
                     << "\' and the query was {" << sqlite3_sql(m_stmtHandle) << '}';
 
                 throw core::AppException<std::runtime_error>("Failed to bind text content to the SQLite statement parameter", oss.str());
             }
         }
 
+        /// <summary>
+        /// Binds the specified parameter to an integer value.
+        /// </summary>
+        /// <param name="paramName">Name of the parameter.</param>
+        /// <param name="integer">The integer value.</param>
+        void PrepStatement::Bind(const string &paramName, int integer)
+        {
+            Bind(GetParamIndex(paramName), integer);
+        }
+
+        /// <summary>
+        /// Binds the specified parameter to an integer value.
+        /// </summary>
+        /// <param name="paramName">Name of the parameter.</param>
+        /// <param name="integer">The integer value.</param>
+        void PrepStatement::Bind(const string &paramName, long long integer)
+        {
+            Bind(GetParamIndex(paramName), integer);
+        }
+
+        /// <summary>
+        /// Binds the specified parameter to a real number.
+        /// </summary>
+        /// <param name="paramName">Name of the parameter.</param>
+        /// <param name="real">The real number.</param>
+        void PrepStatement::Bind(const string &paramName, double real)
+        {
+            Bind(GetParamIndex(paramName), real);
+        }
+
+        /// <summary>
+        /// Binds the specified parameter to text content.
+        /// </summary>
+        /// <param name="paramName">Name of the parameter.</param>
+        /// <param name="text">The text content.</param>
+        void PrepStatement::Bind(const string &paramName, const string &text)
+        {
+            Bind(GetParamIndex(paramName), text);
+        }
+
+        /// <summary>
+        /// Binds the specified parameter to a text value (UCS-2 encoded).
+        /// </summary>
+        /// <param name="paramName">Name of the parameter.</param>
+        /// <param name="text">The text value (UCS-2 encoded).</param>
+        void PrepStatement::Bind(const string &paramName, const wstring &text)
+        {
+            Bind(GetParamIndex(paramName), text);
+        }
+
+        /// <summary>
+        /// Binds the specified parameter to a blob value.
+        /// </summary>
+        /// <param name="paramName">Name of the parameter.</param>
+        /// <param name="blob">The blob value.</param>
+        void PrepStatement::Bind(const string &paramName, const void *blob, int nBytes)
+        {
+            Bind(GetParamIndex(paramName), blob, nBytes);
+        }
+
         /// <summary>
         /// Clears the bindings.
         /// </summary>
@@ -372,7 +482,7 @@ namespace _3fd
         /// <returns>The return code of 'sqlite3_step'.</returns>
         int PrepStatement::Step(bool throwEx)
         {
-            CALL_STACK_TRACE;
+            CALL_STACK_TRACE_TIMED;
 
             int attempts(0);
 
@@ -495,21 +605,25 @@ namespace _3fd
         }
 
         /// <summary>
-        /// Gets the column value as integer.
+        /// Gets how many columns the rows in the result of the statement have.
         /// </summary>
-        /// <param name="columnName">Name of the column.</param>
-        /// <returns>The column value.</returns>
-        int PrepStatement::GetColumnValueInteger(const string &columnName)
+        int PrepStatement::GetColumnCount() const
         {
-            _ASSERTE(m_stepping == true); // Cannot retrieve a value before stepping into the query execution
+            return sqlite3_column_count(m_stmtHandle);
+        }
 
+        /// <summary>
+        /// Finds the index of a column in the result of the statement.
+        /// </summary>
+        /// <param name="columnName">Name of the column.</param>
+        /// <param name="errorMessage">The message of the exception thrown when the column is not found.</param>
+        /// <returns>The column index, which starts at 0.</returns>
+        int PrepStatement::FindColumnIndex(const string &columnName, const char *errorMessage) const
+        {
             auto iter = m_columnIndexes.find(columnName);
 
             if(m_columnIndexes.end() != iter)
-            {
-                _ASSERTE(sqlite3_column_type(m_stmtHandle, iter->second) == SQLITE_INTEGER); // Fires if the specified column does not hold an integer number as value
-                return sqlite3_column_int(m_stmtHandle, iter->second);
-            }
+                return iter->second;
             else
             {
                 CALL_STACK_TRACE;
@@ -517,62 +631,158 @@ namespace _3fd
                 oss << "SQLite wrapper error: the column \'" << columnName
                     << "\' does not belong to the output row. Query was {" << sqlite3_sql(m_stmtHandle) << '}';
 
-                throw core::AppException<std::runtime_error>("Failed to get integer value from SQLite query result", oss.str());
+                throw core::AppException<std::runtime_error>(errorMessage, oss.str());
             }
         }
 
         /// <summary>
-        /// Gets the column value as integer 64 bits.
+        /// Gets the index of a column in the result of the statement, so its values
+        /// can be retrieved without looking it up again.
         /// </summary>
         /// <param name="columnName">Name of the column.</param>
+        /// <returns>The column index, which starts at 0.</returns>
+        int PrepStatement::GetColumnIndex(const string &columnName) const
+        {
+            return FindColumnIndex(columnName, "Could not find column in SQLite query result");
+        }
+
+        /// <summary>
+        /// Gets the column value as integer.
+        /// </summary>
+        /// <param name="columnIndex">Index of the column, which starts at 0.</param>
         /// <returns>The column value.</returns>
-        long long PrepStatement::GetColumnValueInteger64(const string &columnName)
+        int PrepStatement::GetColumnValueInteger(int columnIndex)
         {
             _ASSERTE(m_stepping == true); // Cannot retrieve a value before stepping into the query execution
+            _ASSERTE(columnIndex >= 0 && columnIndex < sqlite3_column_count(m_stmtHandle)); // Fires if the index is out of range
+            _ASSERTE(sqlite3_column_type(m_stmtHandle, columnIndex) == SQLITE_INTEGER); // Fires if the specified column does not hold an integer number as value
+            return sqlite3_column_int(m_stmtHandle, columnIndex);
+        }
 
-            auto iter = m_columnIndexes.find(columnName);
+        /// <summary>
+        /// Gets the column value as integer 64 bits.
+        /// </summary>
+        /// <param name="columnIndex">Index of the column, which starts at 0.</param>
+        /// <returns>The column value.</returns>
+        long long PrepStatement::GetColumnValueInteger64(int columnIndex)
+        {
+            _ASSERTE(m_stepping == true); // Cannot retrieve a value before stepping into the query execution
+            _ASSERTE(columnIndex >= 0 && columnIndex < sqlite3_column_count(m_stmtHandle)); // Fires if the index is out of range
+            _ASSERTE(sqlite3_column_type(m_stmtHandle, columnIndex) == SQLITE_INTEGER); // Fires if the specified column does not hold an integer number as value
+            return sqlite3_column_int64(m_stmtHandle, columnIndex);
+        }
 
-            if(m_columnIndexes.end() != iter)
-            {
-                _ASSERTE(sqlite3_column_type(m_stmtHandle, iter->second) == SQLITE_INTEGER); // Fires if the specified column does not hold an integer number as value
-                return sqlite3_column_int64(m_stmtHandle, iter->second);
-            }
-            else
-            {
-                CALL_STACK_TRACE;
-                ostringstream oss;
-                oss << "SQLite wrapper error: the column \'" << columnName
-                    << "\' does not belong to the output row. Query was {" << sqlite3_sql(m_stmtHandle) << '}';
+        /// <summary>
+        /// Gets the column value as double precision floating point.
+        /// </summary>
+        /// <param name="columnIndex">Index of the column, which starts at 0.</param>
+        /// <returns>The column value.</returns>
+        double PrepStatement::GetColumnValueFloat64(int columnIndex)
+        {
+            _ASSERTE(m_stepping == true); // Cannot retrieve a value before stepping into the query execution
+            _ASSERTE(columnIndex >= 0 && columnIndex < sqlite3_column_count(m_stmtHandle)); // Fires if the index is out of range
+            _ASSERTE(sqlite3_column_type(m_stmtHandle, columnIndex) == SQLITE_FLOAT); // Fires if the specified column does not hold a floating point number as value
+            return sqlite3_column_double(m_stmtHandle, columnIndex);
+        }
 
-                throw core::AppException<std::runtime_error>("Failed to get integer value from SQLite query result", oss.str());
-            }
+        /// <summary>
+        /// Gets the column value as text.
+        /// </summary>
+        /// <param name="columnIndex">Index of the column, which starts at 0.</param>
+        /// <returns>The column value.</returns>
+        string PrepStatement::GetColumnValueText(int columnIndex)
+        {
+            _ASSERTE(m_stepping == true); // Cannot retrieve a value before stepping into the query execution
+            _ASSERTE(columnIndex >= 0 && columnIndex < sqlite3_column_count(m_stmtHandle)); // Fires if the index is out of range
+            _ASSERTE(sqlite3_column_type(m_stmtHandle, columnIndex) == SQLITE_TEXT); // Fires if the specified column does not hold text content
+            return reinterpret_cast<const char *> (sqlite3_column_text(m_stmtHandle, columnIndex));
         }
 
         /// <summary>
-        /// Gets the column value as double precision floating point.
+        /// Gets the column value as text, materialized in an arena. This avoids a
+        /// heap allocation per retrieved value when the row only has to live as long
+        /// as the request-scoped work that reads it.
         /// </summary>
-        /// <param name="columnName">Name of the column.</param>
+        /// <param name="columnIndex">Index of the column, which starts at 0.</param>
+        /// <param name="arena">The arena where the text will be copied to.</param>
+        /// <returns>The column value (null terminated), valid until the arena is rewound or released.</returns>
+        const char * PrepStatement::GetColumnValueText(int columnIndex, utils::Arena &arena)
+        {
+            _ASSERTE(m_stepping == true); // Cannot retrieve a value before stepping into the query execution
+            _ASSERTE(columnIndex >= 0 && columnIndex < sqlite3_column_count(m_stmtHandle)); // Fires if the index is out of range
+            _ASSERTE(sqlite3_column_type(m_stmtHandle, columnIndex) == SQLITE_TEXT); // Fires if the specified column does not hold text content
+            auto text = sqlite3_column_text(m_stmtHandle, columnIndex);
+            auto nBytes = sqlite3_column_bytes(m_stmtHandle, columnIndex);
+
+            auto copy = arena.AllocateArray<char>(nBytes + 1);
+            memcpy(copy, text, nBytes);
+            copy[nBytes] = 0;
+            return copy;
+        }
+
+        /// <summary>
+        /// Gets the column value as text (UTF-16 encoded).
+        /// </summary>
+        /// <param name="columnIndex">Index of the column, which starts at 0.</param>
+        /// <returns>The column value (UTF-16 encoded).</returns>
+        wstring PrepStatement::GetColumnValueText16(int columnIndex)
+        {
+            _ASSERTE(m_stepping == true); // Cannot retrieve a value before stepping into the query execution
+            _ASSERTE(columnIndex >= 0 && columnIndex < sqlite3_column_count(m_stmtHandle)); // Fires if the index is out of range
+            _ASSERTE(sqlite3_column_type(m_stmtHandle, columnIndex) == SQLITE_TEXT); // Fires if the specified column does not hold text content
+            return reinterpret_cast<const wchar_t *> (sqlite3_column_text16(m_stmtHandle, columnIndex));
+        }
+
+        /// <summary>
+        /// Gets the column value as blob.
+        /// </summary>
+        /// <param name="columnIndex">Index of the column, which starts at 0.</param>
+        /// <param name="nBytes">Receives the size of the blob.</param>
         /// <returns>The column value.</returns>
-        double PrepStatement::GetColumnValueFloat64(const string &columnName)
+        const void * PrepStatement::GetColumnValueBlob(int columnIndex, int &nBytes)
         {
             _ASSERTE(m_stepping == true); // Cannot retrieve a value before stepping into the query execution
+            _ASSERTE(columnIndex >= 0 && columnIndex < sqlite3_column_count(m_stmtHandle)); // Fires if the index is out of range
+            _ASSERTE(sqlite3_column_type(m_stmtHandle, columnIndex) == SQLITE_BLOB); // Fires if the specified column does not hold blob content
+            auto blob = sqlite3_column_blob(m_stmtHandle, columnIndex);
+            nBytes = sqlite3_column_bytes(m_stmtHandle, columnIndex);
+            return blob;
+        }
 
-            auto iter = m_columnIndexes.find(columnName);
+        /// <summary>
+        /// Gets the column value as integer.
+        /// </summary>
+        /// <param name="columnName">Name of the column.</param>
+        /// <returns>The column value.</returns>
+        int PrepStatement::GetColumnValueInteger(const string &columnName)
+        {
+            return GetColumnValueInteger(
+                FindColumnIndex(columnName, "Failed to get integer value from SQLite query result")
+            );
+        }
 
-            if(m_columnIndexes.end() != iter)
-            {
-                _ASSERTE(sqlite3_column_type(m_stmtHandle, iter->second) == SQLITE_FLOAT); // Fires if the specified column does not hold a floating point number as value
-                return sqlite3_column_double(m_stmtHandle, iter->second);
-            }
-            else
-            {
-                CALL_STACK_TRACE;
-                ostringstream oss;
-                oss << "SQLite wrapper error: the column \'" << columnName
-                    << "\' does not belong to the output row. Query was {" << sqlite3_sql(m_stmtHandle) << '}';
+        /// <summary>
+        /// Gets the column value as integer 64 bits.
+        /// </summary>
+        /// <param name="columnName">Name of the column.</param>
+        /// <returns>The column value.</returns>
+        long long PrepStatement::GetColumnValueInteger64(const string &columnName)
+        {
+            return GetColumnValueInteger64(
+                FindColumnIndex(columnName, "Failed to get integer value from SQLite query result")
+            );
+        }
 
-                throw core::AppException<std::runtime_error>("Failed to get floating point value from SQLite query result", oss.str());
-            }
+        /// <summary>
+        /// Gets the column value as double precision floating point.
+        /// </summary>
+        /// <param name="columnName">Name of the column.</param>
+        /// <returns>The column value.</returns>
+        double PrepStatement::GetColumnValueFloat64(const string &columnName)
+        {
+            return GetColumnValueFloat64(
+                FindColumnIndex(columnName, "Failed to get floating point value from SQLite query result")
+            );
         }
 
         /// <summary>
@@ -582,24 +792,23 @@ namespace _3fd
         /// <returns>The column value.</returns>
         string PrepStatement::GetColumnValueText(const string &columnName)
         {
-            _ASSERTE(m_stepping == true); // Cannot retrieve a value before stepping into the query execution
-
-            auto iter = m_columnIndexes.find(columnName);
-
-            if(m_columnIndexes.end() != iter)
-            {
-                _ASSERTE(sqlite3_column_type(m_stmtHandle, iter->second) == SQLITE_TEXT); // Fires if the specified column does not hold text content
-                return reinterpret_cast<const char *> (sqlite3_column_text(m_stmtHandle, iter->second));
-            }
-            else
-            {
-                CALL_STACK_TRACE;
-                ostringstream oss;
-                oss << "SQLite wrapper error: the column \'" << columnName
-                    << "\' does not belong to the output row. Query was {" << sqlite3_sql(m_stmtHandle) << '}';
+            return GetColumnValueText(
+                FindColumnIndex(columnName, "Failed to get text content from SQLite query result")
+            );
+        }
 
-                throw core::AppException<std::runtime_error>("Failed to get text content from SQLite query result", oss.str());
-            }
+        /// <summary>
+        /// Gets the column value as text, materialized in an arena.
+        /// </summary>
+        /// <param name="columnName">Name of the column.</param>
+        /// <param name="arena">The arena where the text will be copied to.</param>
+        /// <returns>The column value (null terminated), valid until the arena is rewound or released.</returns>
+        const char * PrepStatement::GetColumnValueText(const string &columnName, utils::Arena &arena)
+        {
+            return GetColumnValueText(
+                FindColumnIndex(columnName, "Failed to get text content from SQLite query result"),
+                arena
+            );
         }
 
         /// <summary>
@@ -609,52 +818,43 @@ namespace _3fd
         /// <returns>The column value (UTF-16 encoded).</returns>
         wstring PrepStatement::GetColumnValueText16(const string &columnName)
         {
-            _ASSERTE(m_stepping == true); // Cannot retrieve a value before stepping into the query execution
-
-            auto iter = m_columnIndexes.find(columnName);
-
-            if(m_columnIndexes.end() != iter)
-            {
-                _ASSERTE(sqlite3_column_type(m_stmtHandle, iter->second) == SQLITE_TEXT); // Fires if the specified column does not hold text content
-                return reinterpret_cast<const wchar_t *> (sqlite3_column_text16(m_stmtHandle, iter->second));
-            }
-            else
-            {
-                CALL_STACK_TRACE;
-                ostringstream oss;
-                oss << "SQLite wrapper error: the column \'" << columnName
-                    << "\' does not belong to the output row. Query was {" << sqlite3_sql(m_stmtHandle) << '}';
-
-                throw core::AppException<std::runtime_error>("Failed to get text content from SQLite query result", oss.str());
-            }
+            return GetColumnValueText16(
+                FindColumnIndex(columnName, "Failed to get text content from SQLite query result")
+            );
         }
 
         /// <summary>
         /// Gets the column value as blob.
         /// </summary>
         /// <param name="columnName">Name of the column.</param>
+        /// <param name="nBytes">Receives the size of the blob.</param>
         /// <returns>The column value.</returns>
         const void * PrepStatement::GetColumnValueBlob(const string &columnName, int &nBytes)
         {
-            _ASSERTE(m_stepping == true); // Cannot retrieve a value before stepping into the query execution
-
-            auto iter = m_columnIndexes.find(columnName);
+            return GetColumnValueBlob(
+                FindColumnIndex(columnName, "Failed to get blob content from SQLite query result"),
+                nBytes
+            );
+        }
 
-            if(m_columnIndexes.end() != iter)
-            {
-                _ASSERTE(sqlite3_column_type(m_stmtHandle, iter->second) == SQLITE_BLOB); // Fires if the specified column does not hold blob content
-                auto blob = sqlite3_column_blob(m_stmtHandle, iter->second);
-                nBytes = sqlite3_column_bytes(m_stmtHandle, iter->second);
-                return blob;
-            }
-            else
+        /// <summary>
+        /// Checks whether a statement has as many parameters and result columns
+        /// as the types of a <see cref="TypedStatement"/> expect.
+        /// </summary>
+        /// <param name="statement">The statement.</param>
+        /// <param name="numParams">The expected number of parameters.</param>
+        /// <param name="numColumns">The expected number of columns in the result.</param>
+        void CheckTypedStatementShape(const PrepStatement &statement, int numParams, int numColumns)
+        {
+            if (statement.GetParamCount() != numParams || statement.GetColumnCount() != numColumns)
             {
                 CALL_STACK_TRACE;
                 ostringstream oss;
-                oss << "SQLite wrapper error: the column \'" << columnName 
-                    << "\' does not belong to the output row. Query was {" << sqlite3_sql(m_stmtHandle) << '}';
+                oss << "SQLite wrapper error: the statement was typed for " << numParams << " parameter(s) and "
+                    << numColumns << " column(s), but has " << statement.GetParamCount() << " parameter(s) and "
+                    << statement.GetColumnCount() << " column(s). Query was {" << statement.GetQuery() << '}';
 
-                throw core::AppException<std::runtime_error>("Failed to get blob content from SQLite query result", oss.str());
+                throw core::AppException<std::runtime_error>("Failed to create typed SQLite statement", oss.str());
             }
         }
 
@@ -0,0 +1,467 @@
+#include "stdafx.h"
+#include "timing.h"
+#include "exceptions.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+#ifdef _MSC_VER
+#   include <intrin.h>
+#endif
+
+namespace _3fd
+{
+namespace core
+{
+    ///////////////////////////////////////
+    //  LatencyHistogram Class
+    ///////////////////////////////////////
+
+    const uint32_t LatencyHistogram::numBuckets;
+
+    // Gets the index of the highest bit set in a word, which cannot be zero
+    static uint32_t GetIdxHighestBit(uint64_t word)
+    {
+#   if defined _MSC_VER && (defined _M_X64 || defined _M_ARM64)
+        unsigned long idx;
+        _BitScanReverse64(&idx, word);
+        return idx;
+#   elif defined _MSC_VER
+        unsigned long idx;
+        if (_BitScanReverse(&idx, static_cast<unsigned long> (word >> 32)))
+            return idx + 32;
+
+        _BitScanReverse(&idx, static_cast<unsigned long> (word));
+        return idx;
+#   else
+        return 63 - __builtin_clzll(word);
+#   endif
+    }
+
+    /// <summary>
+    /// Gets the index of the bucket where a value is counted. Values below 32 have exact buckets,
+    /// whereas the others fall in one of 16 buckets inside the power of 2 they belong to.
+    /// </summary>
+    /// <param name="value">The value.</param>
+    /// <returns>The index of the bucket.</returns>
+    uint32_t LatencyHistogram::GetBucketIndex(uint64_t value) NOEXCEPT
+    {
+        if (value < 32)
+            return static_cast<uint32_t> (value);
+
+        // keep only the 5 highest bits, whose top one is always set:
+        auto shift = GetIdxHighestBit(value) - 4;
+        return shift * 16 + static_cast<uint32_t> (value >> shift);
+    }
+
+    /// <summary>
+    /// Gets the highest value counted by a bucket.
+    /// </summary>
+    /// <param name="bucketIdx">The index of the bucket.</param>
+    /// <returns>The highest value in the range of the bucket.</returns>
+    uint64_t LatencyHistogram::GetBucketHighestValue(uint32_t bucketIdx) NOEXCEPT
+    {
+        if (bucketIdx < 32)
+            return bucketIdx;
+
+        auto shift = bucketIdx / 16 - 1;
+        uint64_t lowest = static_cast<uint64_t> (bucketIdx % 16 + 16) << shift;
+        return lowest + ((static_cast<uint64_t> (1) << shift) - 1);
+    }
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="LatencyHistogram"/> class.
+    /// </summary>
+    LatencyHistogram::LatencyHistogram()
+        : m_count(0)
+        , m_sum(0)
+        , m_min(UINT64_MAX)
+        , m_max(0)
+    {
+        for (auto &counter : m_counts)
+            counter.store(0, std::memory_order_relaxed);
+    }
+
+    /// <summary>
+    /// Adds the values of another histogram into this one. Only the thread owning this
+    /// histogram can call this, but the other one might be concurrently recording.
+    /// </summary>
+    /// <param name="other">The histogram whose values will be added.</param>
+    void LatencyHistogram::Add(const LatencyHistogram &other) NOEXCEPT
+    {
+        // the count is summed from the buckets, so it stays consistent with them:
+        uint64_t count(0);
+        for (uint32_t idx = 0; idx < numBuckets; ++idx)
+        {
+            auto value = other.m_counts[idx].load(std::memory_order_relaxed);
+            Increment(m_counts[idx], value);
+            count += value;
+        }
+
+        if (count == 0)
+            return;
+
+        Increment(m_count, count);
+        Increment(m_sum, other.m_sum.load(std::memory_order_relaxed));
+
+        auto min = other.m_min.load(std::memory_order_relaxed);
+        if (min < m_min.load(std::memory_order_relaxed))
+            m_min.store(min, std::memory_order_relaxed);
+
+        auto max = other.m_max.load(std::memory_order_relaxed);
+        if (max > m_max.load(std::memory_order_relaxed))
+            m_max.store(max, std::memory_order_relaxed);
+    }
+
+    /// <summary>
+    /// Gets the mean of the recorded values.
+    /// </summary>
+    /// <returns>The mean, or zero when the histogram is empty.</returns>
+    double LatencyHistogram::GetMean() const NOEXCEPT
+    {
+        auto count = GetCount();
+        return count > 0 ? static_cast<double> (m_sum.load(std::memory_order_relaxed)) / count : 0.0;
+    }
+
+    /// <summary>
+    /// Gets a percentile of the recorded values.
+    /// </summary>
+    /// <param name="percentile">The percentile, from 0 to 100.</param>
+    /// <returns>
+    /// The highest value equivalent to the one at the given percentile (within the
+    /// precision of the buckets), or zero when the histogram is empty.
+    /// </returns>
+    uint64_t LatencyHistogram::GetPercentile(double percentile) const NOEXCEPT
+    {
+        auto count = GetCount();
+        if (count == 0)
+            return 0;
+
+        auto rank = static_cast<uint64_t> (std::ceil(percentile / 100.0 * count));
+        if (rank < 1)
+            rank = 1;
+
+        uint64_t cumulative(0);
+        for (uint32_t idx = 0; idx < numBuckets; ++idx)
+        {
+            cumulative += m_counts[idx].load(std::memory_order_relaxed);
+
+            if (cumulative >= rank)
+            {
+                auto value = GetBucketHighestValue(idx);
+                if (value > GetMax())
+                    return GetMax();
+                if (value < GetMin())
+                    return GetMin();
+                return value;
+            }
+        }
+
+        return GetMax();
+    }
+
+    ///////////////////////////////////////
+    //  TimingRegistry Class
+    ///////////////////////////////////////
+
+    thread_local TimingRegistry::ThreadHistograms * TimingRegistry::threadHistograms(nullptr);
+
+    thread_local bool TimingRegistry::threadFinished(false);
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="TimingRegistry::ThreadHistograms"/> struct.
+    /// </summary>
+    TimingRegistry::ThreadHistograms::ThreadHistograms()
+    {
+        for (auto &histogram : histograms)
+            histogram.store(nullptr, std::memory_order_relaxed);
+    }
+
+    /// <summary>
+    /// Finalizes an instance of the <see cref="TimingRegistry::ThreadHistograms"/> struct.
+    /// </summary>
+    TimingRegistry::ThreadHistograms::~ThreadHistograms()
+    {
+        for (auto &histogram : histograms)
+            delete histogram.load(std::memory_order_relaxed);
+    }
+
+    /* The registry is made of function-local statics because
+    timers might be registered during static initialization: */
+
+    /// <summary>
+    /// Holds the names of the timers and the histograms of all threads.
+    /// </summary>
+    struct TimingRegistry::Registry
+    {
+        std::mutex mutex;
+        std::vector<string> names;
+        std::map<string, uint32_t> idsByName;
+        std::vector<ThreadHistograms *> threads;
+
+        // histograms of the threads that already exited, indexed by timer id
+        std::vector<std::unique_ptr<LatencyHistogram>> finished;
+    };
+
+    TimingRegistry::Registry & TimingRegistry::GetRegistry()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    /// <summary>
+    /// Registers a timer. This is invoked only once per site, by the macros SCOPED_TIMER
+    /// and CALL_STACK_TRACE_TIMED. Sites registering the same name share the timer.
+    /// </summary>
+    /// <param name="name">The name of the timer.</param>
+    /// <returns>The id of the timer, or an invalid id (which records nothing) if the registry is full.</returns>
+    uint32_t TimingRegistry::RegisterTimer(const char *name) NOEXCEPT
+    {
+        try
+        {
+            auto &registry = GetRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+
+            auto iter = registry.idsByName.find(name);
+            if (iter != registry.idsByName.end())
+                return iter->second;
+
+            if (registry.names.size() >= maxTimers)
+                return maxTimers;
+
+            auto timerId = static_cast<uint32_t> (registry.names.size());
+            registry.names.push_back(name);
+            registry.finished.emplace_back(nullptr);
+            registry.idsByName[name] = timerId;
+            return timerId;
+        }
+        catch (std::exception &)
+        {
+            return maxTimers;
+        }
+    }
+
+    /// <summary>
+    /// Creates the histogram of a timer for the calling thread, which
+    /// is registered upon the creation of its first histogram.
+    /// </summary>
+    /// <param name="timerId">The timer id.</param>
+    /// <returns>The new histogram, or a null pointer if memory allocation failed or the thread is exiting.</returns>
+    LatencyHistogram * TimingRegistry::CreateHistogram(uint32_t timerId) NOEXCEPT
+    {
+        // timings recorded after the histograms have been released would never be freed:
+        if (threadFinished)
+            return nullptr;
+
+        try
+        {
+            if (threadHistograms == nullptr)
+            {
+                std::unique_ptr<ThreadHistograms> newHistograms(new ThreadHistograms());
+
+                {
+                    auto &registry = GetRegistry();
+                    std::lock_guard<std::mutex> lock(registry.mutex);
+                    registry.threads.push_back(newHistograms.get());
+                }
+
+                threadHistograms = newHistograms.release();
+
+                // merges and releases the histograms when the thread exits:
+                thread_local static ThreadExitTrigger exitTrigger;
+                (void)exitTrigger;
+            }
+
+            auto histogram = new LatencyHistogram();
+            threadHistograms->histograms[timerId].store(histogram, std::memory_order_release);
+            return histogram;
+        }
+        catch (std::exception &)
+        {
+            return nullptr;
+        }
+    }
+
+    /// <summary>
+    /// Unregisters the current thread, merging its histograms into the ones of finished threads.
+    /// </summary>
+    void TimingRegistry::UnregisterThread()
+    {
+        threadFinished = true;
+
+        if (threadHistograms == nullptr)
+            return;
+
+        try
+        {
+            auto &registry = GetRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+
+            for (uint32_t idx = 0; idx < registry.finished.size(); ++idx)
+            {
+                auto histogram = threadHistograms->histograms[idx].load(std::memory_order_relaxed);
+                if (histogram == nullptr)
+                    continue;
+
+                if (!registry.finished[idx])
+                    registry.finished[idx].reset(histogram);
+                else
+                {
+                    registry.finished[idx]->Add(*histogram);
+                    delete histogram;
+                }
+
+                threadHistograms->histograms[idx].store(nullptr, std::memory_order_relaxed);
+            }
+
+            auto &threads = registry.threads;
+            threads.erase(std::remove(threads.begin(), threads.end(), threadHistograms), threads.end());
+        }
+        catch (std::exception &ex)
+        {
+            std::ostringstream oss;
+            oss << "Generic failure when merging timings of exiting thread: " << ex.what();
+            AttemptConsoleOutput(oss.str());
+        }
+
+        delete threadHistograms;
+        threadHistograms = nullptr;
+    }
+
+    /// <summary>
+    /// Gets the statistics of all timers, merged from all threads.
+    /// </summary>
+    /// <returns>A summary for each timer which recorded anything, in the order of registration.</returns>
+    std::vector<TimingSummary> TimingRegistry::GetSummaries()
+    {
+        try
+        {
+            std::vector<TimingSummary> summaries;
+
+            auto &registry = GetRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+
+            for (uint32_t idx = 0; idx < registry.names.size(); ++idx)
+            {
+                std::unique_ptr<LatencyHistogram> merged(new LatencyHistogram());
+
+                if (registry.finished[idx])
+                    merged->Add(*registry.finished[idx]);
+
+                for (auto thread : registry.threads)
+                {
+                    auto histogram = thread->histograms[idx].load(std::memory_order_acquire);
+                    if (histogram != nullptr)
+                        merged->Add(*histogram);
+                }
+
+                if (merged->GetCount() == 0)
+                    continue;
+
+                TimingSummary summary;
+                summary.name = registry.names[idx];
+                summary.count = merged->GetCount();
+                summary.min = merged->GetMin();
+                summary.max = merged->GetMax();
+                summary.mean = merged->GetMean();
+                summary.p50 = merged->GetPercentile(50.0);
+                summary.p90 = merged->GetPercentile(90.0);
+                summary.p99 = merged->GetPercentile(99.0);
+                summary.p999 = merged->GetPercentile(99.9);
+                summaries.push_back(std::move(summary));
+            }
+
+            return summaries;
+        }
+        catch (std::exception &ex)
+        {
+            std::ostringstream oss;
+            oss << "Generic failure when merging timings: " << ex.what();
+            throw AppException<std::runtime_error>(oss.str());
+        }
+    }
+
+    /// <summary>
+    /// Gets a report of all timers as text, one line per timer, with durations in microseconds.
+    /// </summary>
+    /// <returns>The report.</returns>
+    string TimingRegistry::GetReportAsText()
+    {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(3);
+
+        for (auto &summary : GetSummaries())
+        {
+            oss << summary.name
+                << ": count=" << summary.count
+                << ", min=" << summary.min / 1000.0
+                << ", mean=" << summary.mean / 1000.0
+                << ", p50=" << summary.p50 / 1000.0
+                << ", p90=" << summary.p90 / 1000.0
+                << ", p99=" << summary.p99 / 1000.0
+                << ", p999=" << summary.p999 / 1000.0
+                << ", max=" << summary.max / 1000.0
+                << " (us)\n";
+        }
+
+        return oss.str();
+    }
+
+    /// <summary>
+    /// Gets a report of all timers as a JSON array, with durations in nanoseconds.
+    /// </summary>
+    /// <returns>The report.</returns>
+    string TimingRegistry::GetReportAsJson()
+    {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(1) << '[';
+
+        bool first(true);
+        for (auto &summary : GetSummaries())
+        {
+            if (!first)
+                oss << ',';
+
+            first = false;
+
+            oss << "{\"name\":\"";
+            for (auto ch : summary.name)
+            {
+                if (ch == '"' || ch == '\\')
+                    oss << '\\' << ch;
+                else if (static_cast<unsigned char> (ch) < 0x20)
+                    oss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)ch << std::dec << std::setfill(' ');
+                else
+                    oss << ch;
+            }
+
+            oss << "\",\"count\":" << summary.count
+                << ",\"min\":" << summary.min
+                << ",\"mean\":" << summary.mean
+                << ",\"p50\":" << summary.p50
+                << ",\"p90\":" << summary.p90
+                << ",\"p99\":" << summary.p99
+                << ",\"p999\":" << summary.p999
+                << ",\"max\":" << summary.max
+                << '}';
+        }
+
+        oss << ']';
+        return oss.str();
+    }
+
+    /// <summary>
+    /// Writes the report of all timers (as text) to the log.
+    /// </summary>
+    /// <param name="prio">The priority for the log entry.</param>
+    void TimingRegistry::WriteToLog(Logger::Priority prio)
+    {
+        Logger::Write("Timings report", GetReportAsText(), prio);
+    }
+
+}// end of namespace core
+}// end of namespace _3fd
@@ -0,0 +1,228 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "base.h"
+#include "preprocessing.h"
+#include "logger.h"
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+namespace _3fd
+{
+namespace core
+{
+    using std::string;
+
+    /// <summary>
+    /// A histogram of durations (in nanoseconds) in the fashion of HDR histograms: the buckets are
+    /// linear inside each power of 2, with 16 buckets per octave, so any recorded value is known
+    /// within a relative error of about 6%, while the whole range of 64 bits takes only 976 counters.
+    /// Only one thread can record into a histogram, but any thread can read it concurrently.
+    /// </summary>
+    class LatencyHistogram : notcopiable
+    {
+    public:
+
+        static const uint32_t numBuckets = 976;
+
+    private:
+
+        std::atomic<uint64_t> m_counts[numBuckets];
+        std::atomic<uint64_t> m_count;
+        std::atomic<uint64_t> m_sum;
+        std::atomic<uint64_t> m_min;
+        std::atomic<uint64_t> m_max;
+
+        /// <summary>
+        /// Increments a counter, which is only written by a single thread, hence no atomic RMW.
+        /// </summary>
+        static void Increment(std::atomic<uint64_t> &counter, uint64_t value) NOEXCEPT
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+    public:
+
+        static uint32_t GetBucketIndex(uint64_t value) NOEXCEPT;
+
+        static uint64_t GetBucketHighestValue(uint32_t bucketIdx) NOEXCEPT;
+
+        LatencyHistogram();
+
+        /// <summary>
+        /// Records a value. Only the thread owning the histogram can call this.
+        /// </summary>
+        /// <param name="value">The value to record.</param>
+        void Record(uint64_t value) NOEXCEPT
+        {
+            Increment(m_counts[GetBucketIndex(value)], 1);
+            Increment(m_count, 1);
+            Increment(m_sum, value);
+
+            if (value < m_min.load(std::memory_order_relaxed))
+                m_min.store(value, std::memory_order_relaxed);
+
+            if (value > m_max.load(std::memory_order_relaxed))
+                m_max.store(value, std::memory_order_relaxed);
+        }
+
+        void Add(const LatencyHistogram &other) NOEXCEPT;
+
+        /// <summary>
+        /// Gets how many values have been recorded.
+        /// </summary>
+        uint64_t GetCount() const NOEXCEPT { return m_count.load(std::memory_order_relaxed); }
+
+        /// <summary>
+        /// Gets the lowest value recorded, or zero when the histogram is empty.
+        /// </summary>
+        uint64_t GetMin() const NOEXCEPT { return GetCount() > 0 ? m_min.load(std::memory_order_relaxed) : 0; }
+
+        /// <summary>
+        /// Gets the highest value recorded.
+        /// </summary>
+        uint64_t GetMax() const NOEXCEPT { return m_max.load(std::memory_order_relaxed); }
+
+        double GetMean() const NOEXCEPT;
+
+        uint64_t GetPercentile(double percentile) const NOEXCEPT;
+    };
+
+    /// <summary>
+    /// Holds the statistics of a named timer, merged from all threads.
+    /// All durations are in nanoseconds.
+    /// </summary>
+    struct TimingSummary
+    {
+        string name;
+        uint64_t count;
+        uint64_t min;
+        uint64_t max;
+        double mean;
+        uint64_t p50;
+        uint64_t p90;
+        uint64_t p99;
+        uint64_t p999;
+    };
+
+    /// <summary>
+    /// Keeps the histograms of the named timers. Every thread records into histograms of its own,
+    /// so recording takes no locks, and these are merged only when a report is requested. When a
+    /// thread exits, its histograms are merged into those of the threads that already finished.
+    /// </summary>
+    class TimingRegistry
+    {
+    private:
+
+        static const uint32_t maxTimers = 1024;
+
+        /// <summary>
+        /// The histograms of a thread, allocated on demand and indexed by timer id.
+        /// </summary>
+        struct ThreadHistograms
+        {
+            std::atomic<LatencyHistogram *> histograms[maxTimers];
+
+            ThreadHistograms();
+            ~ThreadHistograms();
+        };
+
+        thread_local static ThreadHistograms *threadHistograms;
+
+        // whether the histograms of the thread have already been released on its exit
+        thread_local static bool threadFinished;
+
+        struct Registry;
+
+        static Registry &GetRegistry();
+
+        /// <summary>
+        /// Releases the histograms of a thread when it exits.
+        /// </summary>
+        struct ThreadExitTrigger
+        {
+            ~ThreadExitTrigger() { UnregisterThread(); }
+        };
+
+        /// <summary>
+        /// Prevents a default instance of the <see cref="TimingRegistry"/> class from being created.
+        /// </summary>
+        TimingRegistry() {}
+
+        static LatencyHistogram *CreateHistogram(uint32_t timerId) NOEXCEPT;
+
+        static void UnregisterThread();
+
+    public:
+
+        static uint32_t RegisterTimer(const char *name) NOEXCEPT;
+
+        /// <summary>
+        /// Records a duration into the histogram of a timer for the calling thread.
+        /// </summary>
+        /// <param name="timerId">The timer id, as returned by <see cref="TimingRegistry::RegisterTimer"/>.</param>
+        /// <param name="nanosecs">The duration in nanoseconds.</param>
+        static void Record(uint32_t timerId, uint64_t nanosecs) NOEXCEPT
+        {
+            if (timerId >= maxTimers)
+                return;
+
+            LatencyHistogram *histogram;
+            if (threadHistograms == nullptr
+                || (histogram = threadHistograms->histograms[timerId].load(std::memory_order_relaxed)) == nullptr)
+            {
+                histogram = CreateHistogram(timerId);
+                if (histogram == nullptr)
+                    return;
+            }
+
+            histogram->Record(nanosecs);
+        }
+
+        static std::vector<TimingSummary> GetSummaries();
+
+        static string GetReportAsText();
+
+        static string GetReportAsJson();
+
+        static void WriteToLog(Logger::Priority prio = Logger::PRIO_INFORMATION);
+    };
+
+    /// <summary>
+    /// Records how long the enclosing scope takes into the histogram of a named timer.
+    /// Use it through the macros SCOPED_TIMER or CALL_STACK_TRACE_TIMED.
+    /// </summary>
+    class ScopedTimer : notcopiable
+    {
+    private:
+
+        const uint32_t m_timerId;
+        const std::chrono::steady_clock::time_point m_start;
+
+    public:
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="ScopedTimer"/> class.
+        /// </summary>
+        /// <param name="timerId">The timer id, as returned by <see cref="TimingRegistry::RegisterTimer"/>.</param>
+        explicit ScopedTimer(uint32_t timerId)
+            : m_timerId(timerId)
+            , m_start(std::chrono::steady_clock::now()) {}
+
+        /// <summary>
+        /// Finalizes an instance of the <see cref="ScopedTimer"/> class.
+        /// </summary>
+        ~ScopedTimer()
+        {
+            auto elapsed = std::chrono::steady_clock::now() - m_start;
+            TimingRegistry::Record(m_timerId, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+    };
+
+}// end of namespace core
+}// end of namespace _3fd
+
+#endif // header guard
@@ -3,7 +3,9 @@
 
 #include "exceptions.h"
 
+#include <atomic>
 #include <cinttypes>
+#include <cstddef>
 #include <condition_variable>
 #include <functional>
 #include <future>
@@ -12,6 +14,7 @@
 #include <mutex>
 #include <queue>
 #include <stack>
+#include <string>
 #include <vector>
 
 #ifdef _3FD_HAS_STLOPTIMALLOC
@@ -278,6 +281,165 @@ namespace utils
         void Shrink();
     };
 
+    /// <summary>
+    /// A monotonic region of memory for request-scoped work. Allocation just bumps
+    /// a pointer inside the current chunk, there is no individual deallocation, and
+    /// the memory is reclaimed all at once (either by rewinding to a checkpoint or by
+    /// releasing the whole region). The arena was designed for SINGLE-THREAD access.
+    /// </summary>
+    class Arena : notcopiable
+    {
+    private:
+
+        /// <summary>
+        /// Header of a chunk of memory, whose usable room comes right after it.
+        /// </summary>
+        struct Chunk
+        {
+            Chunk *previous;
+            size_t size;
+        };
+
+        Chunk *m_curChunk;
+        Chunk *m_spareChunks;
+
+        char *m_nextAddr;
+        char *m_end;
+
+        const size_t m_chunkSize;
+
+        void AllocateChunk(size_t minSize);
+
+        static void FreeChunks(Chunk *chunk) NOEXCEPT;
+
+    public:
+
+        /// <summary>
+        /// Marks a position in the arena to which it can be later rewound.
+        /// </summary>
+        struct Checkpoint
+        {
+            void *chunk;
+            char *nextAddr;
+        };
+
+        Arena(size_t chunkSize = 16384);
+
+        Arena(Arena &&ob);
+
+        ~Arena();
+
+        void *Allocate(size_t nBytes, size_t alignment = alignof(std::max_align_t));
+
+        /// <summary>
+        /// Allocates room for an array of objects in the arena (not initialized).
+        /// </summary>
+        /// <param name="count">How many objects.</param>
+        /// <returns>A pointer to the allocated memory.</returns>
+        template <typename Type>
+        Type *AllocateArray(size_t count)
+        {
+            return static_cast<Type *> (Allocate(count * sizeof(Type), alignof(Type)));
+        }
+
+        Checkpoint GetCheckpoint() const NOEXCEPT;
+
+        void Rewind(const Checkpoint &checkpoint) NOEXCEPT;
+
+        void Release() NOEXCEPT;
+    };
+
+    /// <summary>
+    /// Rewinds an arena to the point it was upon construction of this
+    /// object when the scope ends. Scopes can be nested.
+    /// </summary>
+    class ArenaScope : notcopiable
+    {
+    private:
+
+        Arena &m_arena;
+        Arena::Checkpoint m_checkpoint;
+
+    public:
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="ArenaScope"/> class.
+        /// </summary>
+        /// <param name="arena">The arena to rewind at the end of the scope.</param>
+        ArenaScope(Arena &arena)
+            : m_arena(arena)
+            , m_checkpoint(arena.GetCheckpoint())
+        {}
+
+        /// <summary>
+        /// Finalizes an instance of the <see cref="ArenaScope"/> class.
+        /// </summary>
+        ~ArenaScope()
+        {
+            m_arena.Rewind(m_checkpoint);
+        }
+    };
+
+    /// <summary>
+    /// Implements a minimal STL allocator that takes memory from an <see cref="Arena"/>.
+    /// Deallocation is a no-op, hence the container must not outlive the arena region
+    /// it was built in (including rewinding to a checkpoint before it was created).
+    /// </summary>
+    template <typename Type>
+    class ArenaAllocator
+    {
+    private:
+
+        template <typename OtherType> friend class ArenaAllocator;
+
+        Arena *m_arena;
+
+    public:
+
+        typedef Type value_type;
+
+        ArenaAllocator(Arena &arena) NOEXCEPT
+            : m_arena(&arena) {}
+
+        // converting copy constructor
+        template <typename OtherType>
+        ArenaAllocator(const ArenaAllocator<OtherType> &ob) NOEXCEPT
+            : m_arena(ob.m_arena) {}
+
+        // allocates blocks of memory
+        Type *allocate(size_t numBlocks)
+        {
+            return m_arena->AllocateArray<Type>(numBlocks);
+        }
+
+        // memory in the arena is only reclaimed all at once
+        void deallocate(Type *, size_t) NOEXCEPT {}
+
+        template <typename OtherType>
+        bool operator==(const ArenaAllocator<OtherType> &that) const NOEXCEPT
+        {
+            return m_arena == that.m_arena;
+        }
+
+        template <typename OtherType>
+        bool operator!=(const ArenaAllocator<OtherType> &that) const NOEXCEPT
+        {
+            return !(*this == that);
+        }
+    };
+
+    /// <summary>
+    /// A string whose content lives in an <see cref="Arena"/>.
+    /// </summary>
+    template <typename CharType>
+    using ArenaString = std::basic_string<CharType, std::char_traits<CharType>, ArenaAllocator<CharType>>;
+
+    /// <summary>
+    /// A vector whose content lives in an <see cref="Arena"/>.
+    /// </summary>
+    template <typename Type>
+    using ArenaVector = std::vector<Type, ArenaAllocator<Type>>;
+
 
     ////////////////////////////////////////////////
     // Multi-thread and Synchronization Utilities
@@ -306,6 +468,47 @@ namespace utils
         bool WaitFor(unsigned long millisecs);
     };
 
+    /// <summary>
+    /// Implements an event count, which lets threads park when a condition they poll
+    /// (such as a non-empty queue) does not hold, without risk of missing the notification
+    /// and at the cost of a fence when nobody is waiting. The waiter must follow the protocol:
+    /// call <see cref="PrepareWait"/>, check the condition once again, then either call
+    /// <see cref="CancelWait"/> (condition holds) or <see cref="CommitWait"/>.
+    /// </summary>
+    class EventCount
+    {
+    private:
+
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        std::atomic<uint32_t> m_epoch;
+        std::atomic<uint32_t> m_numWaiters;
+
+        void Notify(bool all);
+
+    public:
+
+        EventCount();
+
+        EventCount(const EventCount &) = delete;
+
+        uint32_t PrepareWait();
+
+        void CancelWait();
+
+        void CommitWait(uint32_t key);
+
+        /// <summary>
+        /// Wakes a single waiting thread, if any.
+        /// </summary>
+        void NotifyOne() { Notify(false); }
+
+        /// <summary>
+        /// Wakes all waiting threads.
+        /// </summary>
+        void NotifyAll() { Notify(true); }
+    };
+
     /// <summary>
     /// Provides helpers for asynchronous callbacks.
     /// </summary>
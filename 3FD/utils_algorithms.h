@@ -1,37 +1,382 @@
 #ifndef UTILS_ALGORITHMS_H // header guard
 #define UTILS_ALGORITHMS_H
 
+#include "utils_threadpool.h"
+
+#include <atomic>
 #include <chrono>
 #include <cmath>
 #include <cstdlib>
+#include <exception>
 #include <functional>
 #include <iterator>
 #include <algorithm>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef _3FD_AVX2_CODE
+#   include <immintrin.h>
+#elif defined _MSC_VER && (defined _M_IX86 || defined _M_X64)
+#   include <intrin.h>
+#endif
 
 namespace _3fd
 {
 namespace utils
 {
     /// <summary>
-    /// Binary search in sub-range of vector containing map cases entries.
+    /// A functor to use as 'getKey' when the elements are the keys themselves.
+    /// </summary>
+    struct KeyIdentity
+    {
+        template <typename Type>
+        const Type &operator()(const Type &obj) const NOEXCEPT { return obj; }
+    };
+
+    /// <summary>
+    /// Search policy for the classic binary search, which compares the key in the middle
+    /// for both less and greater (branching on the results) and falls back to a linear
+    /// search when the range is small. This is the default policy.
+    /// </summary>
+    struct ClassicBinSearchPolicy
+    {
+        template <typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+        static IterType LowerBound(IterType begin,
+                                   IterType end,
+                                   const SearchKeyType &searchKey,
+                                   GetKeyFnType &getKey,
+                                   LessFnType &lessThan) NOEXCEPT
+        {
+            while (begin != end)
+            {
+                auto middle = begin + std::distance(begin, end) / 2;
+
+                if (lessThan(getKey(*middle), searchKey))
+                    begin = middle + 1;
+                else
+                    end = middle;
+            }
+
+            return begin;
+        }
+
+        template <typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+        static IterType UpperBound(IterType begin,
+                                   IterType end,
+                                   const SearchKeyType &searchKey,
+                                   GetKeyFnType &getKey,
+                                   LessFnType &lessThan) NOEXCEPT
+        {
+            while (begin != end)
+            {
+                auto middle = begin + std::distance(begin, end) / 2;
+
+                if (lessThan(searchKey, getKey(*middle)))
+                    end = middle;
+                else
+                    begin = middle + 1;
+            }
+
+            return begin;
+        }
+    };
+
+    /// <summary>
+    /// Search policy for a branchless binary search, which only halves the length of
+    /// the range at each step, so the compiler can use a conditional move rather than
+    /// a branch the CPU cannot predict. It does not exit early upon a match.
+    /// </summary>
+    struct BranchlessBinSearchPolicy
+    {
+        template <typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+        static IterType LowerBound(IterType begin,
+                                   IterType end,
+                                   const SearchKeyType &searchKey,
+                                   GetKeyFnType &getKey,
+                                   LessFnType &lessThan) NOEXCEPT
+        {
+            auto length = std::distance(begin, end);
+
+            if (length == 0)
+                return begin;
+
+            while (length > 1)
+            {
+                auto half = length / 2;
+                begin = lessThan(getKey(begin[half]), searchKey) ? begin + half : begin;
+                length -= half;
+            }
+
+            return begin + (lessThan(getKey(*begin), searchKey) ? 1 : 0);
+        }
+
+        template <typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+        static IterType UpperBound(IterType begin,
+                                   IterType end,
+                                   const SearchKeyType &searchKey,
+                                   GetKeyFnType &getKey,
+                                   LessFnType &lessThan) NOEXCEPT
+        {
+            auto length = std::distance(begin, end);
+
+            if (length == 0)
+                return begin;
+
+            while (length > 1)
+            {
+                auto half = length / 2;
+                begin = lessThan(searchKey, getKey(begin[half])) ? begin : begin + half;
+                length -= half;
+            }
+
+            return begin + (lessThan(searchKey, getKey(*begin)) ? 0 : 1);
+        }
+    };
+
+    // Counts the set bits in a 32 bits word
+    inline unsigned int _popcount32(uint32_t word) NOEXCEPT
+    {
+#   if defined _MSC_VER && (defined _M_IX86 || defined _M_X64)
+        return __popcnt(word);
+#   elif defined __GNUG__
+        return __builtin_popcount(word);
+#   else
+        unsigned int count(0);
+        for (; word != 0; word &= word - 1)
+            ++count;
+        return count;
+#   endif
+    }
+
+#   ifdef _3FD_AVX2_CODE
+    /// <summary>
+    /// Counts how many elements come before a (biased) key in the leading blocks of 8 elements
+    /// of a small sorted array, using AVX2. Only invoke this when the CPU supports AVX2.
+    /// </summary>
+    template <bool orEqual>
+    _3FD_AVX2_TARGET size_t _avx2_count_before(const int32_t *data, size_t count, int32_t key, int32_t bias, size_t &idx) NOEXCEPT
+    {
+        size_t result(0);
+        auto keys = _mm256_set1_epi32(key);
+        auto biases = _mm256_set1_epi32(bias);
+
+        for (; idx + 8 <= count; idx += 8)
+        {
+            auto values = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *> (data + idx)), biases);
+            auto mask = orEqual ? _mm256_cmpgt_epi32(values, keys) : _mm256_cmpgt_epi32(keys, values);
+            auto numSet = _popcount32(static_cast<uint32_t> (_mm256_movemask_ps(_mm256_castsi256_ps(mask))));
+            result += orEqual ? 8 - numSet : numSet;
+        }
+
+        return result;
+    }
+
+    /// <summary>
+    /// Counts how many elements come before a (biased) key in the leading blocks of 4 elements
+    /// of a small sorted array, using AVX2. Only invoke this when the CPU supports AVX2.
+    /// </summary>
+    template <bool orEqual>
+    _3FD_AVX2_TARGET size_t _avx2_count_before(const int64_t *data, size_t count, int64_t key, int64_t bias, size_t &idx) NOEXCEPT
+    {
+        size_t result(0);
+        auto keys = _mm256_set1_epi64x(key);
+        auto biases = _mm256_set1_epi64x(bias);
+
+        for (; idx + 4 <= count; idx += 4)
+        {
+            auto values = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *> (data + idx)), biases);
+            auto mask = orEqual ? _mm256_cmpgt_epi64(values, keys) : _mm256_cmpgt_epi64(keys, values);
+            auto numSet = _popcount32(static_cast<uint32_t> (_mm256_movemask_pd(_mm256_castsi256_pd(mask))));
+            result += orEqual ? 4 - numSet : numSet;
+        }
+
+        return result;
+    }
+#   endif
+
+    /// <summary>
+    /// Counts how many elements in a small sorted array come before a key, which is the
+    /// position of the lower bound (or upper bound, when 'orEqual' is set). The values
+    /// are XOR'ed with a bias, so unsigned values can be compared as signed ones. Uses
+    /// AVX2 when the CPU supports it, otherwise a scalar loop the compiler can vectorize.
+    /// </summary>
+    template <bool orEqual>
+    size_t _simd_count_before(const int32_t *data, size_t count, int32_t key, int32_t bias) NOEXCEPT
+    {
+        size_t result(0), idx(0);
+        key ^= bias;
+#   ifdef _3FD_AVX2_CODE
+        if (_3FD_CPU_HAS_AVX2())
+            result = _avx2_count_before<orEqual>(data, count, key, bias, idx);
+#   endif
+        for (; idx < count; ++idx)
+        {
+            auto value = data[idx] ^ bias;
+            result += (orEqual ? !(key < value) : value < key) ? 1 : 0;
+        }
+
+        return result;
+    }
+
+    /// <summary>
+    /// Counts how many elements in a small sorted array come before a key.
+    /// This is the same as the overload above, but for 64 bits integers.
+    /// </summary>
+    template <bool orEqual>
+    size_t _simd_count_before(const int64_t *data, size_t count, int64_t key, int64_t bias) NOEXCEPT
+    {
+        size_t result(0), idx(0);
+        key ^= bias;
+#   ifdef _3FD_AVX2_CODE
+        if (_3FD_CPU_HAS_AVX2())
+            result = _avx2_count_before<orEqual>(data, count, key, bias, idx);
+#   endif
+        for (; idx < count; ++idx)
+        {
+            auto value = data[idx] ^ bias;
+            result += (orEqual ? !(key < value) : value < key) ? 1 : 0;
+        }
+
+        return result;
+    }
+
+    /// <summary>
+    /// Determines whether the SIMD search applies to the given types, which requires
+    /// a contiguous range of 32 or 64 bits integers that are compared as keys themselves.
     /// </summary>
-    /// <param name="begin">An iterator to the first position of the sub-range.
-    /// In the end, this parameter keeps the beginning of the last sub-range this
-    /// iterative algorithm has delved into.</param>
-    /// <param name="begin">An iterator to one past the last position of the sub-range.
-    /// In the end, this parameter keeps the end of the last sub-range this iterative
-    /// algorithm has delved into.</param>
-    /// <param name="searchKey">The key to search for.</param>
-    /// <param name="getKey">A functor that retrieves the key for an object.</param>
-    /// <param name="lessThan">A functor that evaluates when a key value is less than another.</param>
-    /// <returns>An iterator to the found entry. If there was no match,
-    /// 'begin == end' in the position it was supposed to be found.</returns>
     template <typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
-    IterType BinarySearch(IterType &begin,
-                          IterType &end,
-                          SearchKeyType searchKey,
-                          GetKeyFnType getKey,
-                          LessFnType lessThan) NOEXCEPT
+    struct _simd_search_traits
+    {
+        typedef typename std::iterator_traits<IterType>::value_type ValueType;
+
+        static const bool isContiguous =
+            std::is_pointer<IterType>::value
+            || std::is_same<IterType, typename std::vector<ValueType>::iterator>::value
+            || std::is_same<IterType, typename std::vector<ValueType>::const_iterator>::value;
+
+        static const bool value =
+            isContiguous
+            && std::is_integral<ValueType>::value
+            && (sizeof(ValueType) == 4 || sizeof(ValueType) == 8)
+            && std::is_same<typename std::decay<SearchKeyType>::type, ValueType>::value
+            && std::is_same<typename std::decay<GetKeyFnType>::type, KeyIdentity>::value
+            && std::is_same<typename std::decay<LessFnType>::type, std::less<ValueType>>::value;
+
+        // the signed integer type of the same size
+        typedef typename std::conditional<sizeof(ValueType) == 4, int32_t, int64_t>::type SignedType;
+    };
+
+    /// <summary>
+    /// Search policy that narrows down the range with the branchless binary search and, once
+    /// the range is small, finishes with a linear search using SIMD (AVX2 when available).
+    /// SIMD only applies to contiguous ranges of 32/64 bits integers, when 'getKey' is
+    /// <see cref="KeyIdentity"/> and 'lessThan' is 'std::less'. Otherwise, this is the
+    /// same as <see cref="BranchlessBinSearchPolicy"/>.
+    /// </summary>
+    struct SimdBinSearchPolicy
+    {
+        // Gets the size of the range below which the linear search kicks in
+        static size_t GetLinearSearchThreshold() NOEXCEPT
+        {
+#   ifdef _3FD_AVX2_CODE
+            if (_3FD_CPU_HAS_AVX2())
+                return 16;
+#   endif
+            return 1; // without SIMD, the linear search does not pay off
+        }
+
+        template <bool upper, typename IterType, typename SearchKeyType>
+        static IterType Bound(IterType begin, IterType end, const SearchKeyType &searchKey) NOEXCEPT
+        {
+            typedef _simd_search_traits<IterType, SearchKeyType, KeyIdentity, std::less<SearchKeyType>> Traits;
+            typedef typename Traits::SignedType SignedType;
+
+            const SignedType bias = std::is_signed<SearchKeyType>::value
+                ? 0 : static_cast<SignedType> (static_cast<SearchKeyType> (1) << (8 * sizeof(SearchKeyType) - 1));
+
+            auto length = std::distance(begin, end);
+            const auto linearSearchThreshold = GetLinearSearchThreshold();
+
+            while (static_cast<size_t> (length) > linearSearchThreshold)
+            {
+                auto half = length / 2;
+                begin = (upper ? !(searchKey < begin[half]) : begin[half] < searchKey) ? begin + half : begin;
+                length -= half;
+            }
+
+            if (length == 0)
+                return begin;
+
+            return begin + _simd_count_before<upper>(reinterpret_cast<const SignedType *> (&*begin),
+                                                     static_cast<size_t> (length),
+                                                     static_cast<SignedType> (searchKey),
+                                                     bias);
+        }
+
+        template <typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+        static IterType LowerBound(IterType begin,
+                                   IterType end,
+                                   const SearchKeyType &searchKey,
+                                   GetKeyFnType &getKey,
+                                   LessFnType &lessThan) NOEXCEPT
+        {
+            return LowerBound(begin, end, searchKey, getKey, lessThan,
+                std::integral_constant<bool, _simd_search_traits<IterType, SearchKeyType, GetKeyFnType, LessFnType>::value>());
+        }
+
+        template <typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+        static IterType UpperBound(IterType begin,
+                                   IterType end,
+                                   const SearchKeyType &searchKey,
+                                   GetKeyFnType &getKey,
+                                   LessFnType &lessThan) NOEXCEPT
+        {
+            return UpperBound(begin, end, searchKey, getKey, lessThan,
+                std::integral_constant<bool, _simd_search_traits<IterType, SearchKeyType, GetKeyFnType, LessFnType>::value>());
+        }
+
+    private:
+
+        template <typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+        static IterType LowerBound(IterType begin, IterType end, const SearchKeyType &searchKey,
+                                   GetKeyFnType &, LessFnType &, std::true_type) NOEXCEPT
+        {
+            return Bound<false>(begin, end, searchKey);
+        }
+
+        template <typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+        static IterType LowerBound(IterType begin, IterType end, const SearchKeyType &searchKey,
+                                   GetKeyFnType &getKey, LessFnType &lessThan, std::false_type) NOEXCEPT
+        {
+            return BranchlessBinSearchPolicy::LowerBound(begin, end, searchKey, getKey, lessThan);
+        }
+
+        template <typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+        static IterType UpperBound(IterType begin, IterType end, const SearchKeyType &searchKey,
+                                   GetKeyFnType &, LessFnType &, std::true_type) NOEXCEPT
+        {
+            return Bound<true>(begin, end, searchKey);
+        }
+
+        template <typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+        static IterType UpperBound(IterType begin, IterType end, const SearchKeyType &searchKey,
+                                   GetKeyFnType &getKey, LessFnType &lessThan, std::false_type) NOEXCEPT
+        {
+            return BranchlessBinSearchPolicy::UpperBound(begin, end, searchKey, getKey, lessThan);
+        }
+    };
+
+    /// <summary>
+    /// Classic binary search in sub-range, which returns as soon as a match is found.
+    /// </summary>
+    template <typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+    IterType _binary_search_impl(ClassicBinSearchPolicy,
+                                 IterType &begin,
+                                 IterType &end,
+                                 SearchKeyType &searchKey,
+                                 GetKeyFnType &getKey,
+                                 LessFnType &lessThan) NOEXCEPT
     {
         auto length = std::distance(begin, end);
 
@@ -67,7 +412,67 @@ namespace utils
         return begin;
     }
 
-    template <typename IterType1,
+    /// <summary>
+    /// Binary search in sub-range using the lower bound provided by the search policy.
+    /// When there is a match, the sub-range is narrowed down to the first matching entry.
+    /// </summary>
+    template <typename SearchPolicyType, typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+    IterType _binary_search_impl(SearchPolicyType,
+                                 IterType &begin,
+                                 IterType &end,
+                                 SearchKeyType &searchKey,
+                                 GetKeyFnType &getKey,
+                                 LessFnType &lessThan) NOEXCEPT
+    {
+        auto lowerBound = SearchPolicyType::LowerBound(begin, end, searchKey, getKey, lessThan);
+
+        begin = lowerBound;
+
+        if (lowerBound != end && !lessThan(searchKey, getKey(*lowerBound)))
+            end = lowerBound + 1;
+        else
+            end = lowerBound;
+
+        return lowerBound;
+    }
+
+    /// <summary>
+    /// Binary search in sub-range of vector containing map cases entries.
+    /// </summary>
+    /// <param name="begin">An iterator to the first position of the sub-range.
+    /// In the end, this parameter keeps the beginning of the last sub-range this
+    /// iterative algorithm has delved into.</param>
+    /// <param name="begin">An iterator to one past the last position of the sub-range.
+    /// In the end, this parameter keeps the end of the last sub-range this iterative
+    /// algorithm has delved into.</param>
+    /// <param name="searchKey">The key to search for.</param>
+    /// <param name="getKey">A functor that retrieves the key for an object.</param>
+    /// <param name="lessThan">A functor that evaluates when a key value is less than another.</param>
+    /// <typeparam name="SearchPolicyType">The search policy, such as <see cref="ClassicBinSearchPolicy"/>
+    /// (default), <see cref="BranchlessBinSearchPolicy"/> or <see cref="SimdBinSearchPolicy"/>.</typeparam>
+    /// <returns>An iterator to the found entry. If there was no match,
+    /// 'begin == end' in the position it was supposed to be found.</returns>
+    template <typename SearchPolicyType = ClassicBinSearchPolicy,
+              typename IterType,
+              typename SearchKeyType,
+              typename GetKeyFnType,
+              typename LessFnType>
+    IterType BinarySearch(IterType &begin,
+                          IterType &end,
+                          SearchKeyType searchKey,
+                          GetKeyFnType getKey,
+                          LessFnType lessThan) NOEXCEPT
+    {
+        return _binary_search_impl(SearchPolicyType(),
+                                   begin,
+                                   end,
+                                   searchKey,
+                                   getKey,
+                                   lessThan);
+    }
+
+    template <typename SearchPolicyType = ClassicBinSearchPolicy,
+              typename IterType1,
               typename IterType2,
               typename SearchKeyType,
               typename GetKeyFnType,
@@ -78,13 +483,132 @@ namespace utils
                            GetKeyFnType getKey,
                            LessFnType lessThan) NOEXCEPT
     {
-        return BinarySearch(begin,
+        return BinarySearch<SearchPolicyType>(begin,
                             end,
                             searchKey,
                             getKey,
                             lessThan);
     }
 
+    /// <summary>
+    /// Finds the lower bound for a key by galloping backwards from an entry known to match it,
+    /// probing at exponentially growing distances until an entry less than the key is found,
+    /// and then using the search policy in the last gap. This takes O(log n) steps for a run of
+    /// n matching entries, regardless of the size of the whole range.
+    /// </summary>
+    /// <param name="begin">An iterator to the first position of the range to search.</param>
+    /// <param name="match">An iterator to an entry known to match the key.</param>
+    /// <returns>An iterator to the first entry not less than the key.</returns>
+    template <typename SearchPolicyType, typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+    IterType _gallop_lower_bound(IterType begin,
+                                 IterType match,
+                                 const SearchKeyType &searchKey,
+                                 GetKeyFnType &getKey,
+                                 LessFnType &lessThan) NOEXCEPT
+    {
+        decltype(std::distance(begin, match)) step(1);
+
+        while (step <= std::distance(begin, match))
+        {
+            auto probe = match - step;
+
+            if (lessThan(getKey(*probe), searchKey))
+                return SearchPolicyType::LowerBound(probe + 1, match, searchKey, getKey, lessThan);
+
+            match = probe;
+            step *= 2;
+        }
+
+        return SearchPolicyType::LowerBound(begin, match, searchKey, getKey, lessThan);
+    }
+
+    /// <summary>
+    /// Finds the upper bound for a key by galloping forward from the position past an entry
+    /// known to match it, probing at exponentially growing distances until an entry greater
+    /// than the key is found, and then using the search policy in the last gap.
+    /// </summary>
+    /// <param name="begin">An iterator to the position past an entry known to match the key.</param>
+    /// <param name="end">An iterator to one past the last position of the range to search.</param>
+    /// <returns>An iterator to the first entry greater than the key.</returns>
+    template <typename SearchPolicyType, typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+    IterType _gallop_upper_bound(IterType begin,
+                                 IterType end,
+                                 const SearchKeyType &searchKey,
+                                 GetKeyFnType &getKey,
+                                 LessFnType &lessThan) NOEXCEPT
+    {
+        decltype(std::distance(begin, end)) step(1);
+
+        while (step <= std::distance(begin, end))
+        {
+            auto probe = begin + (step - 1);
+
+            if (lessThan(searchKey, getKey(*probe)))
+                return SearchPolicyType::UpperBound(begin, probe, searchKey, getKey, lessThan);
+
+            begin = probe + 1;
+            step *= 2;
+        }
+
+        return SearchPolicyType::UpperBound(begin, end, searchKey, getKey, lessThan);
+    }
+
+    /// <summary>
+    /// Gets the sub range of entries that match the given key using the lower
+    /// bound provided by the search policy, then galloping to the upper bound.
+    /// </summary>
+    template <typename SearchPolicyType, typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+    bool _bin_search_subrange_impl(SearchPolicyType,
+                                   IterType &subRangeBegin,
+                                   IterType &subRangeEnd,
+                                   SearchKeyType &searchKey,
+                                   GetKeyFnType &getKey,
+                                   LessFnType &lessThan) NOEXCEPT
+    {
+        auto lowerBound = SearchPolicyType::LowerBound(subRangeBegin, subRangeEnd, searchKey, getKey, lessThan);
+
+        subRangeBegin = lowerBound;
+
+        // no match?
+        if (lowerBound == subRangeEnd || lessThan(searchKey, getKey(*lowerBound)))
+        {
+            subRangeEnd = lowerBound;
+            return false;
+        }
+
+        subRangeEnd = _gallop_upper_bound<SearchPolicyType>(lowerBound + 1, subRangeEnd, searchKey, getKey, lessThan);
+        return true;
+    }
+
+    /// <summary>
+    /// Gets the sub range of entries that match the given key using the classic binary search,
+    /// which stops at the first match found. Because every partition discarded until then has
+    /// only entries either less or greater than the key, all matches are in the last partition,
+    /// so the bounds are found by galloping from the first match to both sides of it.
+    /// </summary>
+    template <typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+    bool _bin_search_subrange_impl(ClassicBinSearchPolicy,
+                                   IterType &subRangeBegin,
+                                   IterType &subRangeEnd,
+                                   SearchKeyType &searchKey,
+                                   GetKeyFnType &getKey,
+                                   LessFnType &lessThan) NOEXCEPT
+    {
+        auto firstMatch = BinarySearch(subRangeBegin,
+                                       subRangeEnd,
+                                       searchKey,
+                                       getKey,
+                                       lessThan);
+
+        // no match?
+        if (subRangeBegin == subRangeEnd)
+            return false;
+
+        subRangeBegin = _gallop_lower_bound<ClassicBinSearchPolicy>(subRangeBegin, firstMatch, searchKey, getKey, lessThan);
+        subRangeEnd = _gallop_upper_bound<ClassicBinSearchPolicy>(firstMatch + 1, subRangeEnd, searchKey, getKey, lessThan);
+        return true;
+    }
+
     /// <summary>
     /// Gets the sub range of entries that match the given key (using binary search).
     /// </summary>
@@ -95,56 +619,431 @@ namespace utils
     /// <param name="searchKey">The key to search.</param>
     /// <param name="getKey">A functor that retrieves the key for an object.</param>
     /// <param name="lessThan">A functor that evaluates when a key value is less than another.</param>
+    /// <typeparam name="SearchPolicyType">The search policy, such as <see cref="ClassicBinSearchPolicy"/>
+    /// (default), <see cref="BranchlessBinSearchPolicy"/> or <see cref="SimdBinSearchPolicy"/>.</typeparam>
     /// <returns>When a sub-range has been found, returns <c>true</c> and
     /// 'subRangeBegin != subRangeEnd', otherwise, returns <c>false</c> and
     /// 'subRangeBegin == subRangeEnd' in the position it was supposed to be found.</returns>
-    template <typename IterType, typename SearchKeyType, typename GetKeyFnType, typename LessFnType>
+    template <typename SearchPolicyType = ClassicBinSearchPolicy,
+              typename IterType,
+              typename SearchKeyType,
+              typename GetKeyFnType,
+              typename LessFnType>
     bool BinSearchSubRange(IterType &subRangeBegin,
                            IterType &subRangeEnd,
                            SearchKeyType searchKey,
                            GetKeyFnType getKey,
                            LessFnType lessThan) NOEXCEPT
     {
-        auto firstMatch = BinarySearch(subRangeBegin,
-                                       subRangeEnd,
-                                       searchKey,
-                                       getKey,
-                                       lessThan);
+        return _bin_search_subrange_impl(SearchPolicyType(),
+                                         subRangeBegin,
+                                         subRangeEnd,
+                                         searchKey,
+                                         getKey,
+                                         lessThan);
+    }
 
-        // no match?
-        if (subRangeBegin == subRangeEnd)
-            return false;
+    /// <summary>
+    /// Keeps a copy of the keys from a sorted range in the Eytzinger layout (the
+    /// breadth-first order of a complete binary search tree), so that the first levels
+    /// of the search share cache lines and the next ones can be prefetched. This pays
+    /// off for large ranges that are searched many times more than they change.
+    /// </summary>
+    template <typename KeyType>
+    class EytzingerLayout
+    {
+    private:
 
-        auto end = firstMatch;
+        std::vector<KeyType> m_keys; // 1-based, position 0 is not used
+        std::vector<size_t> m_ranks; // position of each key in the sorted range
 
-        do // iterate to find lower bound:
+        template <typename IterType, typename GetKeyFnType>
+        void Fill(IterType begin, GetKeyFnType &getKey, size_t &rank, size_t node)
         {
-            // search another match in the left partition:
-            end = BinarySearch(subRangeBegin,
-                               end,
-                               searchKey,
-                               getKey,
-                               lessThan);
+            // in-order traversal of the implicit tree visits the keys in sorted order:
+            if (node < m_keys.size())
+            {
+                Fill(begin, getKey, rank, 2 * node);
+                m_keys[node] = getKey(begin[rank]);
+                m_ranks[node] = rank++;
+                Fill(begin, getKey, rank, 2 * node + 1);
+            }
+        }
 
-        } while (subRangeBegin != end);
+    public:
 
-        /* Now go back to the partition at the right of the first
-        match, and start looking for the end of the range: */
+        /// <summary>
+        /// Initializes a new instance of the <see cref="EytzingerLayout{KeyType}"/> class.
+        /// </summary>
+        /// <param name="begin">An iterator to the first position of the sorted range.</param>
+        /// <param name="end">An iterator to one past the last position of the sorted range.</param>
+        /// <param name="getKey">A functor that retrieves the key for an object.</param>
+        template <typename IterType, typename GetKeyFnType>
+        EytzingerLayout(IterType begin, IterType end, GetKeyFnType getKey)
+            : m_keys(std::distance(begin, end) + 1)
+            , m_ranks(std::distance(begin, end) + 1)
+        {
+            size_t rank(0);
+            Fill(begin, getKey, rank, 1);
+        }
 
-        auto begin = firstMatch;
+        /// <summary>
+        /// Gets how many keys are in the layout.
+        /// </summary>
+        /// <returns>The size of the original range.</returns>
+        size_t GetSize() const { return m_keys.size() - 1; }
 
-        do  // iterate to find upper bound:
+        /// <summary>
+        /// Searches the position of the first key not less than the given one.
+        /// </summary>
+        /// <param name="searchKey">The key to search.</param>
+        /// <param name="lessThan">A functor that evaluates when a key value is less than another.</param>
+        /// <returns>The position of the lower bound in the original range
+        /// (the size of the range when all keys are less than the given one).</returns>
+        template <typename LessFnType>
+        size_t LowerBound(const KeyType &searchKey, LessFnType lessThan) const NOEXCEPT
         {
-            // search another match in the right partition:
-            begin = BinarySearch(begin + 1,
-                                 subRangeEnd,
-                                 searchKey,
-                                 getKey,
-                                 lessThan);
+            // how many keys fit a cache line, which is how many levels below the prefetch reaches:
+            const size_t keysPerCacheLine = (sizeof(KeyType) < 64) ? 64 / sizeof(KeyType) : 1;
 
-        } while (begin != subRangeEnd);
+            const auto numKeys = m_keys.size();
+            size_t node(1);
 
-        return true;
+            while (node < numKeys)
+            {
+#   ifdef __GNUG__
+                if (node * keysPerCacheLine < numKeys)
+                    __builtin_prefetch(&m_keys[node * keysPerCacheLine]);
+#   endif
+                node = 2 * node + (lessThan(m_keys[node], searchKey) ? 1 : 0);
+            }
+
+            // the lower bound is where the search last went left, so drop the trailing right turns and that one:
+            while ((node & 1) != 0)
+                node >>= 1;
+
+            node >>= 1;
+
+            return (node != 0) ? m_ranks[node] : GetSize();
+        }
+    };
+
+    /// <summary>
+    /// Runs two functors in parallel, one in the calling thread and the other
+    /// in the thread pool, and returns when both have finished. While waiting,
+    /// the calling thread helps the pool, so nested calls do not exhaust it.
+    /// An exception thrown by any of the functors is forwarded to the caller.
+    /// </summary>
+    /// <param name="left">The functor to run in the calling thread.</param>
+    /// <param name="right">The functor to run in the thread pool.</param>
+    /// <param name="pool">The thread pool.</param>
+    template <typename LeftFnType, typename RightFnType>
+    void _fork_join_impl(LeftFnType &left, RightFnType &right, ThreadPool &pool)
+    {
+        std::atomic<bool> rightDone(false);
+        std::exception_ptr leftEx, rightEx;
+
+        pool.Post([&right, &rightDone, &rightEx]()
+        {
+            try
+            {
+                right();
+            }
+            catch (...)
+            {
+                rightEx = std::current_exception();
+            }
+
+            rightDone.store(true, std::memory_order_release);
+        });
+
+        try
+        {
+            left();
+        }
+        catch (...)
+        {
+            leftEx = std::current_exception();
+        }
+
+        while (!rightDone.load(std::memory_order_acquire))
+        {
+            if (!pool.TryRunPendingTask())
+                std::this_thread::yield();
+        }
+
+        if (leftEx)
+            std::rethrow_exception(leftEx);
+
+        if (rightEx)
+            std::rethrow_exception(rightEx);
+    }
+
+    template <typename IndexType, typename FnType>
+    void _parallel_for_impl(IndexType begin, IndexType end, size_t grainSize, FnType &fn, ThreadPool &pool)
+    {
+        if (static_cast<size_t> (end - begin) <= grainSize)
+        {
+            for (auto idx = begin; idx != end; ++idx)
+                fn(idx);
+
+            return;
+        }
+
+        auto middle = begin + (end - begin) / 2;
+        auto left = [begin, middle, grainSize, &fn, &pool]() { _parallel_for_impl(begin, middle, grainSize, fn, pool); };
+        auto right = [middle, end, grainSize, &fn, &pool]() { _parallel_for_impl(middle, end, grainSize, fn, pool); };
+        _fork_join_impl(left, right, pool);
+    }
+
+    /// <summary>
+    /// Invokes a functor for each index (or random access iterator) in a range,
+    /// in parallel, by recursively splitting the range in halves.
+    /// </summary>
+    /// <param name="begin">The first index of the range.</param>
+    /// <param name="end">One past the last index of the range.</param>
+    /// <param name="grainSize">The size of the sub-ranges processed
+    /// sequentially, which must be large enough to pay off the overhead.</param>
+    /// <param name="fn">The functor, which receives an index and is invoked concurrently.</param>
+    /// <param name="pool">The thread pool.</param>
+    template <typename IndexType, typename FnType>
+    void ParallelFor(IndexType begin,
+                     IndexType end,
+                     size_t grainSize,
+                     FnType fn,
+                     ThreadPool &pool = ThreadPool::GetDefault())
+    {
+        _ASSERTE(grainSize > 0);
+        _parallel_for_impl(begin, end, grainSize, fn, pool);
+    }
+
+    template <typename IndexType, typename ValueType, typename MapFnType, typename ReduceFnType>
+    ValueType _parallel_reduce_impl(IndexType begin,
+                                    IndexType end,
+                                    size_t grainSize,
+                                    const ValueType &identity,
+                                    MapFnType &map,
+                                    ReduceFnType &reduce,
+                                    ThreadPool &pool)
+    {
+        if (static_cast<size_t> (end - begin) <= grainSize)
+        {
+            ValueType result(identity);
+
+            for (auto idx = begin; idx != end; ++idx)
+                result = reduce(result, map(idx));
+
+            return result;
+        }
+
+        auto middle = begin + (end - begin) / 2;
+        ValueType leftResult(identity), rightResult(identity);
+
+        auto left = [&]() { leftResult = _parallel_reduce_impl(begin, middle, grainSize, identity, map, reduce, pool); };
+        auto right = [&]() { rightResult = _parallel_reduce_impl(middle, end, grainSize, identity, map, reduce, pool); };
+        _fork_join_impl(left, right, pool);
+
+        return reduce(leftResult, rightResult);
+    }
+
+    /// <summary>
+    /// Maps each index (or random access iterator) in a range to a value and
+    /// reduces them all to a single value, in parallel. The order of the operands
+    /// is preserved, hence the reduction needs to be associative, but not commutative.
+    /// </summary>
+    /// <param name="begin">The first index of the range.</param>
+    /// <param name="end">One past the last index of the range.</param>
+    /// <param name="grainSize">The size of the sub-ranges processed sequentially.</param>
+    /// <param name="identity">The identity value for the reduction.</param>
+    /// <param name="map">The functor that maps an index to a value, invoked concurrently.</param>
+    /// <param name="reduce">The functor that combines two values, invoked concurrently.</param>
+    /// <param name="pool">The thread pool.</param>
+    /// <returns>The reduction of all values mapped from the range.</returns>
+    template <typename IndexType, typename ValueType, typename MapFnType, typename ReduceFnType>
+    ValueType ParallelReduce(IndexType begin,
+                             IndexType end,
+                             size_t grainSize,
+                             ValueType identity,
+                             MapFnType map,
+                             ReduceFnType reduce,
+                             ThreadPool &pool = ThreadPool::GetDefault())
+    {
+        _ASSERTE(grainSize > 0);
+        return _parallel_reduce_impl(begin, end, grainSize, identity, map, reduce, pool);
+    }
+
+    /// <summary>
+    /// Merges two sorted ranges into another one (moving the elements) in parallel,
+    /// by splitting at the middle of the longer range and at the corresponding
+    /// bound in the other one. Equivalent elements keep their relative order.
+    /// </summary>
+    template <typename InIterType, typename OutIterType, typename LessFnType>
+    void _parallel_merge_impl(InIterType leftBegin, InIterType leftEnd,
+                              InIterType rightBegin, InIterType rightEnd,
+                              OutIterType dest,
+                              size_t grainSize,
+                              LessFnType &lessThan,
+                              ThreadPool &pool)
+    {
+        auto leftLength = leftEnd - leftBegin;
+        auto rightLength = rightEnd - rightBegin;
+
+        /* Splitting makes progress only when the longer range has 2 or more elements,
+        otherwise the same subproblem would come back forever when the grain is 1: */
+        if (static_cast<size_t> (leftLength + rightLength) <= std::max(grainSize, static_cast<size_t> (2))
+            || leftLength == 0 || rightLength == 0)
+        {
+            std::merge(std::make_move_iterator(leftBegin), std::make_move_iterator(leftEnd),
+                       std::make_move_iterator(rightBegin), std::make_move_iterator(rightEnd),
+                       dest, lessThan);
+            return;
+        }
+
+        InIterType leftMiddle, rightMiddle;
+
+        // split at the middle of the longer range, keeping equivalent elements from the left first:
+        if (leftLength >= rightLength)
+        {
+            leftMiddle = leftBegin + leftLength / 2;
+            rightMiddle = std::lower_bound(rightBegin, rightEnd, *leftMiddle, lessThan);
+        }
+        else
+        {
+            rightMiddle = rightBegin + rightLength / 2;
+            leftMiddle = std::upper_bound(leftBegin, leftEnd, *rightMiddle, lessThan);
+        }
+
+        auto destMiddle = dest + (leftMiddle - leftBegin) + (rightMiddle - rightBegin);
+
+        auto first = [=, &lessThan, &pool]()
+        {
+            _parallel_merge_impl(leftBegin, leftMiddle, rightBegin, rightMiddle, dest, grainSize, lessThan, pool);
+        };
+
+        auto second = [=, &lessThan, &pool]()
+        {
+            _parallel_merge_impl(leftMiddle, leftEnd, rightMiddle, rightEnd, destMiddle, grainSize, lessThan, pool);
+        };
+
+        _fork_join_impl(first, second, pool);
+    }
+
+    /// <summary>
+    /// Sorts a range in parallel, leaving the result either in the range
+    /// itself or in the auxiliary buffer. At each level of recursion, the
+    /// sorted halves are placed in the opposite storage and then merged back.
+    /// </summary>
+    template <typename IterType1, typename IterType2, typename LessFnType>
+    void _parallel_merge_sort_impl(IterType1 begin, IterType1 end,
+                                   IterType2 buffer,
+                                   bool toBuffer,
+                                   size_t grainSize,
+                                   LessFnType &lessThan,
+                                   ThreadPool &pool)
+    {
+        auto length = end - begin;
+
+        if (static_cast<size_t> (length) <= grainSize)
+        {
+            std::stable_sort(begin, end, lessThan);
+
+            if (toBuffer)
+                std::move(begin, end, buffer);
+
+            return;
+        }
+
+        auto middle = begin + length / 2;
+        auto bufMiddle = buffer + length / 2;
+
+        auto left = [=, &lessThan, &pool]() { _parallel_merge_sort_impl(begin, middle, buffer, !toBuffer, grainSize, lessThan, pool); };
+        auto right = [=, &lessThan, &pool]() { _parallel_merge_sort_impl(middle, end, bufMiddle, !toBuffer, grainSize, lessThan, pool); };
+        _fork_join_impl(left, right, pool);
+
+        if (toBuffer)
+            _parallel_merge_impl(begin, middle, middle, end, buffer, grainSize, lessThan, pool);
+        else
+            _parallel_merge_impl(buffer, bufMiddle, bufMiddle, buffer + length, begin, grainSize, lessThan, pool);
+    }
+
+    /// <summary>
+    /// Sorts a range in parallel using merge sort, which is stable.
+    /// An auxiliary buffer as large as the range is allocated.
+    /// </summary>
+    /// <param name="begin">An iterator to the first position of the range.</param>
+    /// <param name="end">An iterator to one past the last position of the range.</param>
+    /// <param name="lessThan">A functor that evaluates when an element is less than another.</param>
+    /// <param name="grainSize">The size of the sub-ranges sorted (or merged) sequentially.</param>
+    /// <param name="pool">The thread pool.</param>
+    template <typename IterType, typename LessFnType>
+    void ParallelMergeSort(IterType begin,
+                           IterType end,
+                           LessFnType lessThan,
+                           size_t grainSize = 8192,
+                           ThreadPool &pool = ThreadPool::GetDefault())
+    {
+        _ASSERTE(grainSize > 0);
+
+        if (static_cast<size_t> (end - begin) <= grainSize)
+        {
+            std::stable_sort(begin, end, lessThan);
+            return;
+        }
+
+        /* The elements are moved to the buffer, which is then sorted
+        having the moved-from elements in the range as auxiliary storage: */
+        typedef typename std::iterator_traits<IterType>::value_type ValueType;
+        std::vector<ValueType> buffer(std::make_move_iterator(begin), std::make_move_iterator(end));
+
+        _parallel_merge_sort_impl(buffer.begin(), buffer.end(), begin, true, grainSize, lessThan, pool);
+    }
+
+    template <typename IterType, typename PredFnType>
+    IterType _parallel_partition_impl(IterType begin, IterType end, size_t grainSize, PredFnType &pred, ThreadPool &pool)
+    {
+        if (static_cast<size_t> (end - begin) <= grainSize)
+            return std::partition(begin, end, pred);
+
+        auto middle = begin + (end - begin) / 2;
+        IterType leftPoint, rightPoint;
+
+        auto left = [&]() { leftPoint = _parallel_partition_impl(begin, middle, grainSize, pred, pool); };
+        auto right = [&]() { rightPoint = _parallel_partition_impl(middle, end, grainSize, pred, pool); };
+        _fork_join_impl(left, right, pool);
+
+        /* Now the layout is [true|false][true|false], so swap the false elements
+        from the left half with as many true elements from the end of the right
+        half (or vice-versa), which does not need to keep their order: */
+        auto numLeftFalse = middle - leftPoint;
+        auto numRightTrue = rightPoint - middle;
+        auto numSwaps = std::min(numLeftFalse, numRightTrue);
+        auto swapDest = rightPoint - numSwaps;
+
+        auto swapElem = [leftPoint, swapDest](IterType iter) { std::iter_swap(iter, swapDest + (iter - leftPoint)); };
+        _parallel_for_impl(leftPoint, leftPoint + numSwaps, grainSize, swapElem, pool);
+
+        return leftPoint + numRightTrue;
+    }
+
+    /// <summary>
+    /// Partitions a range in parallel, so that the elements that satisfy a predicate come first.
+    /// Like <c>std::partition</c>, the relative order of the elements is not preserved.
+    /// </summary>
+    /// <param name="begin">An iterator to the first position of the range.</param>
+    /// <param name="end">An iterator to one past the last position of the range.</param>
+    /// <param name="pred">The predicate, invoked concurrently.</param>
+    /// <param name="grainSize">The size of the sub-ranges partitioned sequentially.</param>
+    /// <param name="pool">The thread pool.</param>
+    /// <returns>An iterator to the first element of the second group.</returns>
+    template <typename IterType, typename PredFnType>
+    IterType ParallelPartition(IterType begin,
+                               IterType end,
+                               PredFnType pred,
+                               size_t grainSize = 8192,
+                               ThreadPool &pool = ThreadPool::GetDefault())
+    {
+        _ASSERTE(grainSize > 0);
+        return _parallel_partition_impl(begin, end, grainSize, pred, pool);
     }
 
     /// <summary>
@@ -0,0 +1,184 @@
+#include "stdafx.h"
+#include "utils.h"
+#include "exceptions.h"
+
+#include <cassert>
+#include <cstdlib>
+
+namespace _3fd
+{
+namespace utils
+{
+    ////////////////////////////////
+    // Arena Class
+    ////////////////////////////////
+
+    /* The size of the chunk header rounded up to the maximum alignment, so the
+    payload that comes right after it is suitably aligned for any object: */
+    static const size_t chunkHeaderSize =
+        (2 * sizeof(void *) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="Arena"/> class.
+    /// No memory is allocated until the first request is made.
+    /// </summary>
+    /// <param name="chunkSize">The size (in bytes) of the chunks the arena takes from the heap.
+    /// Requests larger than that are served by a chunk dedicated to them.</param>
+    Arena::Arena(size_t chunkSize) :
+        m_curChunk(nullptr),
+        m_spareChunks(nullptr),
+        m_nextAddr(nullptr),
+        m_end(nullptr),
+        m_chunkSize(chunkSize)
+    {
+        _ASSERTE(chunkSize > 0); // Cannot handle a null value as the amount of memory
+    }
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="Arena"/> class using move semantics.
+    /// </summary>
+    /// <param name="ob">The object whose resources will be stolen.</param>
+    Arena::Arena(Arena &&ob) :
+        m_curChunk(ob.m_curChunk),
+        m_spareChunks(ob.m_spareChunks),
+        m_nextAddr(ob.m_nextAddr),
+        m_end(ob.m_end),
+        m_chunkSize(ob.m_chunkSize)
+    {
+        ob.m_curChunk = ob.m_spareChunks = nullptr;
+        ob.m_nextAddr = ob.m_end = nullptr;
+    }
+
+    /// <summary>
+    /// Finalizes an instance of the <see cref="Arena"/> class.
+    /// </summary>
+    Arena::~Arena()
+    {
+        Release();
+    }
+
+    /// <summary>
+    /// Frees a linked list of chunks.
+    /// </summary>
+    /// <param name="chunk">The head of the list.</param>
+    void Arena::FreeChunks(Chunk *chunk) NOEXCEPT
+    {
+        while (chunk != nullptr)
+        {
+            auto previous = chunk->previous;
+            free(chunk);
+            chunk = previous;
+        }
+    }
+
+    /// <summary>
+    /// Makes a new chunk the current one, reusing a spare chunk when possible.
+    /// </summary>
+    /// <param name="minSize">The minimum usable room (in bytes) the chunk must have.</param>
+    void Arena::AllocateChunk(size_t minSize)
+    {
+        Chunk *chunk(nullptr);
+
+        // first look for a spare chunk (left behind by a rewind) big enough:
+        Chunk **link = &m_spareChunks;
+        while (*link != nullptr)
+        {
+            if ((*link)->size >= minSize)
+            {
+                chunk = *link;
+                *link = chunk->previous;
+                break;
+            }
+
+            link = &(*link)->previous;
+        }
+
+        if (chunk == nullptr)
+        {
+            auto size = (minSize > m_chunkSize) ? minSize : m_chunkSize;
+            chunk = static_cast<Chunk *> (malloc(chunkHeaderSize + size));
+
+            if (chunk == nullptr)
+                throw core::AppException<std::runtime_error>("Failed to allocate memory for arena", "std::malloc");
+
+            chunk->size = size;
+        }
+
+        chunk->previous = m_curChunk;
+        m_curChunk = chunk;
+        m_nextAddr = reinterpret_cast<char *> (chunk) + chunkHeaderSize;
+        m_end = m_nextAddr + chunk->size;
+    }
+
+    /// <summary>
+    /// Allocates memory from the arena.
+    /// </summary>
+    /// <param name="nBytes">The amount of bytes to allocate.</param>
+    /// <param name="alignment">The alignment (a power of 2, not greater than the one of 'std::max_align_t').</param>
+    /// <returns>A pointer to the allocated memory.</returns>
+    void * Arena::Allocate(size_t nBytes, size_t alignment)
+    {
+        _ASSERTE(alignment > 0 && (alignment & (alignment - 1)) == 0); // alignment must be a power of 2
+        _ASSERTE(alignment <= alignof(std::max_align_t)); // chunks do not guarantee stricter alignment
+
+        auto addr = reinterpret_cast<char *> (
+            (reinterpret_cast<uintptr_t> (m_nextAddr) + alignment - 1) & ~(uintptr_t)(alignment - 1)
+        );
+
+        if (m_nextAddr == nullptr || addr + nBytes > m_end)
+        {
+            // the chunk payload is aligned for any object, so no padding is needed:
+            AllocateChunk(nBytes);
+            addr = m_nextAddr;
+        }
+
+        m_nextAddr = addr + nBytes;
+        return addr;
+    }
+
+    /// <summary>
+    /// Gets a checkpoint marking the current position in the arena.
+    /// </summary>
+    /// <returns>The checkpoint to which the arena can be later rewound.</returns>
+    Arena::Checkpoint Arena::GetCheckpoint() const NOEXCEPT
+    {
+        return Checkpoint{ m_curChunk, m_nextAddr };
+    }
+
+    /// <summary>
+    /// Rewinds the arena to a checkpoint, which reclaims all memory allocated after it.
+    /// The chunks left behind are kept for reuse, so that repeatedly rewinding an arena
+    /// (such as once per request) does not hit the heap anymore after warming up.
+    /// </summary>
+    /// <param name="checkpoint">The checkpoint, which cannot have been invalidated by
+    /// a previous rewind to an earlier position.</param>
+    void Arena::Rewind(const Checkpoint &checkpoint) NOEXCEPT
+    {
+        while (m_curChunk != checkpoint.chunk)
+        {
+            _ASSERTE(m_curChunk != nullptr); // the checkpoint does not belong to this arena
+            auto chunk = m_curChunk;
+            m_curChunk = chunk->previous;
+            chunk->previous = m_spareChunks;
+            m_spareChunks = chunk;
+        }
+
+        m_nextAddr = checkpoint.nextAddr;
+        m_end = (m_curChunk != nullptr)
+            ? reinterpret_cast<char *> (m_curChunk) + chunkHeaderSize + m_curChunk->size
+            : nullptr;
+    }
+
+    /// <summary>
+    /// Releases the whole region, returning all the memory held by the arena to the heap.
+    /// </summary>
+    void Arena::Release() NOEXCEPT
+    {
+        FreeChunks(m_curChunk);
+        FreeChunks(m_spareChunks);
+        m_curChunk = m_spareChunks = nullptr;
+        m_nextAddr = m_end = nullptr;
+    }
+
+} // end of namespace utils
+} // end of namespace _3fd
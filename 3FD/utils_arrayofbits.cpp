@@ -1,53 +1,158 @@
 #include "stdafx.h"
-#include "utils.h"
+#include "arrayofbits.h"
 #include "exceptions.h"
 
 #include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#ifdef _3FD_AVX2_CODE
+#   include <immintrin.h>
+#endif
 
 namespace _3fd
 {
 namespace utils
 {
+    // All bits activated in a word
+    static const uint64_t allOnes = ~static_cast<uint64_t> (0);
+
+    /// <summary>
+    /// Gets the position of the most significant activated bit in a word, which cannot be zero.
+    /// </summary>
+    static unsigned int GetIdxHiActBitInWord(uint64_t word)
+    {
+        _ASSERTE(word != 0); // it is assumed there is an activated bit
+#   if defined __GNUG__
+        return 63 - __builtin_clzll(word);
+#   elif defined _MSC_VER && (defined _M_X64 || defined _M_ARM64)
+        unsigned long pos;
+        _BitScanReverse64(&pos, word);
+        return pos;
+#   else
+        unsigned int pos(63);
+        for (; (word & (static_cast<uint64_t> (1) << 63)) == 0; word <<= 1)
+            --pos;
+        return pos;
+#   endif
+    }
+
+    /// <summary>
+    /// Counts the activated bits in a word.
+    /// </summary>
+    static unsigned int PopCount(uint64_t word)
+    {
+#   if defined __GNUG__
+        return __builtin_popcountll(word);
+#   elif defined _MSC_VER && defined _M_X64
+        return static_cast<unsigned int> (__popcnt64(word));
+#   else
+        word = word - ((word >> 1) & 0x5555555555555555ULL);
+        word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+        word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        return static_cast<unsigned int> ((word * 0x0101010101010101ULL) >> 56);
+#   endif
+    }
+
+    /// <summary>
+    /// Determines whether the 4 words starting at a given address have no bit set
+    /// after being XOR'ed with a mask (which is either all zeros or all ones).
+    /// </summary>
+    static bool IsChunkEmpty(const uint64_t *chunk, uint64_t flip)
+    {
+        return ((chunk[0] ^ flip) | (chunk[1] ^ flip) | (chunk[2] ^ flip) | (chunk[3] ^ flip)) == 0;
+    }
+
     /// <summary>
-    /// Gets the room in words that fits a given amount of bits.
+    /// Moves a word index forward past the chunks of 4 words that have no bit set (after the XOR).
     /// </summary>
-    /// <param name="nBits">The amount of bits.</param>
-    /// <returns>The minimum room in words (32/64 bits) necessary to store the given amount of bits.</returns>
-    static size_t GetRoomInWordsFor(size_t nBits)
+    static void SkipEmptyChunksForward(const uint64_t *data, size_t &wordIdx, size_t numWords, uint64_t flip)
     {
-        const auto bitsInWord = 8 * sizeof(void *);
-        unsigned int correction = (nBits % bitsInWord > 0) ? 1 : 0;
-        return correction + nBits / bitsInWord;
+        while (wordIdx + 4 <= numWords && IsChunkEmpty(data + wordIdx, flip))
+            wordIdx += 4;
     }
 
+    /// <summary>
+    /// Moves a word index backward past the chunks of 4 words (ending at the index) that have
+    /// no bit set (after the XOR). Returns <c>false</c> if everything down to the start is empty.
+    /// </summary>
+    static bool SkipEmptyChunksBackward(const uint64_t *data, size_t &wordIdx, uint64_t flip)
+    {
+        while (wordIdx >= 3 && IsChunkEmpty(data + wordIdx - 3, flip))
+        {
+            if (wordIdx < 4)
+                return false;
+
+            wordIdx -= 4;
+        }
+
+        return true;
+    }
+
+#   ifdef _3FD_AVX2_CODE
+    /// <summary>
+    /// Same as <see cref="IsChunkEmpty"/>, but using AVX2.
+    /// </summary>
+    _3FD_AVX2_TARGET static bool IsChunkEmptyAvx2(const uint64_t *chunk, uint64_t flip)
+    {
+        auto data = _mm256_loadu_si256(reinterpret_cast<const __m256i *> (chunk));
+        return (flip == 0)
+            ? _mm256_testz_si256(data, data) != 0 // all zeros?
+            : _mm256_testc_si256(data, _mm256_set1_epi64x(-1)) != 0; // all ones?
+    }
+
+    /// <summary>
+    /// Same as <see cref="SkipEmptyChunksForward"/>, but using AVX2.
+    /// </summary>
+    _3FD_AVX2_TARGET static void SkipEmptyChunksForwardAvx2(const uint64_t *data, size_t &wordIdx, size_t numWords, uint64_t flip)
+    {
+        while (wordIdx + 4 <= numWords && IsChunkEmptyAvx2(data + wordIdx, flip))
+            wordIdx += 4;
+    }
+
+    /// <summary>
+    /// Same as <see cref="SkipEmptyChunksBackward"/>, but using AVX2.
+    /// </summary>
+    _3FD_AVX2_TARGET static bool SkipEmptyChunksBackwardAvx2(const uint64_t *data, size_t &wordIdx, uint64_t flip)
+    {
+        while (wordIdx >= 3 && IsChunkEmptyAvx2(data + wordIdx - 3, flip))
+        {
+            if (wordIdx < 4)
+                return false;
+
+            wordIdx -= 4;
+        }
+
+        return true;
+    }
+#   endif
+
     /// <summary>
     /// Initializes a new instance of the <see cref="ArrayOfBits"/> class.
     /// </summary>
     /// <param name="nBits">The number of bits.</param>
     /// <param name="val">if set to <c>true</c>, initialize all bits in the array as activated, otherwise, deactivated.</param>
-    ArrayOfBits::ArrayOfBits(size_t nBits, bool val) : 
+    ArrayOfBits::ArrayOfBits(size_t nBits, bool val) :
         m_nBits(nBits),
-        m_data(nullptr)
+        m_data(nullptr),
+        m_activatedBitsCount(0)
     {
-        if (val)
-        {
-            const auto nBytes = GetRoomInWordsFor(nBits) * sizeof(void *);
-            m_data = (uintptr_t *)malloc(nBytes);
+        // allocate at least one word, so the searches never have to check for an empty array:
+        const auto numWords = (nBits > 0) ? GetNumWords() : 1;
+        m_data = static_cast<uint64_t *> (calloc(numWords, sizeof(uint64_t)));
 
-            if (m_data == nullptr)
-                throw core::AppException<std::runtime_error>("Failed to allocate memory for array of bits", "std::malloc");
+        if (m_data == nullptr)
+            throw core::AppException<std::runtime_error>("Failed to allocate memory for array of bits", "std::calloc");
 
-            memset(m_data, 0xff, nBytes);
-            m_activatedBitsCount = nBytes;
-        }
-        else
+        if (val && nBits > 0)
         {
-            m_data = (uintptr_t *)calloc(GetRoomInWordsFor(nBits), sizeof(void *));
+            memset(m_data, 0xff, numWords * sizeof(uint64_t));
 
-            if (m_data == nullptr)
-                throw core::AppException<std::runtime_error>("Failed to allocate memory for array of bits", "std::calloc");
+            // unused bits in the last word are kept deactivated:
+            if (nBits % 64 != 0)
+                m_data[numWords - 1] = allOnes >> (64 - nBits % 64);
 
-            m_activatedBitsCount = 0;
+            m_activatedBitsCount = nBits;
         }
     }
 
@@ -55,12 +160,12 @@ namespace utils
     /// Initializes a new instance of the <see cref="ArrayOfBits"/> class using move semantics.
     /// </summary>
     /// <param name="ob">The object whose resources will be stolen.</param>
-    ArrayOfBits::ArrayOfBits(ArrayOfBits &&ob) : 
+    ArrayOfBits::ArrayOfBits(ArrayOfBits &&ob) :
         m_nBits(ob.m_nBits),
         m_data(ob.m_data),
         m_activatedBitsCount(ob.m_activatedBitsCount)
     {
-        ob.m_data = 0;
+        ob.m_data = nullptr;
     }
 
     /// <summary>
@@ -76,17 +181,15 @@ namespace utils
     /// Gets the memory address of the word containing a given bit in the array.
     /// </summary>
     /// <param name="bitIdx">The index of the desired bit.</param>
-    /// <param name="bitInPos">The position (0 based) of the bit inside the word, increasing from the least to the most significant bit.</param>
+    /// <param name="mask">Receives a mask for the bit inside the word.</param>
     /// <returns>
     /// A pointer to the word inside the array that contains the bit in the specified position.
     /// </returns>
-    uintptr_t * ArrayOfBits::GetWord(size_t bitIdx, uint32_t &bitInPos) const
+    uint64_t * ArrayOfBits::GetWord(size_t bitIdx, uint64_t &mask) const
     {
         _ASSERTE(bitIdx < m_nBits); // out-of-bound memory access violation!
-        const auto bitsInWord = 8 * sizeof(void *);
-        auto wordIdx = bitIdx / bitsInWord;
-        bitInPos = (wordIdx - 1) - (bitIdx - wordIdx * bitsInWord);
-        return m_data + wordIdx;
+        mask = static_cast<uint64_t> (1) << (bitIdx % 64);
+        return m_data + bitIdx / 64;
     }
 
     /// <summary>
@@ -96,31 +199,89 @@ namespace utils
     /// <returns><c>true</c> when the specified bit is activated, otherwise, <c>false</c>.</returns>
     bool ArrayOfBits::operator[](size_t bitIdx) const
     {
-        uint32_t bitPos;
-        uintptr_t *ptr = GetWord(bitIdx, bitPos);
-        uintptr_t mask = 1 << bitPos;
+        uint64_t mask;
+        auto ptr = GetWord(bitIdx, mask);
         return (*ptr & mask) != 0;
     }
 
     /// <summary>
-    /// Gets the bit index of the most significant activated bit inside the given word.
+    /// Finds the first bit at or after a given position whose state differs from a mask.
+    /// Empty regions are skipped 256 bits at a time.
     /// </summary>
-    /// <param name="word">The given word.</param>
-    /// <returns>The position (0 based) of the bit, increasing along with the data address.</returns>
-    /// <remarks>This algorithm works for little-endian byte encoding only!</remarks>
-    static uint32_t GetIdxHiActBitInWord(uintptr_t word)
+    /// <param name="bitIdx">The index where to start the search.</param>
+    /// <param name="flip">All zeros to look for an activated bit, or all ones to look for a deactivated bit.</param>
+    /// <returns>The index of the bit found. If none has been found, returns the same as 'Size()'.</returns>
+    size_t ArrayOfBits::FindNext(size_t bitIdx, uint64_t flip) const
     {
-        _ASSERTE(word != 0); // it is assumed there is an activated bit
+        if (bitIdx >= m_nBits)
+            return m_nBits;
 
-        auto movingBit = 1 + (~(uintptr_t)0 >> 1); // start from the most significant bit
-        uint32_t pos(0);
-        while (word & movingBit == 0)
+        const auto numWords = GetNumWords();
+        auto wordIdx = bitIdx / 64;
+        auto word = (m_data[wordIdx] ^ flip) & (allOnes << (bitIdx % 64));
+
+        while (word == 0)
         {
-            ++pos;
-            movingBit >>= 1;
+            if (++wordIdx == numWords)
+                return m_nBits;
+
+#   ifdef _3FD_AVX2_CODE
+            if (_3FD_CPU_HAS_AVX2())
+                SkipEmptyChunksForwardAvx2(m_data, wordIdx, numWords, flip);
+            else
+#   endif
+                SkipEmptyChunksForward(m_data, wordIdx, numWords, flip);
+
+            if (wordIdx == numWords)
+                return m_nBits;
+
+            word = m_data[wordIdx] ^ flip;
         }
 
-        return pos;
+        // unused bits in the last word show up as deactivated, so the result must be checked:
+        auto foundIdx = wordIdx * 64 + _count_trailing_zeros64(word);
+        return (foundIdx < m_nBits) ? foundIdx : m_nBits;
+    }
+
+    /// <summary>
+    /// Finds the last bit at or before a given position whose state differs from a mask.
+    /// Empty regions are skipped 256 bits at a time.
+    /// </summary>
+    /// <param name="bitIdx">The index where to start the search (backwards).</param>
+    /// <param name="flip">All zeros to look for an activated bit, or all ones to look for a deactivated bit.</param>
+    /// <returns>The index of the bit found. If none has been found, returns the same as 'Size()'.</returns>
+    size_t ArrayOfBits::FindPrevious(size_t bitIdx, uint64_t flip) const
+    {
+        if (m_nBits == 0)
+            return m_nBits;
+
+        if (bitIdx >= m_nBits)
+            bitIdx = m_nBits - 1;
+
+        auto wordIdx = bitIdx / 64;
+        auto word = (m_data[wordIdx] ^ flip) & (allOnes >> (63 - bitIdx % 64));
+
+        while (word == 0)
+        {
+            if (wordIdx == 0)
+                return m_nBits;
+
+            --wordIdx;
+
+#   ifdef _3FD_AVX2_CODE
+            const bool found = _3FD_CPU_HAS_AVX2()
+                ? SkipEmptyChunksBackwardAvx2(m_data, wordIdx, flip)
+                : SkipEmptyChunksBackward(m_data, wordIdx, flip);
+#   else
+            const bool found = SkipEmptyChunksBackward(m_data, wordIdx, flip);
+#   endif
+            if (!found)
+                return m_nBits;
+
+            word = m_data[wordIdx] ^ flip;
+        }
+
+        return wordIdx * 64 + GetIdxHiActBitInWord(word);
     }
 
     /// <summary>
@@ -131,136 +292,507 @@ namespace utils
     /// </returns>
     size_t ArrayOfBits::FindFirstActivated() const
     {
-        if (m_activatedBitsCount > 0)
+        return (m_activatedBitsCount > 0) ? FindNext(0, 0) : m_nBits;
+    }
+
+    /// <summary>
+    /// Finds the first deactivated bit in the array.
+    /// </summary>
+    /// <returns>
+    /// The index where the first deactivated bit has been found. If none has been found, returns the same as 'Size()'.
+    /// </returns>
+    size_t ArrayOfBits::FindFirstDeactivated() const
+    {
+        return (m_activatedBitsCount < m_nBits) ? FindNext(0, allOnes) : m_nBits;
+    }
+
+    /// <summary>
+    /// Finds the last activated bit in the array.
+    /// </summary>
+    /// <returns>
+    /// The index where the last activated bit has been found. If none has been found, returns the same as 'Size()'.
+    /// </returns>
+    size_t ArrayOfBits::FindLastActivated() const
+    {
+        return (m_activatedBitsCount > 0) ? FindPrevious(m_nBits - 1, 0) : m_nBits;
+    }
+
+    /// <summary>
+    /// Finds the last deactivated bit in the array.
+    /// </summary>
+    /// <returns>
+    /// The index where the last deactivated bit has been found. If none has been found, returns the same as 'Size()'.
+    /// </returns>
+    size_t ArrayOfBits::FindLastDeactivated() const
+    {
+        return (m_activatedBitsCount < m_nBits) ? FindPrevious(m_nBits - 1, allOnes) : m_nBits;
+    }
+
+    /// <summary>
+    /// Finds the first activated bit at or after a given position.
+    /// </summary>
+    /// <param name="bitIdx">The index where to start the search.</param>
+    /// <returns>
+    /// The index where the activated bit has been found. If none has been found, returns the same as 'Size()'.
+    /// </returns>
+    size_t ArrayOfBits::FindNextActivated(size_t bitIdx) const
+    {
+        return FindNext(bitIdx, 0);
+    }
+
+    /// <summary>
+    /// Finds the first deactivated bit at or after a given position.
+    /// </summary>
+    /// <param name="bitIdx">The index where to start the search.</param>
+    /// <returns>
+    /// The index where the deactivated bit has been found. If none has been found, returns the same as 'Size()'.
+    /// </returns>
+    size_t ArrayOfBits::FindNextDeactivated(size_t bitIdx) const
+    {
+        return FindNext(bitIdx, allOnes);
+    }
+
+    /// <summary>
+    /// Activates a given bit.
+    /// </summary>
+    /// <param name="bitIdx">The bit index.</param>
+    void ArrayOfBits::Activate(size_t bitIdx)
+    {
+        uint64_t mask;
+        auto ptr = GetWord(bitIdx, mask);
+
+        if ((*ptr & mask) == 0)
+        {
+            *ptr |= mask;
+            ++m_activatedBitsCount;
+        }
+    }
+
+    /// <summary>
+    /// Deactivates a given bit.
+    /// </summary>
+    /// <param name="bitIdx">The bit index.</param>
+    void ArrayOfBits::Deactivate(size_t bitIdx)
+    {
+        uint64_t mask;
+        auto ptr = GetWord(bitIdx, mask);
+
+        if ((*ptr & mask) != 0)
         {
-            const auto bitsInWord = 8 * sizeof(void *);
-            const auto last = m_data + m_nBits / bitsInWord;
+            *ptr &= ~mask;
+            --m_activatedBitsCount;
+        }
+    }
 
-            auto iter = m_data;
-            while (iter < last && *iter == 0)
-                ++iter;
+    /// <summary>
+    /// Sets the state of all bits in a given range.
+    /// </summary>
+    /// <param name="beginIdx">The index of the first bit in the range.</param>
+    /// <param name="endIdx">The index one past the last bit in the range.</param>
+    /// <param name="val">if set to <c>true</c>, activates the bits, otherwise, deactivates them.</param>
+    void ArrayOfBits::SetRange(size_t beginIdx, size_t endIdx, bool val)
+    {
+        _ASSERTE(beginIdx <= endIdx && endIdx <= m_nBits); // out-of-bound memory access violation!
 
-            if (iter < last)
-                return (iter - m_data) + GetIdxHiActBitInWord(*iter);
+        if (beginIdx == endIdx)
+            return;
 
-            /* The last word might contain unused bits that must be ignored. The bits to take into
-            account are the ones which contribute above a given value, as calculated below: */
-            auto unusedBits = (1 << (bitsInWord - (Size() % bitsInWord))) - 1;
-            if (*iter > unusedBits)
-                return (iter - m_data) + GetIdxHiActBitInWord(*iter);
+        auto firstWordIdx = beginIdx / 64;
+        auto lastWordIdx = (endIdx - 1) / 64;
+        auto firstMask = allOnes << (beginIdx % 64);
+        auto lastMask = allOnes >> (63 - (endIdx - 1) % 64);
+
+        // how many bits are activated in the range before the change:
+        size_t countBefore;
+
+        if (firstWordIdx == lastWordIdx)
+        {
+            auto mask = firstMask & lastMask;
+            countBefore = PopCount(m_data[firstWordIdx] & mask);
+            m_data[firstWordIdx] = val ? (m_data[firstWordIdx] | mask) : (m_data[firstWordIdx] & ~mask);
+        }
+        else
+        {
+            countBefore = PopCount(m_data[firstWordIdx] & firstMask)
+                        + PopCount(m_data[lastWordIdx] & lastMask);
+
+            for (auto wordIdx = firstWordIdx + 1; wordIdx < lastWordIdx; ++wordIdx)
+                countBefore += PopCount(m_data[wordIdx]);
+
+            m_data[firstWordIdx] = val ? (m_data[firstWordIdx] | firstMask) : (m_data[firstWordIdx] & ~firstMask);
+            m_data[lastWordIdx] = val ? (m_data[lastWordIdx] | lastMask) : (m_data[lastWordIdx] & ~lastMask);
+            memset(m_data + firstWordIdx + 1, val ? 0xff : 0, (lastWordIdx - firstWordIdx - 1) * sizeof(uint64_t));
         }
 
-        return Size();
+        if (val)
+            m_activatedBitsCount += (endIdx - beginIdx) - countBefore;
+        else
+            m_activatedBitsCount -= countBefore;
     }
 
     /// <summary>
-    /// Finds the first deactivated bit in the array.
+    /// Counts the activated bits in a given range.
     /// </summary>
-    /// <returns>The index where the first deactivated bit has been found.</returns>
-    size_t ArrayOfBits::FindFirstDeactivated() const
+    /// <param name="beginIdx">The index of the first bit in the range.</param>
+    /// <param name="endIdx">The index one past the last bit in the range.</param>
+    /// <returns>How many bits are activated in the range.</returns>
+    size_t ArrayOfBits::CountActivated(size_t beginIdx, size_t endIdx) const
     {
-        if (m_activatedBitsCount < m_nBits)
+        _ASSERTE(beginIdx <= endIdx && endIdx <= m_nBits); // out-of-bound memory access violation!
+
+        if (beginIdx == endIdx)
+            return 0;
+
+        auto firstWordIdx = beginIdx / 64;
+        auto lastWordIdx = (endIdx - 1) / 64;
+        auto firstMask = allOnes << (beginIdx % 64);
+        auto lastMask = allOnes >> (63 - (endIdx - 1) % 64);
+
+        if (firstWordIdx == lastWordIdx)
+            return PopCount(m_data[firstWordIdx] & firstMask & lastMask);
+
+        size_t count = PopCount(m_data[firstWordIdx] & firstMask)
+                     + PopCount(m_data[lastWordIdx] & lastMask);
+
+        for (auto wordIdx = firstWordIdx + 1; wordIdx < lastWordIdx; ++wordIdx)
+            count += PopCount(m_data[wordIdx]);
+
+        return count;
+    }
+
+    /// <summary>
+    /// Checks whether another array has the same size as this one.
+    /// </summary>
+    /// <param name="other">The other array.</param>
+    void ArrayOfBits::CheckSameSize(const ArrayOfBits &other) const
+    {
+        if (other.m_nBits != m_nBits)
         {
-            const auto bitsInWord = 8 * sizeof(void *);
-            const auto max = ~(uintptr_t)0;
-            const auto last = m_data + m_nBits / bitsInWord;
-
-            auto iter = m_data;
-            while (iter < last && *iter == max)
-                ++iter;
-
-            if (iter < last)
-                return (iter - m_data) + GetIdxHiActBitInWord(~*iter);
-
-            /* The last word might contain unused bits that must be ignored. The bits to take into
-            account are the ones which contribute above a given value, as calculated below: */
-            auto usedBits = ~((1 << (bitsInWord - (Size() % bitsInWord))) - 1);
-            if (*iter < usedBits)
-                return (iter - m_data) + GetIdxHiActBitInWord(~*iter);
+            std::ostringstream oss;
+            oss << "Left operand has " << m_nBits << " bits, whereas the right one has " << other.m_nBits;
+            throw core::AppException<std::invalid_argument>("Bitwise operation on arrays of bits with different sizes", oss.str());
         }
+    }
+
+    /// <summary>
+    /// Applies a bitwise AND with another array of the same size.
+    /// </summary>
+    /// <param name="other">The other array.</param>
+    /// <returns>A reference to this array.</returns>
+    ArrayOfBits & ArrayOfBits::operator&=(const ArrayOfBits &other)
+    {
+        CheckSameSize(other);
+        const auto numWords = GetNumWords();
+        size_t count(0);
+
+        for (size_t wordIdx = 0; wordIdx < numWords; ++wordIdx)
+            count += PopCount(m_data[wordIdx] &= other.m_data[wordIdx]);
 
-        return Size();
+        m_activatedBitsCount = count;
+        return *this;
     }
 
     /// <summary>
-    /// Finds the last activated bit in the array.
+    /// Applies a bitwise OR with another array of the same size.
     /// </summary>
-    /// <returns>
-    /// The index where the last activated bit has been found. If none has been found, returns the same as 'Size()'.
-    /// </returns>
-    size_t ArrayOfBits::FindLastActivated() const
+    /// <param name="other">The other array.</param>
+    /// <returns>A reference to this array.</returns>
+    ArrayOfBits & ArrayOfBits::operator|=(const ArrayOfBits &other)
     {
-        if (m_activatedBitsCount > 0)
+        CheckSameSize(other);
+        const auto numWords = GetNumWords();
+        size_t count(0);
+
+        for (size_t wordIdx = 0; wordIdx < numWords; ++wordIdx)
+            count += PopCount(m_data[wordIdx] |= other.m_data[wordIdx]);
+
+        m_activatedBitsCount = count;
+        return *this;
+    }
+
+    /// <summary>
+    /// Applies a bitwise XOR with another array of the same size.
+    /// </summary>
+    /// <param name="other">The other array.</param>
+    /// <returns>A reference to this array.</returns>
+    ArrayOfBits & ArrayOfBits::operator^=(const ArrayOfBits &other)
+    {
+        CheckSameSize(other);
+        const auto numWords = GetNumWords();
+        size_t count(0);
+
+        for (size_t wordIdx = 0; wordIdx < numWords; ++wordIdx)
+            count += PopCount(m_data[wordIdx] ^= other.m_data[wordIdx]);
+
+        m_activatedBitsCount = count;
+        return *this;
+    }
+
+    ////////////////////////////////////
+    // HierarchicalArrayOfBits Class
+    ////////////////////////////////////
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="HierarchicalArrayOfBits"/> class.
+    /// </summary>
+    /// <param name="nBits">The number of bits.</param>
+    /// <param name="val">if set to <c>true</c>, initialize all bits in the array as activated, otherwise, deactivated.</param>
+    HierarchicalArrayOfBits::HierarchicalArrayOfBits(size_t nBits, bool val) :
+        m_nBits(nBits),
+        m_data(nullptr),
+        m_activatedBitsCount(val ? nBits : 0)
+    {
+        // allocate at least one word, so the searches never have to check for an empty array:
+        const auto numDataWords = (nBits > 0) ? (nBits + 63) / 64 : 1;
+
+        // each level has one bit per word in the level below, up to a level with a single word:
+        std::vector<size_t> levelSizes;
+        auto totalWords = numDataWords;
+        auto numWords = numDataWords;
+        do
+        {
+            numWords = (numWords + 63) / 64;
+            levelSizes.push_back(numWords);
+            totalWords += 2 * numWords;
+        }
+        while (numWords > 1);
+
+        m_levels.reserve(levelSizes.size());
+        m_data = static_cast<uint64_t *> (calloc(totalWords, sizeof(uint64_t)));
+
+        if (m_data == nullptr)
+            throw core::AppException<std::runtime_error>("Failed to allocate memory for array of bits", "std::calloc");
+
+        auto ptr = m_data + numDataWords;
+        for (auto size : levelSizes)
+        {
+            Level level = { ptr, ptr + size };
+            m_levels.push_back(level);
+            ptr += 2 * size;
+        }
+
+        // initialize the bits and the bottom level:
+        for (size_t wordIdx = 0; wordIdx < numDataWords; ++wordIdx)
+        {
+            const auto usedMask = GetUsedMask(wordIdx);
+            const auto bit = static_cast<uint64_t> (1) << (wordIdx % 64);
+
+            if (val)
+                m_data[wordIdx] = usedMask;
+
+            if (m_data[wordIdx] != 0)
+                m_levels[0].nonEmpty[wordIdx / 64] |= bit;
+
+            if (m_data[wordIdx] != usedMask)
+                m_levels[0].nonFull[wordIdx / 64] |= bit;
+        }
+
+        // then the upper levels:
+        for (size_t levelIdx = 1; levelIdx < m_levels.size(); ++levelIdx)
         {
-            const auto bitsInWord = 8 * sizeof(void *);
-            const auto last = m_data + m_nBits / bitsInWord;
-
-            /* Start by the last word, but it might contain unused bits that must be ignored.
-            The bits to take into account are the ones which contribute above a given value,
-            as calculated below : */
-            auto unusedBits = (1 << (bitsInWord - (Size() % bitsInWord))) - 1;
-            if (*last >= unusedBits)
-                return (last - m_data) + GetIdxHiActBitInWord(*last);
-
-            auto iter = last - 1;
-            while (iter >= m_data)
+            auto &below = m_levels[levelIdx - 1];
+            auto &level = m_levels[levelIdx];
+
+            for (size_t wordIdx = 0; wordIdx < levelSizes[levelIdx - 1]; ++wordIdx)
             {
-                if (*iter == 0)
-                    --iter;
-                else
-                    return (iter - m_data) + GetIdxHiActBitInWord(*iter);
+                const auto bit = static_cast<uint64_t> (1) << (wordIdx % 64);
+
+                if (below.nonEmpty[wordIdx] != 0)
+                    level.nonEmpty[wordIdx / 64] |= bit;
+
+                if (below.nonFull[wordIdx] != 0)
+                    level.nonFull[wordIdx / 64] |= bit;
             }
         }
+    }
 
-        return Size();
+    /// <summary>
+    /// Initializes a new instance of the <see cref="HierarchicalArrayOfBits"/> class using move semantics.
+    /// </summary>
+    /// <param name="ob">The object whose resources will be stolen.</param>
+    HierarchicalArrayOfBits::HierarchicalArrayOfBits(HierarchicalArrayOfBits &&ob) :
+        m_nBits(ob.m_nBits),
+        m_data(ob.m_data),
+        m_levels(std::move(ob.m_levels)),
+        m_activatedBitsCount(ob.m_activatedBitsCount)
+    {
+        ob.m_data = nullptr;
     }
 
     /// <summary>
-    /// Finds the last activated bit in the array.
+    /// Finalizes an instance of the <see cref="HierarchicalArrayOfBits"/> class.
     /// </summary>
-    /// <returns>The index where the last deactivated bit has been found.</returns>
-    size_t ArrayOfBits::FindLastDeactivated() const
+    HierarchicalArrayOfBits::~HierarchicalArrayOfBits()
+    {
+        if (m_data != nullptr)
+            free(m_data);
+    }
+
+    /// <summary>
+    /// Gets a mask for the bits in a word that are in use, so a word is full when equal to it.
+    /// </summary>
+    /// <param name="wordIdx">The index of the word.</param>
+    /// <returns>A mask with the bits in use activated.</returns>
+    uint64_t HierarchicalArrayOfBits::GetUsedMask(size_t wordIdx) const
     {
-        if (m_activatedBitsCount < m_nBits)
+        if (wordIdx < m_nBits / 64)
+            return allOnes;
+
+        return (m_nBits % 64 != 0) ? allOnes >> (64 - m_nBits % 64) : 0;
+    }
+
+    /// <summary>
+    /// Sets the bit for a word in a summary, going up the levels as long as
+    /// the summary word changes from empty to non-empty, or vice versa.
+    /// </summary>
+    /// <param name="summary">Which summary to update.</param>
+    /// <param name="wordIdx">The index of the word in the array.</param>
+    /// <param name="val">The value to set in the summary.</param>
+    void HierarchicalArrayOfBits::Propagate(uint64_t *Level::*summary, size_t wordIdx, bool val)
+    {
+        for (auto &level : m_levels)
         {
-            const auto bitsInWord = 8 * sizeof(void *);
-            const auto last = m_data + m_nBits / bitsInWord;
-
-            /* Start by the last word, but it might contain unused bits that must be ignored.
-            The bits to take into account are the ones which contribute above a given value,
-            as calculated below : */
-            auto usedBits = ~((1 << (bitsInWord - (Size() % bitsInWord))) - 1);
-            if (*last < usedBits)
-                return (last - m_data) + GetIdxHiActBitInWord(~*last);
-
-            const auto max = ~(uintptr_t)0;
-            auto iter = last - 1;
-            while (iter >= m_data)
-            {
-                if (*iter == max)
-                    --iter;
-                else
-                    return (iter - m_data) + GetIdxHiActBitInWord(~*iter);
-            }
+            auto &word = (level.*summary)[wordIdx / 64];
+            const bool wasEmpty = (word == 0);
+            const auto bit = static_cast<uint64_t> (1) << (wordIdx % 64);
+            word = val ? (word | bit) : (word & ~bit);
+
+            if (wasEmpty == (word == 0))
+                break;
+
+            wordIdx /= 64;
+        }
+    }
+
+    /// <summary>
+    /// Updates the summaries after a word in the array has changed.
+    /// </summary>
+    /// <param name="wordIdx">The index of the word.</param>
+    /// <param name="before">The content of the word before the change.</param>
+    /// <param name="after">The content of the word after the change.</param>
+    void HierarchicalArrayOfBits::UpdateSummaries(size_t wordIdx, uint64_t before, uint64_t after)
+    {
+        if ((before == 0) != (after == 0))
+            Propagate(&Level::nonEmpty, wordIdx, after != 0);
+
+        const auto usedMask = GetUsedMask(wordIdx);
+        if ((before == usedMask) != (after == usedMask))
+            Propagate(&Level::nonFull, wordIdx, after != usedMask);
+    }
+
+    /// <summary>
+    /// Finds the first bit whose state differs from a mask, descending the summary levels.
+    /// </summary>
+    /// <param name="summary">The summary telling which words have such bits.</param>
+    /// <param name="flip">All zeros to look for an activated bit, or all ones to look for a deactivated bit.</param>
+    /// <returns>The index of the bit found. If none has been found, returns the same as 'Size()'.</returns>
+    size_t HierarchicalArrayOfBits::FindFirst(uint64_t *Level::*summary, uint64_t flip) const
+    {
+        size_t wordIdx(0);
+        for (auto level = m_levels.rbegin(); level != m_levels.rend(); ++level)
+        {
+            auto word = ((*level).*summary)[wordIdx];
+            if (word == 0)
+                return m_nBits; // only happens in the top level
+
+            wordIdx = wordIdx * 64 + _count_trailing_zeros64(word);
         }
 
-        return Size();
+        return wordIdx * 64 + _count_trailing_zeros64((m_data[wordIdx] ^ flip) & GetUsedMask(wordIdx));
+    }
+
+    /// <summary>
+    /// Finds the last bit whose state differs from a mask, descending the summary levels.
+    /// </summary>
+    /// <param name="summary">The summary telling which words have such bits.</param>
+    /// <param name="flip">All zeros to look for an activated bit, or all ones to look for a deactivated bit.</param>
+    /// <returns>The index of the bit found. If none has been found, returns the same as 'Size()'.</returns>
+    size_t HierarchicalArrayOfBits::FindLast(uint64_t *Level::*summary, uint64_t flip) const
+    {
+        size_t wordIdx(0);
+        for (auto level = m_levels.rbegin(); level != m_levels.rend(); ++level)
+        {
+            auto word = ((*level).*summary)[wordIdx];
+            if (word == 0)
+                return m_nBits; // only happens in the top level
+
+            wordIdx = wordIdx * 64 + GetIdxHiActBitInWord(word);
+        }
+
+        return wordIdx * 64 + GetIdxHiActBitInWord((m_data[wordIdx] ^ flip) & GetUsedMask(wordIdx));
+    }
+
+    /// <summary>
+    /// Gets the state of a specified bit.
+    /// </summary>
+    /// <param name="bitIdx">The index of the bit.</param>
+    /// <returns><c>true</c> when the specified bit is activated, otherwise, <c>false</c>.</returns>
+    bool HierarchicalArrayOfBits::operator[](size_t bitIdx) const
+    {
+        _ASSERTE(bitIdx < m_nBits); // out-of-bound memory access violation!
+        return (m_data[bitIdx / 64] & (static_cast<uint64_t> (1) << (bitIdx % 64))) != 0;
+    }
+
+    /// <summary>
+    /// Finds the first activated bit in the array.
+    /// </summary>
+    /// <returns>
+    /// The index where the first activated bit has been found. If none has been found, returns the same as 'Size()'.
+    /// </returns>
+    size_t HierarchicalArrayOfBits::FindFirstActivated() const
+    {
+        return FindFirst(&Level::nonEmpty, 0);
+    }
+
+    /// <summary>
+    /// Finds the first deactivated bit in the array.
+    /// </summary>
+    /// <returns>
+    /// The index where the first deactivated bit has been found. If none has been found, returns the same as 'Size()'.
+    /// </returns>
+    size_t HierarchicalArrayOfBits::FindFirstDeactivated() const
+    {
+        return FindFirst(&Level::nonFull, allOnes);
+    }
+
+    /// <summary>
+    /// Finds the last activated bit in the array.
+    /// </summary>
+    /// <returns>
+    /// The index where the last activated bit has been found. If none has been found, returns the same as 'Size()'.
+    /// </returns>
+    size_t HierarchicalArrayOfBits::FindLastActivated() const
+    {
+        return FindLast(&Level::nonEmpty, 0);
+    }
+
+    /// <summary>
+    /// Finds the last deactivated bit in the array.
+    /// </summary>
+    /// <returns>
+    /// The index where the last deactivated bit has been found. If none has been found, returns the same as 'Size()'.
+    /// </returns>
+    size_t HierarchicalArrayOfBits::FindLastDeactivated() const
+    {
+        return FindLast(&Level::nonFull, allOnes);
     }
 
     /// <summary>
     /// Activates a given bit.
     /// </summary>
     /// <param name="bitIdx">The bit index.</param>
-    void ArrayOfBits::Activate(size_t bitIdx)
+    void HierarchicalArrayOfBits::Activate(size_t bitIdx)
     {
-        uint32_t bitPos;
-        uintptr_t *ptr = GetWord(bitIdx, bitPos);
-        auto mask = static_cast<uintptr_t> (1 << bitPos);
+        _ASSERTE(bitIdx < m_nBits); // out-of-bound memory access violation!
+        const auto wordIdx = bitIdx / 64;
+        const auto before = m_data[wordIdx];
+        const auto after = before | (static_cast<uint64_t> (1) << (bitIdx % 64));
 
-        if (*ptr & mask == 0)
+        if (after != before)
         {
-            *ptr |= mask;
+            m_data[wordIdx] = after;
             ++m_activatedBitsCount;
+            UpdateSummaries(wordIdx, before, after);
         }
     }
 
@@ -268,18 +800,36 @@ namespace utils
     /// Deactivates a given bit.
     /// </summary>
     /// <param name="bitIdx">The bit index.</param>
-    void ArrayOfBits::Deactivate(size_t bitIdx)
+    void HierarchicalArrayOfBits::Deactivate(size_t bitIdx)
     {
-        uint32_t bitPos;
-        uintptr_t *ptr = GetWord(bitIdx, bitPos);
-        auto mask = static_cast<uintptr_t> (1 << bitPos);
+        _ASSERTE(bitIdx < m_nBits); // out-of-bound memory access violation!
+        const auto wordIdx = bitIdx / 64;
+        const auto before = m_data[wordIdx];
+        const auto after = before & ~(static_cast<uint64_t> (1) << (bitIdx % 64));
 
-        if (*ptr & mask != 0)
+        if (after != before)
         {
-            *ptr &= mask;
+            m_data[wordIdx] = after;
             --m_activatedBitsCount;
+            UpdateSummaries(wordIdx, before, after);
         }
     }
 
+    /// <summary>
+    /// Finds the first deactivated bit and activates it, which is how a slot gets allocated.
+    /// </summary>
+    /// <returns>
+    /// The index of the bit that has been activated. If none was deactivated, returns the same as 'Size()'.
+    /// </returns>
+    size_t HierarchicalArrayOfBits::ActivateFirstDeactivated()
+    {
+        auto bitIdx = FindFirstDeactivated();
+
+        if (bitIdx < m_nBits)
+            Activate(bitIdx);
+
+        return bitIdx;
+    }
+
 }// end of namespace utils
 }// end of namespace _3fd
@@ -16,6 +16,8 @@ namespace utils
 
     /// <summary>
     /// Invokes a callback asynchronously and leaves without waiting for termination.
+    /// The callback runs in a thread of its own, so it can block for as long as it needs.
+    /// Short callbacks are cheaper to post to a <see cref="ThreadPool"/> instead.
     /// </summary>
     /// <param name="callback">The callback.</param>
     void Asynchronous::InvokeAndLeave(const std::function<void()> &callback)
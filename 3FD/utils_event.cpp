@@ -90,5 +90,93 @@ namespace _3fd
                     });
         }
 
+        ///////////////////////////////////////
+        // EventCount Class
+        ///////////////////////////////////////
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="EventCount"/> class.
+        /// </summary>
+        EventCount::EventCount()
+        try:
+            m_mutex(), // might throw an exception
+            m_condition(), // might throw an exception
+            m_epoch(0),
+            m_numWaiters(0)
+        {
+        }
+        catch (std::system_error &ex)
+        {
+            std::ostringstream oss;
+            oss << "Failed to create an event count for thread synchronization: " << core::StdLibExt::GetDetailsFromSystemError(ex);
+            throw core::AppException<std::runtime_error>(oss.str());
+        }
+
+        /// <summary>
+        /// Announces the intention to wait. The condition must be
+        /// checked once again after this call and before committing.
+        /// </summary>
+        /// <returns>The key to later pass to <see cref="CommitWait"/>.</returns>
+        uint32_t EventCount::PrepareWait()
+        {
+            m_numWaiters.fetch_add(1, std::memory_order_relaxed);
+
+            /* Pairs with the fence in 'Notify': either the notifier sees this
+            waiter, or this waiter sees the change made by the notifier when
+            checking the condition again. */
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            return m_epoch.load(std::memory_order_relaxed);
+        }
+
+        /// <summary>
+        /// Gives up waiting, because the condition turned out to hold.
+        /// </summary>
+        void EventCount::CancelWait()
+        {
+            m_numWaiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        /// <summary>
+        /// Blocks until a notification happens after the preparation to wait.
+        /// </summary>
+        /// <param name="key">The key returned by <see cref="PrepareWait"/>.</param>
+        void EventCount::CommitWait(uint32_t key)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+
+                m_condition.wait(lock, [this, key]()
+                {
+                    return m_epoch.load(std::memory_order_relaxed) != key;
+                });
+            }
+
+            m_numWaiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        /// <summary>
+        /// Notifies the waiting threads, to be called after making the condition hold.
+        /// </summary>
+        /// <param name="all">Whether all waiting threads should be woken, rather than a single one.</param>
+        void EventCount::Notify(bool all)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            // nobody waiting means no need to go for the lock:
+            if (m_numWaiters.load(std::memory_order_relaxed) == 0)
+                return;
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_epoch.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            if (all)
+                m_condition.notify_all();
+            else
+                m_condition.notify_one();
+        }
+
     } // end of namespace utils
 } // end of namespace _3fd
@@ -1,18 +1,770 @@
 #include "stdafx.h"
 #include "utils_io.h"
+#include "logger.h"
 #include <cerrno>
+#include <climits>
+#include <cmath>
+
+#ifdef _WIN32
+#   include <io.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/uio.h>
+#   include <unistd.h>
+#endif
 
 namespace _3fd
 {
 namespace utils
 {
     ///////////////////////////////////////
-    // Specialization of serializations
+    // Native formatting of numbers
+    ///////////////////////////////////////
+
+    /// <summary>
+    /// An unsigned integer of fixed capacity, large enough for exact arithmetic
+    /// on any double scaled by a power of 10, so it never allocates memory.
+    /// </summary>
+    class BigUnsigned
+    {
+    private:
+
+        static const size_t maxWords = 40;
+
+        std::array<uint32_t, maxWords> m_words; // least significant first
+        size_t m_count; // words in use, the most significant not zero
+
+    public:
+
+        explicit BigUnsigned(uint64_t value)
+            : m_count(0)
+        {
+            while (value != 0)
+            {
+                m_words[m_count++] = static_cast<uint32_t> (value);
+                value >>= 32;
+            }
+        }
+
+        void MultiplyBy(uint32_t factor)
+        {
+            uint64_t carry(0);
+            for (size_t idx = 0; idx < m_count; ++idx)
+            {
+                carry += static_cast<uint64_t> (m_words[idx]) * factor;
+                m_words[idx] = static_cast<uint32_t> (carry);
+                carry >>= 32;
+            }
+
+            if (carry != 0)
+            {
+                _ASSERTE(m_count < maxWords);
+                m_words[m_count++] = static_cast<uint32_t> (carry);
+            }
+        }
+
+        void MultiplyByPow10(uint32_t exponent)
+        {
+            static const uint32_t powersOf10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+
+            for (; exponent >= 9; exponent -= 9)
+                MultiplyBy(powersOf10[9]);
+
+            MultiplyBy(powersOf10[exponent]);
+        }
+
+        void ShiftLeft(uint32_t numBits)
+        {
+            if (m_count == 0)
+                return;
+
+            const size_t wordShift = numBits / 32;
+            const uint32_t bitShift = numBits % 32;
+            _ASSERTE(m_count + wordShift < maxWords);
+
+            m_words[m_count + wordShift] = 0;
+
+            for (size_t idx = m_count; idx-- > 0;)
+            {
+                if (bitShift != 0)
+                    m_words[idx + wordShift + 1] |= m_words[idx] >> (32 - bitShift);
+
+                m_words[idx + wordShift] = m_words[idx] << bitShift;
+            }
+
+            for (size_t idx = 0; idx < wordShift; ++idx)
+                m_words[idx] = 0;
+
+            m_count += wordShift + 1;
+            if (m_words[m_count - 1] == 0)
+                --m_count;
+        }
+
+        int Compare(const BigUnsigned &other) const
+        {
+            if (m_count != other.m_count)
+                return m_count < other.m_count ? -1 : 1;
+
+            for (size_t idx = m_count; idx-- > 0;)
+            {
+                if (m_words[idx] != other.m_words[idx])
+                    return m_words[idx] < other.m_words[idx] ? -1 : 1;
+            }
+
+            return 0;
+        }
+
+        // Subtracts a value not greater than this one
+        void Subtract(const BigUnsigned &other)
+        {
+            int64_t borrow(0);
+            for (size_t idx = 0; idx < m_count; ++idx)
+            {
+                borrow += static_cast<int64_t> (m_words[idx]) - (idx < other.m_count ? other.m_words[idx] : 0);
+                m_words[idx] = static_cast<uint32_t> (borrow);
+                borrow = (borrow < 0) ? -1 : 0;
+            }
+
+            while (m_count > 0 && m_words[m_count - 1] == 0)
+                --m_count;
+        }
+
+        bool IsZero() const { return m_count == 0; }
+    };
+
+    /// <summary>
+    /// Formats an integer, with at least as many digits as the precision, as printf does.
+    /// </summary>
+    void NumberText::FormatInteger(bool negative, unsigned long long magnitude, int precision)
+    {
+        std::array<char, 24> digits;
+        size_t numDigits(0);
+
+        while (magnitude != 0)
+        {
+            digits[numDigits++] = static_cast<char> ('0' + magnitude % 10);
+            magnitude /= 10;
+        }
+
+        // no precision means at least one digit, while a zero precision allows none for zero:
+        size_t minDigits = (precision < 0) ? 1 : static_cast<size_t> (precision);
+
+        char *out = m_text.data();
+
+        if (negative)
+            *out++ = '-';
+
+        for (size_t count = numDigits; count < minDigits; ++count)
+            *out++ = '0';
+
+        while (numDigits > 0)
+            *out++ = digits[--numDigits];
+
+        m_length = out - m_text.data();
+    }
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="NumberText"/> class with a signed integer.
+    /// </summary>
+    /// <param name="value">The value to format.</param>
+    /// <param name="precision">The minimum amount of digits, or a negative value for none.</param>
+    NumberText::NumberText(signed long long value, int precision)
+    {
+        _ASSERTE(precision <= maxPrecision);
+        auto magnitude = (value < 0) ? 0ULL - static_cast<unsigned long long> (value) : static_cast<unsigned long long> (value);
+        FormatInteger(value < 0, magnitude, precision);
+    }
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="NumberText"/> class with an unsigned integer.
+    /// </summary>
+    /// <param name="value">The value to format.</param>
+    /// <param name="precision">The minimum amount of digits, or a negative value for none.</param>
+    NumberText::NumberText(unsigned long long value, int precision)
+    {
+        _ASSERTE(precision <= maxPrecision);
+        FormatInteger(false, value, precision);
+    }
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="NumberText"/> class with a floating point value,
+    /// formatted as printf does with "%.*G". The decimal digits are generated from the exact binary
+    /// value with big integer arithmetic, then rounded half to even, so the result matches printf.
+    /// </summary>
+    /// <param name="value">The value to format.</param>
+    /// <param name="precision">The amount of significant digits, or a negative value for the default.</param>
+    NumberText::NumberText(double value, int precision)
+    {
+        _ASSERTE(precision <= maxPrecision);
+
+        const int numSignificant = (precision < 0) ? 6 : (precision == 0 ? 1 : precision);
+
+        char *out = m_text.data();
+
+        if (std::signbit(value))
+        {
+            *out++ = '-';
+            value = -value;
+        }
+
+        if (std::isnan(value) || std::isinf(value))
+        {
+            out = std::copy_n(std::isnan(value) ? "NAN" : "INF", 3, out);
+            m_length = out - m_text.data();
+            return;
+        }
+
+        std::array<char, maxPrecision> digits;
+        int exponent10(0);
+
+        if (value == 0.0)
+            std::fill_n(digits.begin(), numSignificant, '0');
+        else
+        {
+            // value = mantissa * 2^exponent2, exactly:
+            int exponent2;
+            auto mantissa = static_cast<uint64_t> (std::ldexp(std::frexp(value, &exponent2), 53));
+            exponent2 -= 53;
+
+            // value = numerator / denominator:
+            BigUnsigned numerator(mantissa), denominator(1);
+
+            if (exponent2 > 0)
+                numerator.ShiftLeft(exponent2);
+            else
+                denominator.ShiftLeft(-exponent2);
+
+            // scale so the quotient lies in [1, 10):
+            exponent10 = static_cast<int> (std::floor(std::log10(value)));
+
+            if (exponent10 > 0)
+                denominator.MultiplyByPow10(exponent10);
+            else
+                numerator.MultiplyByPow10(-exponent10);
+
+            auto tenTimesDenominator = denominator;
+            tenTimesDenominator.MultiplyBy(10);
+
+            if (numerator.Compare(tenTimesDenominator) >= 0)
+            {
+                denominator = tenTimesDenominator;
+                ++exponent10;
+            }
+            else if (numerator.Compare(denominator) < 0)
+            {
+                numerator.MultiplyBy(10);
+                --exponent10;
+            }
+
+            // generate the digits:
+            for (int idx = 0; idx < numSignificant; ++idx)
+            {
+                char digit('0');
+                while (numerator.Compare(denominator) >= 0)
+                {
+                    numerator.Subtract(denominator);
+                    ++digit;
+                }
+
+                digits[idx] = digit;
+                numerator.MultiplyBy(10);
+            }
+
+            // round half to even what is left (now ten times the remainder):
+            auto halfDenominator = denominator;
+            halfDenominator.MultiplyBy(5);
+            auto comparison = numerator.Compare(halfDenominator);
+
+            if (comparison > 0 || (comparison == 0 && (digits[numSignificant - 1] - '0') % 2 != 0))
+            {
+                int idx = numSignificant - 1;
+                while (idx >= 0 && digits[idx] == '9')
+                    digits[idx--] = '0';
+
+                if (idx >= 0)
+                    ++digits[idx];
+                else
+                {
+                    digits[0] = '1';
+                    ++exponent10;
+                }
+            }
+        }
+
+        // trailing zeros are not significant:
+        int numDigits(numSignificant);
+        while (numDigits > 1 && digits[numDigits - 1] == '0')
+            --numDigits;
+
+        if (exponent10 < -4 || exponent10 >= numSignificant)
+        {
+            // scientific notation:
+            *out++ = digits[0];
+
+            if (numDigits > 1)
+            {
+                *out++ = '.';
+                out = std::copy(digits.begin() + 1, digits.begin() + numDigits, out);
+            }
+
+            *out++ = 'E';
+            *out++ = (exponent10 < 0) ? '-' : '+';
+
+            auto magnitude = std::abs(exponent10);
+            if (magnitude >= 100)
+                *out++ = static_cast<char> ('0' + magnitude / 100);
+
+            *out++ = static_cast<char> ('0' + magnitude / 10 % 10);
+            *out++ = static_cast<char> ('0' + magnitude % 10);
+        }
+        else if (exponent10 >= 0)
+        {
+            // fixed notation, with integer part:
+            int numIntDigits = exponent10 + 1;
+            out = std::copy(digits.begin(), digits.begin() + std::min(numIntDigits, numDigits), out);
+
+            for (int idx = numDigits; idx < numIntDigits; ++idx)
+                *out++ = '0';
+
+            if (numDigits > numIntDigits)
+            {
+                *out++ = '.';
+                out = std::copy(digits.begin() + numIntDigits, digits.begin() + numDigits, out);
+            }
+        }
+        else
+        {
+            // fixed notation, fraction only:
+            *out++ = '0';
+            *out++ = '.';
+
+            for (int idx = -1; idx > exponent10; --idx)
+                *out++ = '0';
+
+            out = std::copy(digits.begin(), digits.begin() + numDigits, out);
+        }
+
+        m_length = out - m_text.data();
+    }
+
+    ///////////////////////////////////////
+    // Transcoding of UTF-8 to wide chars
     ///////////////////////////////////////
 
-    size_t _estimate_string_size()
+    size_t TranscodeUTF8ToWide(const char *text, size_t length, size_t maxCount, wchar_t *out, size_t outCount)
     {
-        return 0;
+        const uint32_t replacementChar = 0xFFFD;
+
+        auto in = reinterpret_cast<const unsigned char *> (text);
+        auto end = in + length;
+        size_t count(0);
+
+        if (out == nullptr)
+            outCount = 0;
+
+        while (in < end && count < maxCount)
+        {
+            // fast path for ASCII:
+            if (*in < 0x80)
+            {
+                if (count < outCount)
+                    out[count] = static_cast<wchar_t> (*in);
+
+                ++count;
+                ++in;
+                continue;
+            }
+
+            // decode the lead byte:
+            uint32_t codePoint;
+            uint32_t minCodePoint;
+            int numContBytes;
+
+            if ((*in & 0xE0) == 0xC0)
+            {
+                codePoint = *in & 0x1F;
+                minCodePoint = 0x80;
+                numContBytes = 1;
+            }
+            else if ((*in & 0xF0) == 0xE0)
+            {
+                codePoint = *in & 0x0F;
+                minCodePoint = 0x800;
+                numContBytes = 2;
+            }
+            else if ((*in & 0xF8) == 0xF0)
+            {
+                codePoint = *in & 0x07;
+                minCodePoint = 0x10000;
+                numContBytes = 3;
+            }
+            else
+            {
+                codePoint = replacementChar;
+                minCodePoint = 0;
+                numContBytes = 0;
+            }
+
+            ++in;
+
+            // decode the continuation bytes:
+            while (numContBytes > 0)
+            {
+                if (in == end || (*in & 0xC0) != 0x80)
+                {
+                    codePoint = replacementChar; // truncated sequence
+                    break;
+                }
+
+                codePoint = (codePoint << 6) | (*in++ & 0x3F);
+                --numContBytes;
+            }
+
+            // overlong encodings, surrogates and beyond Unicode range are invalid:
+            if (codePoint < minCodePoint
+                || (codePoint >= 0xD800 && codePoint <= 0xDFFF)
+                || codePoint > 0x10FFFF)
+            {
+                codePoint = replacementChar;
+            }
+
+            // encode in UTF-16 if wchar_t is not large enough:
+            if (sizeof(wchar_t) == 2 && codePoint >= 0x10000)
+            {
+                if (count + 2 > maxCount)
+                    break;
+
+                if (count + 2 <= outCount)
+                {
+                    codePoint -= 0x10000;
+                    out[count] = static_cast<wchar_t> (0xD800 | (codePoint >> 10));
+                    out[count + 1] = static_cast<wchar_t> (0xDC00 | (codePoint & 0x3FF));
+                }
+                else
+                    outCount = count; // no more room, so stop writing
+
+                count += 2;
+            }
+            else
+            {
+                if (count < outCount)
+                    out[count] = static_cast<wchar_t> (codePoint);
+
+                ++count;
+            }
+        }
+
+        return count;
+    }
+
+    size_t WriteWideText(FILE *file, const char *text, size_t length, size_t maxCount, int width)
+    {
+        std::array<wchar_t, 256> buffer;
+
+        auto count = TranscodeUTF8ToWide(text, length, maxCount, buffer.data(), buffer.size());
+        if (count <= buffer.size())
+            return WriteWideText(file, buffer.data(), count, width);
+
+        std::wstring wideText(count, L'\0');
+        TranscodeUTF8ToWide(text, length, maxCount, &wideText[0], wideText.size());
+        return WriteWideText(file, wideText.data(), count, width);
+    }
+
+    ///////////////////////////////////////
+    // Buffered output
+    ///////////////////////////////////////
+
+    /// <summary>
+    /// Writes a batch of blocks into the file descriptor.
+    /// </summary>
+    /// <param name="blocks">The blocks to write.</param>
+    /// <param name="count">How many blocks there are.</param>
+    void FileDescriptorSink::Write(const OutputBlock *blocks, size_t count)
+    {
+#ifdef _WIN32
+        for (size_t idx = 0; idx < count; ++idx)
+        {
+            auto data = blocks[idx].data;
+            auto left = blocks[idx].size;
+
+            while (left > 0)
+            {
+                auto chunkSize = static_cast<unsigned int> (std::min(left, static_cast<size_t> (INT_MAX)));
+                int rc = _write(m_fileDescriptor, data, chunkSize);
+                if (rc < 0)
+                    throw core::AppException<std::runtime_error>("Failed to write into file", strerror(errno));
+
+                data += rc;
+                left -= rc;
+            }
+        }
+#else
+        std::array<iovec, 64> vecs;
+
+        while (count > 0)
+        {
+            // gather as many blocks as a single call takes:
+            int numVecs(0);
+            while (numVecs < static_cast<int> (vecs.size()) && static_cast<size_t> (numVecs) < count)
+            {
+                vecs[numVecs].iov_base = const_cast<char *> (blocks[numVecs].data);
+                vecs[numVecs].iov_len = blocks[numVecs].size;
+                ++numVecs;
+            }
+
+            auto rc = writev(m_fileDescriptor, vecs.data(), numVecs);
+            if (rc < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                throw core::AppException<std::runtime_error>("Failed to write into file", strerror(errno));
+            }
+
+            // skip the blocks fully written:
+            auto written = static_cast<size_t> (rc);
+            while (count > 0 && written >= blocks->size)
+            {
+                written -= blocks->size;
+                ++blocks;
+                --count;
+            }
+
+            // a partial write resumes from the middle of a block:
+            if (count > 0 && written > 0)
+            {
+                OutputBlock rest = { blocks->data + written, blocks->size - written };
+                Write(&rest, 1);
+                ++blocks;
+                --count;
+            }
+        }
+#endif
+    }
+
+#ifndef _WIN32
+    /// <summary>
+    /// Initializes a new instance of the <see cref="MemoryMappedFileSink"/> class.
+    /// </summary>
+    /// <param name="filePath">The path of the file, which is truncated if it already exists.</param>
+    /// <param name="windowSize">The size of the window mapped into memory, rounded up to the size of a page.</param>
+    MemoryMappedFileSink::MemoryMappedFileSink(const std::string &filePath, size_t windowSize)
+        : m_fileDescriptor(-1)
+        , m_filePath(filePath)
+        , m_window(nullptr)
+        , m_windowSize(windowSize)
+        , m_windowOffset(0)
+        , m_length(0)
+    {
+        CALL_STACK_TRACE;
+
+        // the offset of a mapping must be aligned to pages:
+        const size_t pageSize = sysconf(_SC_PAGESIZE);
+        m_windowSize = std::max((m_windowSize + pageSize - 1) / pageSize, static_cast<size_t> (1)) * pageSize;
+
+        m_fileDescriptor = open(filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (m_fileDescriptor < 0)
+        {
+            std::ostringstream oss;
+            oss << "POSIX API: open for \'" << filePath << "\' - " << strerror(errno);
+            throw core::AppException<std::runtime_error>("Failed to create output file", oss.str());
+        }
+
+        try
+        {
+            MapWindow(0);
+        }
+        catch (...)
+        {
+            close(m_fileDescriptor);
+            throw;
+        }
+    }
+
+    /// <summary>
+    /// Maps into memory the window of the file starting at the given offset, growing the file to cover it.
+    /// </summary>
+    /// <param name="offset">The offset of the window in the file.</param>
+    void MemoryMappedFileSink::MapWindow(uint64_t offset)
+    {
+        if (m_window != nullptr)
+        {
+            munmap(m_window, m_windowSize);
+            m_window = nullptr;
+        }
+
+        /* Allocate the blocks up front, otherwise a full disk would kill the process with
+        SIGBUS when writing into the mapping. When the file system does not support it, fall
+        back to a sparse file: */
+        const auto fileSize = static_cast<off_t> (offset + m_windowSize);
+        const char *call = "mmap";
+
+        if (posix_fallocate(m_fileDescriptor, 0, fileSize) != 0 && ftruncate(m_fileDescriptor, fileSize) != 0)
+            call = "ftruncate";
+        else
+        {
+            auto addr = mmap(nullptr, m_windowSize, PROT_WRITE, MAP_SHARED, m_fileDescriptor, static_cast<off_t> (offset));
+            if (addr != MAP_FAILED)
+            {
+                m_window = static_cast<char *> (addr);
+                m_windowOffset = offset;
+                return;
+            }
+        }
+
+        std::ostringstream oss;
+        oss << "POSIX API: " << call << " for \'" << m_filePath << "\' - " << strerror(errno);
+        throw core::AppException<std::runtime_error>("Failed to map output file into memory", oss.str());
+    }
+
+    /// <summary>
+    /// Copies a batch of blocks into the file.
+    /// </summary>
+    /// <param name="blocks">The blocks to write.</param>
+    /// <param name="count">How many blocks there are.</param>
+    void MemoryMappedFileSink::Write(const OutputBlock *blocks, size_t count)
+    {
+        for (size_t idx = 0; idx < count; ++idx)
+        {
+            auto data = blocks[idx].data;
+            auto left = blocks[idx].size;
+
+            while (left > 0)
+            {
+                auto position = static_cast<size_t> (m_length - m_windowOffset);
+
+                if (position == m_windowSize)
+                {
+                    MapWindow(m_windowOffset + m_windowSize);
+                    position = 0;
+                }
+
+                auto chunkSize = std::min(left, m_windowSize - position);
+                memcpy(m_window + position, data, chunkSize);
+                m_length += chunkSize;
+                data += chunkSize;
+                left -= chunkSize;
+            }
+        }
+    }
+
+    /// <summary>
+    /// Unmaps the file and truncates it to the length of what was written.
+    /// </summary>
+    void MemoryMappedFileSink::Close()
+    {
+        if (m_window != nullptr)
+        {
+            munmap(m_window, m_windowSize);
+            m_window = nullptr;
+        }
+
+        if (ftruncate(m_fileDescriptor, static_cast<off_t> (m_length)) != 0)
+        {
+            std::ostringstream oss;
+            oss << "POSIX API: ftruncate for \'" << m_filePath << "\' - " << strerror(errno);
+            close(m_fileDescriptor);
+            throw core::AppException<std::runtime_error>("Failed to truncate output file", oss.str());
+        }
+
+        close(m_fileDescriptor);
+    }
+
+    /// <summary>
+    /// Finalizes an instance of the <see cref="MemoryMappedFileSink"/> class.
+    /// </summary>
+    MemoryMappedFileSink::~MemoryMappedFileSink()
+    {
+        CALL_STACK_TRACE;
+
+        try
+        {
+            Close();
+        }
+        catch (core::IAppException &ex)
+        {
+            core::Logger::Write(ex, core::Logger::PRIO_CRITICAL);
+        }
+    }
+#endif
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="OutputBuffer"/> class.
+    /// </summary>
+    /// <param name="sink">The destination of the bytes, which must outlive this object.</param>
+    /// <param name="capacity">The capacity of the buffer.</param>
+    OutputBuffer::OutputBuffer(IOutputSink &sink, size_t capacity)
+        : m_sink(sink)
+        , m_buffer(new char[std::max(capacity, static_cast<size_t> (64))])
+        , m_capacity(std::max(capacity, static_cast<size_t> (64)))
+        , m_size(0)
+        , m_totalLength(0)
+    {
+    }
+
+    /// <summary>
+    /// Finalizes an instance of the <see cref="OutputBuffer"/> class, flushing the buffer.
+    /// </summary>
+    OutputBuffer::~OutputBuffer()
+    {
+        CALL_STACK_TRACE;
+
+        try
+        {
+            Flush();
+        }
+        catch (core::IAppException &ex)
+        {
+            core::Logger::Write(ex, core::Logger::PRIO_CRITICAL);
+        }
+    }
+
+    /// <summary>
+    /// Writes a block of bytes into the output.
+    /// </summary>
+    /// <param name="data">The bytes to write.</param>
+    /// <param name="size">How many bytes there are.</param>
+    void OutputBuffer::Write(const char *data, size_t size)
+    {
+        CALL_STACK_TRACE;
+
+        if (size <= m_capacity - m_size)
+        {
+            memcpy(m_buffer.get() + m_size, data, size);
+            m_size += size;
+        }
+        // a large block goes along with the buffered bytes, without copying:
+        else if (size >= m_capacity / 4)
+        {
+            OutputBlock blocks[] = { { m_buffer.get(), m_size }, { data, size } };
+            m_sink.Write(blocks, 2);
+            m_size = 0;
+        }
+        else
+        {
+            Flush();
+            memcpy(m_buffer.get(), data, size);
+            m_size = size;
+        }
+
+        m_totalLength += size;
+    }
+
+    /// <summary>
+    /// Writes the buffered bytes into the output.
+    /// </summary>
+    void OutputBuffer::Flush()
+    {
+        CALL_STACK_TRACE;
+
+        if (m_size == 0)
+            return;
+
+        // the bytes are kept if the sink fails, so they can go out in a later attempt:
+        OutputBlock block = { m_buffer.get(), m_size };
+        m_sink.Write(&block, 1);
+        m_size = 0;
     }
 
 #ifdef _3FD_PLATFORM_WINRT
@@ -1,6 +1,8 @@
 #ifndef UTILS_IO_H // header guard
 #define UTILS_IO_H
 
+#include "base.h"
+#include "preprocessing.h"
 #include "exceptions.h"
 #include "callstacktracer.h"
 
@@ -14,6 +16,8 @@
 #include <sstream>
 #include <string>
 #include <array>
+#include <memory>
+#include <type_traits>
 
 #ifdef __linux__
 #   include <wchar.h>
@@ -256,6 +260,216 @@ namespace utils
          static constexpr const wchar_t *place_holder_width_precision(long double) { return L"%*.*lG"; }
     };
 
+    /// <summary>
+    /// Holds the text of a number formatted natively (without printf), as printf would format it
+    /// with the same precision: integers as "%.*d" and floating point values as "%.*G", exactly
+    /// rounded. The text has no padding and lives in a small array, so nothing is allocated.
+    /// </summary>
+    class NumberText
+    {
+    public:
+
+        // Higher precisions are left to printf:
+        static const int maxPrecision = 40;
+
+        // Longest text of a floating point value for a given precision, as in "-1.2345E+308":
+        static constexpr uint32_t GetMaxLength(int precision)
+        {
+            return (precision < 0 ? 6 : (precision == 0 ? 1 : precision)) + 7;
+        }
+
+    private:
+
+        std::array<char, maxPrecision + 24> m_text;
+        size_t m_length;
+
+        void FormatInteger(bool negative, unsigned long long magnitude, int precision);
+
+    public:
+
+        NumberText(signed long long value, int precision);
+
+        NumberText(unsigned long long value, int precision);
+
+        NumberText(double value, int precision);
+
+        const char *GetData() const { return m_text.data(); }
+
+        size_t GetLength() const { return m_length; }
+    };
+
+    // Tells whether a type is formatted by NumberText (characters are not numbers here)
+    template <typename ValType>
+    struct IsNativeNumber : std::integral_constant<bool,
+        std::is_floating_point<ValType>::value || (std::is_integral<ValType>::value
+            && !std::is_same<ValType, bool>::value
+            && !std::is_same<ValType, char>::value
+            && !std::is_same<ValType, wchar_t>::value
+            && !std::is_same<ValType, char16_t>::value
+            && !std::is_same<ValType, char32_t>::value)
+    > {};
+
+    // Formats a number natively, widening it first to the type NumberText takes
+    template <typename ValType>
+    NumberText MakeNumberText(ValType value, int precision)
+    {
+        typedef typename std::conditional<std::is_floating_point<ValType>::value, double,
+            typename std::conditional<std::is_signed<ValType>::value, signed long long, unsigned long long>::type
+        >::type WideType;
+
+        return NumberText(static_cast<WideType> (value), precision);
+    }
+
+    /// <summary>
+    /// Writes text into a buffer, right-aligned in the given width. Same as snprintf, it
+    /// writes nothing but returns the length needed, when the buffer is too short.
+    /// </summary>
+    /// <param name="buffer">The output buffer.</param>
+    /// <param name="text">The text to write, in ASCII.</param>
+    /// <param name="length">The length of the text.</param>
+    /// <param name="width">The width, or a negative value for none.</param>
+    /// <returns>The length of the text written, padding included, not counting the null terminator.</returns>
+    template <typename CharType>
+    size_t WriteText(const RawBufferInfo<CharType> &buffer, const char *text, size_t length, int width)
+    {
+        size_t padding = (width > 0 && static_cast<size_t> (width) > length) ? width - length : 0;
+        size_t total = padding + length;
+
+        if (total < buffer.count)
+        {
+            auto dest = std::fill_n(buffer.data, padding, static_cast<CharType> (' '));
+            dest = std::copy(text, text + length, dest);
+            *dest = 0;
+        }
+
+        return total;
+    }
+
+    /// <summary>
+    /// Writes text into a file, right-aligned in the given width.
+    /// </summary>
+    /// <param name="file">The output file.</param>
+    /// <param name="text">The text to write, in ASCII.</param>
+    /// <param name="length">The length of the text.</param>
+    /// <param name="width">The width, or a negative value for none.</param>
+    /// <returns>The length of the text written, padding included.</returns>
+    template <typename CharType>
+    size_t WriteText(FILE *file, const char *text, size_t length, int width)
+    {
+        size_t padding = (width > 0 && static_cast<size_t> (width) > length) ? width - length : 0;
+        bool failed(false);
+
+        for (size_t idx = 0; idx < padding && !failed; ++idx)
+            failed = (fputc(' ', file) == EOF);
+
+        if (!failed && length > 0)
+            failed = (fwrite(text, 1, length, file) != length);
+
+        if (failed)
+            throw core::AppException<std::runtime_error>("fwrite: IO error!", strerror(errno));
+
+        return padding + length;
+    }
+
+    /// <summary>
+    /// Writes text into a file of wide chars, right-aligned in the given width.
+    /// </summary>
+    template <>
+    inline size_t WriteText<wchar_t>(FILE *file, const char *text, size_t length, int width)
+    {
+        size_t padding = (width > 0 && static_cast<size_t> (width) > length) ? width - length : 0;
+
+        for (size_t idx = 0; idx < padding + length; ++idx)
+        {
+            if (fputwc(idx < padding ? L' ' : static_cast<wchar_t> (text[idx - padding]), file) == WEOF)
+                throw core::AppException<std::runtime_error>("fputwc: IO error!", strerror(errno));
+        }
+
+        return padding + length;
+    }
+
+    /// <summary>
+    /// Transcodes UTF-8 to wide chars (UTF-32, or UTF-16 where wchar_t takes 2 bytes) in a single pass.
+    /// Invalid sequences become the replacement character U+FFFD. The output is filled while there is
+    /// room, but the transcoding goes on to count the length of the whole text.
+    /// </summary>
+    /// <param name="text">The UTF-8 text.</param>
+    /// <param name="length">The length of the text, in bytes.</param>
+    /// <param name="maxCount">How many wide chars at most to take from the text.</param>
+    /// <param name="out">The output, which can be null when only counting.</param>
+    /// <param name="outCount">The room in the output, in wide chars (no null terminator is written).</param>
+    /// <returns>The length of the transcoded text, in wide chars.</returns>
+    size_t TranscodeUTF8ToWide(const char *text, size_t length, size_t maxCount, wchar_t *out, size_t outCount);
+
+    /// <summary>
+    /// Writes wide-char text into a buffer, right-aligned in the given width. Same as
+    /// snprintf, it writes nothing but returns the length needed, when the buffer is too short.
+    /// </summary>
+    /// <returns>The length of the text written, padding included, not counting the null terminator.</returns>
+    inline size_t WriteWideText(const RawBufferInfo<wchar_t> &buffer, const wchar_t *text, size_t length, int width)
+    {
+        size_t padding = (width > 0 && static_cast<size_t> (width) > length) ? width - length : 0;
+        size_t total = padding + length;
+
+        if (total < buffer.count)
+        {
+            auto dest = std::fill_n(buffer.data, padding, L' ');
+            dest = std::copy(text, text + length, dest);
+            *dest = 0;
+        }
+
+        return total;
+    }
+
+    /// <summary>
+    /// Writes wide-char text into a file of wide chars, right-aligned in the given width.
+    /// </summary>
+    /// <returns>The length of the text written, padding included.</returns>
+    inline size_t WriteWideText(FILE *file, const wchar_t *text, size_t length, int width)
+    {
+        size_t padding = (width > 0 && static_cast<size_t> (width) > length) ? width - length : 0;
+
+        for (size_t idx = 0; idx < padding + length; ++idx)
+        {
+            if (fputwc(idx < padding ? L' ' : text[idx - padding], file) == WEOF)
+                throw core::AppException<std::runtime_error>("fputwc: IO error!", strerror(errno));
+        }
+
+        return padding + length;
+    }
+
+    /// <summary>
+    /// Writes UTF-8 text transcoded into a buffer of wide chars, right-aligned in the given width.
+    /// When the buffer is too short, it returns the length needed, but the content of the buffer
+    /// is undefined.
+    /// </summary>
+    /// <returns>The length of the text written, padding included, not counting the null terminator.</returns>
+    inline size_t WriteWideText(const RawBufferInfo<wchar_t> &buffer, const char *text, size_t length, size_t maxCount, int width)
+    {
+        auto count = TranscodeUTF8ToWide(text, length, maxCount, buffer.data, buffer.count);
+        size_t padding = (width > 0 && static_cast<size_t> (width) > count) ? width - count : 0;
+        size_t total = padding + count;
+
+        if (total < buffer.count)
+        {
+            if (padding > 0)
+            {
+                memmove(buffer.data + padding, buffer.data, count * sizeof(wchar_t));
+                std::fill_n(buffer.data, padding, L' ');
+            }
+
+            buffer.data[total] = 0;
+        }
+
+        return total;
+    }
+
+    /// <summary>
+    /// Writes UTF-8 text transcoded into a file of wide chars, right-aligned in the given width.
+    /// </summary>
+    /// <returns>The length of the text written, padding included.</returns>
+    size_t WriteWideText(FILE *file, const char *text, size_t length, size_t maxCount, int width);
+
     /// <summary>
     /// Wraps a generic value for serialization,
     /// packing it along with format information.
@@ -287,9 +501,130 @@ namespace utils
             return *this;
         }
 
-        // Serializes the held value to text
+        // Gets the held value
+        ValType GetValue() const { return m_value; }
+
+        // Gets the width, or a negative value when not set
+        int GetWidth() const { return m_width; }
+
+        // Gets the precision, or a negative value when not set
+        int GetPrecision() const { return m_precision; }
+
+    private:
+
+        /* How the held value is serialized: with printf, as a number, as narrow text into narrow
+        text, as text or character into wide text, or with narrow printf into wide text (which
+        avoids swprintf, very slow in some platforms, and its lack of the length needed) */
+        enum { PrintfKind, NumberKind, NarrowTextKind, WideTextKind, NarrowPrintfKind };
+
+        typedef typename std::remove_cv<typename std::remove_pointer<ValType>::type>::type PointeeType;
+
+        static const bool isNarrowText = std::is_pointer<ValType>::value && std::is_same<PointeeType, char>::value;
+
+        static const bool isWideText = std::is_pointer<ValType>::value && std::is_same<PointeeType, wchar_t>::value;
+
+        template <typename CharType>
+        using SerializationKind = std::integral_constant<int,
+            IsNativeNumber<ValType>::value ? NumberKind :
+            std::is_same<CharType, char>::value ? (isNarrowText ? NarrowTextKind : PrintfKind) :
+            (isNarrowText || isWideText || std::is_same<ValType, char>::value || std::is_same<ValType, wchar_t>::value)
+                ? WideTextKind : NarrowPrintfKind
+        >;
+
+        template <typename CharType>
+        using FallbackKind = std::integral_constant<int,
+            std::is_same<CharType, char>::value ? PrintfKind : NarrowPrintfKind
+        >;
+
+        // Serializes a number natively
+        template <typename CharType, typename OutType>
+        size_t SerializeTo(OutType output, std::integral_constant<int, NumberKind>) const
+        {
+            if (m_precision > NumberText::maxPrecision)
+                return SerializeTo<CharType>(output, FallbackKind<CharType>());
+
+            auto text = MakeNumberText(m_value, m_precision);
+            return WriteText<CharType>(output, text.GetData(), text.GetLength(), m_width);
+        }
+
+        // Serializes narrow text into narrow text, which is just a copy
         template <typename CharType, typename OutType>
-        size_t SerializeTo(OutType output) const
+        size_t SerializeTo(OutType output, std::integral_constant<int, NarrowTextKind>) const
+        {
+            const char *text = (m_value != nullptr) ? m_value : "(null)";
+            auto length = strlen(text);
+
+            if (m_precision >= 0 && static_cast<size_t> (m_precision) < length)
+                length = m_precision;
+
+            return WriteText<CharType>(output, text, length, m_width);
+        }
+
+        // Serializes UTF-8 text into wide text
+        template <typename OutType>
+        size_t SerializeToWide(OutType output, const char *text) const
+        {
+            if (text == nullptr)
+                text = "(null)";
+
+            auto maxCount = (m_precision >= 0) ? static_cast<size_t> (m_precision) : SIZE_MAX;
+            return WriteWideText(output, text, strlen(text), maxCount, m_width);
+        }
+
+        // Serializes wide text into wide text, which is just a copy
+        template <typename OutType>
+        size_t SerializeToWide(OutType output, const wchar_t *text) const
+        {
+            if (text == nullptr)
+                text = L"(null)";
+
+            auto length = wcslen(text);
+
+            if (m_precision >= 0 && static_cast<size_t> (m_precision) < length)
+                length = m_precision;
+
+            return WriteWideText(output, text, length, m_width);
+        }
+
+        // Serializes a character into wide text (a narrow char is taken as Latin-1)
+        template <typename OutType>
+        size_t SerializeToWide(OutType output, char ch) const
+        {
+            wchar_t wch = static_cast<unsigned char> (ch);
+            return WriteWideText(output, &wch, 1, m_width);
+        }
+
+        template <typename OutType>
+        size_t SerializeToWide(OutType output, wchar_t ch) const
+        {
+            return WriteWideText(output, &ch, 1, m_width);
+        }
+
+        // Serializes text or a character into wide text natively
+        template <typename CharType, typename OutType>
+        size_t SerializeTo(OutType output, std::integral_constant<int, WideTextKind>) const
+        {
+            return SerializeToWide(output, m_value);
+        }
+
+        // Serializes the held value with narrow printf, then widens the text, which is ASCII
+        template <typename CharType, typename OutType>
+        size_t SerializeTo(OutType output, std::integral_constant<int, NarrowPrintfKind>) const
+        {
+            std::array<char, 64> text;
+            auto length = SerializeTo<char>(RawBufferInfo<char>{ text.data(), text.size() }, std::integral_constant<int, PrintfKind>());
+
+            if (length < text.size())
+                return WriteText<CharType>(output, text.data(), length, -1);
+
+            std::string longText(length + 1, '\0');
+            SerializeTo<char>(RawBufferInfo<char>{ &longText[0], longText.size() }, std::integral_constant<int, PrintfKind>());
+            return WriteText<CharType>(output, longText.data(), length, -1);
+        }
+
+        // Serializes the held value with printf
+        template <typename CharType, typename OutType>
+        size_t SerializeTo(OutType output, std::integral_constant<int, PrintfKind>) const
         {
             if (m_precision < 0)
             {
@@ -307,13 +642,117 @@ namespace utils
             }
         }
 
-        // Estimates required size for serialized string
-        uint32_t EstimateStringSize() const
+        // Gets the exact length of a serialized integer
+        template <typename Type>
+        uint32_t EstimateStringSize(Type value, std::true_type /* is integer */) const
+        {
+            auto length = static_cast<uint32_t> (MakeNumberText(value, m_precision).GetLength());
+            return std::max(length, static_cast<uint32_t> (std::max(m_width, 0)));
+        }
+
+        // Gets the longest length of a serialized floating point value
+        template <typename Type>
+        uint32_t EstimateStringSize(Type, std::false_type /* is integer */) const
+        {
+            return std::max(NumberText::GetMaxLength(m_precision), static_cast<uint32_t> (std::max(m_width, 0)));
+        }
+
+        template <typename CharType>
+        uint32_t EstimateStringSize(std::integral_constant<int, NumberKind>) const
+        {
+            if (m_precision > NumberText::maxPrecision)
+                return EstimateStringSize<CharType>(FallbackKind<CharType>());
+
+            return EstimateStringSize(m_value, std::is_integral<ValType>());
+        }
+
+        template <typename CharType>
+        uint32_t EstimateStringSize(std::integral_constant<int, NarrowTextKind>) const
+        {
+            auto length = static_cast<uint32_t> (m_value != nullptr ? strlen(m_value) : 6);
+
+            if (m_precision >= 0 && static_cast<uint32_t> (m_precision) < length)
+                length = m_precision;
+
+            return std::max(length, static_cast<uint32_t> (std::max(m_width, 0)));
+        }
+
+        // Gets the length of text or character serialized into wide text, which is never
+        // too short, because UTF-8 never takes less bytes than the wide chars to transcode it
+        uint32_t EstimateWideSize(const char *text) const
+        {
+            auto length = static_cast<uint32_t> (text != nullptr ? strlen(text) : 6);
+
+            if (m_precision >= 0 && static_cast<uint32_t> (m_precision) < length)
+                length = m_precision;
+
+            return std::max(length, static_cast<uint32_t> (std::max(m_width, 0)));
+        }
+
+        uint32_t EstimateWideSize(const wchar_t *text) const
+        {
+            auto length = static_cast<uint32_t> (text != nullptr ? wcslen(text) : 6);
+
+            if (m_precision >= 0 && static_cast<uint32_t> (m_precision) < length)
+                length = m_precision;
+
+            return std::max(length, static_cast<uint32_t> (std::max(m_width, 0)));
+        }
+
+        template <typename Type>
+        uint32_t EstimateWideSize(Type) const
+        {
+            return std::max(1U, static_cast<uint32_t> (std::max(m_width, 0)));
+        }
+
+        template <typename CharType>
+        uint32_t EstimateStringSize(std::integral_constant<int, WideTextKind>) const
+        {
+            return EstimateWideSize(m_value);
+        }
+
+        template <typename CharType>
+        uint32_t EstimateStringSize(std::integral_constant<int, NarrowPrintfKind>) const
+        {
+            // pointers take 2 hex digits per byte, plus prefix:
+            return std::max(EstimateStringSize<CharType>(std::integral_constant<int, PrintfKind>()),
+                            static_cast<uint32_t> (2 * sizeof(ValType) + 2));
+        }
+
+        template <typename CharType>
+        uint32_t EstimateStringSize(std::integral_constant<int, PrintfKind>) const
         {
             auto width = (m_width >= 0) ? m_width : 0;
             auto precision = (m_precision >= 0) ? m_precision : 0;
             return std::max((uint32_t)std::max(width, precision), (uint32_t)sizeof (ValType));
         }
+
+    public:
+
+        /// <summary>
+        /// Serializes the held value to text. Numbers, narrow text into narrow text, and text
+        /// or characters into wide text are written natively, straight into the output, otherwise
+        /// printf is used (the narrow one, even for wide output).
+        /// </summary>
+        /// <param name="output">The output, which is a file or a buffer.</param>
+        /// <returns>The length of the serialized text, which can be larger than a buffer
+        /// provided as output, in which case the buffer is left unchanged.</returns>
+        template <typename CharType, typename OutType>
+        size_t SerializeTo(OutType output) const
+        {
+            return SerializeTo<CharType>(output, SerializationKind<CharType>());
+        }
+
+        /// <summary>
+        /// Estimates the length of the serialized text. This is exact for integers, narrow text
+        /// into narrow text and wide text, and never too short for floating point values and UTF-8
+        /// into wide text.
+        /// </summary>
+        template <typename CharType = char>
+        uint32_t EstimateStringSize() const
+        {
+            return EstimateStringSize<CharType>(SerializationKind<CharType>());
+        }
     };
 
     // Wraps an argument to prepare for serialization
@@ -346,18 +785,16 @@ namespace utils
     // Serialization Helpers
     //////////////////////////////
 
-    size_t _estimate_string_size();
-
-    template <typename FirstArgVType, typename ... Args>
-    size_t _estimate_string_size(FirstArgVType &&firstArg, Args ... args)
+    template <typename CharType>
+    constexpr size_t _estimate_string_size()
     {
-        return FormatArg(firstArg).EstimateStringSize() + _estimate_string_size(args ...);
+        return 0;
     }
 
-    template <typename ... Args>
-    size_t _estimate_string_size(Args ... args)
+    template <typename CharType, typename FirstArgVType, typename ... Args>
+    size_t _estimate_string_size(FirstArgVType &&firstArg, Args ... args)
     {
-        return _estimate_string_size(args ...);
+        return FormatArg(firstArg).template EstimateStringSize<CharType>() + _estimate_string_size<CharType>(args ...);
     }
 
     template <typename CharType>
@@ -440,30 +877,26 @@ namespace utils
     /// <summary>
     /// Serializes to a string the argument values as text.
     /// </summary>
-    /// <param name="out">The output string.</param>
+    /// <param name="out">The output string, which might use a custom allocator
+    /// (such as <see cref="ArenaAllocator" />, for scratch buffers in an arena).</param>
     /// <param name="...args">The values to serialize, all wrapped in <see cref="SerializableValue" /> objects.</param>
     /// <returns>The length of text written into the string.</returns>
-    template <typename CharType, typename ... Args>
-    size_t SerializeTo(std::basic_string<CharType> &out, Args ... args)
+    template <typename CharType, typename CharTraits, typename AllocType, typename ... Args>
+    size_t SerializeTo(std::basic_string<CharType, CharTraits, AllocType> &out, Args ... args)
     {
         CALL_STACK_TRACE;
 
         try
         {
-            /* Try to guarantee room in the string buffer using a rough estimation
-            for the serialized string size. If the current size exceeds the estimation,
-            do nothing, otherwise, expand it. When resizing, make use of all already
-            reserved capacity if that is enough, because such allocation is cheap,
-            otherwise, just allocate memory for the estimation and hope for the best.*/
+            /* Try to guarantee room in the string buffer using an estimation for the
+            serialized string size, which is never too short for numbers and narrow text.
+            Always make use of all already reserved capacity, because that is cheap, and
+            a string reused for serialization keeps the capacity from the last time. If
+            that is not enough, allocate memory for the estimation (plus the null
+            terminator) and hope for the best.*/
 
-            auto estReqSize = _estimate_string_size(args ...);
-            if (out.size() < estReqSize)
-            {
-                if (out.capacity() < estReqSize)
-                    out.resize(estReqSize);
-                else
-                    out.resize(out.capacity());
-            }
+            auto estReqSize = _estimate_string_size<CharType>(args ...);
+            out.resize(std::max(out.capacity(), estReqSize + 1));
 
             while (true)
             {
@@ -494,7 +927,418 @@ namespace utils
         }
     }
 
+    /////////////////////////////////////
+    // Buffered output
+    /////////////////////////////////////
+
+    /// <summary>
+    /// A block of bytes to write.
+    /// </summary>
+    struct OutputBlock
+    {
+        const char *data;
+        size_t size;
+    };
+
+    /// <summary>
+    /// Interface for the destination of the bytes accumulated by <see cref="OutputBuffer"/>.
+    /// </summary>
+    class INTFOPT IOutputSink
+    {
+    public:
+
+        virtual ~IOutputSink() {}
+
+        /// <summary>
+        /// Writes a batch of blocks, in order, with as few system calls as possible.
+        /// </summary>
+        /// <param name="blocks">The blocks to write.</param>
+        /// <param name="count">How many blocks there are.</param>
+        virtual void Write(const OutputBlock *blocks, size_t count) = 0;
+    };
+
+    /// <summary>
+    /// Writes into a file descriptor, with a single call of writev for a batch of blocks
+    /// (in Windows, which lacks writev, the blocks are written one by one).
+    /// The descriptor is owned by the caller.
+    /// </summary>
+    class FileDescriptorSink : public IOutputSink, notcopiable
+    {
+    private:
+
+        int m_fileDescriptor;
+
+    public:
+
+        explicit FileDescriptorSink(int fileDescriptor)
+            : m_fileDescriptor(fileDescriptor) {}
+
+        virtual void Write(const OutputBlock *blocks, size_t count) override;
+    };
+
+#ifndef _WIN32
+    /// <summary>
+    /// Writes into a file by copying the bytes into a window of the file mapped into memory,
+    /// which moves forward as the file grows. When finished, the file is truncated to the
+    /// length of what was written. (POSIX only.)
+    /// </summary>
+    class MemoryMappedFileSink : public IOutputSink, notcopiable
+    {
+    private:
+
+        int m_fileDescriptor;
+        std::string m_filePath;
+        char *m_window;
+        size_t m_windowSize;
+        uint64_t m_windowOffset;
+        uint64_t m_length;
+
+        void MapWindow(uint64_t offset);
+
+        void Close();
+
+    public:
+
+        static const size_t defaultWindowSize = 64 * 1024 * 1024;
+
+        MemoryMappedFileSink(const std::string &filePath, size_t windowSize = defaultWindowSize);
+
+        ~MemoryMappedFileSink();
+
+        virtual void Write(const OutputBlock *blocks, size_t count) override;
+
+        /// <summary>
+        /// Gets the length of what has been written into the file so far.
+        /// </summary>
+        uint64_t GetLength() const { return m_length; }
+    };
+#endif
+
+    /// <summary>
+    /// Accumulates text in a large buffer, so it gets to the output (a file, for instance) in big
+    /// chunks rather than with a system call for every small piece. Writing a block larger than a
+    /// fraction of the buffer does not copy it, but rather sends it along with the buffered bytes
+    /// in a single batch. The buffer is flushed when full, when <see cref="Flush"/> is called and
+    /// when the object is destroyed. Use it with <see cref="SerializeTo"/>.
+    /// </summary>
+    class OutputBuffer : notcopiable
+    {
+    private:
+
+        IOutputSink &m_sink;
+        std::unique_ptr<char[]> m_buffer;
+        size_t m_capacity;
+        size_t m_size;
+        uint64_t m_totalLength;
+
+    public:
+
+        static const size_t defaultCapacity = 1024 * 1024;
+
+        OutputBuffer(IOutputSink &sink, size_t capacity = defaultCapacity);
+
+        ~OutputBuffer();
+
+        void Write(const char *data, size_t size);
+
+        /// <summary>
+        /// Writes a string into the output.
+        /// </summary>
+        /// <param name="str">The string to write.</param>
+        void Write(const std::string &str) { Write(str.data(), str.size()); }
+
+        void Flush();
+
+        /// <summary>
+        /// Gets the room left in the buffer, for text to be written straight into it.
+        /// </summary>
+        RawBufferInfo<char> GetFreeSpace() { return RawBufferInfo<char>{ m_buffer.get() + m_size, m_capacity - m_size }; }
+
+        /// <summary>
+        /// Takes as written some text put into the room given by <see cref="GetFreeSpace"/>.
+        /// </summary>
+        /// <param name="size">The length of the text.</param>
+        void Commit(size_t size)
+        {
+            _ASSERTE(size <= m_capacity - m_size);
+            m_size += size;
+            m_totalLength += size;
+        }
+
+        /// <summary>
+        /// Gets the capacity of the buffer.
+        /// </summary>
+        size_t GetCapacity() const { return m_capacity; }
+
+        /// <summary>
+        /// Gets how many bytes are held in the buffer, not yet flushed.
+        /// </summary>
+        size_t GetSize() const { return m_size; }
+
+        /// <summary>
+        /// Gets how many bytes have been written into the output, including the ones still in the buffer.
+        /// </summary>
+        uint64_t GetTotalLength() const { return m_totalLength; }
+    };
+
+    /// <summary>
+    /// Serializes to a buffered output the argument values as UTF-8 encoded text.
+    /// </summary>
+    /// <param name="out">The buffered output.</param>
+    /// <param name="...args">The values to serialize, all wrapped in <see cref="SerializableValue" /> objects.</param>
+    /// <returns>The length of text written into the output.</returns>
+    template <typename ... Args>
+    size_t SerializeTo(OutputBuffer &out, Args ... args)
+    {
+        CALL_STACK_TRACE;
+
+        // serialize straight into the buffer, if there is room:
+        auto pcount = _serialize_to_buffer_impl(out.GetFreeSpace(), args ...);
+
+        if (pcount >= out.GetFreeSpace().count)
+        {
+            out.Flush();
+            pcount = _serialize_to_buffer_impl(out.GetFreeSpace(), args ...);
+
+            // does not fit even in the empty buffer?
+            if (pcount >= out.GetFreeSpace().count)
+            {
+                std::string text;
+                pcount = SerializeTo(text, args ...);
+                out.Write(text);
+                return pcount;
+            }
+        }
+
+        out.Commit(pcount);
+        return pcount;
+    }
+
+    /////////////////////////////////////
+    // Compiled format strings
+    /////////////////////////////////////
+
+    /* A format string has "{}" placeholders, each replaced by the next argument. It is parsed
+    at compile time by the functions below, which are constexpr (hence recursive in C++11) and
+    split ranges in halves, so the recursion depth is logarithmic in the length of the string. */
+
+    template <typename CharType>
+    constexpr bool _is_placeholder(const CharType *text, size_t length, size_t pos)
+    {
+        return pos + 1 < length && text[pos] == '{' && text[pos + 1] == '}';
+    }
+
+    // Counts the placeholders starting in [begin, end)
+    template <typename CharType>
+    constexpr size_t _count_placeholders(const CharType *text, size_t length, size_t begin, size_t end)
+    {
+        return (end - begin == 0) ? 0
+            : (end - begin == 1) ? (_is_placeholder(text, length, begin) ? 1 : 0)
+            : _count_placeholders(text, length, begin, (begin + end) / 2)
+                + _count_placeholders(text, length, (begin + end) / 2, end);
+    }
+
+    template <typename CharType>
+    constexpr size_t _find_placeholder(const CharType *text, size_t length, size_t begin, size_t end);
+
+    template <typename CharType>
+    constexpr size_t _find_placeholder_right(const CharType *text, size_t length, size_t foundLeft, size_t middle, size_t end)
+    {
+        return foundLeft != middle ? foundLeft : _find_placeholder(text, length, middle, end);
+    }
+
+    // Finds the first placeholder starting in [begin, end), or returns 'end'
+    template <typename CharType>
+    constexpr size_t _find_placeholder(const CharType *text, size_t length, size_t begin, size_t end)
+    {
+        return (end - begin == 0) ? end
+            : (end - begin == 1) ? (_is_placeholder(text, length, begin) ? begin : end)
+            : _find_placeholder_right(text, length,
+                _find_placeholder(text, length, begin, (begin + end) / 2), (begin + end) / 2, end);
+    }
+
+    // Gets where the literal segment of the given index starts
+    template <typename CharType>
+    constexpr size_t _segment_start(const CharType *text, size_t length, size_t index)
+    {
+        return index == 0 ? 0 : _find_placeholder(text, length, _segment_start(text, length, index - 1), length) + 2;
+    }
+
+    // Tells whether a type can be an argument for a format string
+    template <typename ValType>
+    struct IsSerializable : std::integral_constant<bool,
+        std::is_arithmetic<ValType>::value || std::is_pointer<ValType>::value || std::is_array<ValType>::value> {};
+
+    template <typename CharType, typename CharTraits, typename AllocType>
+    struct IsSerializable<std::basic_string<CharType, CharTraits, AllocType>> : std::true_type {};
+
+    template <typename ValType>
+    struct IsSerializable<SerializableValue<ValType>> : std::true_type {};
+
+    template <typename ... Args>
+    struct _all_serializable : std::true_type {};
+
+    template <typename FirstArgType, typename ... Args>
+    struct _all_serializable<FirstArgType, Args ...> : std::integral_constant<bool,
+        IsSerializable<FirstArgType>::value && _all_serializable<Args ...>::value> {};
+
+    /// <summary>
+    /// A serializer specialized for a format string, which writes the literal segment of
+    /// the given index, then the argument that follows it, and recurses into the next segment.
+    /// The position and length of every segment are known at compile time.
+    /// </summary>
+    template <typename Format, typename CharType, size_t Index>
+    struct _compiled_format_impl
+    {
+        static constexpr size_t start = _segment_start(Format::Text(), Format::Length(), Index);
+        static constexpr size_t length = _find_placeholder(Format::Text(), Format::Length(), start, Format::Length()) - start;
+
+        // Writes the last segment and the null terminator
+        static size_t Serialize(const RawBufferInfo<CharType> &buffer)
+        {
+            if (length < buffer.count)
+            {
+                memcpy(buffer.data, Format::Text() + start, length * sizeof(CharType));
+                buffer.data[length] = 0;
+            }
+
+            return length;
+        }
+
+        template <typename FirstArgType, typename ... Args>
+        static size_t Serialize(const RawBufferInfo<CharType> &buffer, FirstArgType firstArg, Args ... args)
+        {
+            if (length >= buffer.count)
+                return length + 1; // needs more room
+
+            memcpy(buffer.data, Format::Text() + start, length * sizeof(CharType));
+
+            auto pcount = length + FormatArg(firstArg).template SerializeTo<CharType>(
+                RawBufferInfo<CharType>{ buffer.data + length, buffer.count - length }
+            );
+
+            if (pcount < buffer.count)
+            {
+                return pcount + _compiled_format_impl<Format, CharType, Index + 1>::Serialize(
+                    RawBufferInfo<CharType>{ buffer.data + pcount, buffer.count - pcount }, args ...);
+            }
+
+            return pcount + 1; // needs more room
+        }
+    };
+
+    template <typename Format, typename CharType, size_t Index>
+    constexpr size_t _compiled_format_impl<Format, CharType, Index>::start;
+
+    template <typename Format, typename CharType, size_t Index>
+    constexpr size_t _compiled_format_impl<Format, CharType, Index>::length;
+
+    template <typename Format, typename CharType, typename ... Args>
+    size_t _serialize_formatted_impl(const RawBufferInfo<CharType> &buffer, Args ... args)
+    {
+        static_assert(std::is_same<typename std::decay<decltype(Format::Text()[0])>::type, CharType>::value,
+            "The format string and the output must have the same type of character");
+
+        static_assert(_count_placeholders(Format::Text(), Format::Length(), 0, Format::Length()) == sizeof...(Args),
+            "The amount of arguments does not match the placeholders in the format string");
+
+        static_assert(_all_serializable<Args ...>::value,
+            "The type of an argument cannot be serialized to text");
+
+        return _compiled_format_impl<Format, CharType, 0>::Serialize(buffer, args ...);
+    }
+
+    /// <summary>
+    /// Serializes to a buffer the argument values as text, in place of the placeholders
+    /// of a format string compiled by the macro SERIALIZE_FORMATTED.
+    /// </summary>
+    /// <param name="buffer">The output buffer.</param>
+    /// <param name="bufCharCount">The buffer size in number of characters.</param>
+    /// <param name="...args">The values to serialize, optionally wrapped by <see cref="FormatArg" />.</param>
+    /// <returns>The length of text written into the buffer.</returns>
+    template <typename Format, typename CharType, typename ... Args>
+    size_t SerializeFormatted(CharType buffer[], size_t bufCharCount, Args ... args)
+    {
+        auto pcount = _serialize_formatted_impl<Format>(RawBufferInfo<CharType>{ buffer, bufCharCount }, args ...);
+
+        if (pcount < bufCharCount)
+            return pcount;
+        else
+            throw core::AppException<std::logic_error>("Failed to serialize arguments: buffer is too short!");
+    }
+
+    /// <summary>
+    /// Serializes to a buffer the argument values as text, in place of the placeholders
+    /// of a format string compiled by the macro SERIALIZE_FORMATTED.
+    /// </summary>
+    /// <param name="buffer">The output buffer.</param>
+    /// <param name="...args">The values to serialize, optionally wrapped by <see cref="FormatArg" />.</param>
+    /// <returns>The length of text written into the buffer.</returns>
+    template <typename Format, typename CharType, size_t N, typename ... Args>
+    size_t SerializeFormatted(std::array<CharType, N> &buffer, Args ... args)
+    {
+        return SerializeFormatted<Format>(buffer.data(), buffer.size(), args ...);
+    }
+
+    /// <summary>
+    /// Serializes to a string the argument values as text, in place of the placeholders
+    /// of a format string compiled by the macro SERIALIZE_FORMATTED.
+    /// </summary>
+    /// <param name="out">The output string.</param>
+    /// <param name="...args">The values to serialize, optionally wrapped by <see cref="FormatArg" />.</param>
+    /// <returns>The length of text written into the string.</returns>
+    template <typename Format, typename CharType, typename CharTraits, typename AllocType, typename ... Args>
+    size_t SerializeFormatted(std::basic_string<CharType, CharTraits, AllocType> &out, Args ... args)
+    {
+        try
+        {
+            // the literal segments have the length of the format string without the placeholders:
+            auto estReqSize = Format::Length() - 2 * sizeof...(Args) + _estimate_string_size<CharType>(args ...);
+            out.resize(std::max(out.capacity(), estReqSize + 1));
+
+            while (true)
+            {
+                auto pcount = _serialize_formatted_impl<Format>(RawBufferInfo<CharType>{ &out[0], out.size() }, args ...);
+
+                // string buffer was big enough?
+                if (out.size() > pcount)
+                {
+                    out.resize(pcount);
+                    return pcount;
+                }
+
+                // need more room?
+                out.resize(
+                    (out.size() * 2 > pcount) ? out.size() * 2 : out.size() + pcount
+                );
+            }
+        }
+        catch (core::IAppException &)
+        {
+            throw; // just forward already prepared application exceptions
+        }
+        catch (std::exception &ex)
+        {
+            std::ostringstream oss;
+            oss << "Failed to serialize arguments: " << ex.what();
+            throw core::AppException<std::runtime_error>(oss.str());
+        }
+    }
+
 }// end of namespace utils
 }// end of namespace _3fd
 
+/* Serializes to an output (buffer, array or string) the arguments as text, in place of the "{}"
+   placeholders of a format string literal, as in SERIALIZE_FORMATTED(buffer, "{} failed after {} attempt(s)", name, count)
+   The format string is parsed at compile time, when the amount and types of the arguments are checked too,
+   and a serializer specialized for the call site copies the literal segments with sizes known at compile time. */
+#define SERIALIZE_FORMATTED(OUTPUT, FORMAT, ...) \
+    ([&]() -> size_t { \
+        struct _3fdFormat { \
+            static constexpr decltype(&(FORMAT)[0]) Text() { return FORMAT; } \
+            static constexpr size_t Length() { return sizeof(FORMAT) / sizeof((FORMAT)[0]) - 1; } \
+        }; \
+        return _3fd::utils::SerializeFormatted<_3fdFormat>(OUTPUT, __VA_ARGS__); \
+    }())
+
 #endif // end of header guard
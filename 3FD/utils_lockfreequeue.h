@@ -6,7 +6,10 @@
 #include <functional>
 #include <memory>
 #include <atomic>
+#include <chrono>
 #include <mutex>
+#include <thread>
+#include <type_traits>
 #include <vector>
 #include <queue>
 
@@ -22,6 +25,12 @@ namespace _3fd
 {
 namespace utils
 {
+    /// <summary>
+    /// The assumed size of a cache line, used to keep apart data
+    /// written by different threads in order to avoid false sharing.
+    /// </summary>
+    const size_t cacheLineSize(64);
+
     /// <summary>
     /// Implements a lock-free queue for multiple writers
     /// but a single consumer.
@@ -40,8 +49,126 @@ namespace utils
                 : next(nullptr), value(entry) {}
         };
 
+        /// <summary>
+        /// A cache of recycled elements private to a thread, where producers
+        /// take elements from (thus shared by all queues of the same type).
+        /// It keeps a limited amount of elements, so the memory taken by a
+        /// burst of insertions is given back afterwards.
+        /// </summary>
+        class ElementsCache
+        {
+        private:
+
+            Element *m_top;
+            size_t m_count;
+
+        public:
+
+            static const size_t maxCount = 1024;
+
+            ElementsCache() : m_top(nullptr), m_count(0) {}
+
+            ElementsCache(const ElementsCache &) = delete;
+
+            ~ElementsCache()
+            {
+                while (m_top != nullptr)
+                {
+                    auto next = m_top->next.load(std::memory_order_relaxed);
+                    delete m_top;
+                    m_top = next;
+                }
+            }
+
+            Element *Pop()
+            {
+                auto elem = m_top;
+                if (elem != nullptr)
+                {
+                    m_top = elem->next.load(std::memory_order_relaxed);
+                    --m_count;
+                }
+
+                return elem;
+            }
+
+            // Takes the elements of a list, deleting those in excess of the limit
+            void PushList(Element *list)
+            {
+                while (list != nullptr)
+                {
+                    auto next = list->next.load(std::memory_order_relaxed);
+
+                    if (m_count < maxCount)
+                    {
+                        list->next.store(m_top, std::memory_order_relaxed);
+                        m_top = list;
+                        ++m_count;
+                    }
+                    else
+                        delete list;
+
+                    list = next;
+                }
+            }
+        };
+
+        static ElementsCache &GetThreadCache()
+        {
+            static thread_local ElementsCache cache;
+            return cache;
+        }
+
+        // head, tail and the list of recycled elements are kept in separate cache lines:
+        char m_padding0[cacheLineSize];
         std::atomic<Element *> m_head;
+        char m_padding1[cacheLineSize - sizeof(std::atomic<Element *>)];
         std::atomic<Element *> m_tail;
+        char m_padding2[cacheLineSize - sizeof(std::atomic<Element *>)];
+        std::atomic<Element *> m_recycled;
+        char m_padding3[cacheLineSize - sizeof(std::atomic<Element *>)];
+
+        /// <summary>
+        /// Gets an element for a new entry, recycling a previously consumed one when possible.
+        /// </summary>
+        /// <param name="entry">The entry the element will hold.</param>
+        /// <returns>The element ready to be inserted in the queue.</returns>
+        Element *GetElement(Type *entry)
+        {
+            auto &cache = GetThreadCache();
+            auto elem = cache.Pop();
+
+            if (elem == nullptr)
+            {
+                /* Take all the elements recycled by the consumer at once. Because
+                nobody else pops from this list, this is not subject to ABA: */
+                cache.PushList(m_recycled.exchange(nullptr, std::memory_order_acquire));
+                elem = cache.Pop();
+
+                if (elem == nullptr)
+                    return new Element(entry);
+            }
+
+            elem->value.store(entry, std::memory_order_relaxed);
+            elem->next.store(nullptr, std::memory_order_relaxed);
+            return elem;
+        }
+
+        /// <summary>
+        /// Hands a consumed element back to the producers. This is only
+        /// called by the consumer, after no producer can touch the element.
+        /// </summary>
+        /// <param name="elem">The element to recycle.</param>
+        void RecycleElement(Element *elem)
+        {
+            auto top = m_recycled.load(std::memory_order_relaxed);
+
+            do
+            {
+                elem->next.store(top, std::memory_order_relaxed);
+            }
+            while (!m_recycled.compare_exchange_weak(top, elem, std::memory_order_release, std::memory_order_relaxed));
+        }
 
     public:
 
@@ -52,6 +179,7 @@ namespace utils
         LockFreeQueue()
         {
             auto emptyElem = new Element();
+            m_recycled.store(nullptr, std::memory_order_relaxed);
             m_tail.store(emptyElem, std::memory_order_relaxed);
             m_head.store(emptyElem, std::memory_order_release);
         }
@@ -77,6 +205,15 @@ namespace utils
                 tail = next;
             }
             while (tail != nullptr);
+
+            // Clears the elements waiting to be recycled:
+            auto recycled = m_recycled.load(std::memory_order_acquire);
+            while (recycled != nullptr)
+            {
+                auto next = recycled->next.load(std::memory_order_relaxed);
+                delete recycled;
+                recycled = next;
+            }
         }
 
         /// <summary>
@@ -85,8 +222,8 @@ namespace utils
         /// <param name="entry">The entry to insert.</param>
         void Add(Type *entry)
         {
-            // Create a new element and without locks, replace the head of the queue:
-            auto newElem = new Element(entry);
+            // Get a new element and without locks, replace the head of the queue:
+            auto newElem = GetElement(entry);
             auto headBefore = m_head.exchange(newElem, std::memory_order_acq_rel);
             headBefore->next.store(newElem, std::memory_order_release);
         }
@@ -110,8 +247,8 @@ namespace utils
                 if (next != nullptr)
                 {
                     auto value = tail->value.load(std::memory_order_relaxed);
-                    delete tail;
                     m_tail.store(next, std::memory_order_relaxed); // move tail
+                    RecycleElement(tail);
 
                     // this value can be null if already consumed before
                     if (value != nullptr)
@@ -142,6 +279,370 @@ namespace utils
         }
     };
 
+    /// <summary>
+    /// Implements a bounded lock-free queue for multiple writers and multiple
+    /// consumers, which never allocates memory after construction. This is a
+    /// ring buffer whose slots have a sequence number each, as described by
+    /// Dmitry Vyukov, so producers and consumers only contend on the counter
+    /// of their own side.
+    /// </summary>
+    template<typename Type>
+    class BoundedLockFreeQueue
+    {
+    private:
+
+        /* Once a slot is claimed, it must be published (or released), otherwise the threads on the
+        other side wait for it forever. So what happens while a slot is claimed must not throw: */
+        static_assert(std::is_nothrow_move_constructible<Type>::value && std::is_nothrow_move_assignable<Type>::value,
+                      "BoundedLockFreeQueue requires a type that does not throw when moved");
+
+        struct Slot
+        {
+            std::atomic<size_t> sequence;
+            typename std::aligned_storage<sizeof(Type), alignof(Type)>::type storage;
+
+            Type *GetItem() { return reinterpret_cast<Type *> (&storage); }
+        };
+
+        Slot * const m_slots;
+        const size_t m_mask;
+
+        // the counters are kept in separate cache lines to avoid false sharing:
+        char m_padding0[cacheLineSize];
+        std::atomic<size_t> m_enqueuePos;
+        char m_padding1[cacheLineSize - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> m_dequeuePos;
+        char m_padding2[cacheLineSize - sizeof(std::atomic<size_t>)];
+
+        // Rounds up to the next power of 2
+        static size_t RoundUpPow2(size_t value)
+        {
+            size_t pow2(2);
+            while (pow2 < value)
+                pow2 <<= 1;
+
+            return pow2;
+        }
+
+        // Waits a little before retrying, escalating from spinning to yielding and then sleeping
+        static void Backoff(unsigned int &attempt)
+        {
+            if (attempt < 16)
+                ++attempt;
+            else if (attempt < 64)
+            {
+                ++attempt;
+                std::this_thread::yield();
+            }
+            else
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        /// <summary>
+        /// Claims consecutive slots from one of the ends of the ring.
+        /// </summary>
+        /// <param name="position">The counter for the end of the ring to claim from.</param>
+        /// <param name="seqOffset">The offset added to the position of a slot to get the sequence number
+        /// of the slot when it is ready to be claimed (0 for producers and 1 for consumers).</param>
+        /// <param name="maxCount">The maximum amount of slots to claim.</param>
+        /// <param name="first">Receives the position of the first claimed slot.</param>
+        /// <returns>How many slots were claimed, which is zero when the ring is full/empty.</returns>
+        size_t ClaimSlots(std::atomic<size_t> &position, size_t seqOffset, size_t maxCount, size_t &first)
+        {
+            if (maxCount == 0)
+                return 0;
+
+            auto pos = position.load(std::memory_order_relaxed);
+
+            while (true)
+            {
+                /* Count how many slots ahead are ready. Once ready, a slot cannot
+                change state until claimed, and only the winner of the CAS below
+                gets to claim them: */
+                size_t count(0);
+                while (count < maxCount)
+                {
+                    auto &slot = m_slots[(pos + count) & m_mask];
+                    auto seq = slot.sequence.load(std::memory_order_acquire);
+                    if (seq != pos + count + seqOffset)
+                        break;
+
+                    ++count;
+                }
+
+                if (count > 0)
+                {
+                    if (position.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+                    {
+                        first = pos;
+                        return count;
+                    }
+                }
+                else
+                {
+                    auto seq = m_slots[pos & m_mask].sequence.load(std::memory_order_acquire);
+                    auto dif = static_cast<intptr_t> (seq) - static_cast<intptr_t> (pos + seqOffset);
+
+                    if (dif < 0)
+                        return 0; // full (for producers) or empty (for consumers)
+
+                    // another thread claimed this slot first:
+                    pos = position.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Publishes an item placed into a slot claimed by a producer
+        void PublishItem(size_t pos)
+        {
+            m_slots[pos & m_mask].sequence.store(pos + 1, std::memory_order_release);
+        }
+
+        // Destroys the item left in a slot claimed by a consumer and makes the slot available for producers
+        void ReleaseSlot(size_t pos)
+        {
+            auto &slot = m_slots[pos & m_mask];
+            slot.GetItem()->~Type();
+            slot.sequence.store(pos + m_mask + 1, std::memory_order_release);
+        }
+
+        // Adds a batch of items constructed without throwing, so the slots are claimed at once
+        template <typename IterType>
+        size_t TryAddBatchImpl(IterType begin, size_t count, std::true_type)
+        {
+            size_t added(0);
+
+            while (added < count)
+            {
+                size_t first;
+                auto claimed = ClaimSlots(m_enqueuePos, 0, count - added, first);
+                if (claimed == 0)
+                    break;
+
+                for (auto pos = first; pos < first + claimed; ++pos)
+                {
+                    new (m_slots[pos & m_mask].GetItem()) Type(*begin);
+                    ++begin;
+                    PublishItem(pos);
+                }
+
+                added += claimed;
+            }
+
+            return added;
+        }
+
+        // Adds a batch of items whose construction might throw, so each one is made before its slot is claimed
+        template <typename IterType>
+        size_t TryAddBatchImpl(IterType begin, size_t count, std::false_type)
+        {
+            size_t added(0);
+
+            while (added < count)
+            {
+                Type item(*begin);
+                if (!TryAdd(std::move(item)))
+                    break;
+
+                ++begin;
+                ++added;
+            }
+
+            return added;
+        }
+
+    public:
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="BoundedLockFreeQueue{Type}"/> class.
+        /// The initialization of this instance is NOT THREAD-SAFE.
+        /// </summary>
+        /// <param name="capacity">The capacity, which is rounded up to a power of 2.</param>
+        BoundedLockFreeQueue(size_t capacity)
+            : m_slots(new Slot[RoundUpPow2(capacity)])
+            , m_mask(RoundUpPow2(capacity) - 1)
+        {
+            for (size_t idx = 0; idx <= m_mask; ++idx)
+                m_slots[idx].sequence.store(idx, std::memory_order_relaxed);
+
+            m_enqueuePos.store(0, std::memory_order_relaxed);
+            m_dequeuePos.store(0, std::memory_order_release);
+        }
+
+        BoundedLockFreeQueue(const BoundedLockFreeQueue &) = delete;
+
+        /// <summary>
+        /// Finalizes an instance of the <see cref="BoundedLockFreeQueue{Type}"/> class.
+        /// The destruction of this instance is NOT THREAD-SAFE.
+        /// </summary>
+        ~BoundedLockFreeQueue()
+        {
+            // Destroy the items left in the queue:
+            auto pos = m_dequeuePos.load(std::memory_order_relaxed);
+            auto end = m_enqueuePos.load(std::memory_order_acquire);
+            while (pos != end)
+                m_slots[pos++ & m_mask].GetItem()->~Type();
+
+            delete[] m_slots;
+        }
+
+        /// <summary>
+        /// Gets the capacity of the queue.
+        /// </summary>
+        /// <returns>How many items the queue can hold.</returns>
+        size_t GetCapacity() const { return m_mask + 1; }
+
+        /// <summary>
+        /// Determines whether the queue is empty. This is only a snapshot
+        /// and might be outdated by the time the caller uses it.
+        /// </summary>
+        /// <returns>
+        /// <c>true</c> when the queue is empty, otherwise, <c>false</c>.
+        /// </returns>
+        bool IsEmpty() const
+        {
+            return m_dequeuePos.load(std::memory_order_acquire)
+                == m_enqueuePos.load(std::memory_order_acquire);
+        }
+
+        /// <summary>
+        /// Attempts to add an item to the queue.
+        /// </summary>
+        /// <param name="item">The item to add (using move semantics).</param>
+        /// <returns><c>true</c> when successful, or <c>false</c> if the queue was full.</returns>
+        bool TryAdd(Type &&item)
+        {
+            size_t pos;
+            if (ClaimSlots(m_enqueuePos, 0, 1, pos) == 0)
+                return false;
+
+            new (m_slots[pos & m_mask].GetItem()) Type(std::move(item));
+            PublishItem(pos);
+            return true;
+        }
+
+        /// <summary>
+        /// Attempts to add an item to the queue.
+        /// </summary>
+        /// <param name="item">The item to add (using copy semantics).</param>
+        /// <returns><c>true</c> when successful, or <c>false</c> if the queue was full.</returns>
+        bool TryAdd(const Type &item)
+        {
+            return TryAdd(Type(item));
+        }
+
+        /// <summary>
+        /// Attempts to add a batch of items to the queue, claiming room for them at once.
+        /// When copying an item might throw, the items are copied and added one at a time,
+        /// so an exception leaves the queue intact.
+        /// </summary>
+        /// <param name="begin">An iterator to the first item to add (wrap it in 'std::make_move_iterator' for move semantics).</param>
+        /// <param name="count">How many items to add.</param>
+        /// <returns>How many items (from the beginning of the batch) were added, which is less than requested when the queue gets full.</returns>
+        template <typename IterType>
+        size_t TryAddBatch(IterType begin, size_t count)
+        {
+            return TryAddBatchImpl(begin, count,
+                std::integral_constant<bool, std::is_nothrow_constructible<Type, decltype(*begin)>::value>());
+        }
+
+        /// <summary>
+        /// Attempts to remove an item from the queue.
+        /// </summary>
+        /// <param name="item">Receives the removed item.</param>
+        /// <returns><c>true</c> when successful, or <c>false</c> if the queue was empty.</returns>
+        bool TryRemove(Type &item)
+        {
+            size_t pos;
+            if (ClaimSlots(m_dequeuePos, 1, 1, pos) == 0)
+                return false;
+
+            item = std::move(*m_slots[pos & m_mask].GetItem());
+            ReleaseSlot(pos);
+            return true;
+        }
+
+        /// <summary>
+        /// Attempts to remove a batch of items from the queue, claiming them at once.
+        /// </summary>
+        /// <param name="out">An output iterator to receive the removed items.</param>
+        /// <param name="maxCount">The maximum amount of items to remove.</param>
+        /// <returns>How many items were removed, which is zero when the queue was empty.</returns>
+        template <typename OutIterType>
+        size_t TryRemoveBatch(OutIterType out, size_t maxCount)
+        {
+            size_t first(0);
+            auto claimed = ClaimSlots(m_dequeuePos, 1, maxCount, first);
+            auto pos = first;
+
+            try
+            {
+                for (; pos < first + claimed; ++pos)
+                {
+                    *out = std::move(*m_slots[pos & m_mask].GetItem());
+                    ++out;
+                    ReleaseSlot(pos);
+                }
+            }
+            catch (...)
+            {
+                /* The output failed, but the slots claimed must go back to the producers,
+                otherwise the queue is blocked for good. (The items left there are lost.) */
+                for (; pos < first + claimed; ++pos)
+                    ReleaseSlot(pos);
+
+                throw;
+            }
+
+            return claimed;
+        }
+
+        /// <summary>
+        /// Adds an item to the queue, waiting for room when the queue is full.
+        /// </summary>
+        /// <param name="item">The item to add.</param>
+        void WaitAdd(Type item)
+        {
+            unsigned int attempt(0);
+            while (!TryAdd(std::move(item)))
+                Backoff(attempt);
+        }
+
+        /// <summary>
+        /// Removes an item from the queue, waiting for one when the queue is empty.
+        /// </summary>
+        /// <param name="item">Receives the removed item.</param>
+        void WaitRemove(Type &item)
+        {
+            unsigned int attempt(0);
+            while (!TryRemove(item))
+                Backoff(attempt);
+        }
+
+        /// <summary>
+        /// Removes an item from the queue, waiting for one until a timeout.
+        /// </summary>
+        /// <param name="item">Receives the removed item.</param>
+        /// <param name="millisecs">The timeout in milliseconds.</param>
+        /// <returns><c>true</c> when an item was removed, or <c>false</c> when the timeout happened first.</returns>
+        bool WaitRemoveFor(Type &item, unsigned long millisecs)
+        {
+            using namespace std::chrono;
+            auto deadline = steady_clock::now() + milliseconds(millisecs);
+            unsigned int attempt(0);
+
+            while (!TryRemove(item))
+            {
+                if (steady_clock::now() >= deadline)
+                    return false;
+
+                Backoff(attempt);
+            }
+
+            return true;
+        }
+    };
+
     /// <summary>
     /// Implements a locked queue in order to aid the testing of
     /// the lock-free implementation.
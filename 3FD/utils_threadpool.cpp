@@ -0,0 +1,288 @@
+#include "stdafx.h"
+#include "utils_threadpool.h"
+#include "exceptions.h"
+#include "logger.h"
+
+#include <sstream>
+
+namespace _3fd
+{
+namespace utils
+{
+    ////////////////////////////////
+    // ThreadPool Class
+    ////////////////////////////////
+
+    /// <summary>
+    /// Holds the state of a worker thread in the pool.
+    /// </summary>
+    class ThreadPool::Worker : notcopiable
+    {
+    public:
+
+        ThreadPool &pool;
+        WorkStealingDeque<Task> deque;
+        uint32_t randomState;
+
+        Worker(ThreadPool &p, uint32_t seed)
+            : pool(p), randomState(seed) {}
+
+        /// <summary>
+        /// Generates a pseudo-random number (xorshift) for the choice of victims to steal from.
+        /// </summary>
+        uint32_t GetRandom()
+        {
+            randomState ^= randomState << 13;
+            randomState ^= randomState >> 17;
+            randomState ^= randomState << 5;
+            return randomState;
+        }
+    };
+
+    thread_local ThreadPool::Worker * ThreadPool::currentWorker(nullptr);
+
+    // The capacity of the queue where tasks posted from outside the pool are injected
+    static const size_t injectionQueueCapacity(4096);
+
+    // How many times an idle worker looks for tasks before parking
+    static const int maxSpinsBeforeParking(32);
+
+    /// <summary>
+    /// Initializes a new instance of the <see cref="ThreadPool"/> class.
+    /// </summary>
+    /// <param name="numWorkers">How many worker threads to launch. When zero,
+    /// this is the amount of hardware threads available.</param>
+    ThreadPool::ThreadPool(unsigned int numWorkers)
+        : m_injectionQueue(injectionQueueCapacity)
+        , m_stop(false)
+    {
+        CALL_STACK_TRACE;
+
+        if (numWorkers == 0)
+        {
+            numWorkers = std::thread::hardware_concurrency();
+
+            if (numWorkers == 0)
+                numWorkers = 1;
+        }
+
+        try
+        {
+            m_workers.reserve(numWorkers);
+            for (unsigned int idx = 0; idx < numWorkers; ++idx)
+                m_workers.emplace_back(new Worker(*this, 2654435761U * (idx + 1)));
+
+            m_threads.reserve(numWorkers);
+            for (auto &worker : m_workers)
+                m_threads.emplace_back(&ThreadPool::RunWorker, this, worker.get());
+        }
+        catch (std::system_error &ex)
+        {
+            m_stop.store(true, std::memory_order_release);
+            m_eventCount.NotifyAll();
+
+            for (auto &thread : m_threads)
+                thread.join();
+
+            std::ostringstream oss;
+            oss << "System failure when launching worker threads for pool: " << core::StdLibExt::GetDetailsFromSystemError(ex);
+            throw core::AppException<std::runtime_error>(oss.str());
+        }
+        catch (std::exception &ex)
+        {
+            m_stop.store(true, std::memory_order_release);
+            m_eventCount.NotifyAll();
+
+            for (auto &thread : m_threads)
+                thread.join();
+
+            std::ostringstream oss;
+            oss << "Generic failure when launching worker threads for pool: " << ex.what();
+            throw core::AppException<std::runtime_error>(oss.str());
+        }
+    }
+
+    /// <summary>
+    /// Finalizes an instance of the <see cref="ThreadPool"/> class.
+    /// The workers finish the pending tasks before terminating.
+    /// </summary>
+    ThreadPool::~ThreadPool()
+    {
+        m_stop.store(true, std::memory_order_release);
+        m_eventCount.NotifyAll();
+
+        for (auto &thread : m_threads)
+            thread.join();
+
+        // Discard tasks posted while the workers were terminating:
+        Task *task;
+        while (m_injectionQueue.TryRemove(task))
+            delete task;
+    }
+
+    /// <summary>
+    /// Gets the pool shared by the whole application, which is lazily
+    /// created with one worker per hardware thread.
+    /// </summary>
+    /// <returns>The default pool.</returns>
+    ThreadPool & ThreadPool::GetDefault()
+    {
+        static ThreadPool defaultPool;
+        return defaultPool;
+    }
+
+    /// <summary>
+    /// Executes a task and destroys it. Because the failures cannot be reported
+    /// to whoever posted it, they are written to the log.
+    /// </summary>
+    /// <param name="task">The task.</param>
+    void ThreadPool::Execute(Task *task) NOEXCEPT
+    {
+        std::unique_ptr<Task> taskPtr(task);
+
+        try
+        {
+            (*taskPtr)();
+        }
+        catch (core::IAppException &ex)
+        {
+            core::Logger::Write(ex, core::Logger::PRIO_ERROR);
+        }
+        catch (std::exception &ex)
+        {
+            std::ostringstream oss;
+            oss << "Generic failure when executing callback asynchronously: " << ex.what();
+            core::Logger::Write(oss.str(), core::Logger::PRIO_ERROR);
+        }
+        catch (...)
+        {
+            std::ostringstream oss;
+            oss << "Unexpected exception during asynchronous execution of callback";
+            core::Logger::Write(oss.str(), core::Logger::PRIO_ERROR);
+        }
+    }
+
+    /// <summary>
+    /// Looks for a task to execute, first in the deque of the worker, then
+    /// in the injection queue, and finally in the deques of the other workers.
+    /// </summary>
+    /// <param name="worker">The worker looking for a task, or a null pointer
+    /// when the caller is not a worker of this pool.</param>
+    /// <returns>The task found, or a null pointer if none was found.</returns>
+    ThreadPool::Task * ThreadPool::FindTask(Worker *worker)
+    {
+        Task *task(nullptr);
+
+        if (worker != nullptr && (task = worker->deque.Take()) != nullptr)
+            return task;
+
+        if (m_injectionQueue.TryRemove(task))
+            return task;
+
+        // Steal, starting from a random victim so that thieves spread out:
+        auto numWorkers = m_workers.size();
+        size_t start = (worker != nullptr) ? worker->GetRandom() % numWorkers : 0;
+
+        for (size_t count = 0; count < numWorkers; ++count)
+        {
+            auto victim = m_workers[(start + count) % numWorkers].get();
+
+            if (victim != worker && (task = victim->deque.Steal()) != nullptr)
+                return task;
+        }
+
+        return nullptr;
+    }
+
+    /// <summary>
+    /// The loop of a worker thread.
+    /// </summary>
+    /// <param name="worker">The worker.</param>
+    void ThreadPool::RunWorker(Worker *worker)
+    {
+        currentWorker = worker;
+
+        while (true)
+        {
+            auto task = FindTask(worker);
+
+            for (int count = 0; task == nullptr && count < maxSpinsBeforeParking; ++count)
+            {
+                std::this_thread::yield();
+                task = FindTask(worker);
+            }
+
+            if (task != nullptr)
+            {
+                Execute(task);
+                continue;
+            }
+
+            // Nothing found, so park, but not before checking once again:
+            auto key = m_eventCount.PrepareWait();
+
+            task = FindTask(worker);
+
+            if (task != nullptr)
+            {
+                m_eventCount.CancelWait();
+                Execute(task);
+                continue;
+            }
+
+            if (m_stop.load(std::memory_order_acquire))
+            {
+                m_eventCount.CancelWait();
+                break;
+            }
+
+            m_eventCount.CommitWait(key);
+        }
+
+        currentWorker = nullptr;
+    }
+
+    /// <summary>
+    /// Places a task where the workers can find it and wakes one of them.
+    /// When the injection queue is full, this waits for room.
+    /// </summary>
+    /// <param name="task">The task.</param>
+    void ThreadPool::Enqueue(Task *task)
+    {
+        if (currentWorker != nullptr && &currentWorker->pool == this)
+            currentWorker->deque.Push(task);
+        else
+            m_injectionQueue.WaitAdd(task);
+
+        m_eventCount.NotifyOne();
+    }
+
+    /// <summary>
+    /// Posts a callback for execution in the pool, with no means of waiting for
+    /// it to finish. Failures of the callback are written to the log.
+    /// </summary>
+    /// <param name="callback">The callback.</param>
+    void ThreadPool::Post(const std::function<void()> &callback)
+    {
+        Enqueue(new Task(callback));
+    }
+
+    /// <summary>
+    /// Executes a pending task (if any) in the calling thread. Threads waiting for
+    /// the result of tasks can call this, so they help rather than block the pool.
+    /// </summary>
+    /// <returns><c>true</c> when a task was executed, otherwise, <c>false</c>.</returns>
+    bool ThreadPool::TryRunPendingTask()
+    {
+        auto worker = (currentWorker != nullptr && &currentWorker->pool == this) ? currentWorker : nullptr;
+        auto task = FindTask(worker);
+
+        if (task == nullptr)
+            return false;
+
+        Execute(task);
+        return true;
+    }
+
+}// end of namespace utils
+}// end of namespace _3fd
@@ -0,0 +1,251 @@
+#ifndef UTILS_THREADPOOL_H // header guard
+#define UTILS_THREADPOOL_H
+
+#include "base.h"
+#include "utils.h"
+#include "utils_lockfreequeue.h"
+
+#include <atomic>
+#include <cinttypes>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace _3fd
+{
+namespace utils
+{
+    /// <summary>
+    /// Implements the work-stealing deque by Chase and Lev, as revised by Lê et al. for
+    /// the C11 memory model. Only the thread owning the deque can push and take from the
+    /// bottom, whereas any thread can steal from the top.
+    /// </summary>
+    template <typename Type>
+    class WorkStealingDeque : notcopiable
+    {
+    private:
+
+        /// <summary>
+        /// A circular array whose size is a power of 2.
+        /// </summary>
+        class Array : notcopiable
+        {
+        private:
+
+            std::unique_ptr<std::atomic<Type *>[]> m_items;
+            const int64_t m_mask;
+
+        public:
+
+            Array(int64_t size)
+                : m_items(new std::atomic<Type *>[static_cast<size_t> (size)])
+                , m_mask(size - 1) {}
+
+            int64_t GetSize() const { return m_mask + 1; }
+
+            Type *Get(int64_t idx) const
+            {
+                return m_items[idx & m_mask].load(std::memory_order_relaxed);
+            }
+
+            void Put(int64_t idx, Type *item)
+            {
+                m_items[idx & m_mask].store(item, std::memory_order_relaxed);
+            }
+        };
+
+        std::atomic<int64_t> m_top;
+        char m_padding0[cacheLineSize - sizeof(std::atomic<int64_t>)];
+        std::atomic<int64_t> m_bottom;
+        std::atomic<Array *> m_array;
+        char m_padding1[cacheLineSize - sizeof(std::atomic<int64_t>) - sizeof(std::atomic<Array *>)];
+
+        /* Arrays replaced when growing cannot be released while thieves might still
+        read from them, so they are kept until the deque is destroyed. Because the
+        size doubles at each replacement, this never takes more than the current array: */
+        std::vector<std::unique_ptr<Array>> m_retiredArrays;
+
+    public:
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="WorkStealingDeque{Type}"/> class.
+        /// </summary>
+        /// <param name="initialSize">The initial capacity, which must be a power of 2.</param>
+        WorkStealingDeque(int64_t initialSize = 256)
+            : m_top(0)
+            , m_bottom(0)
+            , m_array(new Array(initialSize))
+        {
+            _ASSERTE(initialSize > 0 && (initialSize & (initialSize - 1)) == 0); // size must be a power of 2
+        }
+
+        /// <summary>
+        /// Finalizes an instance of the <see cref="WorkStealingDeque{Type}"/> class.
+        /// </summary>
+        ~WorkStealingDeque()
+        {
+            delete m_array.load(std::memory_order_relaxed);
+        }
+
+        /// <summary>
+        /// Determines whether the deque is empty. This is only a snapshot.
+        /// </summary>
+        /// <returns><c>true</c> when the deque is empty, otherwise, <c>false</c>.</returns>
+        bool IsEmpty() const
+        {
+            return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed);
+        }
+
+        /// <summary>
+        /// Pushes an item to the bottom of the deque. Only the owner can call this.
+        /// </summary>
+        /// <param name="item">The item to push.</param>
+        void Push(Type *item)
+        {
+            auto bottom = m_bottom.load(std::memory_order_relaxed);
+            auto top = m_top.load(std::memory_order_acquire);
+            auto array = m_array.load(std::memory_order_relaxed);
+
+            // Full? Replace the array by a larger one:
+            if (bottom - top > array->GetSize() - 1)
+            {
+                std::unique_ptr<Array> newArray(new Array(2 * array->GetSize()));
+                for (auto idx = top; idx < bottom; ++idx)
+                    newArray->Put(idx, array->Get(idx));
+
+                m_retiredArrays.emplace_back(array);
+                array = newArray.release();
+                m_array.store(array, std::memory_order_release);
+            }
+
+            array->Put(bottom, item);
+            m_bottom.store(bottom + 1, std::memory_order_release); // publishes the item for thieves
+        }
+
+        /// <summary>
+        /// Takes an item from the bottom of the deque. Only the owner can call this.
+        /// </summary>
+        /// <returns>The item taken, or a null pointer if the deque was empty.</returns>
+        Type *Take()
+        {
+            auto bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+            auto array = m_array.load(std::memory_order_relaxed);
+            m_bottom.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto top = m_top.load(std::memory_order_relaxed);
+
+            if (top > bottom) // empty?
+            {
+                m_bottom.store(bottom + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            auto item = array->Get(bottom);
+
+            // Last item? Race against thieves for it:
+            if (top == bottom)
+            {
+                if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    item = nullptr;
+
+                m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            }
+
+            return item;
+        }
+
+        /// <summary>
+        /// Steals an item from the top of the deque. Any thread can call this.
+        /// </summary>
+        /// <returns>The item stolen, or a null pointer if the deque was empty or another thread won the race.</returns>
+        Type *Steal()
+        {
+            auto top = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto bottom = m_bottom.load(std::memory_order_acquire);
+
+            if (top >= bottom)
+                return nullptr;
+
+            auto item = m_array.load(std::memory_order_acquire)->Get(top);
+
+            if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return nullptr;
+
+            return item;
+        }
+    };
+
+    /// <summary>
+    /// A pool of worker threads, each one with its own deque of tasks, from which idle
+    /// workers steal. Tasks posted from inside a worker go to its own deque, while the
+    /// ones posted from elsewhere go to a shared injection queue. Idle workers park on
+    /// an event count, so they neither spin nor miss new tasks.
+    /// </summary>
+    class ThreadPool : notcopiable
+    {
+    private:
+
+        typedef std::function<void()> Task;
+
+        class Worker;
+
+        thread_local static Worker *currentWorker;
+
+        std::vector<std::unique_ptr<Worker>> m_workers;
+        std::vector<std::thread> m_threads;
+        BoundedLockFreeQueue<Task *> m_injectionQueue;
+        EventCount m_eventCount;
+        std::atomic<bool> m_stop;
+
+        Task *FindTask(Worker *worker);
+
+        void RunWorker(Worker *worker);
+
+        void Enqueue(Task *task);
+
+        static void Execute(Task *task) NOEXCEPT;
+
+    public:
+
+        ThreadPool(unsigned int numWorkers = 0);
+
+        ~ThreadPool();
+
+        static ThreadPool &GetDefault();
+
+        /// <summary>
+        /// Gets how many worker threads are in the pool.
+        /// </summary>
+        /// <returns>The number of workers.</returns>
+        unsigned int GetNumWorkers() const { return static_cast<unsigned int> (m_threads.size()); }
+
+        void Post(const std::function<void()> &callback);
+
+        bool TryRunPendingTask();
+
+        /// <summary>
+        /// Submits a callable for execution in the pool.
+        /// </summary>
+        /// <param name="callable">The callable, which takes no arguments.</param>
+        /// <returns>A future for the result returned (or the exception thrown) by the callable.</returns>
+        template <typename CallableType>
+        std::future<typename std::result_of<CallableType()>::type> Submit(CallableType &&callable)
+        {
+            typedef typename std::result_of<CallableType()>::type ResultType;
+
+            // std::function requires copyable targets, hence the shared pointer:
+            auto packagedTask = std::make_shared<std::packaged_task<ResultType()>>(std::forward<CallableType>(callable));
+            auto future = packagedTask->get_future();
+            Enqueue(new Task([packagedTask]() { (*packagedTask)(); }));
+            return future;
+        }
+    };
+
+}// end of namespace utils
+}// end of namespace _3fd
+
+#endif // end of header guard
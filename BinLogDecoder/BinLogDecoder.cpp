@@ -0,0 +1,60 @@
+#include "stdafx.h"
+#include "exceptions.h"
+#include "logger_binary.h"
+#include <exception>
+#include <fstream>
+#include <iostream>
+
+/// <summary>
+/// Renders to text the records in a binary log written by <see cref="_3fd::core::BinaryLog"/>.
+/// Usage: BinLogDecoder INPUT.binlog [OUTPUT.txt]
+/// When no output file is specified, the text goes to the standard output.
+/// </summary>
+int main(int argc, char *argv[])
+{
+    using namespace _3fd::core;
+
+    if (argc < 2 || argc > 3)
+    {
+        std::cerr << "Usage: BinLogDecoder INPUT.binlog [OUTPUT.txt]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try
+    {
+        std::ifstream input(argv[1], std::ios::binary);
+
+        if (!input.is_open())
+        {
+            std::cerr << "Could not open input file \'" << argv[1] << '\'' << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::ofstream outputFile;
+
+        if (argc == 3)
+        {
+            outputFile.open(argv[2], std::ios::trunc);
+
+            if (!outputFile.is_open())
+            {
+                std::cerr << "Could not open output file \'" << argv[2] << '\'' << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        auto numRecords = BinaryLog::Decode(input, argc == 3 ? outputFile : std::cout);
+        std::cerr << numRecords << " record(s) decoded" << std::endl;
+        return EXIT_SUCCESS;
+    }
+    catch (IAppException &ex)
+    {
+        std::cerr << ex.ToString() << std::endl;
+    }
+    catch (std::exception &ex)
+    {
+        std::cerr << "Generic failure: " << ex.what() << std::endl;
+    }
+
+    return EXIT_FAILURE;
+}
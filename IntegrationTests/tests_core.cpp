@@ -1,14 +1,28 @@
 #include "stdafx.h"
 #include "runtime.h"
 #include "exceptions.h"
+#include "profiler.h"
+#include "timing.h"
+#include "logger_binary.h"
 #include <map>
+#include <algorithm>
 #include <list>
 #include <array>
 #include <chrono>
+#include <cstdio>
 #include <thread>
 #include <future>
+#include <fstream>
 #include <random>
 #include <iostream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+#ifdef ENABLE_3FD_MMAP_LOGGER
+#   include <Poco/InflatingStream.h>
+#   include <dirent.h>
+#endif
 
 namespace _3fd
 {
@@ -54,6 +68,584 @@ namespace integration_tests
         }
     }
 
+    /// <summary>
+    /// Measures how long writing to the log takes for the calling
+    /// threads, while several of them write at the same time.
+    /// </summary>
+    TEST(Framework_CoreRuntime_TestCase, LogOutput_Speed_Test)
+    {
+        using namespace std::chrono;
+
+        // Ensures proper initialization/finalization of the framework
+#   ifdef _3FD_PLATFORM_WINRT
+        core::FrameworkInstance _framework("IntegrationTestsApp.WinRT.UWP");
+#   else
+        core::FrameworkInstance _framework;
+#   endif
+
+        CALL_STACK_TRACE;
+
+        try
+        {
+            const int numThreads = 4;
+            const int numWritesPerThread = 20000;
+            std::vector<std::future<long long>> futures;
+
+            for (int count = 0; count < numThreads; ++count)
+            {
+                futures.push_back(std::async(std::launch::async, []()
+                {
+                    const string message("Log entry written to measure the cost of logging.");
+                    auto startTime = steady_clock::now();
+
+                    for (int idx = 0; idx < numWritesPerThread; ++idx)
+                        Logger::Write(message, core::Logger::PRIO_INFORMATION);
+
+                    return static_cast<long long> (duration_cast<nanoseconds>(steady_clock::now() - startTime).count());
+                }));
+            }
+
+            long long totalTime(0);
+            for (auto &future : futures)
+                totalTime += future.get();
+
+            std::cout << "Logger::Write with " << numThreads << " threads: "
+                      << static_cast<double> (totalTime) / (numThreads * numWritesPerThread)
+                      << " ns per call" << std::endl;
+        }
+        catch (...)
+        {
+            HandleException();
+        }
+    }
+
+#ifdef ENABLE_3FD_MMAP_LOGGER
+    /// <summary>
+    /// Tests the rotation of memory-mapped log segments, while several threads write at the
+    /// same time, checking that no record is lost in the archives of the full segments.
+    /// </summary>
+    TEST(Framework_CoreRuntime_TestCase, LogRotation_Test)
+    {
+        using namespace std::chrono;
+
+        // Ensures proper initialization/finalization of the framework
+        core::FrameworkInstance _framework;
+
+        CALL_STACK_TRACE;
+
+        try
+        {
+            const int numThreads = 4;
+            const int numWritesPerThread = 10000;
+
+            // tells apart the records written in this execution:
+            std::ostringstream oss;
+            oss << "rotation test " << system_clock::now().time_since_epoch().count() << " - ";
+            const string token = oss.str();
+
+            std::vector<std::future<void>> futures;
+
+            for (int count = 0; count < numThreads; ++count)
+            {
+                futures.push_back(std::async(std::launch::async, [&token, count]()
+                {
+                    const string message = token + string(200, 'a' + count);
+
+                    for (int idx = 0; idx < numWritesPerThread; ++idx)
+                        Logger::Write(message, core::Logger::PRIO_NOTICE);
+                }));
+            }
+
+            for (auto &future : futures)
+                future.get();
+
+            // seals the current segment and archives the full ones:
+            Logger::Shutdown();
+
+            const string prefix = AppConfig::GetApplicationId() + '.';
+            int numArchives(0), numRecords(0);
+
+            auto countRecords = [&token, &numRecords](std::istream &input)
+            {
+                string line;
+                while (std::getline(input, line))
+                {
+                    if (line.find(token) != string::npos)
+                        ++numRecords;
+                }
+            };
+
+            DIR *dir = opendir(".");
+            ASSERT_TRUE(dir != nullptr);
+
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != nullptr)
+            {
+                const string fileName(entry->d_name);
+
+                if (fileName.compare(0, prefix.length(), prefix) != 0)
+                    continue;
+
+                if (fileName.rfind(".log.gz") == fileName.length() - 7)
+                {
+                    std::ifstream input(fileName, std::ios::binary);
+                    Poco::InflatingInputStream inflater(input, Poco::InflatingStreamBuf::STREAM_GZIP);
+                    countRecords(inflater);
+                    ++numArchives;
+                }
+                else if (fileName.rfind(".log") == fileName.length() - 4)
+                {
+                    // the segment in use upon shutdown is sealed, but not archived:
+                    std::ifstream input(fileName, std::ios::binary);
+                    string header;
+                    std::getline(input, header);
+                    EXPECT_NE(string::npos, header.find("state=done"));
+                    countRecords(input);
+                }
+            }
+
+            closedir(dir);
+
+            EXPECT_GT(numArchives, 0);
+            EXPECT_EQ(numThreads * numWritesPerThread, numRecords);
+        }
+        catch (...)
+        {
+            HandleException();
+        }
+    }
+#endif
+
+#ifdef ENABLE_3FD_NATIVE_LOGGER
+    /// <summary>
+    /// Tests the content of the log file written while several threads write at the same time,
+    /// checking that no record is lost or out of order, and that the file is shifted when it
+    /// reaches the size limit, with the oldest backup purged.
+    /// </summary>
+    TEST(Framework_CoreRuntime_TestCase, LogOutput_Content_Test)
+    {
+        using namespace std::chrono;
+
+        // Ensures proper initialization/finalization of the framework
+        core::FrameworkInstance _framework;
+
+        CALL_STACK_TRACE;
+
+        try
+        {
+            const auto &settings = AppConfig::GetSettings().common.log;
+            ASSERT_GT(settings.purgeCount, 1U);
+
+            // start with a fresh log file, and backups holding a mark of their position:
+            Logger::Shutdown();
+
+            const string filePath = AppConfig::GetApplicationId() + ".log";
+            std::remove(filePath.c_str());
+            std::remove((filePath + '.' + std::to_string(settings.purgeCount + 1)).c_str());
+
+            for (uint32_t idx = 1; idx <= settings.purgeCount; ++idx)
+            {
+                std::ofstream backup(filePath + '.' + std::to_string(idx), std::ios::trunc);
+                backup << "backup " << idx << '\n';
+            }
+
+            // tells apart the records written in this execution:
+            std::ostringstream oss;
+            oss << "content test " << system_clock::now().time_since_epoch().count() << " - ";
+            const string token = oss.str();
+
+            // enough text for the file to reach the size limit once, but not twice:
+            const int numThreads = 4;
+            const int recordLength = 256;
+            const int numWritesPerThread = static_cast<int> (settings.sizeLimit * 1024ULL * 3 / 2 / (numThreads * recordLength));
+
+            std::vector<std::future<void>> futures;
+
+            for (int count = 0; count < numThreads; ++count)
+            {
+                futures.push_back(std::async(std::launch::async, [&token, count, numWritesPerThread]()
+                {
+                    for (int idx = 0; idx < numWritesPerThread; ++idx)
+                    {
+                        std::ostringstream oss;
+                        oss << token << "thread " << count << " record " << idx << ' ';
+                        auto message = oss.str();
+                        message.resize(recordLength - 48, '.');
+                        Logger::Write(message, core::Logger::PRIO_NOTICE);
+                    }
+                }));
+            }
+
+            for (auto &future : futures)
+                future.get();
+
+            // writes what is left in the rings of the threads:
+            Logger::Shutdown();
+
+            // the records of each thread must come in order, from the older file to the newer:
+            std::array<int, numThreads> nextRecord;
+            nextRecord.fill(0);
+            int numRecordsInBackup(0);
+
+            const string fileNames[] = { filePath + ".1", filePath };
+
+            for (auto &fileName : fileNames)
+            {
+                std::ifstream input(fileName);
+                ASSERT_TRUE(input.is_open());
+
+                string line;
+                while (std::getline(input, line))
+                {
+                    auto pos = line.find(token);
+                    if (pos == string::npos)
+                        continue;
+
+                    EXPECT_NE(string::npos, line.rfind("NOTICE - ", pos));
+                    EXPECT_EQ(static_cast<size_t> (recordLength - 48), line.length() - pos);
+
+                    int thread(-1), record(-1);
+                    std::istringstream iss(line.substr(pos + token.length()));
+                    string word;
+                    iss >> word >> thread >> word >> record;
+
+                    ASSERT_TRUE(thread >= 0 && thread < numThreads);
+                    EXPECT_EQ(nextRecord[thread], record);
+                    nextRecord[thread] = record + 1;
+
+                    if (fileName != filePath)
+                        ++numRecordsInBackup;
+                }
+            }
+
+            for (auto count : nextRecord)
+                EXPECT_EQ(numWritesPerThread, count);
+
+            // the file was shifted once, and what was in the last backup was purged:
+            EXPECT_GT(numRecordsInBackup, 0);
+
+            for (uint32_t idx = 2; idx <= settings.purgeCount + 1; ++idx)
+            {
+                std::ifstream backup(filePath + '.' + std::to_string(idx));
+
+                if (idx > settings.purgeCount)
+                {
+                    EXPECT_FALSE(backup.is_open());
+                    continue;
+                }
+
+                string line;
+                ASSERT_TRUE(std::getline(backup, line).good());
+                EXPECT_EQ("backup " + std::to_string(idx - 1), line);
+            }
+        }
+        catch (...)
+        {
+            HandleException();
+        }
+    }
+#endif
+
+    /// <summary>
+    /// Tests changing the log level at runtime, and that messages
+    /// with disabled priorities are not even composed.
+    /// </summary>
+    TEST(Framework_CoreRuntime_TestCase, LogLevel_Test)
+    {
+        // Ensures proper initialization/finalization of the framework
+#   ifdef _3FD_PLATFORM_WINRT
+        core::FrameworkInstance _framework("IntegrationTestsApp.WinRT.UWP");
+#   else
+        core::FrameworkInstance _framework;
+#   endif
+
+        CALL_STACK_TRACE;
+
+        try
+        {
+            Logger::Write("Creates the logger, so the configured level applies", core::Logger::PRIO_FATAL);
+
+            const auto initialLevel = Logger::GetLevel();
+
+            Logger::SetLevel(core::Logger::PRIO_WARNING);
+            EXPECT_EQ(core::Logger::PRIO_WARNING, Logger::GetLevel());
+            EXPECT_TRUE(Logger::IsEnabled(core::Logger::PRIO_ERROR));
+            EXPECT_TRUE(Logger::IsEnabled(core::Logger::PRIO_WARNING));
+            EXPECT_FALSE(Logger::IsEnabled(core::Logger::PRIO_NOTICE));
+            EXPECT_FALSE(Logger::IsEnabled(core::Logger::PRIO_TRACE));
+
+            int numEvaluations(0);
+            auto composeMessage = [&numEvaluations]() -> string
+            {
+                ++numEvaluations;
+                return "This message has been composed";
+            };
+
+            LOG_WRITE(core::Logger::PRIO_DEBUG, composeMessage());
+            LOG_WRITE_FORMATTED(core::Logger::PRIO_INFORMATION, composeMessage() << " to be discarded");
+            EXPECT_EQ(0, numEvaluations);
+
+            LOG_WRITE(core::Logger::PRIO_WARNING, composeMessage());
+            LOG_WRITE_FORMATTED(core::Logger::PRIO_ERROR, composeMessage() << " to be written");
+            EXPECT_EQ(2, numEvaluations);
+
+            Logger::SetLevel(initialLevel);
+        }
+        catch (...)
+        {
+            HandleException();
+        }
+    }
+
+    /// <summary>
+    /// Tests the rate limiting and the collapsing of repeated messages in the log throttle.
+    /// </summary>
+    TEST(Framework_CoreRuntime_TestCase, LogThrottle_Test)
+    {
+        using namespace std::chrono;
+
+        // Ensures proper initialization/finalization of the framework
+#   ifdef _3FD_PLATFORM_WINRT
+        core::FrameworkInstance _framework("IntegrationTestsApp.WinRT.UWP");
+#   else
+        core::FrameworkInstance _framework;
+#   endif
+
+        CALL_STACK_TRACE;
+
+        try
+        {
+            auto now = steady_clock::now();
+            LogThrottle::HeldBack heldBack;
+
+            // 10 messages per second, in bursts of 5:
+            LogThrottle limiter(10, 5, false);
+
+            int numWritten(0);
+            for (int idx = 0; idx < 100; ++idx)
+            {
+                // numbers in the text do not make a new source:
+                std::ostringstream oss;
+                oss << "Failed after " << idx << " attempt(s)";
+
+                if (limiter.Admit(core::Logger::PRIO_ERROR, oss.str(), "", now, heldBack))
+                    ++numWritten;
+            }
+
+            EXPECT_EQ(5, numWritten);
+
+            // other sources are not affected:
+            EXPECT_TRUE(limiter.Admit(core::Logger::PRIO_ERROR, "Another failure", "", now, heldBack));
+            EXPECT_TRUE(limiter.Admit(core::Logger::PRIO_WARNING, "Failed after 1 attempt(s)", "", now, heldBack));
+
+            // the bucket refills with time, and the next message written reports the ones dropped:
+            now += milliseconds(500);
+            ASSERT_TRUE(limiter.Admit(core::Logger::PRIO_ERROR, "Failed after 100 attempt(s)", "", now, heldBack));
+            EXPECT_EQ(95U, heldBack.numDropped);
+            EXPECT_EQ(0U, heldBack.numRepeated);
+            EXPECT_EQ("Failed after 4 attempt(s)", heldBack.message);
+
+            // collapse repetitions, without rate limiting:
+            LogThrottle collapser(0, 0, true);
+
+            EXPECT_TRUE(collapser.Admit(core::Logger::PRIO_ERROR, "Query failed", "timeout", now, heldBack));
+
+            for (int idx = 0; idx < 10; ++idx)
+                EXPECT_FALSE(collapser.Admit(core::Logger::PRIO_ERROR, "Query failed", "timeout", now, heldBack));
+
+            // a different message from the same source reports the repetitions of the previous one:
+            ASSERT_TRUE(collapser.Admit(core::Logger::PRIO_ERROR, "Query failed", "disk full", now, heldBack));
+            EXPECT_EQ(10U, heldBack.numRepeated);
+            EXPECT_EQ("Query failed", heldBack.message);
+
+            EXPECT_FALSE(collapser.Admit(core::Logger::PRIO_ERROR, "Query failed", "disk full", now, heldBack));
+
+            // a message repeated for long is written again:
+            now += seconds(LogThrottle::repeatIntervalSecs);
+            ASSERT_TRUE(collapser.Admit(core::Logger::PRIO_ERROR, "Query failed", "disk full", now, heldBack));
+            EXPECT_EQ(1U, heldBack.numRepeated);
+
+            EXPECT_FALSE(collapser.Admit(core::Logger::PRIO_ERROR, "Query failed", "disk full", now, heldBack));
+            EXPECT_FALSE(collapser.Admit(core::Logger::PRIO_ERROR, "Query failed", "disk full", now, heldBack));
+
+            // what is held back and not reported yet can be taken (as upon shutdown):
+            auto allHeldBack = collapser.TakeHeldBack();
+            ASSERT_EQ(1U, allHeldBack.size());
+            EXPECT_EQ(2U, allHeldBack[0].numRepeated);
+            EXPECT_EQ(static_cast<uint32_t> (core::Logger::PRIO_ERROR), allHeldBack[0].prio);
+            EXPECT_TRUE(collapser.TakeHeldBack().empty());
+
+            // a source gone quiet reports what it held back, without waiting for its next message:
+            EXPECT_FALSE(collapser.Admit(core::Logger::PRIO_ERROR, "Query failed", "disk full", now, heldBack));
+            EXPECT_TRUE(collapser.TakeQuiet(now).empty());
+
+            auto quiet = collapser.TakeQuiet(now + seconds(LogThrottle::quietIntervalSecs));
+            ASSERT_EQ(1U, quiet.size());
+            EXPECT_EQ(1U, quiet[0].numRepeated);
+            EXPECT_EQ("Query failed", quiet[0].message);
+            EXPECT_TRUE(collapser.TakeQuiet(now + seconds(2 * LogThrottle::quietIntervalSecs)).empty());
+            EXPECT_TRUE(collapser.TakeHeldBack().empty());
+
+            // sources forgotten to make room for new ones keep what they held back to be reported:
+            EXPECT_TRUE(collapser.Admit(core::Logger::PRIO_ERROR, "Query failed", "timeout", now, heldBack));
+            EXPECT_FALSE(collapser.Admit(core::Logger::PRIO_ERROR, "Query failed", "timeout", now, heldBack));
+            EXPECT_FALSE(collapser.HasEvicted());
+
+            for (size_t idx = 0; idx < LogThrottle::maxSources; ++idx)
+            {
+                string what("Source ");
+                for (auto value = idx; value > 0; value /= 26)
+                    what.push_back('a' + value % 26); // digits do not tell sources apart
+
+                collapser.Admit(core::Logger::PRIO_WARNING, what, "", now, heldBack);
+            }
+
+            ASSERT_TRUE(collapser.HasEvicted());
+            auto evicted = collapser.TakeEvicted();
+            ASSERT_EQ(1U, evicted.size());
+            EXPECT_EQ(1U, evicted[0].numRepeated);
+            EXPECT_EQ("Query failed", evicted[0].message);
+            EXPECT_FALSE(collapser.HasEvicted());
+            EXPECT_TRUE(collapser.TakeHeldBack().empty());
+        }
+        catch (...)
+        {
+            HandleException();
+        }
+    }
+
+    /// <summary>
+    /// Tests writing records to the binary log and decoding them back to text.
+    /// </summary>
+    TEST(Framework_CoreRuntime_TestCase, BinaryLog_Test)
+    {
+        // Ensures proper initialization/finalization of the framework
+#   ifdef _3FD_PLATFORM_WINRT
+        core::FrameworkInstance _framework("IntegrationTestsApp.WinRT.UWP");
+#   else
+        core::FrameworkInstance _framework;
+#   endif
+
+        CALL_STACK_TRACE;
+
+        try
+        {
+            BinaryLog::Shutdown();
+            remove(BinaryLog::GetFilePath().c_str());
+
+            const auto initialLevel = Logger::GetLevel();
+            Logger::SetLevel(core::Logger::PRIO_DEBUG);
+
+            int notUsed;
+            BINLOG_WRITE(core::Logger::PRIO_WARNING, "connection to {} failed after {} attempts", string("localhost"), 3);
+            BINLOG_WRITE(core::Logger::PRIO_NOTICE, "formatted: ", utils::FormatArg(42.4242).precision(4), ' ', utils::FormatArg(42U).width(4), ' ', L"wide");
+            BINLOG_WRITE(core::Logger::PRIO_TRACE, "this one is discarded: {}", 1);
+            BINLOG_WRITE(core::Logger::PRIO_DEBUG, "address {}", &notUsed);
+
+            // a new session reuses the ids of the format strings:
+            BinaryLog::Shutdown();
+            BINLOG_WRITE(core::Logger::PRIO_WARNING, "connection to {} failed after {} attempts", string("remotehost"), 4);
+            BinaryLog::Shutdown();
+
+            Logger::SetLevel(initialLevel);
+
+            std::ifstream input(BinaryLog::GetFilePath(), std::ios::binary);
+            std::ostringstream output;
+            EXPECT_EQ(4, BinaryLog::Decode(input, output));
+
+            string text = output.str();
+            EXPECT_NE(string::npos, text.find("WARNING - connection to localhost failed after 3 attempts\n"));
+            EXPECT_NE(string::npos, text.find("NOTICE - formatted: 42.42   42 wide\n"));
+            EXPECT_NE(string::npos, text.find("DEBUG - address "));
+            EXPECT_NE(string::npos, text.find("WARNING - connection to remotehost failed after 4 attempts\n"));
+            EXPECT_EQ(string::npos, text.find("discarded"));
+
+            // a record cut short by a crash, followed by another session, must not hide the later records:
+            Logger::SetLevel(core::Logger::PRIO_DEBUG);
+            remove(BinaryLog::GetFilePath().c_str());
+            BINLOG_WRITE(core::Logger::PRIO_WARNING, "connection to {} failed after {} attempts", string("firsthost"), 1);
+            BINLOG_WRITE(core::Logger::PRIO_WARNING, "connection to {} failed after {} attempts", string("crashhost"), 2);
+            BinaryLog::Shutdown();
+
+            string content;
+            {
+                std::ifstream file(BinaryLog::GetFilePath(), std::ios::binary);
+                content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            }
+            {
+                std::ofstream file(BinaryLog::GetFilePath(), std::ios::binary | std::ios::trunc);
+                file.write(content.data(), content.size() - 6);
+            }
+
+            BINLOG_WRITE(core::Logger::PRIO_WARNING, "connection to {} failed after {} attempts", string("nexthost"), 3);
+            BINLOG_WRITE(core::Logger::PRIO_ERROR, "session {} goes on", 2);
+            BinaryLog::Shutdown();
+
+            Logger::SetLevel(initialLevel);
+
+            std::ifstream truncatedInput(BinaryLog::GetFilePath(), std::ios::binary);
+            std::ostringstream truncatedOutput;
+            EXPECT_EQ(3, BinaryLog::Decode(truncatedInput, truncatedOutput));
+
+            text = truncatedOutput.str();
+            EXPECT_NE(string::npos, text.find("WARNING - connection to firsthost failed after 1 attempts\n"));
+            EXPECT_EQ(string::npos, text.find("crashhost"));
+            EXPECT_NE(string::npos, text.find("WARNING - connection to nexthost failed after 3 attempts\n"));
+            EXPECT_NE(string::npos, text.find("ERROR - session 2 goes on\n"));
+        }
+        catch (...)
+        {
+            HandleException();
+        }
+    }
+
+    /// <summary>
+    /// Compares the cost of writing to the binary log against writing text to the log.
+    /// </summary>
+    TEST(Framework_CoreRuntime_TestCase, BinaryLog_Speed_Test)
+    {
+        using namespace std::chrono;
+
+        // Ensures proper initialization/finalization of the framework
+#   ifdef _3FD_PLATFORM_WINRT
+        core::FrameworkInstance _framework("IntegrationTestsApp.WinRT.UWP");
+#   else
+        core::FrameworkInstance _framework;
+#   endif
+
+        CALL_STACK_TRACE;
+
+        try
+        {
+            const int numWrites = 100000;
+            const string host("localhost");
+
+            auto startTime = steady_clock::now();
+
+            for (int idx = 0; idx < numWrites; ++idx)
+            {
+                std::ostringstream oss;
+                oss << "Request " << idx << " to " << host << " took " << 12.5 << " ms";
+                Logger::Write(oss.str(), core::Logger::PRIO_INFORMATION);
+            }
+
+            auto textTime = duration_cast<nanoseconds>(steady_clock::now() - startTime).count();
+            startTime = steady_clock::now();
+
+            for (int idx = 0; idx < numWrites; ++idx)
+                BINLOG_WRITE(core::Logger::PRIO_INFORMATION, "Request {} to {} took {} ms", idx, host, 12.5);
+
+            auto binaryTime = duration_cast<nanoseconds>(steady_clock::now() - startTime).count();
+
+            std::cout << "Text log: " << static_cast<double> (textTime) / numWrites << " ns per call\n"
+                      << "Binary log: " << static_cast<double> (binaryTime) / numWrites << " ns per call" << std::endl;
+        }
+        catch (...)
+        {
+            HandleException();
+        }
+    }
+
     /// <summary>
     /// Third level call
     /// </summary>
@@ -136,5 +728,445 @@ namespace integration_tests
         }
     }
 
+    /// <summary>
+    /// Recursive call traced at each level.
+    /// </summary>
+    static void TracedRecursion(unsigned int depth, string &report)
+    {
+        CALL_STACK_TRACE;
+
+        if (depth > 1)
+            TracedRecursion(depth - 1, report);
+        else
+            report = CallStackTracer::GetStackReport();
+    }
+
+    /// <summary>
+    /// Tests the call stack trace when the stack gets deeper than the ring capacity.
+    /// </summary>
+    TEST(Framework_CoreRuntime_TestCase, StackTrace_Overflow_Test)
+    {
+        // Ensures proper initialization/finalization of the framework
+#   ifdef _3FD_PLATFORM_WINRT
+        core::FrameworkInstance _framework("IntegrationTestsApp.WinRT.UWP");
+#   else
+        core::FrameworkInstance _framework;
+#   endif
+
+        CALL_STACK_TRACE;
+
+        try
+        {
+            string report;
+            TracedRecursion(10000, report);
+            EXPECT_NE(string::npos, report.find("outer frames lost"));
+
+            /* Once the stack unwinds, the frames pushed again are all valid. Only the
+            frame of this test, which has been overwritten, is still missing: */
+            TracedRecursion(3, report);
+            EXPECT_EQ(0, report.find("$ (1 outer frames lost"));
+            EXPECT_EQ(string::npos, report.find("StackTrace_Overflow_Test"));
+        }
+        catch (...)
+        {
+            HandleException();
+        }
+    }
+
+    /// <summary>
+    /// Function with call stack tracing.
+    /// </summary>
+    static void TracedCall(unsigned int &counter)
+    {
+        CALL_STACK_TRACE;
+        ++counter;
+    }
+
+    /// <summary>
+    /// Function without call stack tracing.
+    /// </summary>
+    static void UntracedCall(unsigned int &counter)
+    {
+        ++counter;
+    }
+
+    /// <summary>
+    /// Measures the overhead of CALL_STACK_TRACE, including calls from a
+    /// thread whose stack unwinds to empty after each one of them.
+    /// </summary>
+    TEST(Framework_CoreRuntime_TestCase, StackTrace_Speed_Test)
+    {
+        using namespace std::chrono;
+
+        // Ensures proper initialization/finalization of the framework
+#   ifdef _3FD_PLATFORM_WINRT
+        core::FrameworkInstance _framework("IntegrationTestsApp.WinRT.UWP");
+#   else
+        core::FrameworkInstance _framework;
+#   endif
+
+        const unsigned int numCalls = 10000000;
+
+        // calls through a volatile pointer cannot be inlined:
+        void (*volatile tracedCall)(unsigned int &) = &TracedCall;
+        void (*volatile untracedCall)(unsigned int &) = &UntracedCall;
+
+        unsigned int counter(0);
+        auto startTime = steady_clock::now();
+
+        for (unsigned int idx = 0; idx < numCalls; ++idx)
+            untracedCall(counter);
+
+        auto untracedTime = duration_cast<nanoseconds>(steady_clock::now() - startTime).count();
+        startTime = steady_clock::now();
+
+        for (unsigned int idx = 0; idx < numCalls; ++idx)
+            tracedCall(counter);
+
+        auto tracedTime = duration_cast<nanoseconds>(steady_clock::now() - startTime).count();
+
+        EXPECT_EQ(2 * numCalls, counter);
+
+        std::cout << "CALL_STACK_TRACE overhead: "
+                  << static_cast<double> (tracedTime - untracedTime) / numCalls
+                  << " ns per call" << std::endl;
+    }
+
+    /// <summary>
+    /// Recursive call traced at each level, which throws at the innermost one.
+    /// </summary>
+    static void TracedThrow(unsigned int depth)
+    {
+        CALL_STACK_TRACE;
+
+        if (depth > 1)
+            TracedThrow(depth - 1);
+        else
+            throw AppException<std::runtime_error>("Test exception.", "Exception details.");
+    }
+
+    /// <summary>
+    /// Recursive call traced at each level, which constructs exceptions at the innermost one.
+    /// </summary>
+    static void TracedConstruction(unsigned int depth, unsigned int numExceptions, long long &elapsedTime)
+    {
+        CALL_STACK_TRACE;
+
+        if (depth > 1)
+        {
+            TracedConstruction(depth - 1, numExceptions, elapsedTime);
+            return;
+        }
+
+        auto startTime = std::chrono::steady_clock::now();
+
+        for (unsigned int idx = 0; idx < numExceptions; ++idx)
+            AppException<std::runtime_error> ex("Test exception.", "Exception details.");
+
+        elapsedTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+    }
+
+    /// <summary>
+    /// Measures the cost of constructing, and of throwing and catching, an exception
+    /// with a few traced frames, which does not include formatting the stack trace.
+    /// </summary>
+    TEST(Framework_CoreRuntime_TestCase, Exception_Speed_Test)
+    {
+        using namespace std::chrono;
+
+        // Ensures proper initialization/finalization of the framework
+#   ifdef _3FD_PLATFORM_WINRT
+        core::FrameworkInstance _framework("IntegrationTestsApp.WinRT.UWP");
+#   else
+        core::FrameworkInstance _framework;
+#   endif
+
+        CALL_STACK_TRACE;
+
+        const unsigned int numThrows = 100000;
+        unsigned int numCaught(0);
+        string report;
+
+        auto startTime = steady_clock::now();
+
+        for (unsigned int idx = 0; idx < numThrows; ++idx)
+        {
+            try
+            {
+                TracedThrow(20);
+            }
+            catch (IAppException &ex)
+            {
+                if (++numCaught == numThrows)
+                    report = ex.ToString();
+            }
+        }
+
+        auto throwTime = duration_cast<nanoseconds>(steady_clock::now() - startTime).count();
+
+        EXPECT_EQ(numThrows, numCaught);
+
+        long long constructionTime(0);
+        TracedConstruction(20, numThrows, constructionTime);
+
+#   if defined ENABLE_3FD_CST && defined ENABLE_3FD_ERR_IMPL_DETAILS
+        // the stack trace is formatted on demand, with the frames as they were when thrown:
+        EXPECT_NE(string::npos, report.find("### CALL STACK TRACE ###"));
+        EXPECT_NE(string::npos, report.find("TracedThrow"));
+        EXPECT_NE(string::npos, report.find("Exception_Speed_Test"));
+#   endif
+
+        std::cout << "AppException with 20 traced frames - construction: "
+                  << static_cast<double> (constructionTime) / numThrows
+                  << " ns; throw + catch: "
+                  << static_cast<double> (throwTime) / numThrows
+                  << " ns" << std::endl;
+    }
+
+    /// <summary>
+    /// Innermost function of the profiled workload, which burns CPU.
+    /// </summary>
+    static double ProfiledInnerCall(double value)
+    {
+        CALL_STACK_TRACE;
+
+        for (int idx = 0; idx < 10000; ++idx)
+            value = value * 1.0000001 + 0.5;
+
+        return value;
+    }
+
+    /// <summary>
+    /// Outermost function of the profiled workload.
+    /// </summary>
+    static double ProfiledOuterCall(std::chrono::steady_clock::time_point deadline)
+    {
+        CALL_STACK_TRACE;
+
+        double value(0.0);
+        while (std::chrono::steady_clock::now() < deadline)
+            value += ProfiledInnerCall(value);
+
+        return value;
+    }
+
+    /// <summary>
+    /// A traced function that spends its time blocked, rather than on a CPU.
+    /// </summary>
+    static void ProfiledWaitingCall(std::chrono::steady_clock::time_point deadline)
+    {
+        CALL_STACK_TRACE;
+        std::this_thread::sleep_until(deadline);
+    }
+
+    /// <summary>
+    /// Tests the sampling profiler on top of the call stack tracer, with a workload running in a couple of threads.
+    /// </summary>
+    TEST(Framework_CoreRuntime_TestCase, SamplingProfiler_Test)
+    {
+        // Ensures proper initialization/finalization of the framework
+#   ifdef _3FD_PLATFORM_WINRT
+        core::FrameworkInstance _framework("IntegrationTestsApp.WinRT.UWP");
+#   else
+        core::FrameworkInstance _framework;
+#   endif
+
+        CALL_STACK_TRACE;
+
+        try
+        {
+            SamplingProfiler profiler(500);
+            profiler.Start();
+
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+            auto future = std::async(std::launch::async, &ProfiledOuterCall, deadline);
+            auto waiting = std::async(std::launch::async, &ProfiledWaitingCall, deadline);
+            ProfiledOuterCall(deadline);
+            future.get();
+            waiting.get();
+
+            profiler.Stop();
+
+            EXPECT_GT(profiler.GetNumSamples(), 0U);
+
+            // every line is the folded stack followed by the count of samples:
+            auto folded = profiler.GetFoldedStacks();
+            std::istringstream iss(folded);
+            string line;
+            while (std::getline(iss, line))
+            {
+                auto lastSpacePos = line.rfind(' ');
+                ASSERT_NE(string::npos, lastSpacePos);
+                EXPECT_GT(std::stoul(line.substr(lastSpacePos + 1)), 0UL);
+            }
+
+            EXPECT_NE(string::npos, folded.find("ProfiledOuterCall"));
+            EXPECT_NE(string::npos, folded.find("ProfiledInnerCall"));
+#   ifndef _3FD_PLATFORM_WINRT
+            EXPECT_EQ(string::npos, folded.find("ProfiledWaitingCall")); // not on a CPU
+#   endif
+            std::cout << folded;
+
+            profiler.Reset();
+            EXPECT_EQ(0U, profiler.GetNumSamples());
+        }
+        catch (...)
+        {
+            HandleException();
+        }
+    }
+
+    /// <summary>
+    /// Tests the precision of <see cref="core::LatencyHistogram"/> and its percentiles.
+    /// </summary>
+    TEST(Framework_CoreRuntime_TestCase, LatencyHistogram_Test)
+    {
+        // every value must fall in a bucket whose range contains it, within the expected precision:
+        std::mt19937_64 generator(42);
+        for (int count = 0; count < 100000; ++count)
+        {
+            auto value = generator() >> (generator() % 64);
+            auto bucketIdx = core::LatencyHistogram::GetBucketIndex(value);
+            ASSERT_LT(bucketIdx, core::LatencyHistogram::numBuckets);
+
+            auto highest = core::LatencyHistogram::GetBucketHighestValue(bucketIdx);
+            EXPECT_GE(highest, value);
+            EXPECT_LE(highest - value, value / 16);
+            EXPECT_TRUE(bucketIdx == 0 || core::LatencyHistogram::GetBucketHighestValue(bucketIdx - 1) < value);
+        }
+
+        core::LatencyHistogram histogram;
+        EXPECT_EQ(0U, histogram.GetPercentile(50.0));
+
+        for (uint64_t value = 1; value <= 100000; ++value)
+            histogram.Record(value);
+
+        EXPECT_EQ(100000U, histogram.GetCount());
+        EXPECT_EQ(1U, histogram.GetMin());
+        EXPECT_EQ(100000U, histogram.GetMax());
+        EXPECT_DOUBLE_EQ(50000.5, histogram.GetMean());
+
+        EXPECT_NEAR(50000.0, (double)histogram.GetPercentile(50.0), 50000.0 / 16);
+        EXPECT_NEAR(99000.0, (double)histogram.GetPercentile(99.0), 99000.0 / 16);
+        EXPECT_NEAR(99900.0, (double)histogram.GetPercentile(99.9), 99900.0 / 16);
+        EXPECT_EQ(100000U, histogram.GetPercentile(100.0));
+
+        core::LatencyHistogram merged;
+        merged.Add(histogram);
+        merged.Add(histogram);
+        EXPECT_EQ(200000U, merged.GetCount());
+        EXPECT_EQ(histogram.GetPercentile(99.0), merged.GetPercentile(99.0));
+    }
+
+    /// <summary>
+    /// Times a call, recording into the histogram of a timer.
+    /// </summary>
+    static void TimedCall(uint32_t timerId, int workload)
+    {
+        core::ScopedTimer timer(timerId);
+
+        volatile int sum(0);
+        for (int idx = 0; idx < workload; ++idx)
+            sum += idx;
+    }
+
+    /// <summary>
+    /// Records a timing when destroyed on thread exit, after the histograms of the thread are gone.
+    /// </summary>
+    struct RecordOnThreadExit
+    {
+        uint32_t timerId;
+
+        RecordOnThreadExit() : timerId(0) {}
+
+        ~RecordOnThreadExit() { TimedCall(timerId, 10); }
+    };
+
+    /// <summary>
+    /// Tests timers recording in several threads, including some
+    /// that exit before the report, and the export of reports.
+    /// </summary>
+    TEST(Framework_CoreRuntime_TestCase, TimingRegistry_Test)
+    {
+        // Ensures proper initialization/finalization of the framework
+#   ifdef _3FD_PLATFORM_WINRT
+        core::FrameworkInstance _framework("IntegrationTestsApp.WinRT.UWP");
+#   else
+        core::FrameworkInstance _framework;
+#   endif
+
+        CALL_STACK_TRACE;
+
+        try
+        {
+            auto timerId = core::TimingRegistry::RegisterTimer("integration_tests::TimedCall");
+            EXPECT_EQ(timerId, core::TimingRegistry::RegisterTimer("integration_tests::TimedCall"));
+
+            auto emptyTimerId = core::TimingRegistry::RegisterTimer("integration_tests::NeverCalled");
+            EXPECT_NE(timerId, emptyTimerId);
+
+            const int numCallsPerThread = 10000;
+
+            // these threads exit before the report, so their histograms are merged when they finish:
+            std::vector<std::thread> threads;
+            for (int count = 0; count < 4; ++count)
+            {
+                threads.emplace_back([timerId]()
+                {
+                    // constructed before the first timing, so destroyed after the histograms are released:
+                    thread_local static RecordOnThreadExit lateRecorder;
+                    lateRecorder.timerId = timerId;
+
+                    for (int idx = 0; idx < numCallsPerThread; ++idx)
+                        TimedCall(timerId, idx % 100);
+                });
+            }
+
+            for (auto &thread : threads)
+                thread.join();
+
+            for (int idx = 0; idx < numCallsPerThread; ++idx)
+                TimedCall(timerId, idx % 100);
+
+            auto summaries = core::TimingRegistry::GetSummaries();
+            auto iter = std::find_if(summaries.begin(), summaries.end(), [](const core::TimingSummary &summary)
+            {
+                return summary.name == "integration_tests::TimedCall";
+            });
+
+            ASSERT_NE(summaries.end(), iter);
+
+            // timings recorded by the threads after releasing their histograms are dropped:
+            EXPECT_EQ(5U * numCallsPerThread, iter->count);
+            EXPECT_LE(iter->min, iter->p50);
+            EXPECT_LE(iter->p50, iter->p90);
+            EXPECT_LE(iter->p90, iter->p99);
+            EXPECT_LE(iter->p99, iter->p999);
+            EXPECT_LE(iter->p999, iter->max);
+
+            // timers which recorded nothing are left out:
+            for (auto &summary : summaries)
+                EXPECT_NE("integration_tests::NeverCalled", summary.name);
+
+            auto text = core::TimingRegistry::GetReportAsText();
+            EXPECT_NE(string::npos, text.find("integration_tests::TimedCall: count=50000, min="));
+            EXPECT_NE(string::npos, text.find(", p50="));
+            EXPECT_NE(string::npos, text.find(", p999="));
+            EXPECT_EQ(string::npos, text.find("integration_tests::NeverCalled"));
+            EXPECT_EQ('\n', text.back());
+
+            auto json = core::TimingRegistry::GetReportAsJson();
+            EXPECT_EQ('[', json.front());
+            EXPECT_EQ(']', json.back());
+            EXPECT_NE(string::npos, json.find("{\"name\":\"integration_tests::TimedCall\",\"count\":50000,"));
+
+            core::TimingRegistry::WriteToLog();
+        }
+        catch (...)
+        {
+            HandleException();
+        }
+    }
+
 }// end of namespace integration_tests
 }// end of namespace _3fd
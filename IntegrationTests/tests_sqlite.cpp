@@ -9,6 +9,7 @@
 #include <thread>
 #include <future>
 #include <random>
+#include <vector>
 
 #ifdef _3FD_PLATFORM_WINRT
 #    include "utils_winrt.h"
@@ -128,6 +129,254 @@ namespace integration_tests
         }
     }
 
+    /// <summary>
+    /// Tests the reuse of prepared statements kept in cache by the database connection.
+    /// </summary>
+    TEST(Framework_SQLite_TestCase, StatementCache_Test)
+    {
+        using namespace utils;
+        using namespace sqlite;
+
+        // Ensures proper initialization/finalization of the framework
+#   ifdef _3FD_PLATFORM_WINRT
+        core::FrameworkInstance _framework("IntegrationTestsApp.WinRT.UWP");
+#   else
+        core::FrameworkInstance _framework;
+#   endif
+
+        CALL_STACK_TRACE;
+
+        try
+        {
+            // Open/Create database instance, caching up to 2 statements:
+#ifndef _3FD_PLATFORM_WINRT
+            DatabaseConn database("testdb-basic.dat", true, 2);
+#else
+            DatabaseConn database(
+                WinRTExt::GetFilePathUtf8("testdb-basic.dat", WinRTExt::FileLocation::LocalFolder),
+                true, 2
+            );
+#endif
+            database.CreateStatement("CREATE TABLE Products (Id INTEGER PRIMARY KEY, Name VARCHAR(25) NOT NULL);").Step();
+            EXPECT_EQ(0U, database.GetStmtCacheHits());
+            EXPECT_EQ(1U, database.GetStmtCacheMisses());
+            EXPECT_EQ(1U, database.GetStmtCacheSize());
+
+            const char *insertQuery = "INSERT INTO Products (Id, Name) VALUES(@id, @name);";
+
+            // The statement is prepared once, then reused while idle:
+            for (long long id = 0; id < 10; ++id)
+            {
+                auto insert = database.CreateStatement(insertQuery);
+                insert.Bind("@id", id);
+
+                if (id % 2 == 0)
+                {
+                    insert.Bind("@name", "even");
+                    insert.Step();
+                }
+                else // bindings from the last use must have been cleared, so NOT NULL constraint fails:
+                    EXPECT_EQ(SQLITE_CONSTRAINT, insert.TryStep(false) & 255);
+            }
+
+            EXPECT_EQ(9U, database.GetStmtCacheHits());
+            EXPECT_EQ(2U, database.GetStmtCacheMisses());
+            EXPECT_EQ(2U, database.GetStmtCacheSize());
+
+            // The same query, while the statement is in use, needs another statement:
+            {
+                auto select1 = database.CreateStatement("SELECT * FROM Products ORDER BY Id;");
+                auto select2 = database.CreateStatement("SELECT * FROM Products ORDER BY Id;");
+                EXPECT_NE(select1.GetHandle(), select2.GetHandle());
+
+                select1.Step();
+                select2.Step();
+                EXPECT_EQ(0, select1.GetColumnValueInteger("Id"));
+                EXPECT_EQ("even", select2.GetColumnValueText("Name"));
+            }
+
+            EXPECT_EQ(4U, database.GetStmtCacheMisses());
+            EXPECT_EQ(2U, database.GetStmtCacheSize()); // least recently used evicted
+
+            {// Another query evicts the INSERT statement:
+                auto count = database.CreateStatement("SELECT COUNT(*) AS Total FROM Products;");
+                count.Step();
+                EXPECT_EQ(5, count.GetColumnValueInteger("Total"));
+                count.Reset();
+            }
+
+            // Evicted statements are prepared again:
+            database.CreateStatement(insertQuery);
+            EXPECT_EQ(9U, database.GetStmtCacheHits());
+            EXPECT_EQ(6U, database.GetStmtCacheMisses());
+            EXPECT_EQ(2U, database.GetStmtCacheSize());
+
+            // With a full mutex, threads sharing the connection release statements at the same time:
+            const int numThreads = 4;
+            const int numQueriesPerThread = 500;
+            auto numStmtsBefore = database.GetStmtCacheHits() + database.GetStmtCacheMisses();
+            std::vector<std::future<void>> futures;
+
+            for (int count = 0; count < numThreads; ++count)
+            {
+                futures.push_back(std::async(std::launch::async, [&database]()
+                {
+                    for (int idx = 0; idx < numQueriesPerThread; ++idx)
+                    {
+                        auto select = database.CreateStatement(idx % 2 == 0
+                            ? "SELECT COUNT(*) AS Total FROM Products;"
+                            : "SELECT MAX(Id) AS Total FROM Products;");
+
+                        select.Step();
+                        select.Reset();
+                    }
+                }));
+            }
+
+            for (auto &future : futures)
+                future.get();
+
+            EXPECT_EQ(numStmtsBefore + numThreads * numQueriesPerThread,
+                      database.GetStmtCacheHits() + database.GetStmtCacheMisses());
+            EXPECT_EQ(2U, database.GetStmtCacheSize());
+
+            database.CreateStatement("DROP TABLE Products;").Step();
+        }
+        catch (...)
+        {
+            HandleException();
+        }
+    }
+
+    /// <summary>
+    /// Tests binding parameters and reading columns by position, in plain and typed statements.
+    /// </summary>
+    TEST(Framework_SQLite_TestCase, PositionalBinding_Test)
+    {
+        using namespace utils;
+        using namespace sqlite;
+
+        // Ensures proper initialization/finalization of the framework
+#   ifdef _3FD_PLATFORM_WINRT
+        core::FrameworkInstance _framework("IntegrationTestsApp.WinRT.UWP");
+#   else
+        core::FrameworkInstance _framework;
+#   endif
+
+        CALL_STACK_TRACE;
+
+        try
+        {
+            // Open/Create database instance:
+#ifndef _3FD_PLATFORM_WINRT
+            DatabaseConn database("testdb-basic.dat");
+#else
+            DatabaseConn database(
+                WinRTExt::GetFilePathUtf8("testdb-basic.dat", WinRTExt::FileLocation::LocalFolder)
+            );
+#endif
+            database.CreateStatement("CREATE TABLE Products (Id INTEGER PRIMARY KEY, Name VARCHAR(25) NOT NULL, Price FLOAT NOT NULL);").Step();
+
+            {// Indexes looked up once, then used for every row:
+                auto insert = database.CreateStatement("INSERT INTO Products (Id, Name, Price) VALUES(@id, @name, @price);");
+                EXPECT_EQ(3, insert.GetParamCount());
+
+                const int idParam = insert.GetParamIndex("@id");
+                const int nameParam = insert.GetParamIndex("@name");
+                const int priceParam = insert.GetParamIndex("@price");
+
+                // an unknown name must be reported by its name:
+                try
+                {
+                    insert.Bind("@missing", 1);
+                    ADD_FAILURE();
+                }
+                catch (core::IAppException &ex)
+                {
+                    EXPECT_NE(string::npos, ex.Details().find("@missing"));
+                }
+
+                for (long long id = 0; id < 5; ++id)
+                {
+                    insert.Bind(idParam, id);
+                    insert.Bind(nameParam, string("plain"));
+                    insert.Bind(priceParam, id * 1.5);
+                    insert.Step();
+                }
+
+                auto select = database.CreateStatement("SELECT Id, Name, Price FROM Products ORDER BY Id;");
+                EXPECT_EQ(3, select.GetColumnCount());
+
+                const int idColumn = select.GetColumnIndex("Id");
+                const int priceColumn = select.GetColumnIndex("Price");
+                EXPECT_EQ(0, idColumn);
+                EXPECT_EQ(2, priceColumn);
+
+                long long id(0);
+                while (select.Step() == SQLITE_ROW)
+                {
+                    EXPECT_EQ(id, select.GetColumnValueInteger64(idColumn));
+                    EXPECT_EQ("plain", select.GetColumnValueText(1));
+                    EXPECT_EQ(id * 1.5, select.GetColumnValueFloat64(priceColumn));
+                    ++id;
+                }
+
+                EXPECT_EQ(5, id);
+            }
+
+            {// Typed statements bind and fetch whole tuples:
+                TypedStatement<std::tuple<long long, string, double>> insert(database, "INSERT INTO Products (Id, Name, Price) VALUES(?1, ?2, ?3);");
+
+                for (long long id = 5; id < 10; ++id)
+                {
+                    insert.Bind(id, "typed", id * 1.5);
+                    insert.Step();
+                }
+
+                TypedStatement<std::tuple<string>, std::tuple<long long, string, double>>
+                    select(database, "SELECT Id, Name, Price FROM Products WHERE Name = ?1 ORDER BY Id;");
+
+                select.Bind("typed");
+
+                long long id(5);
+                std::tuple<long long, string, double> row;
+                while (select.Fetch(row))
+                {
+                    EXPECT_EQ(id, std::get<0>(row));
+                    EXPECT_EQ("typed", std::get<1>(row));
+                    EXPECT_EQ(id * 1.5, std::get<2>(row));
+                    ++id;
+                }
+
+                EXPECT_EQ(10, id);
+
+                // Reuse the same statement with another binding:
+                select.Bind("plain");
+                ASSERT_TRUE(select.Fetch(row));
+                EXPECT_EQ(0, std::get<0>(row));
+                EXPECT_EQ("plain", std::get<1>(row));
+                select.Reset();
+
+                TypedStatement<std::tuple<>, std::tuple<int>> count(database, "SELECT COUNT(*) FROM Products;");
+                ASSERT_EQ(SQLITE_ROW, count.Step());
+                EXPECT_EQ(10, std::get<0>(count.GetRow()));
+                count.Reset();
+            }
+
+            // A typed statement whose types do not match the query cannot be created:
+            EXPECT_THROW(
+                (TypedStatement<std::tuple<int>, std::tuple<int>>(database, "SELECT Id, Name FROM Products WHERE Id = ?1;")),
+                core::IAppException
+            );
+
+            database.CreateStatement("DROP TABLE Products;").Step();
+        }
+        catch (...)
+        {
+            HandleException();
+        }
+    }
+
     /// <summary>
     /// Tests the SQLite connection pool, transactions and concurrent access.
     /// </summary>
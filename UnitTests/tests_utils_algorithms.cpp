@@ -2,11 +2,20 @@
 #include "preprocessing.h"
 #include "utils_algorithms.h"
 
+#include <cstdint>
 #include <ctime>
 #include <cmath>
 #include <cstdlib>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
 #include <vector>
 #include <algorithm>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
 
 namespace _3fd
 {
@@ -129,5 +138,474 @@ namespace unit_tests
         }
     }
 
+    /// <summary>
+    /// Checks the search for sub-ranges with a given policy against 'std::equal_range'.
+    /// </summary>
+    template <typename SearchPolicyType>
+    void CheckBinSearchPolicy(const std::vector<Object> &list, int minKey, int maxKey)
+    {
+        auto getKey = [](const Object &x) NOEXCEPT { return x.key; };
+        auto lessThan = [](const Object &a, const Object &b) { return a.key < b.key; };
+
+        for (int key = minKey; key <= maxKey; ++key)
+        {
+            auto expected = std::equal_range(list.cbegin(), list.cend(), Object{ key, 0 }, lessThan);
+
+            auto subRangeBegin = list.cbegin();
+            auto subRangeEnd = list.cend();
+
+            EXPECT_EQ(expected.first != expected.second,
+                utils::BinSearchSubRange<SearchPolicyType>(subRangeBegin, subRangeEnd, key, getKey, std::less<int>()));
+
+            EXPECT_EQ(expected.first, subRangeBegin) << "Wrong lower bound for key " << key;
+            EXPECT_EQ(expected.second, subRangeEnd) << "Wrong upper bound for key " << key;
+
+            auto begin = list.cbegin();
+            auto end = list.cend();
+            auto iter = utils::BinarySearch<SearchPolicyType>(begin, end, key, getKey, std::less<int>());
+
+            if (expected.first != expected.second)
+            {
+                ASSERT_NE(begin, end);
+                EXPECT_EQ(key, iter->key);
+            }
+            else
+            {
+                EXPECT_EQ(begin, end);
+                EXPECT_EQ(expected.first, begin);
+            }
+        }
+    }
+
+    /// <summary>
+    /// Tests the binary search with each of the search policies.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, BinarySearch_Policies_Test)
+    {
+        std::vector<Object> list;
+
+        // Fill the vector with a pattern 1 2 2 4 4 4 4 ... leaving gaps between the keys:
+        for (int val = 1; val < 128; val *= 2)
+        {
+            for (int idx = 0; idx < val; ++idx)
+                list.push_back(Object{ val, val });
+        }
+
+        CheckBinSearchPolicy<utils::ClassicBinSearchPolicy>(list, -1, 130);
+        CheckBinSearchPolicy<utils::BranchlessBinSearchPolicy>(list, -1, 130);
+        CheckBinSearchPolicy<utils::SimdBinSearchPolicy>(list, -1, 130);
+
+        // empty range:
+        list.clear();
+        CheckBinSearchPolicy<utils::BranchlessBinSearchPolicy>(list, 0, 1);
+        CheckBinSearchPolicy<utils::SimdBinSearchPolicy>(list, 0, 1);
+    }
+
+    /// <summary>
+    /// Checks the SIMD search policy over a vector of integers against the standard library.
+    /// </summary>
+    template <typename IntType>
+    void CheckSimdSearchPolicy(const std::vector<IntType> &keys, const std::vector<IntType> &searchKeys)
+    {
+        utils::KeyIdentity getKey;
+        std::less<IntType> lessThan;
+
+        for (auto key : searchKeys)
+        {
+            EXPECT_EQ(std::lower_bound(keys.begin(), keys.end(), key),
+                      utils::SimdBinSearchPolicy::LowerBound(keys.begin(), keys.end(), key, getKey, lessThan));
+
+            EXPECT_EQ(std::upper_bound(keys.begin(), keys.end(), key),
+                      utils::SimdBinSearchPolicy::UpperBound(keys.begin(), keys.end(), key, getKey, lessThan));
+        }
+    }
+
+    /// <summary>
+    /// Tests the SIMD search policy with signed and unsigned integers of 32 and 64 bits.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, BinarySearch_SimdPolicy_Test)
+    {
+        std::mt19937 generator(42);
+
+        for (size_t length : { 0, 1, 5, 8, 31, 32, 33, 100, 1000 })
+        {
+            std::vector<int32_t> signed32(length);
+            std::vector<uint32_t> unsigned32(length);
+            std::vector<int64_t> signed64(length);
+            std::vector<uint64_t> unsigned64(length);
+
+            for (size_t idx = 0; idx < length; ++idx)
+            {
+                // small values make repetitions likely, while the offsets cross the sign bit:
+                auto value = static_cast<int32_t> (generator() % 64) - 32;
+                signed32[idx] = value;
+                unsigned32[idx] = static_cast<uint32_t> (value) + 0x80000000U;
+                signed64[idx] = value * 0x100000000LL;
+                unsigned64[idx] = static_cast<uint64_t> (value) + 0x8000000000000000ULL;
+            }
+
+            std::sort(signed32.begin(), signed32.end());
+            std::sort(unsigned32.begin(), unsigned32.end());
+            std::sort(signed64.begin(), signed64.end());
+            std::sort(unsigned64.begin(), unsigned64.end());
+
+            std::vector<int32_t> signed32Keys;
+            std::vector<uint32_t> unsigned32Keys;
+            std::vector<int64_t> signed64Keys;
+            std::vector<uint64_t> unsigned64Keys;
+
+            for (int32_t value = -34; value <= 34; ++value)
+            {
+                signed32Keys.push_back(value);
+                unsigned32Keys.push_back(static_cast<uint32_t> (value) + 0x80000000U);
+                signed64Keys.push_back(value * 0x100000000LL);
+                unsigned64Keys.push_back(static_cast<uint64_t> (value) + 0x8000000000000000ULL);
+            }
+
+            CheckSimdSearchPolicy(signed32, signed32Keys);
+            CheckSimdSearchPolicy(unsigned32, unsigned32Keys);
+            CheckSimdSearchPolicy(signed64, signed64Keys);
+            CheckSimdSearchPolicy(unsigned64, unsigned64Keys);
+        }
+    }
+
+    /// <summary>
+    /// Tests the search in the Eytzinger layout against 'std::lower_bound'.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, EytzingerLayout_Test)
+    {
+        for (int length : { 0, 1, 2, 3, 7, 8, 100, 1023, 1024, 1025 })
+        {
+            std::vector<Object> list;
+            for (int idx = 0; idx < length; ++idx)
+                list.push_back(Object{ 2 * (idx / 2), idx }); // even keys, in pairs
+
+            utils::EytzingerLayout<int> layout(list.begin(), list.end(), [](const Object &x) { return x.key; });
+            EXPECT_EQ(length, layout.GetSize());
+
+            for (int key = -1; key <= length + 1; ++key)
+            {
+                auto expected = std::lower_bound(list.begin(), list.end(), Object{ key, 0 },
+                    [](const Object &a, const Object &b) { return a.key < b.key; });
+
+                EXPECT_EQ(expected - list.begin(), layout.LowerBound(key, std::less<int>())) << "Wrong lower bound for key " << key;
+            }
+        }
+    }
+
+    /// <summary>
+    /// Compares the speed of the search policies and the Eytzinger layout against 'std::lower_bound'.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, BinarySearch_Speed_Test)
+    {
+        using namespace std::chrono;
+
+        const int numKeys(1 << 20), numSearches(1 << 20);
+
+        std::vector<int32_t> keys(numKeys);
+        for (int idx = 0; idx < numKeys; ++idx)
+            keys[idx] = 2 * idx;
+
+        std::mt19937 generator(42);
+        std::vector<int32_t> searchKeys(numSearches);
+        for (auto &key : searchKeys)
+            key = static_cast<int32_t> (generator() % (2 * numKeys));
+
+        utils::KeyIdentity getKey;
+        std::less<int32_t> lessThan;
+        size_t checksum(0);
+
+        auto measure = [&](const char *label, const std::function<size_t(int32_t)> &search)
+        {
+            auto startTime = steady_clock::now();
+
+            size_t sum(0);
+            for (auto key : searchKeys)
+                sum += search(key);
+
+            auto elapsed = duration_cast<microseconds>(steady_clock::now() - startTime).count();
+            std::cout << std::setw(12) << label << ": " << std::setprecision(4) << elapsed / 1000.0 << " ms" << std::endl;
+
+            if (checksum == 0)
+                checksum = sum;
+            else
+                EXPECT_EQ(checksum, sum) << label;
+        };
+
+        measure("std", [&](int32_t key) -> size_t
+        {
+            return std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+        });
+
+        measure("classic", [&](int32_t key) -> size_t
+        {
+            return utils::ClassicBinSearchPolicy::LowerBound(keys.begin(), keys.end(), key, getKey, lessThan) - keys.begin();
+        });
+
+        measure("branchless", [&](int32_t key) -> size_t
+        {
+            return utils::BranchlessBinSearchPolicy::LowerBound(keys.begin(), keys.end(), key, getKey, lessThan) - keys.begin();
+        });
+
+        measure("simd", [&](int32_t key) -> size_t
+        {
+            return utils::SimdBinSearchPolicy::LowerBound(keys.begin(), keys.end(), key, getKey, lessThan) - keys.begin();
+        });
+
+        utils::EytzingerLayout<int32_t> layout(keys.begin(), keys.end(), getKey);
+        measure("eytzinger", [&](int32_t key) -> size_t
+        {
+            return layout.LowerBound(key, lessThan);
+        });
+    }
+
+    /// <summary>
+    /// Compares the speed of the search for sub-ranges (with each policy) against
+    /// 'std::equal_range', for both short and long runs of equal keys.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, BinSearchSubRange_Speed_Test)
+    {
+        using namespace std::chrono;
+
+        const int numEntries(1 << 20), numSearches(1 << 18);
+
+        for (int runLength : { 3, 1000 })
+        {
+            std::cout << "runs of " << runLength << " entries:" << std::endl;
+
+            std::vector<int32_t> keys(numEntries);
+            for (int idx = 0; idx < numEntries; ++idx)
+                keys[idx] = idx / runLength;
+
+            std::mt19937 generator(42);
+            std::vector<int32_t> searchKeys(numSearches);
+            for (auto &key : searchKeys)
+                key = static_cast<int32_t> (generator() % (keys.back() + 1));
+
+            size_t checksum(0);
+
+            auto measure = [&](const char *label, const std::function<size_t(int32_t)> &search)
+            {
+                auto startTime = steady_clock::now();
+
+                size_t sum(0);
+                for (auto key : searchKeys)
+                    sum += search(key);
+
+                auto elapsed = duration_cast<microseconds>(steady_clock::now() - startTime).count();
+                std::cout << std::setw(12) << label << ": " << std::setprecision(4) << elapsed / 1000.0 << " ms" << std::endl;
+
+                if (checksum == 0)
+                    checksum = sum;
+                else
+                    EXPECT_EQ(checksum, sum) << label;
+            };
+
+            // sums the positions of both bounds
+            measure("std", [&](int32_t key) -> size_t
+            {
+                auto range = std::equal_range(keys.begin(), keys.end(), key);
+                return (range.first - keys.begin()) + (range.second - keys.begin());
+            });
+
+            measure("classic", [&](int32_t key) -> size_t
+            {
+                auto begin = keys.begin();
+                auto end = keys.end();
+                utils::BinSearchSubRange(begin, end, key, utils::KeyIdentity(), std::less<int32_t>());
+                return (begin - keys.begin()) + (end - keys.begin());
+            });
+
+            measure("branchless", [&](int32_t key) -> size_t
+            {
+                auto begin = keys.begin();
+                auto end = keys.end();
+                utils::BinSearchSubRange<utils::BranchlessBinSearchPolicy>(begin, end, key, utils::KeyIdentity(), std::less<int32_t>());
+                return (begin - keys.begin()) + (end - keys.begin());
+            });
+
+            measure("simd", [&](int32_t key) -> size_t
+            {
+                auto begin = keys.begin();
+                auto end = keys.end();
+                utils::BinSearchSubRange<utils::SimdBinSearchPolicy>(begin, end, key, utils::KeyIdentity(), std::less<int32_t>());
+                return (begin - keys.begin()) + (end - keys.begin());
+            });
+        }
+    }
+
+    /// <summary>
+    /// Tests the parallel loop.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, ParallelFor_Test)
+    {
+        const int numEntries(100000);
+        std::vector<int> list(numEntries, 0);
+
+        utils::ParallelFor(0, numEntries, 1000, [&list](int idx)
+        {
+            list[idx] += idx;
+        });
+
+        for (int idx = 0; idx < numEntries; ++idx)
+            ASSERT_EQ(idx, list[idx]);
+
+        // with iterators and an exception thrown:
+        EXPECT_THROW(
+            utils::ParallelFor(list.begin(), list.end(), 1000, [](std::vector<int>::iterator iter)
+            {
+                if (*iter == 12345)
+                    throw std::runtime_error("failure");
+            }),
+            std::runtime_error
+        );
+    }
+
+    /// <summary>
+    /// Tests the parallel reduction.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, ParallelReduce_Test)
+    {
+        const long long numEntries(1000000);
+
+        auto sum = utils::ParallelReduce(0LL, numEntries, 10000, 0LL,
+            [](long long idx) { return idx; },
+            [](long long a, long long b) { return a + b; });
+
+        EXPECT_EQ(numEntries * (numEntries - 1) / 2, sum);
+
+        // concatenation is not commutative, so the order must be kept:
+        auto text = utils::ParallelReduce(0, 26, 2, std::string(),
+            [](int idx) { return std::string(1, static_cast<char> ('a' + idx)); },
+            [](const std::string &a, const std::string &b) { return a + b; });
+
+        EXPECT_EQ("abcdefghijklmnopqrstuvwxyz", text);
+    }
+
+    /// <summary>
+    /// Tests the parallel merge sort, which must be stable.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, ParallelMergeSort_Test)
+    {
+        const int numEntries(1 << 18);
+
+        std::vector<Object> list;
+        list.reserve(numEntries);
+
+        std::mt19937 generator(42);
+        std::uniform_int_distribution<int> distribution(0, 1000);
+
+        // the value keeps the original position, to check stability:
+        for (int idx = 0; idx < numEntries; ++idx)
+            list.push_back(Object{ distribution(generator), idx });
+
+        auto expected = list;
+        auto lessThan = [](const Object &a, const Object &b) { return a.key < b.key; };
+        std::stable_sort(expected.begin(), expected.end(), lessThan);
+
+        utils::ParallelMergeSort(list.begin(), list.end(), lessThan, 1024);
+
+        for (int idx = 0; idx < numEntries; ++idx)
+        {
+            ASSERT_EQ(expected[idx].key, list[idx].key);
+            ASSERT_EQ(expected[idx].val, list[idx].val);
+        }
+
+        // move-only elements:
+        std::vector<std::unique_ptr<int>> pointers;
+        for (int idx = 0; idx < 10000; ++idx)
+            pointers.emplace_back(new int(distribution(generator)));
+
+        utils::ParallelMergeSort(pointers.begin(), pointers.end(),
+            [](const std::unique_ptr<int> &a, const std::unique_ptr<int> &b) { return *a < *b; }, 100);
+
+        EXPECT_TRUE(std::is_sorted(pointers.begin(), pointers.end(),
+            [](const std::unique_ptr<int> &a, const std::unique_ptr<int> &b) { return *a < *b; }));
+
+        // tiny inputs and the smallest grain, where sorting and merging recurse all the way down:
+        for (int length = 0; length < 40; ++length)
+        {
+            std::vector<Object> tiny;
+            for (int idx = 0; idx < length; ++idx)
+                tiny.push_back(Object{ distribution(generator) % 4, idx });
+
+            auto tinyExpected = tiny;
+            std::stable_sort(tinyExpected.begin(), tinyExpected.end(), lessThan);
+
+            utils::ParallelMergeSort(tiny.begin(), tiny.end(), lessThan, 1);
+
+            for (int idx = 0; idx < length; ++idx)
+            {
+                ASSERT_EQ(tinyExpected[idx].key, tiny[idx].key);
+                ASSERT_EQ(tinyExpected[idx].val, tiny[idx].val);
+            }
+        }
+
+        std::vector<int> pair = { 1, 2 };
+        utils::ParallelMergeSort(pair.begin(), pair.end(), std::less<int>(), 1);
+        EXPECT_EQ(1, pair[0]);
+        EXPECT_EQ(2, pair[1]);
+    }
+
+    /// <summary>
+    /// Tests the parallel partition.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, ParallelPartition_Test)
+    {
+        const int numEntries(1 << 18);
+
+        std::vector<int> list(numEntries);
+        std::mt19937 generator(42);
+        std::uniform_int_distribution<int> distribution(0, 1000);
+
+        long long sum(0);
+        int numEven(0);
+        for (auto &entry : list)
+        {
+            entry = distribution(generator);
+            sum += entry;
+            numEven += (entry % 2 == 0) ? 1 : 0;
+        }
+
+        auto isEven = [](int x) { return x % 2 == 0; };
+        auto point = utils::ParallelPartition(list.begin(), list.end(), isEven, 1000);
+
+        EXPECT_EQ(numEven, point - list.begin());
+        EXPECT_TRUE(std::is_partitioned(list.begin(), list.end(), isEven));
+        EXPECT_EQ(sum, std::accumulate(list.begin(), list.end(), 0LL));
+    }
+
+    /// <summary>
+    /// Compares the parallel merge sort against the sequential sort from the standard library.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, ParallelMergeSort_Speed_Test)
+    {
+        using namespace std::chrono;
+
+        std::vector<double> list(1 << 22);
+        std::mt19937 generator(42);
+        std::uniform_real_distribution<double> distribution;
+
+        for (auto &entry : list)
+            entry = distribution(generator);
+
+        auto copy = list;
+
+        auto startTime = steady_clock::now();
+        std::sort(copy.begin(), copy.end());
+        auto stdTime = duration_cast<microseconds>(steady_clock::now() - startTime).count();
+
+        startTime = steady_clock::now();
+        utils::ParallelMergeSort(list.begin(), list.end(), std::less<double>());
+        auto parallelTime = duration_cast<microseconds>(steady_clock::now() - startTime).count();
+
+        EXPECT_EQ(copy, list);
+
+        std::cout << std::setprecision(4)
+                  << "std::sort: " << stdTime / 1000.0 << " ms; "
+                  << "parallel merge sort (" << utils::ThreadPool::GetDefault().GetNumWorkers()
+                  << " workers): " << parallelTime / 1000.0 << " ms" << std::endl;
+    }
+
 }// end of namespace unit_tests
 }// end of namespace _3fd
@@ -1,16 +1,24 @@
 #include "stdafx.h"
-#include "utils.h"
+#include "arrayofbits.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <vector>
 
 namespace _3fd
 {
 namespace unit_tests
 {
-    class Framework_Utils_TestCase : public ::testing::TestWithParam<unsigned int> {};
+    class Framework_Utils_ArrayOfBits_TestCase : public ::testing::TestWithParam<unsigned int> {};
 
     /// <summary>
     /// Basic tests for <see cref="utils::ArrayOfBits"/> class, with focus on the activated bits.
     /// </summary>
-    TEST_P(Framework_Utils_TestCase, ArrayOfBits_FocusOnActivated_BasicTest)
+    TEST_P(Framework_Utils_ArrayOfBits_TestCase, ArrayOfBits_FocusOnActivated_BasicTest)
     {
         const auto n = GetParam();
         utils::ArrayOfBits array(n, false);
@@ -61,7 +69,7 @@ namespace unit_tests
     /// <summary>
     /// Basic tests for <see cref="utils::ArrayOfBits"/> class, with focus on the deactivated bits.
     /// </summary>
-    TEST_P(Framework_Utils_TestCase, ArrayOfBits_FocusOnDeactivated_BasicTest)
+    TEST_P(Framework_Utils_ArrayOfBits_TestCase, ArrayOfBits_FocusOnDeactivated_BasicTest)
     {
         const auto n = GetParam();
         utils::ArrayOfBits array(n, true);
@@ -96,7 +104,7 @@ namespace unit_tests
 
         for (uint32_t idx = 0; idx < n; ++idx)
         {
-            if (array[idx])
+            if (!array[idx])
             {
                 array.Activate(idx);
                 ++count;
@@ -109,9 +117,239 @@ namespace unit_tests
         EXPECT_EQ(n, array.Size());
     }
 
+    /// <summary>
+    /// Tests the bulk operations of <see cref="utils::ArrayOfBits"/> class
+    /// against a vector of booleans.
+    /// </summary>
+    TEST_P(Framework_Utils_ArrayOfBits_TestCase, ArrayOfBits_BulkOperations_Test)
+    {
+        const auto n = GetParam();
+        utils::ArrayOfBits array(n, false);
+        std::vector<bool> expected(n, false);
+
+        // activate a range crossing word boundaries, then deactivate a piece of it:
+        array.ActivateRange(3, n - 2);
+        for (auto idx = 3U; idx < n - 2; ++idx)
+            expected[idx] = true;
+
+        array.DeactivateRange(n / 3, n / 2);
+        for (auto idx = n / 3; idx < n / 2; ++idx)
+            expected[idx] = false;
+
+        auto expectedCount = static_cast<size_t> (std::count(expected.begin(), expected.end(), true));
+        EXPECT_EQ(expectedCount, array.GetActivatedCount());
+        EXPECT_EQ(expectedCount, array.CountActivated(0, n));
+        EXPECT_EQ(static_cast<size_t> (std::count(expected.begin() + 1, expected.begin() + n / 2 + 1, true)),
+                  array.CountActivated(1, n / 2 + 1));
+
+        for (uint32_t idx = 0; idx < n; ++idx)
+            EXPECT_EQ(expected[idx], array[idx]);
+
+        EXPECT_EQ(3, array.FindFirstActivated());
+        EXPECT_EQ(n - 3, array.FindLastActivated());
+        EXPECT_EQ(0, array.FindFirstDeactivated());
+        EXPECT_EQ(n - 1, array.FindLastDeactivated());
+        EXPECT_EQ(n / 3, array.FindNextDeactivated(3));
+        EXPECT_EQ(n / 2, array.FindNextActivated(n / 3));
+
+        // iteration over the activated bits:
+        std::vector<size_t> visited;
+        array.ForEachActivated([&visited](size_t idx) { visited.push_back(idx); });
+        EXPECT_EQ(expectedCount, visited.size());
+
+        size_t prevIdx(0);
+        for (auto idx : visited)
+        {
+            EXPECT_TRUE(expected[idx]);
+            EXPECT_TRUE(idx >= prevIdx);
+            prevIdx = idx;
+        }
+
+        // bitwise operations with another array:
+        utils::ArrayOfBits other(n, false);
+        for (uint32_t idx = 0; idx < n; idx += 2)
+            other.Activate(idx);
+
+        array ^= other;
+        for (uint32_t idx = 0; idx < n; ++idx)
+            EXPECT_EQ(expected[idx] != (idx % 2 == 0), array[idx]);
+
+        array ^= other;
+        array &= other;
+        expectedCount = 0;
+        for (uint32_t idx = 0; idx < n; ++idx)
+        {
+            expected[idx] = expected[idx] && (idx % 2 == 0);
+            EXPECT_EQ(expected[idx], array[idx]);
+            expectedCount += expected[idx] ? 1 : 0;
+        }
+
+        EXPECT_EQ(expectedCount, array.GetActivatedCount());
+
+        array |= other;
+        EXPECT_EQ(other.GetActivatedCount(), array.GetActivatedCount());
+
+        utils::ArrayOfBits otherSize(n + 1, false);
+        EXPECT_THROW(array |= otherSize, std::invalid_argument);
+    }
+
+    /// <summary>
+    /// Tests <see cref="utils::HierarchicalArrayOfBits"/> class by performing
+    /// random changes and checking the searches against an <see cref="utils::ArrayOfBits"/>.
+    /// </summary>
+    TEST_P(Framework_Utils_ArrayOfBits_TestCase, HierarchicalArrayOfBits_BasicTest)
+    {
+        const auto n = GetParam();
+
+        for (auto val : { false, true })
+        {
+            utils::HierarchicalArrayOfBits array(n, val);
+            utils::ArrayOfBits expected(n, val);
+
+            EXPECT_EQ(n, array.Size());
+            EXPECT_EQ(expected.FindFirstActivated(), array.FindFirstActivated());
+            EXPECT_EQ(expected.FindFirstDeactivated(), array.FindFirstDeactivated());
+
+            std::srand(n);
+            for (unsigned int count = 0; count < 4 * n; ++count)
+            {
+                auto idx = static_cast<size_t> (std::rand()) % n;
+
+                if (std::rand() % 2 == 0)
+                {
+                    array.Activate(idx);
+                    expected.Activate(idx);
+                }
+                else
+                {
+                    array.Deactivate(idx);
+                    expected.Deactivate(idx);
+                }
+
+                ASSERT_EQ(expected.GetActivatedCount(), array.GetActivatedCount());
+                ASSERT_EQ(expected[idx], array[idx]);
+                ASSERT_EQ(expected.FindFirstActivated(), array.FindFirstActivated());
+                ASSERT_EQ(expected.FindFirstDeactivated(), array.FindFirstDeactivated());
+                ASSERT_EQ(expected.FindLastActivated(), array.FindLastActivated());
+                ASSERT_EQ(expected.FindLastDeactivated(), array.FindLastDeactivated());
+            }
+
+            // allocate all free slots, in order:
+            auto expectedIdx = expected.FindFirstDeactivated();
+            while (expectedIdx < n)
+            {
+                EXPECT_EQ(expectedIdx, array.ActivateFirstDeactivated());
+                expected.Activate(expectedIdx);
+                expectedIdx = expected.FindFirstDeactivated();
+            }
+
+            EXPECT_EQ(n, array.ActivateFirstDeactivated());
+            EXPECT_EQ(n, array.GetActivatedCount());
+            EXPECT_EQ(n, array.FindFirstDeactivated());
+            EXPECT_EQ(n, array.FindLastDeactivated());
+        }
+    }
+
     INSTANTIATE_TEST_CASE_P(Switch_NumberOfBits,
-                            Framework_Utils_TestCase,
-                            ::testing::Values(30, 100));
+                            Framework_Utils_ArrayOfBits_TestCase,
+                            ::testing::Values(30, 64, 100, 1000, 5000));
+
+    /// <summary>
+    /// Tests the searches in a large and sparse <see cref="utils::ArrayOfBits"/>,
+    /// comparing their speed against a scan over a vector of booleans.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, ArrayOfBits_Speed_Test)
+    {
+        using namespace std::chrono;
+
+        const size_t n = 1 << 24;
+        utils::ArrayOfBits array(n, false);
+        std::vector<bool> bools(n, false);
+
+        // few activated bits, far apart from each other:
+        for (size_t idx = 12345; idx < n; idx += 1 << 20)
+        {
+            array.Activate(idx);
+            bools[idx] = true;
+        }
+
+        auto startTime = steady_clock::now();
+
+        size_t countBools(0);
+        for (size_t idx = 0; idx < n; ++idx)
+            countBools += bools[idx] ? 1 : 0;
+
+        auto boolsTime = duration_cast<microseconds>(steady_clock::now() - startTime).count();
+        startTime = steady_clock::now();
+
+        size_t countBits(0);
+        for (auto idx = array.FindFirstActivated(); idx < n; idx = array.FindNextActivated(idx + 1))
+            ++countBits;
+
+        auto bitsTime = duration_cast<microseconds>(steady_clock::now() - startTime).count();
+
+        EXPECT_EQ(countBools, countBits);
+        EXPECT_EQ(12345, array.FindFirstActivated());
+        EXPECT_EQ(12345 + (countBits - 1) * (1 << 20), array.FindLastActivated());
+
+        // a dense array, looking for the single deactivated bit:
+        array.ActivateRange(0, n);
+        array.Deactivate(n - 7);
+        EXPECT_EQ(n - 1, array.GetActivatedCount());
+        EXPECT_EQ(n - 7, array.FindFirstDeactivated());
+        EXPECT_EQ(n - 7, array.FindLastDeactivated());
+
+        std::cout << std::setprecision(4)
+                  << "scan of vector<bool>: " << boolsTime / 1000.0 << " ms; "
+                  << "ArrayOfBits: " << bitsTime / 1000.0 << " ms" << std::endl;
+    }
+
+    /// <summary>
+    /// Compares the speed of <see cref="utils::HierarchicalArrayOfBits"/> against
+    /// <see cref="utils::ArrayOfBits"/> as a slot allocator for a large pool.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, HierarchicalArrayOfBits_Speed_Test)
+    {
+        using namespace std::chrono;
+
+        const size_t n = 1 << 25;
+        const size_t numFreeSlots = 2000;
+
+        // an almost full pool, with slots freed far apart from each other:
+        utils::ArrayOfBits flat(n, true);
+        utils::HierarchicalArrayOfBits hierarchical(n, true);
+        for (size_t idx = 0; idx < numFreeSlots; ++idx)
+        {
+            flat.Deactivate(n - 1 - idx * (n / numFreeSlots));
+            hierarchical.Deactivate(n - 1 - idx * (n / numFreeSlots));
+        }
+
+        auto startTime = steady_clock::now();
+
+        size_t sumFlat(0);
+        for (size_t count = 0; count < numFreeSlots; ++count)
+        {
+            auto idx = flat.FindFirstDeactivated();
+            flat.Activate(idx);
+            sumFlat += idx;
+        }
+
+        auto flatTime = duration_cast<microseconds>(steady_clock::now() - startTime).count();
+        startTime = steady_clock::now();
+
+        size_t sumHierarchical(0);
+        for (size_t count = 0; count < numFreeSlots; ++count)
+            sumHierarchical += hierarchical.ActivateFirstDeactivated();
+
+        auto hierarchicalTime = duration_cast<microseconds>(steady_clock::now() - startTime).count();
+
+        EXPECT_EQ(sumFlat, sumHierarchical);
+        EXPECT_EQ(n, hierarchical.FindFirstDeactivated());
+
+        std::cout << std::setprecision(4)
+                  << "ArrayOfBits: " << flatTime / 1000.0 << " ms; "
+                  << "HierarchicalArrayOfBits: " << hierarchicalTime / 1000.0 << " ms" << std::endl;
+    }
 
 }// end of namespace unit_tests
 }// end of namespace _3fd
@@ -4,6 +4,15 @@
 #include <sstream>
 #include <codecvt>
 #include <ctime>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <fstream>
+
+#ifdef _WIN32
+#   include <io.h>
+#   define fileno _fileno
+#endif
 
 #define format utils::FormatArg
 
@@ -195,6 +204,307 @@ namespace unit_tests
         }
     }
 
+    /// <summary>
+    /// Tests serializing UTF-8 text, characters and pointers into wide-char text.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, Serialization_WideChar_Transcoding_Test)
+    {
+        try
+        {
+            size_t pcount;
+            std::array<wchar_t, 100> buffer;
+
+            // 2, 3 and 4 bytes sequences:
+            pcount = utils::SerializeTo(buffer, "caf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80");
+            auto expsstr = L"caf\u00E9 \u20AC \U0001F600";
+            EXPECT_STREQ(expsstr, buffer.data());
+            EXPECT_EQ(wcslen(expsstr), pcount);
+
+            // invalid sequences (truncated, stray continuation, overlong and surrogate):
+            pcount = utils::SerializeTo(buffer, "a\xC3", '|', "\x80", '|', "\xC0\xAF", '|', "\xED\xA0\x80", '|', "\xE2\x82");
+            EXPECT_STREQ(L"a\uFFFD|\uFFFD|\uFFFD|\uFFFD|\uFFFD", buffer.data());
+            EXPECT_EQ(wcslen(buffer.data()), pcount);
+
+            // width, precision and null:
+            pcount = utils::SerializeTo(buffer,
+                format("\xC3\xA9t\xC3\xA9").width(5), '|',
+                format("\xC3\xA9t\xC3\xA9").precision(2), '|',
+                format(L"wide").width(6).precision(3), '|',
+                static_cast<const char *> (nullptr));
+
+            EXPECT_STREQ(L"  \u00E9t\u00E9|\u00E9t|   wid|(null)", buffer.data());
+            EXPECT_EQ(wcslen(buffer.data()), pcount);
+
+            // characters and pointers:
+            int notUsed;
+            std::array<wchar_t, 100> expected;
+            swprintf(expected.data(), expected.size(), L"%lc%lc %p", L'x', L'\u00E9', &notUsed);
+            pcount = utils::SerializeTo(buffer, 'x', '\xE9', ' ', &notUsed);
+            EXPECT_STREQ(expected.data(), buffer.data());
+            EXPECT_EQ(wcslen(expected.data()), pcount);
+
+            // the length of text longer than the output is exact:
+            std::string longText(1000, 'a');
+            longText += "\xC3\xA9";
+            std::wstring out;
+            pcount = utils::SerializeTo(out, L'[', longText, L']');
+            EXPECT_EQ(1003U, pcount);
+            EXPECT_EQ(std::wstring(L"[") + std::wstring(1000, L'a') + L"\u00E9]", out);
+        }
+        catch (core::IAppException &ex)
+        {
+            std::cerr << ex.ToString() << std::endl;
+            FAIL();
+        }
+    }
+
+    /// <summary>
+    /// Tests that numbers formatted natively come out exactly as printf formats them.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, Serialization_Numbers_Test)
+    {
+        std::array<char, 128> expected, actual;
+
+        auto checkDouble = [&expected, &actual](double value, int width, int precision)
+        {
+            snprintf(expected.data(), expected.size(), "%*.*G", width, precision, value);
+            auto pcount = utils::SerializeTo(actual, format(value).width(width).precision(precision));
+            EXPECT_STREQ(expected.data(), actual.data());
+            EXPECT_EQ(strlen(expected.data()), pcount);
+        };
+
+        auto checkInteger = [&expected, &actual](long long value, int width, int precision)
+        {
+            snprintf(expected.data(), expected.size(), "%*.*lld", width, precision, value);
+            auto pcount = utils::SerializeTo(actual, format(value).width(width).precision(precision));
+            EXPECT_STREQ(expected.data(), actual.data());
+            EXPECT_EQ(strlen(expected.data()), pcount);
+        };
+
+        const double doubles[] =
+        {
+            0.0, -0.0, 1.0, -1.0, 0.5, 0.42, 0.4242, 42.4242, 123456.0, 1234567.0, 0.0001, 0.00001234,
+            9.9999995, 999999.5, 0.125, 2.5, 1e15, 1e16, 1e100, 1.7976931348623157e308, 2.2250738585072014e-308,
+            4.9406564584124654e-324, 3.141592653589793, -2.718281828459045, 1.0 / 3.0
+        };
+
+        for (auto value : doubles)
+        {
+            for (int precision = 0; precision <= 20; ++precision)
+                checkDouble(value, 12, precision);
+        }
+
+        checkDouble(std::numeric_limits<double>::infinity(), 0, 6);
+        checkDouble(-std::numeric_limits<double>::infinity(), 0, 6);
+
+        const long long integers[] = { 0, 1, -1, 42, -4242, 1000000, std::numeric_limits<long long>::max(), std::numeric_limits<long long>::min() };
+
+        for (auto value : integers)
+        {
+            for (int precision = -1; precision <= 24; ++precision)
+                checkInteger(value, 8, precision);
+        }
+
+        // random values, with the default format:
+        std::mt19937_64 generator(42);
+        for (int count = 0; count < 10000; ++count)
+        {
+            uint64_t bits = generator();
+            double value;
+            memcpy(&value, &bits, sizeof value);
+
+            if (std::isnan(value))
+                continue;
+
+            snprintf(expected.data(), expected.size(), "%G", value);
+            utils::SerializeTo(actual, value);
+            EXPECT_STREQ(expected.data(), actual.data());
+
+            auto integer = static_cast<long long> (bits);
+            snprintf(expected.data(), expected.size(), "%lld|%llu", integer, static_cast<unsigned long long> (bits));
+            utils::SerializeTo(actual, integer, '|', bits);
+            EXPECT_STREQ(expected.data(), actual.data());
+        }
+
+        // the estimation for the output string is never short:
+        std::string out;
+        utils::SerializeTo(out, format(-1.25e-300).precision(17), " and ", std::numeric_limits<long long>::min());
+        snprintf(expected.data(), expected.size(), "%.17G and %lld", -1.25e-300, std::numeric_limits<long long>::min());
+        EXPECT_EQ(expected.data(), out);
+        EXPECT_GE(format(-1.25e-300).precision(17).EstimateStringSize(), 24U);
+        EXPECT_EQ(20U, format(std::numeric_limits<long long>::min()).EstimateStringSize());
+    }
+
+    /// <summary>
+    /// Tests serializing arguments into a buffered output, flushed to a file descriptor.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, Serialization_OutputBuffer_Test)
+    {
+        try
+        {
+            FILE *file = tmpfile();
+            ASSERT_TRUE(file != nullptr);
+
+            std::string expected, line;
+            std::string largeBlock(3000, 'x');
+
+            {
+                utils::FileDescriptorSink sink(fileno(file));
+                utils::OutputBuffer out(sink, 1024);
+
+                for (int idx = 0; idx < 100; ++idx)
+                {
+                    utils::SerializeTo(out, "line ", idx, ": ", format(idx / 4.0).precision(3), '\n');
+                    utils::SerializeTo(line, "line ", idx, ": ", format(idx / 4.0).precision(3), '\n');
+                    expected += line;
+                }
+
+                // a block larger than the buffer goes straight to the output:
+                out.Write(largeBlock);
+                expected += largeBlock;
+
+                // text longer than the buffer:
+                utils::SerializeTo(out, largeBlock, '\n');
+                expected += largeBlock + '\n';
+
+                EXPECT_EQ(expected.size(), out.GetTotalLength());
+                EXPECT_LT(out.GetSize(), out.GetCapacity());
+            }// flushed when destroyed
+
+            std::string actual(expected.size() + 1, '\0');
+            rewind(file);
+            actual.resize(fread(&actual[0], 1, actual.size(), file));
+            fclose(file);
+
+            EXPECT_EQ(expected, actual);
+        }
+        catch (core::IAppException &ex)
+        {
+            std::cerr << ex.ToString() << std::endl;
+            FAIL();
+        }
+    }
+
+    /// <summary>
+    /// A sink that keeps the bytes in a string, and fails when told to.
+    /// </summary>
+    class FailingStringSink : public utils::IOutputSink
+    {
+    public:
+
+        std::string text;
+        bool fail;
+
+        FailingStringSink() : fail(false) {}
+
+        virtual void Write(const utils::OutputBlock *blocks, size_t count) override
+        {
+            if (fail)
+                throw core::AppException<std::runtime_error>("Sink failed on purpose");
+
+            for (size_t idx = 0; idx < count; ++idx)
+                text.append(blocks[idx].data, blocks[idx].size);
+        }
+    };
+
+    /// <summary>
+    /// Tests that a buffered output loses nothing when the sink fails.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, Serialization_OutputBuffer_SinkFailure_Test)
+    {
+        FailingStringSink sink;
+        utils::OutputBuffer out(sink, 64);
+
+        out.Write("buffered bytes");
+        sink.fail = true;
+        EXPECT_THROW(out.Flush(), core::IAppException);
+        EXPECT_THROW(out.Write(std::string(100, 'x')), core::IAppException);
+        EXPECT_EQ(14U, out.GetSize());
+
+        sink.fail = false;
+        out.Flush();
+        EXPECT_EQ(0U, out.GetSize());
+        EXPECT_EQ("buffered bytes", sink.text);
+    }
+
+#ifndef _WIN32
+    /// <summary>
+    /// Tests serializing arguments into a buffered output, flushed to a memory-mapped file.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, Serialization_MemoryMappedFile_Test)
+    {
+        try
+        {
+            const char *filePath = "_3fd_test_mmap_output.txt";
+            std::string expected, line;
+
+            {
+                // small window, so it moves forward many times:
+                utils::MemoryMappedFileSink sink(filePath, 4096);
+                utils::OutputBuffer out(sink, 1000);
+
+                for (int idx = 0; idx < 10000; ++idx)
+                {
+                    utils::SerializeTo(out, "record #", idx, '\n');
+                    utils::SerializeTo(line, "record #", idx, '\n');
+                    expected += line;
+                }
+
+                out.Flush();
+                EXPECT_EQ(expected.size(), sink.GetLength());
+            }// truncated to the length of the text when destroyed
+
+            std::ifstream input(filePath, std::ios::binary);
+            std::string actual((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+            input.close();
+            remove(filePath);
+
+            EXPECT_EQ(expected, actual);
+        }
+        catch (core::IAppException &ex)
+        {
+            std::cerr << ex.ToString() << std::endl;
+            FAIL();
+        }
+    }
+#endif
+
+    /// <summary>
+    /// Tests serializing arguments in place of the placeholders of a compiled format string.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, Serialization_Formatted_Test)
+    {
+        size_t pcount;
+        std::array<char, 100> buffer;
+
+        pcount = SERIALIZE_FORMATTED(buffer,
+            "serialization test: int32({}), float({}), {}, {}",
+            (int32_t)42, format(0.42F).precision(2), "string(UTF-8)", L"string(wide)");
+
+        auto expsstr = "serialization test: int32(42), float(0.42), string(UTF-8), string(wide)";
+        EXPECT_STREQ(expsstr, buffer.data());
+        EXPECT_EQ(strlen(expsstr), pcount);
+
+        // placeholders at the edges and next to each other:
+        pcount = SERIALIZE_FORMATTED(buffer, "{}{}-{}", 1, std::string("two"), 3.5);
+        EXPECT_STREQ("1two-3.5", buffer.data());
+        EXPECT_EQ(8U, pcount);
+
+        // a lone brace is literal text:
+        pcount = SERIALIZE_FORMATTED(buffer, "{ {}} {", 'x');
+        EXPECT_STREQ("{ x} {", buffer.data());
+        EXPECT_EQ(6U, pcount);
+
+        // into a string, grown as needed:
+        std::wstring out;
+        SERIALIZE_FORMATTED(out, L"{} attempt(s) to reach {} failed", 3U, "localhost");
+        EXPECT_EQ(L"3 attempt(s) to reach localhost failed", out);
+
+        // output too short:
+        std::array<char, 10> small;
+        EXPECT_THROW(SERIALIZE_FORMATTED(small, "too long for the buffer: {}", 42), core::IAppException);
+    }
+
     /// <summary>
     /// Helps measuring elapsed time for the interval of execution inside a scope.
     /// </summary>
@@ -283,6 +593,65 @@ namespace unit_tests
         std::cout << std::endl;
     }
 
+    /// <summary>
+    /// Tests serialization speed with a compiled format string, compared to
+    /// serializing the same arguments in sequence, and to sprintf.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, Serialization_Formatted_Speed_Test)
+    {
+        size_t nChars(0);
+        const int nIterations(32768);
+        std::array<char, 100> buffer;
+
+        {// compiled format:
+            std::cout << "formatted: ";
+
+            ScopedTimer timer;
+
+            for (int i = 0; i < nIterations; ++i)
+            {
+                nChars += SERIALIZE_FORMATTED(buffer,
+                    "serialization test: {}; {}; this is UTF-8 text; {}",
+                    (int32_t)42, format(0.42F).precision(2), L"this is wide-char text");
+            }
+        }
+
+        std::cout << " (serialized " << nChars * sizeof(char) << " bytes)" << std::endl;
+
+        {// framework serialization:
+            std::cout << "framework: ";
+
+            ScopedTimer timer;
+
+            for (int i = 0; i < nIterations; ++i)
+            {
+                utils::SerializeTo(buffer,
+                    "serialization test: ",
+                    (int32_t)42, "; ",
+                    format(0.42F).precision(2), "; ",
+                    "this is UTF-8 text; ",
+                    L"this is wide-char text");
+            }
+        }
+
+        std::cout << std::endl;
+
+        {// sprintf:
+            std::cout << "  sprintf: ";
+
+            ScopedTimer timer;
+
+            for (int i = 0; i < nIterations; ++i)
+            {
+                sprintf(buffer.data(),
+                    "serialization test: %d; %.2G; this is UTF-8 text; %ls",
+                    42, 0.42F, L"this is wide-char text");
+            }
+        }
+
+        std::cout << std::endl;
+    }
+
     /// <summary>
     /// Tests serialization speed to encode wide-char text into a statically sized output buffer.
     /// </summary>
@@ -477,5 +846,64 @@ namespace unit_tests
         std::cout << std::endl;
     }
 
+    /// <summary>
+    /// Tests serialization speed to write text into a file, with and without a buffered output.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, Serialization_OutputBuffer_Speed_Test)
+    {
+        const int nIterations(32768);
+
+        {// file stream:
+            std::cout << " file stream: ";
+
+            FILE *file = tmpfile();
+            ASSERT_TRUE(file != nullptr);
+            {
+                ScopedTimer timer;
+
+                for (int i = 0; i < nIterations; ++i)
+                {
+                    utils::SerializeTo<char>(file,
+                        "serialization test: ",
+                        (int32_t)42, "; ",
+                        format(0.42F).precision(2), "; ",
+                        "this is UTF-8 text\n");
+                }
+
+                fflush(file);
+            }
+            fclose(file);
+        }
+
+        std::cout << std::endl;
+
+        {// buffered output:
+            std::cout << "output buffer: ";
+
+            FILE *file = tmpfile();
+            ASSERT_TRUE(file != nullptr);
+            {
+                ScopedTimer timer;
+
+                utils::FileDescriptorSink sink(fileno(file));
+                utils::OutputBuffer out(sink);
+
+                for (int i = 0; i < nIterations; ++i)
+                {
+                    utils::SerializeTo(out,
+                        "serialization test: ",
+                        (int32_t)42, "; ",
+                        format(0.42F).precision(2), "; ",
+                        "this is UTF-8 text\n");
+                }
+
+                out.Flush();
+            }
+            fclose(file);
+        }
+
+        std::cout << std::endl;
+    }
+
 }// end of namespace unit_tests
 }// end of namespace _3fd
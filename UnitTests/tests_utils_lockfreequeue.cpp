@@ -3,7 +3,13 @@
 #include "preprocessing.h"
 
 #include <vector>
+#include <iterator>
+#include <stdexcept>
 #include <thread>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
 #include <cassert>
 
 namespace _3fd
@@ -93,6 +99,288 @@ namespace unit_tests
             producerThread.join();
     }
 
+    /// <summary>
+    /// Measures the throughput of a queue with several producers and a single consumer.
+    /// </summary>
+    /// <param name="queue">The queue to test.</param>
+    /// <param name="numProducers">How many producer threads to launch.</param>
+    /// <param name="numItemsPerProducer">How many items each producer adds to the queue.</param>
+    /// <returns>The throughput in million items per second.</returns>
+    template <typename QueueType>
+    double MeasureQueueThroughput(QueueType &queue, unsigned int numProducers, unsigned long numItemsPerProducer)
+    {
+        using namespace std::chrono;
+
+        // The items only need to be non-null pointers:
+        static unsigned long dummy;
+
+        auto startTime = steady_clock::now();
+
+        std::vector<std::thread> producers;
+        for (unsigned int idx = 0; idx < numProducers; ++idx)
+        {
+            producers.emplace_back([&queue, numItemsPerProducer]()
+            {
+                for (unsigned long count = 0; count < numItemsPerProducer; ++count)
+                    queue.Add(&dummy);
+            });
+        }
+
+        // Consume in the current thread:
+        auto numItems = numProducers * numItemsPerProducer;
+        unsigned long count(0);
+        while (count < numItems)
+        {
+            if (queue.Remove() != nullptr)
+                ++count;
+            else
+                std::this_thread::yield();
+        }
+
+        for (auto &thread : producers)
+            thread.join();
+
+        auto elapsed = duration_cast<microseconds>(steady_clock::now() - startTime).count();
+        return static_cast<double> (numItems) / (elapsed > 0 ? elapsed : 1);
+    }
+
+    /// <summary>
+    /// Compares the throughput of <see cref="utils::LockFreeQueue{}"/>
+    /// against <see cref="utils::LockedQueue{}"/>.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, LockFreeQueue_Throughput_Test)
+    {
+        const unsigned int numProducers = 4;
+        const unsigned long numItemsPerProducer = 1UL << 18;
+
+        utils::LockFreeQueue<unsigned long> lockFreeQueue;
+        utils::LockedQueue<unsigned long> lockedQueue;
+
+        // the first round warms up the recycled elements
+        for (int round = 1; round <= 2; ++round)
+        {
+            std::cout << std::setprecision(3)
+                      << "round " << round << ": lock-free = "
+                      << MeasureQueueThroughput(lockFreeQueue, numProducers, numItemsPerProducer)
+                      << " M items/s; locked = "
+                      << MeasureQueueThroughput(lockedQueue, numProducers, numItemsPerProducer)
+                      << " M items/s" << std::endl;
+        }
+
+        EXPECT_TRUE(lockFreeQueue.IsEmpty());
+    }
+
+    /// <summary>
+    /// Tests <see cref="utils::BoundedLockFreeQueue{}"/> class when full and empty.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, BoundedLockFreeQueue_Basic_Test)
+    {
+        utils::BoundedLockFreeQueue<std::string> queue(5);
+        EXPECT_EQ(8, queue.GetCapacity());
+        EXPECT_TRUE(queue.IsEmpty());
+
+        std::string item;
+        EXPECT_FALSE(queue.TryRemove(item));
+
+        for (int idx = 0; idx < 8; ++idx)
+            EXPECT_TRUE(queue.TryAdd(std::to_string(idx)));
+
+        EXPECT_FALSE(queue.TryAdd("overflow"));
+
+        for (int idx = 0; idx < 4; ++idx)
+        {
+            ASSERT_TRUE(queue.TryRemove(item));
+            EXPECT_EQ(std::to_string(idx), item);
+        }
+
+        // batch insertion wraps around the ring and stops when it gets full:
+        std::vector<std::string> batch{ "a", "b", "c", "d", "e" };
+        EXPECT_EQ(4, queue.TryAddBatch(batch.begin(), batch.size()));
+
+        std::vector<std::string> removed;
+        EXPECT_EQ(3, queue.TryRemoveBatch(std::back_inserter(removed), 3));
+        EXPECT_EQ(5, queue.TryRemoveBatch(std::back_inserter(removed), 10));
+        EXPECT_EQ(0, queue.TryRemoveBatch(std::back_inserter(removed), 10));
+        EXPECT_TRUE(queue.IsEmpty());
+
+        const std::vector<std::string> expected{ "4", "5", "6", "7", "a", "b", "c", "d" };
+        EXPECT_EQ(expected, removed);
+
+        EXPECT_FALSE(queue.WaitRemoveFor(item, 10));
+
+        // items left behind are destroyed along with the queue:
+        queue.TryAdd("left behind");
+    }
+
+    /// <summary>
+    /// An item whose copy fails for some values, to test exception safety.
+    /// </summary>
+    struct FailingCopyItem
+    {
+        int value;
+
+        FailingCopyItem(int p_value = 0) NOEXCEPT : value(p_value) {}
+
+        FailingCopyItem(const FailingCopyItem &ob) : value(ob.value)
+        {
+            if (value < 0)
+                throw std::runtime_error("copy failed");
+        }
+
+        FailingCopyItem(FailingCopyItem &&ob) NOEXCEPT : value(ob.value) {}
+
+        FailingCopyItem &operator =(FailingCopyItem &&ob) NOEXCEPT
+        {
+            value = ob.value;
+            return *this;
+        }
+    };
+
+    /// <summary>
+    /// An output iterator that hands every item assigned to it over to a function.
+    /// </summary>
+    template <typename FuncType>
+    struct FunctionOutputIterator
+    {
+        FuncType func;
+
+        FunctionOutputIterator &operator *() { return *this; }
+
+        FunctionOutputIterator &operator ++() { return *this; }
+
+        template <typename ItemType>
+        FunctionOutputIterator &operator =(ItemType &&item)
+        {
+            func(std::forward<ItemType>(item));
+            return *this;
+        }
+    };
+
+    template <typename FuncType>
+    FunctionOutputIterator<FuncType> MakeFunctionOutputIterator(FuncType func)
+    {
+        return FunctionOutputIterator<FuncType>{ func };
+    }
+
+    /// <summary>
+    /// Tests <see cref="utils::BoundedLockFreeQueue{}"/> class when copying an item throws.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, BoundedLockFreeQueue_FailingCopy_Test)
+    {
+        utils::BoundedLockFreeQueue<FailingCopyItem> queue(4);
+
+        std::vector<FailingCopyItem> batch;
+        for (int value : { 1, 2, -3, 4 })
+            batch.emplace_back(value);
+        EXPECT_THROW(queue.TryAddBatch(batch.begin(), batch.size()), std::runtime_error);
+
+        const FailingCopyItem failing(-5);
+        EXPECT_THROW(queue.TryAdd(failing), std::runtime_error);
+
+        // the items before the failure were added, and no slot was left claimed:
+        EXPECT_EQ(2, queue.TryAddBatch(batch.begin() + 3, 1) + queue.TryAddBatch(batch.begin(), 1));
+
+        std::vector<FailingCopyItem> removed;
+        EXPECT_EQ(4, queue.TryRemoveBatch(std::back_inserter(removed), 10));
+        ASSERT_EQ(4, removed.size());
+        EXPECT_EQ(1, removed[0].value);
+        EXPECT_EQ(2, removed[1].value);
+        EXPECT_EQ(4, removed[2].value);
+        EXPECT_EQ(1, removed[3].value);
+        EXPECT_TRUE(queue.IsEmpty());
+
+        // removing no items from a queue that is not empty:
+        EXPECT_EQ(2, queue.TryAddBatch(std::make_move_iterator(removed.begin()), 2));
+        EXPECT_EQ(0, queue.TryRemoveBatch(std::back_inserter(removed), 0));
+
+        // an output failing in the middle of a batch does not leave the queue blocked:
+        int numAssigned(0);
+        auto failingOutput = [&numAssigned](FailingCopyItem &&item)
+        {
+            if (++numAssigned > 1)
+                throw std::runtime_error("output failed");
+        };
+
+        EXPECT_THROW(queue.TryRemoveBatch(MakeFunctionOutputIterator(failingOutput), 10), std::runtime_error);
+        EXPECT_TRUE(queue.IsEmpty());
+        EXPECT_EQ(4, queue.TryAddBatch(std::make_move_iterator(removed.begin()), 4));
+    }
+
+    /// <summary>
+    /// Tests <see cref="utils::BoundedLockFreeQueue{}"/> class with several producers and consumers.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, BoundedLockFreeQueue_MultiProducerConsumer_Test)
+    {
+        const unsigned long seqLen = 1UL << 18;
+        const unsigned int numProducers = 4, numConsumers = 4;
+
+        utils::BoundedLockFreeQueue<unsigned long> queue(1024);
+
+        std::atomic<unsigned long> sum(0), count(0);
+        std::vector<std::thread> threads;
+
+        for (unsigned int idx = 0; idx < numProducers; ++idx)
+        {
+            threads.emplace_back([&queue, idx, seqLen, numProducers]()
+            {
+                std::vector<unsigned long> batch;
+
+                for (auto num = idx; num < seqLen; num += numProducers)
+                {
+                    // alternate between single and batch insertion:
+                    if ((num / numProducers) % 2 == 0)
+                        queue.WaitAdd(num);
+                    else
+                    {
+                        batch.push_back(num);
+                        auto added = queue.TryAddBatch(batch.begin(), batch.size());
+                        batch.erase(batch.begin(), batch.begin() + added);
+                    }
+                }
+
+                while (!batch.empty())
+                {
+                    queue.WaitAdd(batch.back());
+                    batch.pop_back();
+                }
+            });
+        }
+
+        for (unsigned int idx = 0; idx < numConsumers; ++idx)
+        {
+            threads.emplace_back([&queue, &sum, &count, seqLen]()
+            {
+                unsigned long nums[16];
+
+                while (count.load() < seqLen)
+                {
+                    auto removed = queue.TryRemoveBatch(nums, 16);
+                    if (removed == 0)
+                    {
+                        unsigned long num;
+                        if (!queue.WaitRemoveFor(num, 5))
+                            continue;
+
+                        nums[0] = num;
+                        removed = 1;
+                    }
+
+                    for (size_t idx = 0; idx < removed; ++idx)
+                        sum += nums[idx];
+
+                    count += removed;
+                }
+            });
+        }
+
+        for (auto &thread : threads)
+            thread.join();
+
+        EXPECT_EQ(seqLen, count.load());
+        EXPECT_EQ(seqLen * (seqLen - 1) / 2, sum.load());
+        EXPECT_TRUE(queue.IsEmpty());
+    }
+
 #   ifdef _WIN32
     /// <summary>
     /// Generic tests for <see cref="utils::Win32ApiWrappers::LockFreeQueue{}"/> class.
@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "utils.h"
 
+#include <cstring>
 #include <vector>
 #include <deque>
 
@@ -111,5 +112,76 @@ namespace unit_tests
         myPool.Shrink();
     }
 
+    /// <summary>
+    /// Tests allocation, nested checkpoints and rewind in <see cref="utils::Arena"/> class.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, Arena_CheckpointRewindTest)
+    {
+        const size_t chunkSize = 1024;
+
+        utils::Arena arena(chunkSize);
+
+        auto first = arena.AllocateArray<uint64_t>(4);
+        EXPECT_EQ(0, reinterpret_cast<uintptr_t> (first) % alignof(uint64_t));
+
+        auto outerCheckpoint = arena.GetCheckpoint();
+        auto outerAddr = arena.Allocate(16);
+
+        {// nested scope allocating across several chunks:
+            utils::ArenaScope scope(arena);
+
+            for (int idx = 0; idx < 100; ++idx)
+            {
+                auto ptr = static_cast<char *> (arena.Allocate(100, 1));
+                memset(ptr, idx, 100);
+            }
+
+            // oversized request is served by a dedicated chunk:
+            auto big = static_cast<char *> (arena.Allocate(4 * chunkSize));
+            memset(big, 0xff, 4 * chunkSize);
+        }
+
+        // after the nested scope, the arena goes back to where it was:
+        EXPECT_EQ(static_cast<char *> (outerAddr) + 16, arena.Allocate(1, 1));
+
+        // rewinding to the outer checkpoint hands out the same memory again:
+        arena.Rewind(outerCheckpoint);
+        EXPECT_EQ(outerAddr, arena.Allocate(16));
+
+        arena.Release();
+
+        // the arena is still usable after released:
+        EXPECT_NE(nullptr, arena.Allocate(chunkSize));
+    }
+
+    /// <summary>
+    /// Tests STL containers whose memory lives in a <see cref="utils::Arena"/>.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, Arena_StlAllocatorTest)
+    {
+        utils::Arena arena(4096);
+
+        for (int round = 0; round < 3; ++round)
+        {
+            utils::ArenaScope scope(arena);
+
+            utils::ArenaVector<int> numbers{ utils::ArenaAllocator<int>(arena) };
+
+            for (int idx = 0; idx < 10000; ++idx)
+                numbers.push_back(idx);
+
+            for (int idx = 0; idx < 10000; ++idx)
+                EXPECT_EQ(idx, numbers[idx]);
+
+            utils::ArenaString<char> text{ utils::ArenaAllocator<char>(arena) };
+
+            for (int idx = 0; idx < 100; ++idx)
+                text.append("arena string ");
+
+            EXPECT_EQ(1300, text.size());
+            EXPECT_EQ(0, text.compare(0, 13, "arena string "));
+        }
+    }
+
 }// end of namespace unit_tests
 }// end of namespace _3fd
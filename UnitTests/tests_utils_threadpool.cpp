@@ -0,0 +1,182 @@
+#include "stdafx.h"
+#include "utils_threadpool.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace _3fd
+{
+namespace unit_tests
+{
+    /// <summary>
+    /// Tests <see cref="utils::WorkStealingDeque{}"/> class with a thread stealing
+    /// items while the owner pushes and takes them.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, WorkStealingDeque_Test)
+    {
+        const int numItems = 1 << 16;
+        std::vector<int> items(numItems);
+        for (int idx = 0; idx < numItems; ++idx)
+            items[idx] = idx;
+
+        // a small initial size forces the deque to grow:
+        utils::WorkStealingDeque<int> deque(4);
+        std::atomic<bool> done(false);
+        std::atomic<long long> stolenSum(0);
+
+        std::thread thief([&deque, &done, &stolenSum]()
+        {
+            while (!done.load() || !deque.IsEmpty())
+            {
+                auto item = deque.Steal();
+                if (item != nullptr)
+                    stolenSum += *item;
+            }
+        });
+
+        long long takenSum(0);
+        for (int idx = 0; idx < numItems; ++idx)
+        {
+            deque.Push(&items[idx]);
+
+            if (idx % 3 == 0)
+            {
+                auto item = deque.Take();
+                if (item != nullptr)
+                    takenSum += *item;
+            }
+        }
+
+        done = true;
+        thief.join();
+
+        // drain what the thief might have left behind:
+        int *item;
+        while ((item = deque.Take()) != nullptr)
+            takenSum += *item;
+
+        EXPECT_EQ((long long)numItems * (numItems - 1) / 2, takenSum + stolenSum.load());
+    }
+
+    /// <summary>
+    /// Tests <see cref="utils::ThreadPool"/> class submitting tasks from outside
+    /// and from inside the pool, including tasks that fail.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, ThreadPool_Submit_Test)
+    {
+        utils::ThreadPool pool(4);
+        EXPECT_EQ(4, pool.GetNumWorkers());
+
+        // a task returning a value:
+        auto future = pool.Submit([]() { return 42; });
+        EXPECT_EQ(42, future.get());
+
+        // a task throwing an exception:
+        auto failure = pool.Submit([]() -> int { throw std::runtime_error("failure"); });
+        EXPECT_THROW(failure.get(), std::runtime_error);
+
+        // tasks spawning other tasks, which go to the deques of the workers:
+        std::atomic<int> counter(0);
+        std::vector<std::future<void>> futures;
+        for (int idx = 0; idx < 64; ++idx)
+        {
+            futures.push_back(pool.Submit([&pool, &counter]()
+            {
+                for (int count = 0; count < 64; ++count)
+                    pool.Post([&counter]() { ++counter; });
+            }));
+        }
+
+        for (auto &fut : futures)
+            fut.get();
+
+        // help the pool until all tasks are done:
+        while (counter.load() < 64 * 64)
+        {
+            if (!pool.TryRunPendingTask())
+                std::this_thread::yield();
+        }
+
+        EXPECT_EQ(64 * 64, counter.load());
+    }
+
+    /// <summary>
+    /// Tests <see cref="utils::Asynchronous::InvokeAndLeave"/>.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, Asynchronous_InvokeAndLeave_Test)
+    {
+        // callbacks that block, more than the threads of the default pool, do not hold back the others:
+        auto release = std::make_shared<std::atomic<bool>>(false);
+
+        for (unsigned int idx = 0; idx <= std::thread::hardware_concurrency(); ++idx)
+        {
+            utils::Asynchronous::InvokeAndLeave([release]()
+            {
+                while (!release->load())
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            });
+        }
+
+        std::atomic<int> counter(0);
+
+        for (int idx = 0; idx < 100; ++idx)
+            utils::Asynchronous::InvokeAndLeave([&counter]() { ++counter; });
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+        while (counter.load() < 100 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        EXPECT_EQ(100, counter.load());
+        release->store(true);
+    }
+
+    /// <summary>
+    /// Compares the cost of invoking callbacks asynchronously
+    /// in the thread pool against launching a thread for each one.
+    /// </summary>
+    TEST(Framework_Utils_TestCase, ThreadPool_Speed_Test)
+    {
+        using namespace std::chrono;
+
+        const int numTasks = 10000;
+        std::atomic<int> counter(0);
+
+        auto startTime = steady_clock::now();
+
+        for (int idx = 0; idx < numTasks; ++idx)
+        {
+            std::thread thread([&counter]() { ++counter; });
+            thread.detach();
+        }
+
+        while (counter.load() < numTasks)
+            std::this_thread::yield();
+
+        auto threadsTime = duration_cast<microseconds>(steady_clock::now() - startTime).count();
+
+        counter = 0;
+        auto &pool = utils::ThreadPool::GetDefault();
+        startTime = steady_clock::now();
+
+        for (int idx = 0; idx < numTasks; ++idx)
+            pool.Post([&counter]() { ++counter; });
+
+        while (counter.load() < numTasks)
+            std::this_thread::yield();
+
+        auto poolTime = duration_cast<microseconds>(steady_clock::now() - startTime).count();
+
+        std::cout << std::setprecision(4)
+                  << "thread per task: " << threadsTime / 1000.0 << " ms; "
+                  << "thread pool: " << poolTime / 1000.0 << " ms" << std::endl;
+    }
+
+}// end of namespace unit_tests
+}// end of namespace _3fd
@@ -10,6 +10,8 @@ cd ../UnitTests
 make -j $numCpuCores && make install
 cd ../IntegrationTests
 make -j $numCpuCores && make install
+cd ../BinLogDecoder
+make -j $numCpuCores && make install
 cd ../
 find 3FD/* | grep -v '_impl' | grep '\.h$' | xargs -I{} cp {} build/include/3FD/
 cp -rf btree  build/include/
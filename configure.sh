@@ -43,4 +43,12 @@ ls CMakeFiles &> /dev/null && rm -rf CMakeFiles
 echo Configuring IntegrationTests...
 cmake $CMAKE_OPTIONS
 
+cd ../BinLogDecoder
+echo Cleaning BinLogDecoder...
+{ ls Makefile && make clean; } &> /dev/null
+ls CMakeCache.txt &> /dev/null && rm CMakeCache.txt
+ls CMakeFiles &> /dev/null && rm -rf CMakeFiles
+echo Configuring BinLogDecoder...
+cmake $CMAKE_OPTIONS
+
 cd ..